@@ -0,0 +1,163 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+
+#include <QObject>
+#include <QStringList>
+#include <QSize>
+#include <QFuture>
+#include <QElapsedTimer>
+
+#include <vector>
+
+#include "SceneWidget.h"
+
+/**
+ * @brief Direction of the camera for the images of a scene, see SceneWidget::resetView()
+ */
+struct CameraPreset
+{
+    QString name;                               ///< appended to the names of the image files
+    float yaw;                                  ///< in degrees, about the vertical axis
+    float pitch;                                ///< in degrees, about the horizontal axis
+};
+
+/**
+ * @brief Headless rendering of a list of scene files into image files
+ *
+ * The scenes are loaded and drawn by a SceneWidget which is never shown on screen.
+ * Not being on screen, the widget renders into its framebuffer object with its
+ * context made current on an offscreen surface, and each frame is read back by
+ * grabFramebuffer(). The context still comes from the platform plugin, thus on
+ * Linux an X display is needed (e.g. a virtual one by Xvfb), see README.md.
+ *
+ * The next file is loaded in the background while the current scene is rendered
+ * from each of the camera presets, and the images are written by the global thread
+ * pool. The scenes are uploaded as a whole (no streaming), with their textures.
+ */
+class BatchRenderer : public QObject
+{
+    Q_OBJECT
+public:
+    explicit BatchRenderer(QObject *parent = nullptr);
+    ~BatchRenderer();
+
+    /**
+     * @brief the scene files to render, in order
+     */
+    QStringList const & inputFiles() const { return mInputFiles; }
+    void setInputFiles(QStringList const &pathNames) { mInputFiles = pathNames; }
+
+    /**
+     * @brief the directory of the images (the current one by default), each one named
+     *        after the scene file and the camera preset, e.g. "model_front.png"
+     */
+    QString const & outputDir() const { return mOutputDir; }
+    void setOutputDir(QString const &dir) { mOutputDir = dir; }
+
+    /**
+     * @brief size of the images in pixels (512x512 by default)
+     */
+    QSize imageSize() const { return mImageSize; }
+    void setImageSize(QSize const &size) { mImageSize = size; }
+
+    /**
+     * @brief file suffix of the images, which decides their format ("png" by default)
+     */
+    QString const & imageFormat() const { return mImageFormat; }
+    void setImageFormat(QString const &suffix) { mImageFormat = suffix; }
+
+    /**
+     * @brief the views of each scene (the front one by default)
+     */
+    std::vector<CameraPreset> const & cameraPresets() const { return mCameraPresets; }
+    void setCameraPresets(std::vector<CameraPreset> const &presets) { mCameraPresets = presets; }
+
+    /**
+     * @brief parse a comma-separated list of camera presets
+     *
+     * A preset is either one of the names "front", "back", "left", "right", "top",
+     * "bottom" and "iso", or the angles "yaw:pitch" in degrees.
+     *
+     * @return false if any of them is invalid
+     */
+    static bool parseCameraPresets(QString const &text, std::vector<CameraPreset> &presets);
+
+    /**
+     * @brief parse the name of an anti-aliasing mode, one of "off", "msaa2", "msaa4",
+     *        "msaa8", "msaa16" and "fxaa"
+     */
+    static bool parseAntiAliasing(QString const &text, SceneWidget::AntiAliasing &mode);
+
+    /**
+     * @brief the widget drawing the scenes, for its rendering options
+     */
+    SceneWidget * sceneWidget() { return mSceneWidget; }
+
+    /**
+     * @brief numbers of the scene files rendered and of the failed ones (not loaded,
+     *        or with any image not written)
+     */
+    int renderedNumber() const { return mRenderedNumber; }
+    int failedNumber() const { return mFailedFiles.size(); }
+
+public slots:
+    /**
+     * @brief start rendering the files, finished() is emitted when all of them are done
+     */
+    void start();
+
+signals:
+    void finished(int failedNumber);
+
+private slots:
+    void onSceneLoaded(QString const &pathName);
+    void onSceneLoadFailed(QString const &pathName);
+
+private:
+    bool loadNext();
+    void renderScene(QString const &pathName);
+    void collectWrites(bool wait);
+    void finish();
+
+private:
+    SceneWidget *mSceneWidget;
+    QStringList mInputFiles;
+    QString mOutputDir;
+    QSize mImageSize;
+    QString mImageFormat;
+    std::vector<CameraPreset> mCameraPresets;
+
+    int mNextFile;                              ///< the next file to load
+    int mRenderedNumber;
+    struct ImageWrite
+    {
+        QString sceneFilePath;
+        QFuture<bool> result;
+    };
+    std::vector<ImageWrite> mWrites;            ///< the images being written
+    QStringList mFailedFiles;                   ///< each one listed once
+    QElapsedTimer mTimer;
+};
+
+#endif // BATCHRENDERER_H
@@ -0,0 +1,133 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef BOUNDINGVOLUMEHIERARCHY_H
+#define BOUNDINGVOLUMEHIERARCHY_H
+
+#include <vector>
+#include <functional>
+#include <cstddef>
+
+#include "glm/vec3.hpp"
+
+class Frustum;
+
+/**
+ * @brief Bounding volume hierarchy over axis-aligned boxes
+ *
+ * The primitives are given by their boxes (xmin, xmax, ymin, ymax, zmin, zmax),
+ * and referred to by their indices in the array of boxes. The hierarchy is a
+ * binary tree built with the surface area heuristic on binned centroids, the
+ * large subtrees being built in parallel by the global thread pool.
+ *
+ * The nodes are stored in depth-first pre-order (the left child follows its
+ * parent) and the primitives of each subtree are contiguous in primitives(),
+ * thus a subtree which is entirely within a query volume is taken at once.
+ *
+ * When the boxes move, refit() updates the bounds of the nodes without
+ * changing the tree, which is good enough as long as the primitives do not
+ * move far from each other (the primitives left out for their empty boxes
+ * need a new build to be taken in).
+ */
+class BoundingVolumeHierarchy
+{
+public:
+    struct Node
+    {
+        float bounds[6];
+        unsigned int primitiveBegin;    ///< first primitive of the subtree in primitives()
+        unsigned int primitiveNumber;   ///< number of primitives of the subtree
+        unsigned int rightOffset;       ///< index of the right child minus the one of this node, 0 for leaves
+    };
+
+    BoundingVolumeHierarchy();
+
+    /**
+     * @brief build the hierarchy
+     * @param boxes 6 floats per primitive, the empty boxes (xmin > xmax) are left out
+     * @param primitiveNumber number of the primitives
+     * @param maxLeafSize maximum number of primitives per leaf
+     */
+    void build(float const *boxes, size_t primitiveNumber, unsigned int maxLeafSize = 4);
+    void clear();
+
+    /**
+     * @brief update the bounds of the nodes for the moved boxes
+     * @param boxes the boxes, indexed in the same way as for build()
+     * @param changedPrimitives the primitives whose boxes have been changed,
+     *        all of them if null
+     */
+    void refit(float const *boxes, std::vector<unsigned int> const *changedPrimitives = nullptr);
+
+    bool isEmpty() const { return mNodes.empty(); }
+    std::vector<Node> const & nodes() const { return mNodes; }
+    std::vector<unsigned int> const & primitives() const { return mPrimitives; }
+
+    /**
+     * @brief bounds of all the primitives, empty (xmin > xmax) if none
+     */
+    float const * bounds() const { return mBounds; }
+
+    /**
+     * @brief append the primitives whose boxes intersect the frustum
+     */
+    void queryFrustum(Frustum const &frustum, std::vector<unsigned int> &primitives) const;
+
+    /**
+     * @brief append the primitives whose boxes overlap the given box
+     */
+    void queryBox(float const *bounds, std::vector<unsigned int> &primitives) const;
+
+    /**
+     * @brief append the primitives whose boxes are hit by the ray within the distance
+     */
+    void queryRay(glm::vec3 const &origin, glm::vec3 const &direction, float maxDistance, std::vector<unsigned int> &primitives) const;
+
+    /**
+     * @brief find the closest hit along the ray
+     *
+     * The nodes are visited front to back and those beyond the closest hit so
+     * far are skipped.
+     *
+     * @param origin origin of the ray
+     * @param direction direction of the ray, the distances are in its length
+     * @param distance the maximum distance, receives the distance of the hit if any
+     * @param intersect tests a primitive, returning whether it is hit closer than
+     *        the given distance, which then receives the distance of the hit
+     * @return the primitive hit, -1 if none
+     */
+    int raycast(glm::vec3 const &origin, glm::vec3 const &direction, float &distance,
+                std::function<bool (unsigned int, float &)> const &intersect) const;
+
+protected:
+    void buildRange(unsigned int begin, unsigned int end, unsigned int depth, float const *centroids,
+                    unsigned int maxLeafSize, std::vector<Node> &nodes);
+
+protected:
+    std::vector<Node> mNodes;
+    std::vector<unsigned int> mPrimitives;
+    std::vector<float> mBoxes;                  ///< 6 floats per primitive
+    std::vector<unsigned int> mNodeParents;
+    std::vector<unsigned int> mPrimitiveLeaves; ///< leaf of each primitive, -1 for the left out ones
+    float mBounds[6];
+};
+
+#endif // BOUNDINGVOLUMEHIERARCHY_H
@@ -0,0 +1,144 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef FRAMEGOVERNOR_H
+#define FRAMEGOVERNOR_H
+
+#include <QOpenGLContext>
+#include <QElapsedTimer>
+
+#ifndef GL_TIME_ELAPSED
+#define GL_TIME_ELAPSED 0x88BF // OpenGL 3.3 or GL_ARB_timer_query
+#endif
+
+#define FRAME_TIMER_QUERIES 4
+
+/**
+ * @brief Feedback controller of the resolution scale toward a target frame time
+ *
+ * The frame time is taken as proportional to the number of pixels shaded, that
+ * is to the square of the resolution scale. The measured frame times are smoothed
+ * by an exponential moving average, and the scale moves by a fraction (the gain)
+ * of the way to the one expected to meet the target. The scale is quantized and
+ * kept while the frame time is within the tolerance around the target, so that
+ * the resolution does not flicker from frame to frame.
+ */
+class FrameGovernor
+{
+public:
+    FrameGovernor();
+
+    /**
+     * @brief the frame time aimed at, in milliseconds (16.7 by default)
+     */
+    float targetFrameTime() const { return mTargetFrameTime; }
+    void setTargetFrameTime(float ms);
+
+    /**
+     * @brief the lowest resolution scale (0.25 by default), the highest one is 1
+     */
+    float minScale() const { return mMinScale; }
+    void setMinScale(float scale);
+
+    /**
+     * @brief the resolution scale of the next frame, in both directions
+     */
+    float scale() const { return mScale; }
+
+    /**
+     * @brief the smoothed frame time in milliseconds, 0 if none measured since restart()
+     */
+    float frameTime() const { return mFrameTime; }
+
+    /**
+     * @brief number of the frame times measured since restart()
+     */
+    unsigned int frameNumber() const { return mFrameNumber; }
+
+    /**
+     * @brief take the time of a frame rendered at the current scale
+     * @return true if the scale is changed
+     */
+    bool addFrameTime(float ms);
+
+    /**
+     * @brief forget the measured frame times, keeping the scale reached
+     */
+    void restart();
+
+    /**
+     * @brief back to the full resolution
+     */
+    void reset();
+
+protected:
+    float mTargetFrameTime;
+    float mMinScale;
+    float mScale;
+    float mFrameTime;
+    unsigned int mFrameNumber;
+};
+
+/**
+ * @brief Time of the frames taken on the GPU by timer queries, or on the CPU if not supported
+ *
+ * The queries are read back a few frames late, when their results are available,
+ * so that the pipeline is never stalled. If all of them are still pending, the
+ * frame is not timed. The time on the CPU only covers the submission of the frame.
+ */
+class FrameTimer
+{
+public:
+    FrameTimer();
+    ~FrameTimer();
+
+    /**
+     * @brief create the queries in the current context if it supports them
+     */
+    void initializeGL(QOpenGLContext *glCtx);
+    void destroyGL();
+
+    bool isGpuTimer() const { return mQueries[0] != 0; }
+
+    /**
+     * @brief enclose the commands of a frame
+     */
+    void begin();
+    void end();
+
+    /**
+     * @brief take the time of the oldest frame timed and not taken yet
+     * @param ms receives the time in milliseconds
+     * @return false if none available
+     */
+    bool takeFrameTime(float &ms);
+
+protected:
+    QOpenGLContext *mOpenGLContext;
+    GLuint mQueries[FRAME_TIMER_QUERIES];
+    unsigned int mQueryBegin;                   ///< the oldest pending query
+    unsigned int mQueryNumber;                  ///< the pending queries, from mQueryBegin on (cyclically)
+    bool mTiming;                               ///< between begin() and end() of a timed frame
+    QElapsedTimer mCpuTimer;
+    float mCpuTime;                             ///< negative if taken
+};
+
+#endif // FRAMEGOVERNOR_H
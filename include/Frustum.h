@@ -0,0 +1,67 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef FRUSTUM_H
+#define FRUSTUM_H
+
+#include "glm/vec4.hpp"
+#include "glm/mat4x4.hpp"
+
+/**
+ * @brief View frustum given by 6 planes, for culling axis-aligned bounding boxes
+ *
+ * The bounds are given in the same way as OpenGLRenderableEntity::bounds(),
+ * i.e. (xmin, xmax, ymin, ymax, zmin, zmax).
+ */
+class Frustum
+{
+public:
+    enum Intersection
+    {
+        OUTSIDE,
+        INTERSECTING,
+        INSIDE
+    };
+
+    Frustum();
+
+    /**
+     * @brief extract the planes from a projection matrix
+     *
+     * The planes are in the space which the matrix transforms from, e.g. with
+     * projection*view*model the bounds are tested in the model space.
+     */
+    void setMatrix(glm::mat4x4 const &mat);
+
+    /**
+     * @brief the plane (a, b, c, d) with a*x+b*y+c*z+d >= 0 on the inner side
+     *        (left, right, bottom, top, near, far)
+     */
+    glm::vec4 const & plane(int i) const { return mPlanes[i]; }
+
+    bool intersects(float const *bounds) const;
+    Intersection classify(float const *bounds) const;
+
+protected:
+    glm::vec4 mPlanes[6];
+};
+
+#endif // FRUSTUM_H
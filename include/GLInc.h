@@ -36,7 +36,9 @@ enum
     TEXCOORD,        ///< index of vertex texcoord attribute
     TANGENT,         ///< index of vertex tangent attribute (used for Normal Map)
     BITANGENT,       ///< index of vertex bitangent attribute (used for Normal Map)
-    NUM_ATTRIBUTES   ///< total number of the vertex attributes
+    INSTANCE_MATRIX, ///< first index of per-instance model matrix attribute (4 columns)
+    INSTANCE_NORMAL_MATRIX = INSTANCE_MATRIX + 4, ///< first index of per-instance normal matrix attribute (3 columns)
+    NUM_ATTRIBUTES = INSTANCE_NORMAL_MATRIX + 3   ///< total number of the vertex attributes
 };
 
 }
@@ -24,6 +24,7 @@
 
 #include "GLInc.h"
 #include <QString>
+#include <QStringList>
 #include <functional>
 
 class QOpenGLShaderProgram;
@@ -69,10 +70,13 @@ inline int primitive_vertex_number(GLenum primType)
     }
 }
 
-bool initialize_shader_program(QString const &pn, QOpenGLShaderProgram *p, QString const &vs, QString const &fs);
+// the shader files in vsSnippets are prepended (after the #version line) to the vertex shader
+bool initialize_shader_program(QString const &pn, QOpenGLShaderProgram *p, QString const &vs, QString const &fs,
+                               QStringList const &vsSnippets = QStringList());
 
 // for compatibility with old OpenGL/GLSL before 3.3
 bool initialize_shader_program_comp(QString const &pn, QOpenGLShaderProgram *p, QString const &vs, QString const &fs,
-                                    std::function<void (QOpenGLShaderProgram *)> bindAttributes);
+                                    std::function<void (QOpenGLShaderProgram *)> bindAttributes,
+                                    QStringList const &vsSnippets = QStringList());
 
 #endif // GLUTILS_H
@@ -0,0 +1,272 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+
+#include <QObject>
+
+#include "GLInc.h"
+#include "VertexFormat.h"
+
+#include <map>
+#include <vector>
+#include <functional>
+
+#ifndef GL_DRAW_INDIRECT_BUFFER
+#define GL_DRAW_INDIRECT_BUFFER 0x8F3F // OpenGL 4.0
+#endif
+
+class QOpenGLContext;
+class QOpenGLFunctions;
+class QOpenGLExtraFunctions;
+
+/**
+ * @brief Format of the interleaved vertices, which decides the vertex attributes
+ */
+struct GeometryFormat
+{
+    VertexLayout layout;                ///< layout of the interleaved vertex
+    unsigned int stride;                ///< number of bytes per vertex
+    bool hasNormal;                     ///< whether the vertex contains normal
+    unsigned int texCoordComponents;    ///< components of the texture coordinates in use, 0 if none
+
+    bool operator==(GeometryFormat const &other) const {
+        return layout == other.layout && stride == other.stride && hasNormal == other.hasNormal && texCoordComponents == other.texCoordComponents;
+    }
+};
+
+/**
+ * @brief set the vertex attribute pointers of the interleaved vertices (into the bound vertex array object)
+ * @param glFuncs the OpenGL functions of the current context
+ * @param format the format of the vertices
+ * @param base offset of the first vertex in the bound vertex buffer
+ */
+void setup_vertex_attributes(QOpenGLFunctions *glFuncs, GeometryFormat const &format, const char *base);
+
+/**
+ * @brief set the per-instance attribute pointers of RenderableInstance (into the bound vertex array object)
+ * @param glFuncs the OpenGL functions of the current context
+ * @param instanceBuffer the buffer of the RenderableInstance
+ * @param instanceOffset offset of the first instance in the buffer (in bytes)
+ */
+void setup_instance_attributes(QOpenGLExtraFunctions *glFuncs, GLuint instanceBuffer, size_t instanceOffset);
+
+/**
+ * @brief Command of the indirect draws (the layout taken by glMultiDrawElementsIndirect)
+ */
+struct DrawElementsIndirectCommand
+{
+    GLuint count;           ///< number of indices
+    GLuint instanceCount;   ///< number of instances
+    GLuint firstIndex;      ///< the first index in the index buffer (in indices)
+    GLint baseVertex;       ///< the first vertex in the vertex buffer
+    GLuint baseInstance;    ///< the first of the per-instance attributes
+};
+
+/**
+ * @brief First-fit allocator of the ranges of a fixed capacity, the adjacent free ranges are merged
+ */
+class RangeAllocator
+{
+public:
+    static size_t const INVALID_OFFSET = static_cast<size_t>(-1);
+
+    explicit RangeAllocator(size_t capacity = 0);
+
+    /**
+     * @brief allocate a range
+     * @param size the size of the range (> 0)
+     * @param alignment the alignment of the offset
+     * @return the offset of the range, INVALID_OFFSET if there is no room
+     */
+    size_t allocate(size_t size, size_t alignment = 1);
+
+    /**
+     * @brief free a range returned by allocate()
+     */
+    void free(size_t offset, size_t size);
+
+    size_t capacity() const { return mCapacity; }
+    size_t freeSize() const { return mFreeSize; }
+
+private:
+    std::map<size_t, size_t> mFreeRanges;   ///< offset -> size
+    size_t mCapacity;
+    size_t mFreeSize;
+};
+
+/**
+ * @brief Ranges of the vertices and the indices of a renderable in GeometryArena
+ */
+struct GeometryAllocation
+{
+    int page;                   ///< the page holding the ranges, -1 if not allocated
+    unsigned int vertexOffset;  ///< the first vertex in the vertex buffer of the page (base vertex)
+    unsigned int vertexNumber;  ///< number of vertices
+    size_t indexOffset;         ///< offset in bytes of the first index in the index buffer of the page
+    size_t indexBytes;          ///< number of bytes of the indices
+
+    GeometryAllocation() : page(-1), vertexOffset(0), vertexNumber(0), indexOffset(0), indexBytes(0) {}
+    bool isValid() const { return page >= 0; }
+};
+
+/**
+ * @brief Vertex and index data of the renderables sub-allocated from a few large buffers
+ *
+ * The buffers are organized in pages, each of which has a vertex buffer for one
+ * vertex format, an index buffer (for both 16-bit and 32-bit indices) and a vertex
+ * array object with the attributes set up from the start of the vertex buffer.
+ * The renderables draw their ranges with the base vertex, so the renderables in
+ * the same page share the bindings. The freed ranges are reused by the next
+ * allocations, e.g. by the renderables of the next scene.
+ *
+ * The arena belongs to one context (the vertex array objects are not shared),
+ * and requires the draws with base vertex (OpenGL 3.2 or OpenGL ES 3.2).
+ */
+class GeometryArena : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief the arena of the given context (created on demand), null if not supported by the context
+     */
+    static GeometryArena * instance(QOpenGLContext const *glCtx);
+
+    /**
+     * @brief delete the arena of the given context, which should be current
+     */
+    static void release(QOpenGLContext const *glCtx);
+
+    ~GeometryArena();
+
+    /**
+     * @brief allocate the ranges in a page of the format (a new page is created if needed)
+     * @param format the format of the vertices
+     * @param vertexNumber number of the vertices
+     * @param indexBytes number of bytes of the indices
+     * @param allocation returns the ranges
+     * @return true if succeed
+     */
+    bool allocate(GeometryFormat const &format, unsigned int vertexNumber, size_t indexBytes, GeometryAllocation &allocation);
+
+    /**
+     * @brief free the ranges for reuse (the allocation is reset)
+     */
+    void free(GeometryAllocation &allocation);
+
+    /**
+     * @brief write the vertices of an allocation through the writer (straight into the mapped buffer if possible)
+     */
+    bool writeVertices(GeometryAllocation const &allocation, std::function<void(void *)> const &writer);
+
+    /**
+     * @brief write the indices of an allocation
+     */
+    bool writeIndices(GeometryAllocation const &allocation, void const *indices);
+
+    /**
+     * @brief bind the vertex array object of the page of an allocation (skipped if bound already)
+     */
+    void bindVertexArray(GeometryAllocation const &allocation);
+
+    /**
+     * @brief unbind the vertex array object, to be called before other vertex array objects are used
+     */
+    void releaseVertexArray();
+
+    /**
+     * @brief draw a range of the indices of an allocation (its vertex array object should be bound)
+     * @param allocation the ranges of the renderable
+     * @param indexCount number of indices to draw
+     * @param indexType GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+     * @param indexOffset offset in bytes from the first index of the allocation
+     * @param baseVertex offset in vertices from the first vertex of the allocation
+     * @param instanceNumber number of instances, 0 for a non-instanced draw
+     */
+    void drawElements(GeometryAllocation const &allocation, GLsizei indexCount, GLenum indexType, size_t indexOffset, GLint baseVertex, GLsizei instanceNumber = 0);
+
+    /**
+     * @brief whether the context takes glMultiDrawElementsIndirect with base instances
+     *        (OpenGL 4.3, or GL_ARB_multi_draw_indirect with GL_ARB_base_instance)
+     */
+    bool supportsIndirectDraw() const { return mMultiDrawElementsIndirect != nullptr; }
+
+    /**
+     * @brief draw the commands in the bound GL_DRAW_INDIRECT_BUFFER by one call (a vertex array object of the arena should be bound)
+     * @param indexType GL_UNSIGNED_SHORT or GL_UNSIGNED_INT, of all the commands
+     * @param commandOffset offset of the first command in the buffer (in bytes)
+     * @param commandNumber number of the commands
+     */
+    void multiDrawElementsIndirect(GLenum indexType, size_t commandOffset, GLsizei commandNumber);
+
+    /**
+     * @brief the command drawing a range of the indices of an allocation
+     * @param allocation the ranges of the renderable
+     * @param indexCount number of indices to draw
+     * @param indexSize size of each index in bytes (2 or 4)
+     * @param firstIndex the first index from the first index of the allocation
+     * @param baseVertex offset in vertices from the first vertex of the allocation
+     * @param instanceNumber number of instances
+     * @param baseInstance the first per-instance attributes
+     * @return the command
+     */
+    static DrawElementsIndirectCommand indirectCommand(GeometryAllocation const &allocation, GLuint indexCount, unsigned int indexSize,
+                                                       GLuint firstIndex, GLint baseVertex, GLuint instanceNumber, GLuint baseInstance);
+
+    /**
+     * @brief number of pages, and their total bytes and free bytes (both vertex and index buffers)
+     */
+    size_t pageNumber() const { return mPages.size(); }
+    size_t capacityBytes() const;
+    size_t freeBytes() const;
+
+private:
+    explicit GeometryArena(QOpenGLContext *glCtx);
+
+    bool isSupported() const { return mDrawElementsBaseVertex && mDrawElementsInstancedBaseVertex; }
+    int createPage(GeometryFormat const &format, size_t vertexCapacity, size_t indexCapacity);
+    void destroyGL();
+
+private:
+    typedef void (QOPENGLF_APIENTRYP DrawElementsBaseVertexFunc)(GLenum mode, GLsizei count, GLenum type, const void *indices, GLint basevertex);
+    typedef void (QOPENGLF_APIENTRYP DrawElementsInstancedBaseVertexFunc)(GLenum mode, GLsizei count, GLenum type, const void *indices, GLsizei instancecount, GLint basevertex);
+    typedef void (QOPENGLF_APIENTRYP MultiDrawElementsIndirectFunc)(GLenum mode, GLenum type, const void *indirect, GLsizei drawcount, GLsizei stride);
+
+    struct Page
+    {
+        GeometryFormat format;
+        GLuint vertexBuffer;
+        GLuint indexBuffer;
+        GLuint vertexArray;
+        RangeAllocator vertices;    ///< in vertices
+        RangeAllocator indices;     ///< in bytes
+    };
+
+    QOpenGLContext *mOpenGLContext;
+    std::vector<Page> mPages;
+    GLuint mBoundVertexArray;
+    DrawElementsBaseVertexFunc mDrawElementsBaseVertex;
+    DrawElementsInstancedBaseVertexFunc mDrawElementsInstancedBaseVertex;
+    MultiDrawElementsIndirectFunc mMultiDrawElementsIndirect;
+};
+
+#endif // GEOMETRYARENA_H
@@ -28,6 +28,7 @@
 #include <sstream>
 
 #include <QString>
+#include <QMutex>
 
 #include "GLInc.h"
 
@@ -86,19 +87,21 @@ public:
     void setLogger(Logger *l) { mLogger = l; }
     Logger * logger() { return mLogger; }
 
-    void appendMessage(char const *msg) { if (mLogger) mLogger->appendMessage(msg); }
-    void appendSegment(char const *seg) { if (mLogger) mLogger->appendSegment(seg); }
+    // messages may come from the worker threads (e.g. scene loading), thus serialized
+    void appendMessage(char const *msg) { QMutexLocker locker(&mMutex); if (mLogger) mLogger->appendMessage(msg); }
+    void appendSegment(char const *seg) { QMutexLocker locker(&mMutex); if (mLogger) mLogger->appendSegment(seg); }
     
-    void appendGenericMessage(char const *msg) { if (mLogger) mLogger->appendGenericMessage(msg); }
-    void appendErrorMessage(char const *msg, char const *fn = 0, int ln = 0)   { if (mLogger) mLogger->appendErrorMessage(msg, fn, ln); }
-    void appendWarningMessage(char const *msg, char const *fn = 0, int ln = 0) { if (mLogger) mLogger->appendWarningMessage(msg, fn, ln); }
-    void appendDebugMessage(char const *msg, char const *fn = 0, int ln = 0)   { if (mLogger) mLogger->appendDebugMessage(msg, fn, ln); }
+    void appendGenericMessage(char const *msg) { QMutexLocker locker(&mMutex); if (mLogger) mLogger->appendGenericMessage(msg); }
+    void appendErrorMessage(char const *msg, char const *fn = 0, int ln = 0)   { QMutexLocker locker(&mMutex); if (mLogger) mLogger->appendErrorMessage(msg, fn, ln); }
+    void appendWarningMessage(char const *msg, char const *fn = 0, int ln = 0) { QMutexLocker locker(&mMutex); if (mLogger) mLogger->appendWarningMessage(msg, fn, ln); }
+    void appendDebugMessage(char const *msg, char const *fn = 0, int ln = 0)   { QMutexLocker locker(&mMutex); if (mLogger) mLogger->appendDebugMessage(msg, fn, ln); }
 
 protected:
     LogManager();
     virtual ~LogManager();
 
     Logger *mLogger;
+    QMutex mMutex;
 };
 
 inline std::ostream &operator<< (std::ostream &o, glm::mat4x4 const &m) {
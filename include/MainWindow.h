@@ -23,6 +23,11 @@
 #define MAINWINDOW_H
 
 #include <QMainWindow>
+#include <QVector3D>
+
+class QAction;
+class QLabel;
+class QProgressBar;
 
 QT_BEGIN_NAMESPACE
 namespace Ui { class MainWindow; }
@@ -38,8 +43,16 @@ public:
 
 private slots:
     void openFile();
+    void updateLoadProgress(int percent, QString const &stage);
+    void onSceneLoaded(QString const &pathName);
+    void onSceneLoadFailed(QString const &pathName);
+    void onEntityPicked(QString const &name, unsigned int triangle, QVector3D const &position);
+    void onFrameRendered(float frameTime, float renderScale);
+    void setAntiAliasing(QAction *action);
 
 private:
     Ui::MainWindow *ui;
+    QProgressBar *mLoadProgressBar;
+    QLabel *mFrameLabel;
 };
 #endif // MAINWINDOW_H
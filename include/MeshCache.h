@@ -0,0 +1,79 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include <QString>
+
+#include "SharedPointerTypes.h"
+
+/**
+ * @brief version of the binary format of the mesh cache files
+ *
+ * Should be increased whenever the format or the content of the cached data
+ * (e.g. the vertex layout) changes, so that the stale cache files are ignored.
+ */
+#define MESH_CACHE_VERSION 4
+
+/**
+ * @brief the directory holding the mesh cache files
+ */
+QString mesh_cache_directory();
+
+/**
+ * @brief the path-name of the cache file for the given scene file
+ *
+ * The cache is keyed by the canonical path, size and modification time of the
+ * scene file together with the import flags and the mesh options, so that any
+ * change of them leads to a different cache file.
+ *
+ * @param sourceFilePath the full path-name of the scene file
+ * @param importFlags the post-processing flags of assimp used for importing
+ * @param meshOptions the options of converting the meshes (opaque to the cache)
+ * @return the path-name of the cache file, empty if the scene file does not exist
+ */
+QString mesh_cache_file_path(QString const &sourceFilePath, unsigned int importFlags, unsigned int meshOptions);
+
+/**
+ * @brief load the scene data from the mesh cache
+ *
+ * The cache file is memory-mapped and the renderables refer to the mapped
+ * vertex data directly, which is uploaded to OpenGL without further copies.
+ * The scene graph (nodes and lights) is rebuilt as an aiScene without meshes.
+ *
+ * @param sourceFilePath the full path-name of the scene file
+ * @param importFlags the post-processing flags of assimp used for importing
+ * @param meshOptions the options of converting the meshes
+ * @return the loaded scene data, null if there is no valid cache
+ */
+SceneDataPtr load_mesh_cache(QString const &sourceFilePath, unsigned int importFlags, unsigned int meshOptions);
+
+/**
+ * @brief save the scene data (freshly loaded by assimp) into the mesh cache
+ * @param sceneData the scene data to be saved
+ * @param importFlags the post-processing flags of assimp used for importing
+ * @param meshOptions the options of converting the meshes
+ * @return true if succeed
+ */
+bool save_mesh_cache(SceneDataPtr const &sceneData, unsigned int importFlags, unsigned int meshOptions);
+
+#endif // MESHCACHE_H
@@ -0,0 +1,117 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <cstddef>
+#include <vector>
+
+/**
+ * @brief size of the FIFO post-transform vertex cache used for measuring ACMR
+ */
+#define MESH_OPTIMIZER_MEASURE_CACHE_SIZE 16
+
+/**
+ * @brief average cache miss ratio (transformed vertices per triangle) of a triangle list
+ *
+ * A FIFO post-transform vertex cache is simulated, the ratio ranges from 0.5
+ * (ideal for large regular meshes) to 3 (no vertex reuse at all).
+ *
+ * @param indices the triangle list
+ * @param indexNumber number of indices (3 per triangle)
+ * @param vertexNumber number of vertices referred by the indices
+ * @param cacheSize size of the simulated cache
+ * @return the average cache miss ratio, 0 for an empty list
+ */
+float compute_acmr(unsigned int const *indices, size_t indexNumber, unsigned int vertexNumber,
+                   unsigned int cacheSize = MESH_OPTIMIZER_MEASURE_CACHE_SIZE);
+
+/**
+ * @brief reorder the triangles for the locality of the post-transform vertex cache
+ *
+ * Linear-speed vertex cache optimization by Tom Forsyth, which does not depend
+ * on the exact size of the cache of the hardware.
+ *
+ * @param indices the triangle list, reordered in place
+ * @param indexNumber number of indices (3 per triangle)
+ * @param vertexNumber number of vertices referred by the indices
+ */
+void optimize_vertex_cache(unsigned int *indices, size_t indexNumber, unsigned int vertexNumber);
+
+/**
+ * @brief reorder the clusters of triangles to reduce overdraw
+ *
+ * The triangle list (already optimized for the vertex cache) is cut into clusters
+ * whose ACMR stays within the given ratio of the current one, the clusters facing
+ * outwards from the center of the mesh are moved to the front so that they tend
+ * to occlude the others from any view point (Sander et al. 2007).
+ *
+ * @param indices the triangle list, reordered in place
+ * @param indexNumber number of indices (3 per triangle)
+ * @param positions the vertex positions (3 floats with the given stride in floats)
+ * @param positionStride number of floats between two positions
+ * @param vertexNumber number of vertices referred by the indices
+ * @param threshold the allowed ACMR ratio, e.g. 1.05
+ */
+void optimize_overdraw(unsigned int *indices, size_t indexNumber, float const *positions, size_t positionStride,
+                       unsigned int vertexNumber, float threshold = 1.05f);
+
+/**
+ * @brief reorder the vertices in the order they are first referred by the triangles
+ *
+ * The indices are rewritten to refer to the reordered vertices, the vertices
+ * not referred at all are dropped.
+ *
+ * @param indices the triangle list, rewritten in place
+ * @param indexNumber number of indices (3 per triangle)
+ * @param vertexNumber number of vertices referred by the indices
+ * @return the former index of each reordered vertex
+ */
+std::vector<unsigned int> optimize_vertex_fetch(unsigned int *indices, size_t indexNumber, unsigned int vertexNumber);
+
+/**
+ * @brief simplify the triangle list by collapsing the edges in the order of their quadric errors
+ *
+ * Each edge collapses onto one of its end points (Garland & Heckbert 1997), so the
+ * vertices are not moved and only the indices change, which lets all the levels of
+ * detail share the same vertex data. The collapses are made in passes, each pass
+ * takes the cheapest ones which do not touch each other and do not flip any triangle.
+ *
+ * The vertices on the borders of the mesh, on the non-manifold edges and on the
+ * seams of the attributes (the vertices sharing their position with others, e.g.
+ * split for different texture coordinates) are kept, which preserves the outline
+ * and the UV seams.
+ *
+ * @param indices the triangle list, simplified in place (the returned number of indices are valid)
+ * @param indexNumber number of indices (3 per triangle)
+ * @param positions the vertex positions (3 floats with the given stride in floats)
+ * @param positionStride number of floats between two positions
+ * @param vertexNumber number of vertices referred by the indices
+ * @param targetIndexNumber the simplification stops once there are no more indices than this
+ * @param targetError the largest error allowed (distance in the unit of the positions)
+ * @param resultError receives the largest error of the collapses made (optional)
+ * @return the number of indices of the simplified triangle list
+ */
+size_t simplify_mesh(unsigned int *indices, size_t indexNumber, float const *positions, size_t positionStride,
+                     unsigned int vertexNumber, size_t targetIndexNumber, float targetError, float *resultError = nullptr);
+
+#endif // MESHOPTIMIZER_H
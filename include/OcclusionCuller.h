@@ -0,0 +1,148 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include <vector>
+#include <cstddef>
+
+#include "glm/mat4x4.hpp"
+
+#include "SharedPointerTypes.h"
+
+class RenderScene;
+
+/**
+ * @brief Occlusion culling with a low-resolution depth buffer rasterized on the CPU
+ *
+ * Each frame, the largest instances on the screen (among the ones passing the
+ * frustum culling) with few enough triangles are selected as occluders and
+ * rasterized into a small depth buffer, split into tiles rasterized by the
+ * global thread pool (with SSE when available). The bounds of the instances
+ * are then tested against the depth buffer: an instance is occluded if the
+ * nearest point of its bounds is behind the occluders over all the pixels it
+ * covers.
+ *
+ * The occluders are rasterized at the pixel centers, thus the gaps between them
+ * narrower than a pixel of the depth buffer may be closed. The triangles crossing
+ * the near plane are left out of the occluders (which never makes the culling
+ * wrong), and the instances crossing the near plane are never occluded.
+ */
+class OcclusionCuller
+{
+public:
+    OcclusionCuller();
+
+    /**
+     * @brief width of the depth buffer in pixels (256 by default), the height
+     *        follows the aspect ratio of the viewport
+     */
+    int bufferWidth() const { return mBufferWidth; }
+    void setBufferWidth(int width);
+
+    /**
+     * @brief maximum number of occluders per frame (32 by default)
+     */
+    int maxOccluderNumber() const { return mMaxOccluderNumber; }
+    void setMaxOccluderNumber(int number) { mMaxOccluderNumber = number; }
+
+    /**
+     * @brief maximum number of triangles of an occluder (2048 by default)
+     */
+    unsigned int maxOccluderTriangles() const { return mMaxOccluderTriangles; }
+    void setMaxOccluderTriangles(unsigned int number) { mMaxOccluderTriangles = number; }
+
+    /**
+     * @brief minimum size of an occluder on the screen (0.05 by default), as the
+     *        ratio of the radius of its bounds to the distance from the camera
+     */
+    float minOccluderSize() const { return mMinOccluderSize; }
+    void setMinOccluderSize(float size) { mMinOccluderSize = size; }
+
+    /**
+     * @brief set the size of the viewport, for the aspect ratio of the depth buffer
+     */
+    void setViewportSize(int width, int height);
+
+    /**
+     * @brief select the occluders among the given instances and rasterize them
+     * @param scene the render scene
+     * @param renderables the entities of the scene (indexed by the meshes of the instances)
+     * @param instances the candidates (e.g. the ones within the view frustum)
+     * @param viewProjMat the transform from the scene space to the clip space
+     */
+    void renderOccluders(RenderScene const &scene, OpenGLRenderableEntityArray const &renderables,
+                         std::vector<unsigned int> const &instances, glm::mat4x4 const &viewProjMat);
+
+    /**
+     * @brief whether the bounds in the scene space are hidden by the occluders
+     */
+    bool isOccluded(float const *bounds) const;
+
+    /**
+     * @brief remove the occluded instances from the list (keeping the order of the others)
+     */
+    void cullInstances(RenderScene const &scene, std::vector<unsigned int> &instances);
+
+    /**
+     * @brief statistics of the last frame
+     */
+    size_t occluderNumber() const { return mOccluderNumber; }
+    size_t occluderTriangleNumber() const { return mOccluderTriangleNumber; }
+    size_t occludedInstanceNumber() const { return mOccludedInstanceNumber; }
+
+    /**
+     * @brief the depth buffer (bufferWidth() x bufferHeight(), the depth in [0, 1] per pixel)
+     */
+    float const * depthBuffer() const { return mDepthBuffer.data(); }
+    int bufferHeight() const { return mBufferHeight; }
+
+protected:
+    struct ScreenTriangle
+    {
+        float x[3];
+        float y[3];
+        float z[3];
+    };
+
+    void rasterizeTile(int tile);
+
+protected:
+    int mBufferWidth;
+    int mBufferHeight;
+    float mViewportAspect;
+    int mMaxOccluderNumber;
+    unsigned int mMaxOccluderTriangles;
+    float mMinOccluderSize;
+
+    glm::mat4x4 mViewProjMatrix;
+    std::vector<float> mDepthBuffer;
+    std::vector<float> mTileMaxDepths;              ///< the farthest depth of each tile
+    std::vector<ScreenTriangle> mTriangles;
+    std::vector<std::vector<unsigned int>> mTileBins;  ///< triangles overlapping each tile
+
+    size_t mOccluderNumber;
+    size_t mOccluderTriangleNumber;
+    size_t mOccludedInstanceNumber;
+};
+
+#endif // OCCLUSIONCULLER_H
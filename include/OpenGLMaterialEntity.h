@@ -24,6 +24,7 @@
 
 #include "GLInc.h"
 #include "SharedPointerTypes.h"
+#include "TextureCache.h"
 
 #include <QString>
 
@@ -158,12 +159,28 @@ public:
 
     /**
      * @brief the diffuse texture of the surface material
-     * @return the pointer to the texture
+     * @return the pointer to the texture (shared with the other materials using the same image)
      */
-    QOpenGLTexture* diffuseTexture() const { return mDiffuseTexture; }
+    QOpenGLTexture* diffuseTexture() const { return mDiffuseTexture.get(); }
 
     /**
-     * @brief load diffuse texture from a file
+     * @brief whether some texel of the diffuse texture is not fully opaque, i.e. the
+     *        surfaces using the texture are blended
+     */
+    bool diffuseTextureHasAlpha() const { return mDiffuseTexture && mDiffuseTextureHasAlpha; }
+
+    /**
+     * @brief full path-name of the diffuse texture file (empty if there is no diffuse texture)
+     */
+    QString const & diffuseTextureFilePath() const { return mDiffuseTextureFilePath; }
+
+    /**
+     * @brief set the full path-name of the diffuse texture file, which is loaded by uploadData()
+     */
+    void setDiffuseTextureFilePath(QString const &imageFilePath) { mDiffuseTextureFilePath = imageFilePath; }
+
+    /**
+     * @brief load diffuse texture from a file (through the TextureCache of the context)
      * @param imageFilePath the full path-name of the file
      * @param glCtx the OpenGL context in which this function is performed
      * @return true if succeed
@@ -172,11 +189,22 @@ public:
 
     /**
      * @brief load material information from the aiMaterial struct of Assimp
+     *
+     * No OpenGL call is involved, thus it can be performed in any thread. The
+     * textures are loaded later by uploadData() in the OpenGL context thread.
+     *
      * @param material the pointer to the aiMaterial struct
      * @param textureFilePath the path containing texture files (texture data is not included in aiMaterial)
      * @return true if succeed
      */
-    bool loadData(QOpenGLContext const *glCtx, aiMaterial const *material, QString const &textureFilePath = QString());
+    bool loadData(aiMaterial const *material, QString const &textureFilePath = QString());
+
+    /**
+     * @brief load the textures referred by the material into OpenGL
+     * @param glCtx the OpenGL context in which this function is performed
+     * @return true if succeed
+     */
+    bool uploadData(QOpenGLContext const *glCtx);
 
     /**
      * @brief whether the diffuse texture is ready
@@ -194,7 +222,10 @@ private:
     GLfloat mShininess;
     GLfloat mRefractIntensity;
 
-    QOpenGLTexture *mDiffuseTexture;
+    QString mDiffuseTextureFilePath;
+
+    OpenGLTexturePtr mDiffuseTexture;
+    bool mDiffuseTextureHasAlpha;
     QOpenGLContext const *mOpenGLContext;
 
     bool mIsValid;
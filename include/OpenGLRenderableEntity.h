@@ -22,20 +22,87 @@
 #ifndef OPENGLRENDERABLEENTITY_H
 #define OPENGLRENDERABLEENTITY_H
 
+#include "GLInc.h"
 #include "SharedPointerTypes.h"
+#include "VertexFormat.h"
+#include "GeometryArena.h"
+#include "glm/vec3.hpp"
 #include "glm/mat4x4.hpp"
 
 #include <QString>
 
 typedef std::vector<float> VertexDataBuffer;
 typedef std::vector<unsigned int> IndexDataBuffer;
+typedef std::vector<unsigned short> ShortIndexDataBuffer;
 
 struct aiMesh;
 
+class BoundingVolumeHierarchy;
 class QOpenGLVertexArrayObject;
 class QOpenGLBuffer;
 class QOpenGLContext;
 
+/**
+ * @brief Range of the index data drawn with its own range of the vertex data
+ *
+ * The indices of a section are relative to its first vertex, so that a mesh with
+ * too many vertices for 16-bit indices can still use them when split into sections.
+ */
+struct RenderableSection
+{
+    unsigned int indexOffset;       ///< the first index of the section
+    unsigned int indexNumber;       ///< number of indices of the section
+    unsigned int vertexOffset;      ///< the first vertex referred by the section
+    unsigned int vertexNumber;      ///< number of vertices referred by the section
+};
+
+/**
+ * @brief the full detail and at most 3 simplified levels, see OpenGLRenderableEntity::buildLevelsOfDetail()
+ */
+#define MAX_RENDERABLE_LEVELS 4
+
+/**
+ * @brief Simplified level of detail of a renderable
+ *
+ * The level shares the vertex data of the full detail, its indices follow those
+ * of the full detail in the index data.
+ */
+struct RenderableLevel
+{
+    float error;                                ///< the geometric error of the level (distance in the model space)
+    std::vector<RenderableSection> sections;    ///< one for each section of the full detail, with the same vertices
+};
+
+/**
+ * @brief View of the interleaved vertex data and index data of a renderable
+ *        kept in external memory (e.g. the memory-mapped mesh cache)
+ */
+struct RenderableDataView
+{
+    unsigned int vertexNumber;                      ///< number of vertices
+    VertexLayout vertexLayout;                      ///< layout of the interleaved vertex
+    unsigned int vertexStride;                      ///< number of bytes per interleaved vertex
+    unsigned int indexNumber;                       ///< number of indices (3 per triangle)
+    unsigned int indexDataNumber;                   ///< number of all the indices in indexData, including those of the levels
+    unsigned int indexSize;                         ///< size of each index in bytes (2 or 4)
+    bool hasNormal;                                 ///< whether the vertex contains normal
+    std::vector<unsigned int> textureComponents;    ///< number of components of each texture coordinates channel
+    float bounds[6];                                ///< bounds of the vertices (xmin, xmax, ymin, ymax, zmin, zmax)
+    void const *vertexData;                         ///< the interleaved vertex data
+    void const *indexData;                          ///< the index data
+    std::vector<RenderableSection> sections;        ///< the sections (a single one covering all if empty)
+    std::vector<RenderableLevel> levels;            ///< the simplified levels, whose indices follow indexNumber ones
+};
+
+/**
+ * @brief Per-instance attributes of the instanced drawing, see OpenGLRenderableEntity::drawSurfaceInstanced()
+ */
+struct RenderableInstance
+{
+    float modelMatrix[16];          ///< the world transform of the instance (column-major)
+    float normalMatrix[9];          ///< the normal transform of the instance (column-major)
+};
+
 class OpenGLRenderableEntity
 {
 public:
@@ -45,8 +112,39 @@ public:
     float const * bounds() const { return mBounds; }
     float const * center() const { return mCenter; }
 
+    unsigned int vertexNumber() const { return mVertexNumber; }
+    unsigned int triangleNumber() const { return mTriangleNumber; }
+    VertexLayout vertexLayout() const { return mVertexLayout; }
+    unsigned int vertexStride() const { return mVertexStride; }
+
+    /**
+     * @brief transformation from the stored positions to the model space,
+     *        i.e. the dequantization of the compact layout (identity for the float layout)
+     */
+    glm::mat4x4 positionTransform() const;
+
+    /**
+     * @brief the index data, either 16-bit (if all the vertices of each section can
+     *        be addressed by them) or 32-bit
+     *
+     * The indices of the full detail (indexNumber()) are followed by those of the
+     * simplified levels, indexDataNumber() counts all of them.
+     */
+    unsigned int indexNumber() const { return mTriangleNumber*3; }
+    unsigned int indexDataNumber() const { return static_cast<unsigned int>(mIndexType == GL_UNSIGNED_INT ? mIndexData.size() : mShortIndexData.size()); }
+    unsigned int indexSize() const { return mIndexType == GL_UNSIGNED_INT ? sizeof(unsigned int) : sizeof(unsigned short); }
+    void const * indexData() const;
+    std::vector<RenderableSection> const & sections() const { return mSections; }
+
+    /**
+     * @brief write the interleaved vertex data into the given buffer
+     * @param dst the destination with room for vertexNumber()*vertexStride() bytes
+     */
+    void writeVertexData(void *dst) const;
+
     bool hasNormal() const { return mHasNormal; }
     bool hasTexCoords() const { return mHasTexCoords; }
+    std::vector<unsigned int> const & textureComponents() const { return mTextureComponents; }
 
     QString const & name() const { return mName; }
     void setName(QString const &name) { mName = name; }
@@ -54,33 +152,207 @@ public:
     void setMaterial(OpenGLMaterialEntityPtr m) { mMaterial = m; }
     OpenGLMaterialEntityPtr material() const { return mMaterial.lock(); }
 
-    bool loadData(QOpenGLContext const *glCtx, aiMesh const *mesh);
+    /**
+     * @brief load the vertex and index data from the aiMesh struct of Assimp
+     *
+     * Only the CPU side data is prepared, no OpenGL call is involved, thus it can
+     * be performed in any thread. uploadData() should be called afterwards in the
+     * OpenGL context thread before drawing. The vertices are interleaved from the
+     * mesh while uploading, so the mesh should stay alive until then.
+     *
+     * 16-bit indices are used if the mesh has no more than 65536 vertices. A larger
+     * mesh is split into sections of at most 65536 vertices each (duplicating the
+     * vertices shared by the sections) if required, otherwise 32-bit indices are used.
+     *
+     * The compact vertex layout (see write_compact_mesh_vertices()) takes 16-bit
+     * positions quantized within the bounds of the mesh, octahedral normals and
+     * half float texture coordinates, which requires OpenGL 3.0 (or OpenGL ES 3.0).
+     *
+     * @param mesh the mesh
+     * @param splitForShortIndices whether to split a mesh too large for 16-bit indices
+     * @param vertexLayout the layout of the interleaved vertex data
+     */
+    bool loadData(aiMesh const *mesh, bool splitForShortIndices = false, VertexLayout vertexLayout = VERTEX_LAYOUT_FLOAT);
+
+    /**
+     * @brief load the vertex and index data from external memory
+     *
+     * The vertex data is not copied but uploaded directly from the external memory,
+     * which is kept alive by holding the given owner.
+     *
+     * @param data the view of the data
+     * @param dataOwner the owner of the memory referred by the view
+     */
+    bool loadData(RenderableDataView const &data, std::shared_ptr<void const> const &dataOwner);
     void clearData();
 
+    /**
+     * @brief optimize the loaded mesh for rendering (see MeshOptimizer.h)
+     *
+     * The triangles of each section are reordered for the post-transform vertex
+     * cache and then for overdraw, and the vertices for the locality of fetching.
+     * Only applies to the data loaded from an aiMesh (before uploading), can be
+     * performed in any thread.
+     *
+     * @param acmrBefore returns the average cache miss ratio before optimizing (if not null)
+     * @param acmrAfter returns the average cache miss ratio after optimizing (if not null)
+     * @return true if optimized
+     */
+    bool optimizeMesh(float *acmrBefore = nullptr, float *acmrAfter = nullptr);
+
+    /**
+     * @brief generate the simplified levels of detail (see simplify_mesh() in MeshOptimizer.h)
+     *
+     * Each level is simplified from the previous one to about half of its triangles,
+     * and optimized for the vertex cache. The error of a level adds up those of the
+     * simplifications leading to it. No more levels are made once a simplification
+     * cannot go below 3/4 of the triangles (e.g. held by the borders and the seams).
+     * Replaces the current levels, can be performed in any thread (before uploading).
+     *
+     * @param maxLevelNumber the maximum number of the simplified levels (at most MAX_RENDERABLE_LEVELS-1)
+     * @param minTriangleNumber the meshes with fewer triangles are not simplified
+     * @return the number of the simplified levels made
+     */
+    unsigned int buildLevelsOfDetail(unsigned int maxLevelNumber = MAX_RENDERABLE_LEVELS-1, unsigned int minTriangleNumber = 4096);
+    void clearLevelsOfDetail();
+
+    /**
+     * @brief number of the levels of detail, including the full detail (level 0)
+     */
+    unsigned int levelNumber() const { return static_cast<unsigned int>(mLevels.size()) + 1; }
+    std::vector<RenderableLevel> const & levels() const { return mLevels; }
+
+    /**
+     * @brief the geometric error of the level (distance in the model space), 0 for the full detail
+     */
+    float levelError(unsigned int level) const { return (level == 0 || level > mLevels.size()) ? 0.0f : mLevels[level-1].error; }
+
+    /**
+     * @brief the sections of the level (those of the full detail for level 0)
+     */
+    std::vector<RenderableSection> const & levelSections(unsigned int level) const {
+        return (level == 0 || level > mLevels.size()) ? mSections : mLevels[level-1].sections;
+    }
+
+    /**
+     * @brief the coarsest level whose error is within the given one (in the model space)
+     */
+    unsigned int selectLevel(float maxError) const;
+
+    /**
+     * @brief build the hierarchy over the triangles for intersectRay() (if not yet)
+     *
+     * Built on demand by intersectRay(), or ahead in any thread once the data is loaded.
+     */
+    void buildTriangleHierarchy();
+    bool hasTriangleHierarchy() const { return mTriangleHierarchy != nullptr; }
+
+    /**
+     * @brief find the closest triangle hit by the ray, in the model space
+     * @param origin origin of the ray
+     * @param direction direction of the ray, the distances are in its length
+     * @param distance the maximum distance, receives the distance of the hit if any
+     * @param triangle receives the index of the triangle hit (in the index data)
+     * @return true if hit
+     */
+    bool intersectRay(glm::vec3 const &origin, glm::vec3 const &direction, float &distance, unsigned int &triangle);
+
+    /**
+     * @brief position of a vertex in the model space (dequantized for the compact layout)
+     */
+    glm::vec3 vertexPosition(unsigned int vertex) const;
+
+    /**
+     * @brief the vertices of a triangle (with the vertex offset of its section)
+     */
+    void triangleVertices(unsigned int triangle, unsigned int *vertices) const;
+
+    /**
+     * @brief create the OpenGL resources (if needed) and upload the loaded data
+     * @param glCtx the OpenGL context in which this function is performed
+     * @return true if succeed
+     */
+    bool uploadData(QOpenGLContext const *glCtx);
+
     bool setupGL(QOpenGLContext const *glCtx);
     void destroyGL(QOpenGLContext const *glCtx);
 
-    void drawSurface(QOpenGLContext const *glCtx);
+    /**
+     * @brief whether the buffers are uploaded, thus the entity can be drawn
+     */
+    bool isDrawable() const { return mOpenGLSetup && mBufferSetup; }
+
+    /**
+     * @brief draw the sections of the given level of detail
+     */
+    void drawSurface(QOpenGLContext const *glCtx, unsigned int level = 0);
+
+    /**
+     * @brief draw a number of instances in one call for each section (OpenGL 3.3 or OpenGL ES 3.0)
+     * @param glCtx the OpenGL context in which this function is performed
+     * @param instanceBuffer the buffer of the RenderableInstance of the instances
+     * @param instanceOffset offset of the first instance in the buffer (in bytes)
+     * @param instanceNumber number of the instances
+     * @param level the level of detail
+     */
+    void drawSurfaceInstanced(QOpenGLContext const *glCtx, GLuint instanceBuffer, size_t instanceOffset, GLsizei instanceNumber, unsigned int level = 0);
+
+    /**
+     * @brief the ranges of the data in the geometry arena, invalid if drawn from its own buffers
+     */
+    GeometryAllocation const & geometryAllocation() const { return mGeometryAllocation; }
+
+    /**
+     * @brief GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+     */
+    GLenum indexType() const { return mIndexType; }
+
+    /**
+     * @brief append the indirect commands drawing the sections (only if the data are in the geometry arena)
+     * @param commands the commands to append to
+     * @param instanceNumber number of the instances
+     * @param baseInstance the first of the per-instance attributes of the instances
+     * @param level the level of detail
+     * @return true if appended
+     */
+    bool appendIndirectCommands(std::vector<DrawElementsIndirectCommand> &commands, GLuint instanceNumber, GLuint baseInstance, unsigned int level = 0) const;
 
 private:
+    void computeBounds(aiMesh const *mesh);
+    void splitSections(aiMesh const *mesh);
+    void writeSourceVertices(void *dst) const;
     bool setupBuffers();
+    bool setupArenaBuffers();
+    GeometryFormat geometryFormat() const;
 
 private:
     QString mName;
 
-    QOpenGLVertexArrayObject *mTriangleVAO;
+    std::vector<QOpenGLVertexArrayObject *> mTriangleVAOs;  ///< one for each section
     QOpenGLBuffer *mVertexBuffer;
     QOpenGLBuffer *mTriangleBuffer;
     QOpenGLContext const *mOpenGLContext;
+    GeometryArena *mGeometryArena;              ///< the arena of the context, null if not supported
+    GeometryAllocation mGeometryAllocation;     ///< the ranges of the data in the arena, invalid if in own buffers
 
+    aiMesh const *mSourceMesh;
+    void const *mExternalVertexData;
+    std::shared_ptr<void const> mExternalDataOwner;
     VertexDataBuffer mVertexData;
     IndexDataBuffer mIndexData;
+    ShortIndexDataBuffer mShortIndexData;
+    GLenum mIndexType;                          ///< chosen when the data is loaded, tells which of the index buffers is in use
+    std::vector<RenderableSection> mSections;
+    std::vector<RenderableLevel> mLevels;       ///< the simplified levels of detail (level 1 on)
+    std::vector<unsigned int> mVertexRemap;     ///< source vertex of each vertex of the split or reordered sections, empty if in the source order
+    std::unique_ptr<BoundingVolumeHierarchy> mTriangleHierarchy;
 
     std::weak_ptr<OpenGLMaterialEntity> mMaterial;
     std::vector<unsigned int> mTextureComponents;
     unsigned int mVertexNumber;
     unsigned int mTriangleNumber;
-    unsigned int mComponentsPerVertex;
+    VertexLayout mVertexLayout;
+    unsigned int mVertexStride;
     float mBounds[6];
     float mCenter[3];
     bool mHasNormal;
@@ -0,0 +1,97 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+
+class QOpenGLShaderProgram;
+class QOpenGLTexture;
+class OpenGLMaterialEntity;
+class OpenGLRenderableEntity;
+
+/**
+ * @brief Draw item collected by RenderQueue
+ *
+ * The pointers are only used during the frame in which the item is collected,
+ * the objects are held by the scene.
+ */
+struct RenderItem
+{
+    std::uint64_t sortKey;
+    OpenGLRenderableEntity *renderable;
+    OpenGLMaterialEntity const *material;
+    QOpenGLShaderProgram *program;
+    QOpenGLTexture *texture;                ///< the diffuse texture, null if not used
+    unsigned int node;                      ///< the node of the render scene (for the transforms)
+    unsigned int level;                     ///< the level of detail of the renderable to draw
+    float depth;                            ///< distance from the camera along the view direction
+    bool transparent;
+    bool instanced;                         ///< drawn together with the other instances of the renderable
+};
+
+/**
+ * @brief Queue of the draw items of a frame sorted for fewer state changes
+ *
+ * The sort key of an opaque item is made of (from the most significant bits)
+ * the program, the texture, the material, the renderable and its level of detail
+ * (for the instanced items only) and the depth (front to back, for the early depth test), so that
+ * the items sharing the states, and the instances of a renderable, are drawn in a row.
+ * The transparent items follow all the opaque ones, sorted back to front by the
+ * depth for blending, and then by the states.
+ */
+class RenderQueue
+{
+public:
+    RenderQueue();
+
+    void clear();
+
+    /**
+     * @brief collect an item (the sort key is computed by this function)
+     */
+    void add(RenderItem item);
+
+    /**
+     * @brief sort the items by their keys
+     */
+    void sort();
+
+    std::vector<RenderItem> const & items() const { return mItems; }
+    size_t size() const { return mItems.size(); }
+    bool isEmpty() const { return mItems.empty(); }
+
+protected:
+    unsigned int stateId(std::unordered_map<void const *, unsigned int> &ids, void const *state, unsigned int bits);
+
+protected:
+    std::vector<RenderItem> mItems;
+    // small numbers for the states within a frame, in the order of their first use
+    std::unordered_map<void const *, unsigned int> mProgramIds;
+    std::unordered_map<void const *, unsigned int> mTextureIds;
+    std::unordered_map<void const *, unsigned int> mMaterialIds;
+    std::unordered_map<void const *, unsigned int> mRenderableIds;
+};
+
+#endif // RENDERQUEUE_H
@@ -0,0 +1,166 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef RENDERSCENE_H
+#define RENDERSCENE_H
+
+#include <vector>
+#include <cstdint>
+
+#include "glm/mat3x3.hpp"
+#include "glm/mat4x4.hpp"
+
+#include "SharedPointerTypes.h"
+#include "BoundingVolumeHierarchy.h"
+
+struct aiNode;
+class Frustum;
+class StaticBatchTable;
+
+/**
+ * @brief Flattened scene graph for rendering
+ *
+ * The node hierarchy imported by assimp is flattened once at load time into
+ * arrays (structure of arrays) indexed by the node, in depth-first pre-order,
+ * so that the parent of a node always precedes it and each subtree occupies a
+ * contiguous range. Each node holds its local and world matrices, the normal
+ * matrix of the world matrix and a range of mesh instances, which makes drawing
+ * a linear pass without any recursion or matrix inversion.
+ *
+ * A mesh instance is a mesh referenced by a node, it has the world (scene space)
+ * bounds of the mesh transformed by the node. The instances are indexed by a
+ * bounding volume hierarchy for culling and spatial queries.
+ *
+ * The world matrices and bounds are only recomputed for the nodes whose local
+ * matrices have been changed (and their descendants), see updateWorldTransforms().
+ *
+ * If the scene has static batches (see StaticBatchTable), the merged instances are
+ * left out, and the batches are the instances of an extra root node appended after
+ * the nodes of the hierarchy (with the identity matrix and no source node).
+ */
+class RenderScene
+{
+public:
+    RenderScene();
+
+    /**
+     * @brief flatten the node hierarchy under the root
+     * @param root the root node of the scene imported by assimp
+     * @param renderables the meshes of the scene, for their bounds (the null
+     *        ones have empty bounds, the invalid mesh indices are dropped)
+     * @param staticBatches the static batches of the scene (optional)
+     */
+    void build(aiNode const *root, OpenGLRenderableEntityArray const &renderables, StaticBatchTable const *staticBatches = nullptr);
+    void clear();
+
+    size_t nodeNumber() const { return mParents.size(); }
+    bool isEmpty() const { return mParents.empty(); }
+
+    /**
+     * @brief index of the parent node, -1 for the root
+     */
+    int parent(size_t node) const { return mParents[node]; }
+
+    /**
+     * @brief the source node imported by assimp (owned by the scene), null for the node of the static batches
+     */
+    aiNode const * sourceNode(size_t node) const { return mSourceNodes[node]; }
+
+    glm::mat4x4 const & localMatrix(size_t node) const { return mLocalMatrices[node]; }
+    void setLocalMatrix(size_t node, glm::mat4x4 const &mat);
+
+    /**
+     * @brief transform from the node to the scene (root) space
+     */
+    glm::mat4x4 const & worldMatrix(size_t node) const { return mWorldMatrices[node]; }
+
+    /**
+     * @brief inverse transpose of the upper 3x3 part of the world matrix
+     *
+     * The normal matrix of a model-view matrix V*W is the product of the normal
+     * matrices of V and W, thus the one of V only needs to be computed per frame.
+     */
+    glm::mat3x3 const & normalMatrix(size_t node) const { return mNormalMatrices[node]; }
+
+    /**
+     * @brief bounds of all the instances in the scene space
+     *        (xmin, xmax, ymin, ymax, zmin, zmax), empty if xmin > xmax
+     */
+    float const * bounds() const { return mInstanceHierarchy.bounds(); }
+
+    /**
+     * @brief the instances of a node are instanceBegin(node) to instanceEnd(node)-1
+     */
+    unsigned int instanceBegin(size_t node) const { return mInstanceOffsets[node]; }
+    unsigned int instanceEnd(size_t node) const { return mInstanceOffsets[node+1]; }
+    size_t instanceNumber() const { return mInstanceMeshes.size(); }
+    unsigned int instanceMesh(size_t instance) const { return mInstanceMeshes[instance]; }
+    unsigned int instanceNode(size_t instance) const { return mInstanceNodes[instance]; }
+    float const * instanceBounds(size_t instance) const { return &mInstanceBounds[instance*6]; }
+
+    /**
+     * @brief the hierarchy over the bounds of the instances (the primitives are the instances)
+     */
+    BoundingVolumeHierarchy const & instanceHierarchy() const { return mInstanceHierarchy; }
+
+    bool isDirty() const { return mDirty; }
+
+    /**
+     * @brief recompute the world and normal matrices and the bounds of the changed nodes
+     *
+     * One linear pass over the nodes: a node is updated if its local matrix is
+     * changed or its parent has been updated in the same pass. The hierarchy of
+     * the instances is then refitted for the moved ones.
+     *
+     * @return whether any world matrix has been changed
+     */
+    bool updateWorldTransforms();
+
+    /**
+     * @brief collect the instances within the frustum, in the order of the nodes
+     * @param frustum the frustum in the scene space
+     * @param instances receives the indices of the visible instances (cleared first)
+     */
+    void cullInstances(Frustum const &frustum, std::vector<unsigned int> &instances) const;
+
+protected:
+    void updateInstanceBounds(size_t node);
+
+protected:
+    std::vector<int> mParents;
+    std::vector<aiNode const *> mSourceNodes;
+    std::vector<glm::mat4x4> mLocalMatrices;
+    std::vector<glm::mat4x4> mWorldMatrices;
+    std::vector<glm::mat3x3> mNormalMatrices;
+    std::vector<std::uint8_t> mNodeDirty;
+
+    std::vector<unsigned int> mInstanceOffsets; ///< nodeNumber()+1 offsets of the instances
+    std::vector<unsigned int> mInstanceMeshes;
+    std::vector<unsigned int> mInstanceNodes;
+    std::vector<float> mInstanceBounds;         ///< 6 floats per instance
+    std::vector<float> mMeshBounds;             ///< 6 floats per mesh, in the mesh space
+    BoundingVolumeHierarchy mInstanceHierarchy;
+    std::vector<unsigned int> mMovedInstances;
+
+    bool mDirty;
+};
+
+#endif // RENDERSCENE_H
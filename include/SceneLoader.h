@@ -0,0 +1,193 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef SCENELOADER_H
+#define SCENELOADER_H
+
+#include <QObject>
+#include <QString>
+#include <QThreadPool>
+#include <QMetaType>
+
+#include <atomic>
+
+#include "SharedPointerTypes.h"
+#include "VertexFormat.h"
+
+struct aiScene;
+class TextureLoader;
+
+/**
+ * @brief Scene data produced by SceneLoader
+ *
+ * All the CPU side work (importing, converting meshes and materials) has been
+ * done for the scene data, only the OpenGL resources remain to be created
+ * (see OpenGLRenderableEntity::uploadData and OpenGLMaterialEntity::uploadData).
+ */
+class SceneData
+{
+public:
+    std::shared_ptr<aiScene const> scene;       ///< the scene graph imported by assimp (owned by this object)
+    QString sourceFilePath;                     ///< full path-name of the source file
+    OpenGLMaterialEntityArray materials;        ///< materials (indexed in the same way as in the assimp scene)
+    OpenGLRenderableEntityArray renderables;    ///< renderables (indexed in the same way as in the assimp scene, followed by the static batches)
+    RenderScenePtr renderScene;                 ///< the node hierarchy of the scene flattened for rendering
+    StaticBatchTablePtr staticBatches;          ///< the static batches merged from the small meshes (null if none)
+};
+
+Q_DECLARE_METATYPE(SceneDataPtr)
+
+/**
+ * @brief Loader which imports scene files on a worker thread
+ *
+ * loadAsync() returns immediately, the progress is reported by progressChanged()
+ * (emitted from the worker thread, thus queued to the receivers living in the GUI
+ * thread), and the result by sceneLoaded() or loadFailed() (emitted in the thread
+ * of the loader object). A new request supersedes the pending one, whose result
+ * is discarded.
+ */
+class SceneLoader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit SceneLoader(QObject *parent = nullptr);
+    ~SceneLoader();
+
+    /**
+     * @brief the post-processing flags of assimp used for importing
+     */
+    static unsigned int importFlags();
+
+    /**
+     * @brief whether the scenes are loaded from (and saved into) the mesh cache,
+     *        see MeshCache.h (enabled by default)
+     */
+    bool meshCacheEnabled() const { return mMeshCacheEnabled; }
+    void setMeshCacheEnabled(bool enabled) { mMeshCacheEnabled = enabled; }
+
+    /**
+     * @brief whether the meshes with more than 65536 vertices are split into sections
+     *        drawn with 16-bit indices, see OpenGLRenderableEntity::loadData (disabled by default)
+     */
+    bool splitOversizedMeshes() const { return mSplitOversizedMeshes; }
+    void setSplitOversizedMeshes(bool enabled) { mSplitOversizedMeshes = enabled; }
+
+    /**
+     * @brief the layout of the vertex data of the loaded meshes (VERTEX_LAYOUT_FLOAT by default),
+     *        see OpenGLRenderableEntity::loadData
+     */
+    VertexLayout vertexLayout() const { return mVertexLayout; }
+    void setVertexLayout(VertexLayout layout) { mVertexLayout = layout; }
+
+    /**
+     * @brief whether the meshes are optimized for the vertex cache, overdraw and
+     *        vertex fetch after loading, see OpenGLRenderableEntity::optimizeMesh
+     *        (disabled by default, the optimized meshes are kept in the mesh cache)
+     */
+    bool meshOptimizationEnabled() const { return mMeshOptimizationEnabled; }
+    void setMeshOptimizationEnabled(bool enabled) { mMeshOptimizationEnabled = enabled; }
+
+    /**
+     * @brief whether the simplified levels of detail of the large meshes are generated
+     *        after loading, see OpenGLRenderableEntity::buildLevelsOfDetail
+     *        (disabled by default, the levels are kept in the mesh cache)
+     */
+    bool levelsOfDetailEnabled() const { return mLevelsOfDetailEnabled; }
+    void setLevelsOfDetailEnabled(bool enabled) { mLevelsOfDetailEnabled = enabled; }
+
+    /**
+     * @brief whether the hierarchies of the triangles for picking are built while
+     *        loading (enabled by default, otherwise built on the first pick of each
+     *        entity in the GUI thread), see OpenGLRenderableEntity::buildTriangleHierarchy
+     */
+    bool triangleHierarchiesEnabled() const { return mTriangleHierarchiesEnabled; }
+    void setTriangleHierarchiesEnabled(bool enabled) { mTriangleHierarchiesEnabled = enabled; }
+
+    /**
+     * @brief whether the small meshes sharing a material are merged into static batches
+     *        after loading, see StaticBatchTable (disabled by default; the batches are
+     *        made of the meshes imported by assimp, thus the mesh cache is neither read nor written then)
+     */
+    bool staticBatchingEnabled() const { return mStaticBatchingEnabled; }
+    void setStaticBatchingEnabled(bool enabled) { mStaticBatchingEnabled = enabled; }
+
+    /**
+     * @brief the pipeline to decode the textures of the loaded materials in parallel
+     *        with the meshes (optional, should be set before loading)
+     */
+    TextureLoader * textureLoader() const { return mTextureLoader; }
+    void setTextureLoader(TextureLoader *textureLoader) { mTextureLoader = textureLoader; }
+
+    /**
+     * @brief load the scene file in the background
+     * @param pathName the full path-name of the scene file
+     */
+    void loadAsync(QString const &pathName);
+
+    /**
+     * @brief load the scene file in the calling thread (may be any thread)
+     * @param pathName the full path-name of the scene file
+     * @return the loaded scene data, or null if failed
+     */
+    SceneDataPtr load(QString const &pathName);
+
+    /**
+     * @brief cancel the pending request (if any)
+     */
+    void cancel();
+
+    /**
+     * @brief whether there is a request being processed
+     */
+    bool isLoading() const { return mPendingRequests > 0; }
+
+signals:
+    void progressChanged(int percent, QString const &stage);
+    void sceneLoaded(SceneDataPtr sceneData);
+    void loadFailed(QString const &pathName);
+
+private:
+    SceneDataPtr loadScene(QString const &pathName, unsigned int ticket);
+    bool isCanceled(unsigned int ticket) const { return ticket != 0 && ticket != mCurrentTicket; }
+    void reportProgress(unsigned int ticket, int percent, QString const &stage);
+    void requestTextures(SceneDataPtr const &sceneData);
+    void buildRenderScene(SceneDataPtr const &sceneData);
+    void buildStaticBatches(SceneDataPtr const &sceneData, VertexLayout vertexLayout);
+    void buildTriangleHierarchies(SceneDataPtr const &sceneData);
+
+    friend class SceneLoaderProgressHandler;
+
+private:
+    QThreadPool mThreadPool;
+    QThreadPool mCacheThreadPool;               ///< writes the mesh caches, one at a time, aside from the loads
+    std::atomic<unsigned int> mCurrentTicket;
+    int mPendingRequests;
+    std::atomic<bool> mMeshCacheEnabled;
+    std::atomic<bool> mSplitOversizedMeshes;
+    std::atomic<VertexLayout> mVertexLayout;
+    std::atomic<bool> mMeshOptimizationEnabled;
+    std::atomic<bool> mLevelsOfDetailEnabled;
+    std::atomic<bool> mTriangleHierarchiesEnabled;
+    std::atomic<bool> mStaticBatchingEnabled;
+    TextureLoader *mTextureLoader;
+};
+
+#endif // SCENELOADER_H
@@ -26,31 +26,238 @@
 #include <QOpenGLFunctions>
 #include <QOpenGLVertexArrayObject>
 #include <QOpenGLBuffer>
+#include <QOpenGLTextureBlitter>
+#include <QVector3D>
+#include <QTimer>
 
+#include "glm/vec3.hpp"
+#include "glm/mat3x3.hpp"
 #include "glm/mat4x4.hpp"
-#include "assimp/Importer.hpp"
+#include "glm/gtc/quaternion.hpp"
 
 #include "SharedPointerTypes.h"
 #include "Light.h"
 #include "TrackBall.h"
+#include "Frustum.h"
+#include "FrameGovernor.h"
+#include "OcclusionCuller.h"
+#include "OpenGLRenderableEntity.h"
+#include "RenderQueue.h"
+#include "ShaderUniforms.h"
+
+#include <unordered_map>
 
 class QOpenGLShaderProgram;
+class QOpenGLTexture;
+class QOpenGLFramebufferObject;
+class SceneLoader;
+class TextureLoader;
 
-struct aiNode;
+struct aiScene;
+
+/**
+ * @brief Result of picking, see SceneWidget::pick()
+ */
+struct PickResult
+{
+    OpenGLRenderableEntityPtr renderable;   ///< the entity hit (the original one if merged into a static batch)
+    unsigned int meshIndex;                 ///< index of the entity in the scene
+    unsigned int node;                      ///< the node of the render scene referring to the entity
+    unsigned int triangle;                  ///< the triangle hit, in the index data of the entity, or the face of the
+                                            ///< assimp mesh if hit in a static batch (which follows the face order,
+                                            ///< whereas the entity may have reordered its triangles, see optimizeMesh())
+    glm::vec3 position;                     ///< the point hit in the scene space
+};
 
 class SceneWidget : public QOpenGLWidget, protected QOpenGLFunctions
 {
     Q_OBJECT
 public:
+    /**
+     * @brief Anti-aliasing of the frames, see antiAliasing()
+     */
+    enum AntiAliasing
+    {
+        ANTIALIASING_OFF,
+        ANTIALIASING_MSAA_2X,       ///< rendered into a multisampled buffer, resolved onto the widget
+        ANTIALIASING_MSAA_4X,
+        ANTIALIASING_MSAA_8X,
+        ANTIALIASING_MSAA_16X,
+        ANTIALIASING_FXAA           ///< the edges of the rendered frame smoothed by a post-process pass
+    };
+
     explicit SceneWidget(QWidget *parent = nullptr);
     ~SceneWidget();
 
+    /**
+     * @brief load scene from file in the background
+     *
+     * The current scene keeps being rendered until the new one is ready (or
+     * until its first batch is uploaded, see streamingEnabled()), the progress
+     * and result are reported by the signals below.
+     */
     void loadSceneFromFile(QString const &pathName);
 
+    bool isLoadingScene() const;
+
+    /**
+     * @brief whether a loaded scene is displayed progressively (enabled by default)
+     *
+     * In streaming mode, the loaded scene replaces the current one as soon as a
+     * first batch of its entities is uploaded (within uploadTimeBudget()), the
+     * rest is uploaded during the following frames, each one being drawn as soon
+     * as its buffers are ready. Otherwise the whole scene is uploaded before being
+     * displayed.
+     */
+    bool streamingEnabled() const { return mStreamingEnabled; }
+    void setStreamingEnabled(bool enabled) { mStreamingEnabled = enabled; }
+
+    /**
+     * @brief time spent on uploading the materials and renderables per frame in streaming
+     *        mode, in milliseconds (8 by default, at least one entity is uploaded per frame)
+     */
+    float uploadTimeBudget() const { return mUploadTimeBudget; }
+    void setUploadTimeBudget(float ms) { mUploadTimeBudget = ms; }
+
+    /**
+     * @brief whether there are entities of the scene still waiting for uploading
+     */
+    bool isStreamingScene() const;
+
+    /**
+     * @brief whether the mesh instances out of the view frustum are skipped (enabled by default)
+     */
+    bool frustumCullingEnabled() const { return mFrustumCullingEnabled; }
+    void setFrustumCullingEnabled(bool enabled);
+
+    /**
+     * @brief whether the mesh instances hidden behind the largest ones are skipped,
+     *        see OcclusionCuller (disabled by default)
+     */
+    bool occlusionCullingEnabled() const { return mOcclusionCullingEnabled; }
+    void setOcclusionCullingEnabled(bool enabled);
+
+    /**
+     * @brief whether the opaque meshes referred to by several visible instances are
+     *        drawn by one instanced draw (enabled by default, core profile only)
+     */
+    bool instancingEnabled() const { return mInstancingEnabled; }
+    void setInstancingEnabled(bool enabled);
+
+    /**
+     * @brief whether the items are submitted by glMultiDrawElementsIndirect (enabled by default),
+     *        the draws fall back to the others if not supported by the context
+     */
+    bool indirectDrawingEnabled() const { return mIndirectDrawingEnabled; }
+    void setIndirectDrawingEnabled(bool enabled);
+    bool indirectDrawingSupported() const;
+
+    /**
+     * @brief whether the entities with simplified levels of detail (see SceneLoader::levelsOfDetailEnabled())
+     *        are drawn at the coarsest level whose error projected onto the screen is within
+     *        levelOfDetailPixelError() pixels (enabled by default, 1 pixel by default)
+     */
+    bool levelOfDetailEnabled() const { return mLevelOfDetailEnabled; }
+    void setLevelOfDetailEnabled(bool enabled);
+    float levelOfDetailPixelError() const { return mLevelOfDetailPixelError; }
+    void setLevelOfDetailPixelError(float pixels);
+
+    /**
+     * @brief whether the frames are rendered at a lower resolution while the camera moves,
+     *        scaled by frameGovernor() toward its target frame time (enabled by default)
+     *
+     * The scene is rendered into an offscreen buffer at the scaled resolution, and then
+     * stretched onto the widget. Once the camera stays idle for interactionIdleTime()
+     * milliseconds (250 by default), the frame is rendered again at the full resolution.
+     */
+    bool dynamicResolutionEnabled() const { return mDynamicResolutionEnabled; }
+    void setDynamicResolutionEnabled(bool enabled);
+    int interactionIdleTime() const { return mIdleTimer.interval(); }
+    void setInteractionIdleTime(int ms) { mIdleTimer.setInterval(ms); }
+
+    /**
+     * @brief anti-aliasing of the frames (4x multisampling by default), switchable at any time
+     *
+     * The multisampling is limited to the samples supported by the context, and
+     * turned off if the context cannot resolve the multisampled buffers.
+     */
+    AntiAliasing antiAliasing() const { return mAntiAliasing; }
+    void setAntiAliasing(AntiAliasing mode);
+
+    /**
+     * @brief samples per pixel of the current anti-aliasing, 0 if not multisampled
+     */
+    int antiAliasingSamples() const;
+
+    /**
+     * @brief whether the camera is being moved, until it stays idle for interactionIdleTime()
+     */
+    bool isInteracting() const { return mInteracting; }
+
+    /**
+     * @brief the controller of the resolution scale, for its target frame time and for its state
+     */
+    FrameGovernor & frameGovernor() { return mFrameGovernor; }
+
+    /**
+     * @brief resolution scale of the last frame (1 if rendered onto the widget directly)
+     */
+    float renderScale() const { return mRenderScale; }
+
+    /**
+     * @brief the occlusion culler, for tuning the selection of the occluders and
+     *        for its statistics of the last frame
+     */
+    OcclusionCuller & occlusionCuller() { return mOcclusionCuller; }
+
+    /**
+     * @brief numbers of the mesh instances drawn, culled by the frustum and
+     *        culled by occlusion in the last frame
+     */
+    size_t visibleInstanceNumber() const { return mVisibleInstances.size(); }
+    size_t culledInstanceNumber() const { return mCulledInstanceNumber; }
+    size_t occludedInstanceNumber() const { return mOccludedInstanceNumber; }
+
+    /**
+     * @brief number of the draws of the entities in the last frame (an instanced one counted once)
+     */
+    size_t drawCallNumber() const { return mDrawCallNumber; }
+
+    /**
+     * @brief look at the scene from the given direction, with the whole scene in the view
+     *
+     * The scene is turned about its center by the yaw (about the vertical axis) and
+     * then by the pitch (about the horizontal axis), both in degrees, and viewed from
+     * the front. The direction is kept for the scenes loaded later.
+     */
+    void resetView(float yaw = 0.0f, float pitch = 0.0f);
+
+    /**
+     * @brief find the closest triangle under the given point of the widget
+     *
+     * The ray through the point is tested against the hierarchy of the instances
+     * and then the hierarchies of the triangles of the entities (built ahead while
+     * loading, or on demand, see SceneLoader::triangleHierarchiesEnabled()). A click
+     * of the left button without dragging picks the entity under the cursor.
+     *
+     * @param pos the point in the widget coordinates
+     * @param result receives the hit if any
+     * @return true if hit
+     */
+    bool pick(QPoint const &pos, PickResult &result);
+
 signals:
+    void sceneLoadProgress(int percent, QString const &stage);
+    void sceneLoaded(QString const &pathName);
+    void sceneLoadFailed(QString const &pathName);
+    void entityPicked(QString const &name, unsigned int triangle, QVector3D const &position);
+    void frameRendered(float frameTime, float renderScale);
 
 protected slots:
     void cleanupGL();
+    void onSceneLoaded(SceneDataPtr sceneData);
+    void onTextureImageDecoded();
+    void onInteractionIdle();
 
 protected:
     virtual void initializeGL() override;
@@ -58,37 +265,137 @@ protected:
     virtual void paintGL() override;
 
     virtual void mousePressEvent(QMouseEvent *event) override;
+    virtual void mouseReleaseEvent(QMouseEvent *event) override;
     virtual void mouseMoveEvent(QMouseEvent *event) override;
     virtual void wheelEvent(QWheelEvent *event) override;
 
 protected:
-    void loadSceneData(aiScene const *scene, QString const &sourceFilePath);
+    bool loadSceneData(SceneDataPtr sceneData);
     void cleanupSceneGL();
+    void uploadPendingEntities();
     void clearSceneData();
     void alignScene();
     void recalculateBoundsCenter();
-    void drawRenderableEntity(glm::mat4x4 const &modelMat, OpenGLRenderableEntityPtr renderableEntity);
-    void drawSceneNode(glm::mat4x4 const &parentModelMat, aiNode const *node);
+    void drawRenderScene();
+    void drawRenderQueue();
+    void drawRenderQueueIndirect();
+    void uploadFrameUniforms();
+    PhongUniformLocations const * bindProgram(QOpenGLShaderProgram *program, glm::mat3x3 const &viewNormalMat);
+    void applyMaterial(OpenGLMaterialEntity const *material, PhongUniformLocations const *uniforms);
+    void uploadMaterialUniforms();
+    PhongUniformLocations const * programUniforms(QOpenGLShaderProgram const *program) const;
 
     void cameraZoom(float dz);
     void cameraPan(float dx, float dy);
+    void beginInteraction();
+    bool bindOffscreenBuffer(int width, int height, int &samples);
+    void presentOffscreenBuffer(int width, int height, int samples, bool fxaa);
+    void drawFxaaPass(int width, int height);
 
 protected:
-    Assimp::Importer mSceneImporter;
+    SceneLoader *mSceneLoader;
+    TextureLoader *mTextureLoader;
+    std::shared_ptr<aiScene const> mScene;
+    RenderScenePtr mRenderScene;
+    StaticBatchTablePtr mStaticBatches;
     Light mLight;
     TrackBall mTrackBall;
     OpenGLMaterialEntityPtr mDefaultMaterial;
     OpenGLMaterialEntityArray mMaterials;
     OpenGLRenderableEntityArray mRenderables;
 
+    /**
+     * @brief Material not uploaded yet in streaming mode
+     */
+    struct PendingMaterial
+    {
+        size_t index;                           ///< index in mMaterials
+        QString texturePath;                    ///< canonical path-name of the diffuse texture, empty if none
+    };
+
+    bool mStreamingEnabled;
+    float mUploadTimeBudget;
+    std::vector<PendingMaterial> mPendingMaterials;
+    size_t mNextRenderableToUpload;             ///< renderables from this one on are not uploaded yet in streaming mode
+
+    bool mFrustumCullingEnabled;
+    Frustum mFrustum;                           ///< view frustum in the scene space
+    bool mOcclusionCullingEnabled;
+    OcclusionCuller mOcclusionCuller;
+    std::vector<unsigned int> mVisibleInstances;
+    size_t mCulledInstanceNumber;
+    size_t mOccludedInstanceNumber;
+    RenderQueue mRenderQueue;
+    bool mInstancingEnabled;
+    std::vector<unsigned int> mMeshInstanceCounts;  ///< visible instances of each mesh in the frame
+    std::vector<RenderableInstance> mInstanceData;
+    GLuint mInstanceBuffer;                     ///< the RenderableInstance of the instanced items, refilled every frame
+    size_t mDrawCallNumber;
+
+    /**
+     * @brief Items drawn by one indirect draw, sharing the states and the vertex array object
+     */
+    struct IndirectBatch
+    {
+        OpenGLRenderableEntity *renderable;     ///< the first renderable (the only one if direct)
+        QOpenGLShaderProgram *program;
+        QOpenGLTexture *texture;
+        OpenGLMaterialEntity const *material;
+        bool transparent;
+        bool direct;                            ///< not in the geometry arena, drawn on its own
+        unsigned int level;                     ///< the level of detail of the renderable if direct
+        int page;                               ///< the page of the geometry arena
+        GLenum indexType;
+        size_t commandBegin;
+        size_t commandNumber;
+        GLuint baseInstance;
+        GLuint instanceNumber;
+    };
+    bool mIndirectDrawingEnabled;
+    std::vector<DrawElementsIndirectCommand> mIndirectCommands;
+    std::vector<IndirectBatch> mIndirectBatches;
+    GLuint mIndirectBuffer;                     ///< the commands of the indirect draws, refilled every frame
+    bool mLevelOfDetailEnabled;
+    float mLevelOfDetailPixelError;
+
+    bool mDynamicResolutionEnabled;
+    bool mInteracting;
+    QTimer mIdleTimer;                          ///< ends the interaction, for a frame at the full resolution
+    FrameGovernor mFrameGovernor;
+    FrameTimer mFrameTimer;                     ///< the frames rendered while interacting
+    float mRenderScale;
+    QOpenGLFramebufferObject *mOffscreenBuffer; ///< of the size of the widget, the scaled frames in its lower left part
+    QOpenGLTextureBlitter mTextureBlitter;
+
+    AntiAliasing mAntiAliasing;
+    GLint mMaxSamples;                          ///< 0 if the multisampled buffers cannot be resolved
+    QOpenGLFramebufferObject *mMultisampleBuffer;   ///< rendered into, and resolved into mOffscreenBuffer or onto the widget
+    int mMultisampleBufferSamples;              ///< the samples asked for mMultisampleBuffer
+    QOpenGLShaderProgram *mFxaaProgram;
+    GLint mFxaaSourceExtentLocation;
+    GLint mFxaaTexelSizeLocation;
+    GLuint mScreenTriangleBuffer;               ///< a triangle covering the viewport, for the post-process passes
+    QOpenGLVertexArrayObject mScreenTriangleArray;
+
     QOpenGLShaderProgram *mPhongSimpleProgram;
     QOpenGLShaderProgram *mPhongTextureProgram;
+    QOpenGLShaderProgram *mPhongSimpleInstancedProgram;
+    QOpenGLShaderProgram *mPhongTextureInstancedProgram;
+    PhongUniformLocations mPhongSimpleUniforms;
+    PhongUniformLocations mPhongTextureUniforms;
+    PhongUniformLocations mPhongSimpleInstancedUniforms;
+    PhongUniformLocations mPhongTextureInstancedUniforms;
+    GLuint mFrameUniformBuffer;                 ///< FrameUniformData, refilled every frame
+    GLuint mMaterialUniformBuffer;              ///< MaterialUniformData of all the materials of the scene
+    GLint mMaterialUniformStride;               ///< offset between the materials in the buffer (aligned for binding)
+    std::unordered_map<OpenGLMaterialEntity const *, unsigned int> mMaterialUniformIndices;
     GLint mViewport[4];
     GLfloat mBackgroundColor[4];
     glm::mat4x4 mCameraMatrix;
     glm::mat4x4 mProjectionMatrix;
     glm::mat4x4 mModelMatrix;
     glm::mat4x4 mModelViewMatrix;
+    glm::quat mViewRotation;                    ///< of the scene when aligned, see resetView()
     glm::vec4 mLightPos;
     glm::vec3 mTargetPos;
     glm::vec3 mCameraPos;
@@ -102,6 +409,8 @@ protected:
     float mAngleFoV;
 
     QPoint mLastMousePos;
+    QPoint mPressMousePos;                      ///< where the left button was pressed
+    bool mMouseDragged;                         ///< whether the left button moved since pressed, no picking then
 
     bool mOpenGLInitialized;
     bool mNeedToAlignScene;
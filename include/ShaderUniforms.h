@@ -0,0 +1,117 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef SHADERUNIFORMS_H
+#define SHADERUNIFORMS_H
+
+#include "GLInc.h"
+
+class QOpenGLShaderProgram;
+class OpenGLMaterialEntity;
+
+// the uniform blocks require GLSL 1.40 (OpenGL 3.1), the shaders for the
+// compatibility profile and OpenGL ES take the plain uniforms instead,
+// and so are the instanced shaders (OpenGL 3.3), drawn one by one otherwise
+#if !defined(USE_COMPATIBILITY_PROFILE) && !defined(USE_OPENGLES)
+#   define USE_UNIFORM_BUFFERS
+#   define USE_INSTANCED_DRAWING
+#endif
+
+#ifndef GL_UNIFORM_BUFFER
+#define GL_UNIFORM_BUFFER 0x8A11
+#endif
+#ifndef GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT
+#define GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT 0x8A34
+#endif
+#ifndef GL_INVALID_INDEX
+#define GL_INVALID_INDEX 0xFFFFFFFFu
+#endif
+
+/**
+ * @brief binding points of the uniform blocks of the phong shaders
+ */
+enum UniformBufferBinding
+{
+    FRAME_UNIFORM_BINDING = 0,      ///< block FrameData, see FrameUniformData
+    MATERIAL_UNIFORM_BINDING = 1    ///< block MaterialData, see MaterialUniformData
+};
+
+/**
+ * @brief data of the uniform block FrameData (std140), uploaded once per frame
+ */
+struct FrameUniformData
+{
+    GLfloat projectionMatrix[16];
+    GLfloat lightPosition[4];
+    GLfloat lightAmbient[4];
+    GLfloat lightDiffuse[4];
+    GLfloat lightSpecular[4];
+};
+
+/**
+ * @brief data of the uniform block MaterialData (std140), one for each material
+ *        in a buffer bound by the range of the material in use
+ */
+struct MaterialUniformData
+{
+    GLfloat materialAmbient[4];
+    GLfloat materialDiffuse[4];
+    GLfloat materialEmission[4];
+    GLfloat materialSpecular[4];
+    GLfloat materialShininess;
+    GLfloat padding[3];
+};
+
+void get_material_uniform_data(OpenGLMaterialEntity const *material, MaterialUniformData &data);
+
+/**
+ * @brief locations of the uniforms of a phong program, resolved once after linking
+ *
+ * The ones in the uniform blocks are -1 when the uniform buffers are used.
+ */
+struct PhongUniformLocations
+{
+    GLint modelViewMatrix;
+    GLint normalMatrix;
+    GLint normalEncoded;
+    GLint materialDiffuseMap;
+    GLint positionMatrix;           ///< only in the instanced programs
+    GLint projectionMatrix;
+    GLint lightPosition;
+    GLint lightAmbient;
+    GLint lightDiffuse;
+    GLint lightSpecular;
+    GLint materialAmbient;
+    GLint materialDiffuse;
+    GLint materialEmission;
+    GLint materialSpecular;
+    GLint materialShininess;
+
+    PhongUniformLocations();
+
+    /**
+     * @brief look up the locations (and bind the uniform blocks to their binding points)
+     * @param program the linked program, current in the OpenGL context
+     */
+    void resolve(QOpenGLShaderProgram *program);
+};
+
+#endif // SHADERUNIFORMS_H
@@ -32,5 +32,8 @@
 
 DEFINE_SHARED_PTR_TYPE(OpenGLMaterialEntity)
 DEFINE_SHARED_PTR_TYPE(OpenGLRenderableEntity)
+DEFINE_SHARED_PTR_TYPE(RenderScene)
+DEFINE_SHARED_PTR_TYPE(SceneData)
+DEFINE_SHARED_PTR_TYPE(StaticBatchTable)
 
 #endif // SHAREDPOINTERTYPES_H
@@ -0,0 +1,129 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef STATICBATCHTABLE_H
+#define STATICBATCHTABLE_H
+
+#include <vector>
+#include <cstdint>
+
+#include "SharedPointerTypes.h"
+#include "VertexFormat.h"
+
+struct aiScene;
+
+/**
+ * @brief a mesh instance merged into a static batch
+ */
+struct StaticBatchSource
+{
+    unsigned int mesh;              ///< index of the original mesh in the scene
+    unsigned int node;              ///< the node of the render scene referring to the mesh
+    unsigned int triangleBegin;     ///< the first triangle of the instance in the batch
+    unsigned int triangleNumber;    ///< number of triangles of the instance
+};
+
+/**
+ * @brief Static batches merged from the small meshes of a scene, and the side
+ *        table back to the original mesh instances
+ *
+ * The instances of the small meshes sharing a material (and a vertex format) are
+ * merged at load time into batches, with the node transforms baked into the
+ * vertices, so that each batch takes one draw call instead of one per instance.
+ * The instances of a material are split recursively at the median along the
+ * longest axis, until each chunk fits 16-bit indices and is small enough compared
+ * to the scene, so that the batches stay spatially coherent with tight bounds for
+ * culling.
+ *
+ * The batches are appended to the renderables of the scene (batch b is the mesh
+ * sourceMeshNumber()+b), the render scene built with the table leaves out the
+ * merged instances and refers to the batches instead (see RenderScene::build).
+ * The original meshes all of whose instances are merged are retired, i.e. not
+ * drawn any more, but kept for picking and statistics.
+ *
+ * The batches are static: moving a node does not move the instances merged from
+ * it. The triangles of the batches are in the order of their sources (a batch is
+ * never reordered by the mesh optimizer), which maps a picked triangle back.
+ */
+class StaticBatchTable
+{
+public:
+    StaticBatchTable();
+
+    /**
+     * @brief merge the small meshes into batches
+     *
+     * The batches are converted in parallel by the global thread pool.
+     *
+     * @param scene the scene imported by assimp (with the meshes)
+     * @param renderScene the render scene built without batches, for the instances and their transforms
+     * @param renderables the renderables of the scene, the batches are appended
+     * @param vertexLayout the layout of the vertex data of the batches
+     * @param maxMeshVertices the meshes with more vertices are not merged
+     * @return whether any batch has been made
+     */
+    bool build(aiScene const *scene, RenderScene const &renderScene, OpenGLRenderableEntityArray &renderables,
+               VertexLayout vertexLayout, unsigned int maxMeshVertices = 4096);
+    void clear();
+
+    /**
+     * @brief number of the meshes before the batches are appended
+     */
+    unsigned int sourceMeshNumber() const { return mSourceMeshNumber; }
+
+    size_t batchNumber() const { return mSourceOffsets.empty() ? 0 : mSourceOffsets.size()-1; }
+    bool isBatch(unsigned int mesh) const { return mesh >= mSourceMeshNumber && mesh - mSourceMeshNumber < batchNumber(); }
+
+    /**
+     * @brief the sources of batch b are sourceBegin(b) to sourceEnd(b)-1
+     */
+    unsigned int sourceBegin(size_t batch) const { return mSourceOffsets[batch]; }
+    unsigned int sourceEnd(size_t batch) const { return mSourceOffsets[batch+1]; }
+    size_t sourceNumber() const { return mSources.size(); }
+    StaticBatchSource const & source(size_t i) const { return mSources[i]; }
+
+    /**
+     * @brief the source of a triangle of a batch
+     * @param mesh the mesh index of the batch
+     * @param triangle the triangle in the batch
+     * @return the source, null if the mesh is not a batch
+     */
+    StaticBatchSource const * findSource(unsigned int mesh, unsigned int triangle) const;
+
+    /**
+     * @brief whether the instance (of the render scene built without batches) is merged
+     */
+    bool isInstanceBatched(size_t instance) const { return instance < mBatchedInstances.size() && mBatchedInstances[instance]; }
+
+    /**
+     * @brief whether all the instances of the original mesh are merged
+     */
+    bool isMeshRetired(unsigned int mesh) const { return mesh < mRetiredMeshes.size() && mRetiredMeshes[mesh]; }
+
+protected:
+    unsigned int mSourceMeshNumber;
+    std::vector<unsigned int> mSourceOffsets;       ///< batchNumber()+1 offsets of the sources
+    std::vector<StaticBatchSource> mSources;
+    std::vector<std::uint8_t> mBatchedInstances;
+    std::vector<std::uint8_t> mRetiredMeshes;
+};
+
+#endif // STATICBATCHTABLE_H
@@ -0,0 +1,160 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <QObject>
+#include <QHash>
+#include <QString>
+#include <QByteArray>
+#include <QImage>
+#include <QMutex>
+#include <QPointer>
+
+#include <memory>
+
+class QOpenGLTexture;
+class QOpenGLContext;
+class QOpenGLContextGroup;
+class QOffscreenSurface;
+
+/**
+ * @brief reference-counted handle of a texture shared through TextureCache
+ */
+typedef std::shared_ptr<QOpenGLTexture> OpenGLTexturePtr;
+
+/**
+ * @brief Image decoded from a texture file, ready to be uploaded
+ */
+struct TextureImage
+{
+    QString canonicalPath;      ///< canonical path-name of the image file
+    qint64 size;                ///< size of the image file
+    qint64 modifiedTime;        ///< modification time of the image file (ms since epoch)
+    QByteArray contentHash;     ///< hash of the content of the image file
+    QImage image;               ///< pixels in RGBA8888, flipped vertically for OpenGL
+    bool hasAlpha = false;      ///< whether some pixel is not fully opaque (to be blended)
+};
+
+/**
+ * @brief decode an image file for texturing
+ *
+ * The image is converted to the format taken by OpenGL and flipped in place,
+ * thus no conversion is left for uploading. Can be performed in any thread.
+ *
+ * @param imageFilePath the full path-name of the image file
+ * @param textureImage returns the decoded image
+ * @return true if succeed
+ */
+bool decode_texture_image(QString const &imageFilePath, TextureImage &textureImage);
+
+/**
+ * @brief Cache of the textures loaded from image files, shared by all the contexts of a share group
+ *
+ * The textures are identified by the content of the image files, so that the same
+ * image is decoded and uploaded only once, even if it is referred through different
+ * paths. The canonical path (with the size and modification time of the file) is
+ * remembered to skip reading the files already known. The cache only holds weak
+ * references, a texture is released with the last handle: in the OpenGL context
+ * thread, with a context of the share group made current (on a surface of the
+ * cache) if none of them is current, e.g. in a teardown path.
+ */
+class TextureCache : public QObject
+{
+    Q_OBJECT
+public:
+    /**
+     * @brief the texture cache of the share group of the given context (created on demand)
+     */
+    static TextureCache * instance(QOpenGLContext const *glCtx);
+
+    /**
+     * @brief get the texture of an image file, decode and upload it if not cached yet
+     * @param imageFilePath the full path-name of the image file
+     * @param hasAlpha returns whether some texel is not fully opaque (if not null)
+     * @return the handle of the texture, null if failed
+     */
+    OpenGLTexturePtr texture(QString const &imageFilePath, bool *hasAlpha = nullptr);
+
+    /**
+     * @brief upload a decoded image (unless the same content is cached already)
+     * @param textureImage the image decoded by decode_texture_image()
+     * @param hasAlpha returns whether some texel is not fully opaque (if not null)
+     * @return the handle of the texture, null if failed
+     */
+    OpenGLTexturePtr insert(TextureImage const &textureImage, bool *hasAlpha = nullptr);
+
+    /**
+     * @brief whether the texture of an image file is cached (can be called in any thread)
+     */
+    bool contains(QString const &imageFilePath) const;
+
+    /**
+     * @brief number of textures alive in the cache
+     */
+    int textureNumber() const;
+
+    ~TextureCache();
+
+private:
+    explicit TextureCache(QOpenGLContextGroup *group, QOpenGLContext const *glCtx);
+
+    /**
+     * @brief the deleter of the handles, see releaseTexture()
+     */
+    struct TextureReleaser
+    {
+        QPointer<TextureCache> cache;
+        void operator()(QOpenGLTexture *tex) const;
+    };
+
+    /**
+     * @brief delete a texture with a context of the share group current
+     *        (queued to the thread of the cache if called from another one)
+     */
+    void releaseTexture(QOpenGLTexture *tex);
+
+    OpenGLTexturePtr findTexture(QString const &canonicalPath, qint64 size, qint64 modifiedTime, bool *hasAlpha) const;
+    OpenGLTexturePtr findTexture(QByteArray const &contentHash, bool *hasAlpha) const;
+
+private:
+    struct FileEntry
+    {
+        qint64 size;
+        qint64 modifiedTime;
+        QByteArray contentHash;
+    };
+
+    struct TextureEntry
+    {
+        std::weak_ptr<QOpenGLTexture> texture;
+        bool hasAlpha;
+    };
+
+    QHash<QString, FileEntry> mFiles;                               ///< canonical path-name -> content
+    QHash<QByteArray, TextureEntry> mTextures;                      ///< content hash -> texture
+    mutable QMutex mMutex;                                          ///< guards the lookup tables
+    QOpenGLContextGroup *mGroup;
+    QOffscreenSurface *mSurface;                                    ///< made current with a context of the group to release the textures
+};
+
+#endif // TEXTURECACHE_H
@@ -0,0 +1,140 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef TEXTURELOADER_H
+#define TEXTURELOADER_H
+
+#include <QObject>
+#include <QString>
+#include <QStringList>
+#include <QSet>
+#include <QThreadPool>
+#include <QMutex>
+#include <QWaitCondition>
+
+#include <deque>
+#include <vector>
+
+#include "TextureCache.h"
+
+/**
+ * @brief Pipeline decoding texture files on worker threads
+ *
+ * The image files are decoded, converted and flipped by a pool of worker threads
+ * (see decode_texture_image()), the ready-to-upload images are queued and handed
+ * to the OpenGL context thread by uploadDecoded(), which puts them into the
+ * TextureCache. The decoded images in flight (being decoded or waiting to be
+ * uploaded) are bounded by a memory budget, a worker waits for the uploads before
+ * starting an image which does not fit in the budget.
+ *
+ * The uploaded textures are held by the loader until releaseUploaded(), so that
+ * the materials can pick them up from the cache by path-name.
+ */
+class TextureLoader : public QObject
+{
+    Q_OBJECT
+public:
+    explicit TextureLoader(QObject *parent = nullptr);
+    ~TextureLoader();
+
+    /**
+     * @brief the cache to put the textures into (should be set before uploading)
+     */
+    void setTextureCache(TextureCache *textureCache);
+
+    /**
+     * @brief upper bound of the memory taken by the decoded images in flight, in bytes
+     *        (512 MB by default, an image larger than the budget is decoded alone)
+     */
+    qint64 memoryBudget() const;
+    void setMemoryBudget(qint64 bytes);
+
+    /**
+     * @brief request to decode image files (can be called in any thread)
+     *
+     * The files already cached or requested are skipped.
+     *
+     * @param imageFilePaths the full path-names of the image files
+     */
+    void request(QStringList const &imageFilePaths);
+
+    /**
+     * @brief whether an image file is requested but not uploaded yet
+     *        (no access to the file system, cheap enough to be called per frame)
+     *
+     * @param canonicalPath the canonical path-name of the image file, see QFileInfo::canonicalFilePath()
+     */
+    bool isPending(QString const &canonicalPath) const;
+
+    /**
+     * @brief upload the decoded images into the texture cache
+     *        (the OpenGL context should be current)
+     * @return number of textures uploaded
+     */
+    int uploadDecoded();
+
+    /**
+     * @brief wait until all the requested images are decoded and uploaded
+     *        (the OpenGL context should be current)
+     */
+    void finish();
+
+    /**
+     * @brief drop the references to the uploaded textures
+     *        (the OpenGL context should be current)
+     */
+    void releaseUploaded();
+
+    /**
+     * @brief drop the pending requests and the images not uploaded yet
+     */
+    void cancel();
+
+signals:
+    /**
+     * @brief emitted from a worker thread when the queue of decoded images becomes non-empty
+     */
+    void imageDecoded();
+
+private:
+    void decodeImage(QString const &canonicalPath, unsigned int generation);
+
+private:
+    struct DecodedImage
+    {
+        TextureImage textureImage;
+        qint64 reservedBytes = 0;
+    };
+
+    QThreadPool mThreadPool;
+    TextureCache *mTextureCache;
+    mutable QMutex mMutex;                      ///< guards the members below
+    QWaitCondition mCondition;                  ///< signaled when a job finishes or the budget is released
+    QSet<QString> mRequested;                   ///< canonical path-names being decoded or waiting for uploading
+    std::deque<DecodedImage> mDecoded;          ///< decoded images waiting for uploading
+    int mPendingJobs;                           ///< number of requested images not decoded yet
+    qint64 mMemoryBudget;
+    qint64 mMemoryInFlight;
+    unsigned int mGeneration;                   ///< increased by cancel() to drop the pending requests
+    std::vector<OpenGLTexturePtr> mUploaded;    ///< only accessed in the OpenGL context thread
+};
+
+#endif // TEXTURELOADER_H
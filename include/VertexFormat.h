@@ -0,0 +1,122 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include <cstddef>
+
+struct aiMesh;
+
+/**
+ * @brief layouts of the interleaved vertex data
+ */
+enum VertexLayout
+{
+    VERTEX_LAYOUT_FLOAT,        ///< 32-bit floats for all the attributes, see interleave_mesh_vertices()
+    VERTEX_LAYOUT_COMPACT       ///< quantized attributes, see write_compact_mesh_vertices()
+};
+
+/**
+ * @brief number of floats per vertex of the interleaved data of a mesh
+ *
+ * The interleaved vertex contains position (3), normal (3, if any) and the
+ * texture coordinates of each UV channel (with its own number of components).
+ *
+ * @param mesh the mesh imported by assimp
+ * @return the number of floats per vertex
+ */
+unsigned int interleaved_components(aiMesh const *mesh);
+
+/**
+ * @brief interleave the vertex attributes of the mesh into the given buffer
+ *
+ * The normals are normalized on the fly (the mesh itself is not modified, thus
+ * different meshes can be processed concurrently). SSE is used when available.
+ * The destination can be any writable memory, e.g. a mapped OpenGL buffer.
+ *
+ * @param mesh the mesh imported by assimp
+ * @param dst the destination, with room for mNumVertices*interleaved_components(mesh) floats
+ */
+void interleave_mesh_vertices(aiMesh const *mesh, float *dst);
+
+/**
+ * @brief interleave the vertices of the mesh picked by a remap table into the given buffer
+ *
+ * The i-th vertex written is the vertex vertexRemap[i] of the mesh, e.g. to gather
+ * the vertices of reordered or split meshes without an intermediate copy.
+ *
+ * @param mesh the mesh imported by assimp
+ * @param vertexRemap the source vertex of each vertex written
+ * @param vertexNumber number of the entries of vertexRemap
+ * @param dst the destination, with room for vertexNumber*interleaved_components(mesh) floats
+ */
+void interleave_mesh_vertices(aiMesh const *mesh, unsigned int const *vertexRemap, unsigned int vertexNumber, float *dst);
+
+/**
+ * @brief number of bytes per vertex of the compact vertex data of a mesh
+ */
+unsigned int compact_vertex_stride(aiMesh const *mesh);
+
+/**
+ * @brief number of bytes per vertex needed by the attributes in the given layout,
+ *        e.g. to check the stride of vertex data from elsewhere (the mesh cache)
+ *
+ * @param layout the layout of the interleaved vertex
+ * @param hasNormal whether the vertex contains normal
+ * @param textureComponents number of components of each texture coordinates channel
+ * @param textureChannels number of the texture coordinates channels
+ */
+unsigned int vertex_stride(VertexLayout layout, bool hasNormal, unsigned int const *textureComponents, unsigned int textureChannels);
+
+/**
+ * @brief offset in bytes of the texture coordinates in the compact vertex
+ */
+unsigned int compact_texcoord_offset(bool hasNormal);
+
+/**
+ * @brief write the vertex attributes of the mesh into the given buffer in the compact layout
+ *
+ * The compact vertex contains
+ *  - position: 4 unsigned shorts normalized within the bounds of the mesh (the 4th is padding),
+ *    i.e. position = (xmin, ymin, zmin) + q * (xmax-xmin, ymax-ymin, zmax-zmin)
+ *  - normal (if any): 2 shorts, the octahedral encoding of the unit normal in signed normalized form
+ *  - the texture coordinates of each UV channel: half floats, padded to a multiple of 4 bytes
+ *
+ * @param mesh the mesh imported by assimp
+ * @param bounds the bounds of the vertices (xmin, xmax, ymin, ymax, zmin, zmax)
+ * @param dst the destination, with room for mNumVertices*compact_vertex_stride(mesh) bytes
+ */
+void write_compact_mesh_vertices(aiMesh const *mesh, float const bounds[6], void *dst);
+
+/**
+ * @brief write the vertices of the mesh picked by a remap table in the compact layout,
+ *        see interleave_mesh_vertices() with a remap table
+ */
+void write_compact_mesh_vertices(aiMesh const *mesh, unsigned int const *vertexRemap, unsigned int vertexNumber,
+                                 float const bounds[6], void *dst);
+
+/**
+ * @brief convert a float into a half float (rounded to nearest even)
+ */
+unsigned short float_to_half(float value);
+
+#endif // VERTEXFORMAT_H
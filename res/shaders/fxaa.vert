@@ -0,0 +1,14 @@
+#version 330
+
+// the lower left part of the source covered by the frame
+uniform vec2 sourceExtent;
+
+// a triangle covering the whole viewport
+layout(location = 0) in vec2 position;
+
+out vec2 fragTexCoord;
+
+void main() {
+    fragTexCoord = (position * 0.5 + 0.5) * sourceExtent;
+    gl_Position = vec4(position, 0.0, 1.0);
+}
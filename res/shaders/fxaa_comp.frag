@@ -0,0 +1,49 @@
+// single-pass approximation of FXAA: the edges found by the luma gradient are
+// blurred along their direction, unless the blur takes in another edge
+uniform sampler2D sourceTexture;
+uniform mediump vec2 sourceExtent;
+uniform mediump vec2 texelSize;
+
+varying mediump vec2 fragTexCoord;
+
+#define FXAA_REDUCE_MIN (1.0/128.0)
+#define FXAA_REDUCE_MUL (1.0/8.0)
+#define FXAA_SPAN_MAX 8.0
+#define FXAA_EDGE_THRESHOLD (1.0/8.0)
+#define FXAA_EDGE_THRESHOLD_MIN (1.0/32.0)
+
+mediump vec3 fetch(mediump vec2 texCoord) {
+    // not beyond the part covered by the frame
+    return texture2D(sourceTexture, clamp(texCoord, 0.5 * texelSize, sourceExtent - 0.5 * texelSize)).rgb;
+}
+
+mediump float luma(mediump vec3 color) {
+    return dot(color, vec3(0.299, 0.587, 0.114));
+}
+
+void main() {
+    mediump vec4 colorM = texture2D(sourceTexture, fragTexCoord);
+    mediump float lumaM = luma(colorM.rgb);
+    mediump float lumaNW = luma(fetch(fragTexCoord + vec2(-1.0, -1.0) * texelSize));
+    mediump float lumaNE = luma(fetch(fragTexCoord + vec2(1.0, -1.0) * texelSize));
+    mediump float lumaSW = luma(fetch(fragTexCoord + vec2(-1.0, 1.0) * texelSize));
+    mediump float lumaSE = luma(fetch(fragTexCoord + vec2(1.0, 1.0) * texelSize));
+    mediump float lumaMin = min(lumaM, min(min(lumaNW, lumaNE), min(lumaSW, lumaSE)));
+    mediump float lumaMax = max(lumaM, max(max(lumaNW, lumaNE), max(lumaSW, lumaSE)));
+    if (lumaMax - lumaMin < max(FXAA_EDGE_THRESHOLD_MIN, lumaMax * FXAA_EDGE_THRESHOLD)) {
+        gl_FragColor = colorM;
+        return;
+    }
+
+    mediump vec2 dir = vec2(-((lumaNW + lumaNE) - (lumaSW + lumaSE)), (lumaNW + lumaSW) - (lumaNE + lumaSE));
+    mediump float dirReduce = max((lumaNW + lumaNE + lumaSW + lumaSE) * (0.25 * FXAA_REDUCE_MUL), FXAA_REDUCE_MIN);
+    mediump float rcpDirMin = 1.0 / (min(abs(dir.x), abs(dir.y)) + dirReduce);
+    dir = clamp(dir * rcpDirMin, vec2(-FXAA_SPAN_MAX), vec2(FXAA_SPAN_MAX)) * texelSize;
+
+    mediump vec3 colorA = 0.5 * (fetch(fragTexCoord + dir * (1.0/3.0 - 0.5)) +
+                                 fetch(fragTexCoord + dir * (2.0/3.0 - 0.5)));
+    mediump vec3 colorB = colorA * 0.5 + 0.25 * (fetch(fragTexCoord - dir * 0.5) +
+                                                 fetch(fragTexCoord + dir * 0.5));
+    mediump float lumaB = luma(colorB);
+    gl_FragColor = vec4((lumaB < lumaMin || lumaB > lumaMax) ? colorA : colorB, colorM.a);
+}
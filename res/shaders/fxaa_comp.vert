@@ -0,0 +1,10 @@
+uniform vec2 sourceExtent;
+
+attribute vec2 positionIn;
+
+varying vec2 fragTexCoord;
+
+void main() {
+    fragTexCoord = (positionIn * 0.5 + 0.5) * sourceExtent;
+    gl_Position = vec4(positionIn, 0.0, 1.0);
+}
@@ -0,0 +1,13 @@
+// shared by the vertex shaders of the Phong programs, prepended when they are loaded
+
+uniform bool normalEncoded;
+
+// normals in the compact vertex layout are octahedral encoded (xy only)
+vec3 decodeNormal(vec3 n) {
+    if (!normalEncoded) return n;
+    vec3 v = vec3(n.xy, 1.0 - abs(n.x) - abs(n.y));
+    if (v.z < 0.0) {
+        v.xy = (1.0 - abs(v.yx)) * vec2(v.x >= 0.0 ? 1.0 : -1.0, v.y >= 0.0 ? 1.0 : -1.0);
+    }
+    return normalize(v);
+}
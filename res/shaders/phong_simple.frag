@@ -1,14 +1,20 @@
 #version 330
 
-uniform vec4 lightPosition;
-uniform vec4 lightAmbient;
-uniform vec4 lightDiffuse;
-uniform vec4 lightSpecular;
-uniform vec4 materialAmbient;
-uniform vec4 materialDiffuse;
-uniform vec4 materialEmission;
-uniform vec4 materialSpecular;
-uniform float materialShininess;
+layout(std140) uniform FrameData {
+    mat4 projectionMatrix;
+    vec4 lightPosition;
+    vec4 lightAmbient;
+    vec4 lightDiffuse;
+    vec4 lightSpecular;
+};
+
+layout(std140) uniform MaterialData {
+    vec4 materialAmbient;
+    vec4 materialDiffuse;
+    vec4 materialEmission;
+    vec4 materialSpecular;
+    float materialShininess;
+};
 
 in highp vec4 fragVertex;
 in highp vec3 fragNormal;
@@ -1,6 +1,13 @@
 #version 330
 
-uniform mat4 projectionMatrix;
+layout(std140) uniform FrameData {
+    mat4 projectionMatrix;
+    vec4 lightPosition;
+    vec4 lightAmbient;
+    vec4 lightDiffuse;
+    vec4 lightSpecular;
+};
+
 uniform mat4 modelViewMatrix;
 uniform mat3 normalMatrix;
 
@@ -10,8 +17,9 @@ layout(location = 1) in vec3 normal;
 out vec4 fragVertex;
 out vec3 fragNormal;
 
+// decodeNormal() and normalEncoded come from normal_decode.glsl, prepended when loaded
 void main() {
     fragVertex = modelViewMatrix * vec4(vertex, 1.0);
     gl_Position = projectionMatrix * fragVertex;
-    fragNormal = normalMatrix * normal;
+    fragNormal = normalMatrix * decodeNormal(normal);
 }
@@ -8,8 +8,9 @@ attribute vec3 normalIn; // name "normal" may cause problem on macOS + Qt 5.9.2
 varying vec4 fragVertex;
 varying vec3 fragNormal;
 
+// decodeNormal() and normalEncoded come from normal_decode.glsl, prepended when loaded
 void main() {
     fragVertex = modelViewMatrix * vec4(positionIn, 1.0);
     gl_Position = projectionMatrix * fragVertex;
-    fragNormal = normalMatrix * normalIn;
+    fragNormal = normalMatrix * decodeNormal(normalIn);
 }
@@ -0,0 +1,30 @@
+#version 330
+
+layout(std140) uniform FrameData {
+    mat4 projectionMatrix;
+    vec4 lightPosition;
+    vec4 lightAmbient;
+    vec4 lightDiffuse;
+    vec4 lightSpecular;
+};
+
+// the view transform, the model transforms come with the instances
+uniform mat4 modelViewMatrix;
+uniform mat3 normalMatrix;
+// dequantization of the positions in the compact vertex layout
+uniform mat4 positionMatrix;
+
+layout(location = 0) in vec3 vertex;
+layout(location = 1) in vec3 normal;
+layout(location = 5) in mat4 instanceMatrix;
+layout(location = 9) in mat3 instanceNormalMatrix;
+
+out vec4 fragVertex;
+out vec3 fragNormal;
+
+// decodeNormal() and normalEncoded come from normal_decode.glsl, prepended when loaded
+void main() {
+    fragVertex = modelViewMatrix * (instanceMatrix * (positionMatrix * vec4(vertex, 1.0)));
+    gl_Position = projectionMatrix * fragVertex;
+    fragNormal = normalMatrix * (instanceNormalMatrix * decodeNormal(normal));
+}
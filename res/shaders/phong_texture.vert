@@ -1,7 +1,14 @@
 #version 330
 
+layout(std140) uniform FrameData {
+    mat4 projectionMatrix;
+    vec4 lightPosition;
+    vec4 lightAmbient;
+    vec4 lightDiffuse;
+    vec4 lightSpecular;
+};
+
 uniform mat4 modelViewMatrix;
-uniform mat4 projectionMatrix;
 uniform mat3 normalMatrix;
 
 layout(location = 0) in vec3 positionIn;
@@ -12,9 +19,10 @@ out vec4 fragVertex;
 out vec3 fragNormal;
 out vec2 fragTexCoord;
 
+// decodeNormal() and normalEncoded come from normal_decode.glsl, prepended when loaded
 void main() {
     fragVertex = modelViewMatrix * vec4(positionIn, 1.0);
     gl_Position = projectionMatrix * fragVertex;
-    fragNormal = normalMatrix * normalIn;
+    fragNormal = normalMatrix * decodeNormal(normalIn);
     fragTexCoord = texCoordIn;
 }
@@ -10,9 +10,10 @@ varying vec4 fragVertex;
 varying vec3 fragNormal;
 varying vec2 fragTexCoord;
 
+// decodeNormal() and normalEncoded come from normal_decode.glsl, prepended when loaded
 void main() {
     fragVertex = modelViewMatrix * vec4(positionIn, 1.0);
     gl_Position = projectionMatrix * fragVertex;
-    fragNormal = normalMatrix * normalIn;
+    fragNormal = normalMatrix * decodeNormal(normalIn);
     fragTexCoord = texCoordIn;
 }
@@ -0,0 +1,201 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "BatchRenderer.h"
+#include "LogUtils.h"
+
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <QtConcurrent>
+
+BatchRenderer::BatchRenderer(QObject *parent) : QObject(parent)
+{
+    mOutputDir = QDir::currentPath();
+    mImageSize = QSize(512, 512);
+    mImageFormat = "png";
+    CameraPreset front = { "front", 0.0f, 0.0f };
+    mCameraPresets.push_back(front);
+    mNextFile = 0;
+    mRenderedNumber = 0;
+
+    mSceneWidget = new SceneWidget;
+    // rendered into the framebuffer object of the widget, which is never on screen
+    mSceneWidget->setAttribute(Qt::WA_DontShowOnScreen);
+    // the whole scene with its textures in each image, at the full resolution
+    mSceneWidget->setStreamingEnabled(false);
+    mSceneWidget->setDynamicResolutionEnabled(false);
+    connect(mSceneWidget, &SceneWidget::sceneLoaded, this, &BatchRenderer::onSceneLoaded);
+    connect(mSceneWidget, &SceneWidget::sceneLoadFailed, this, &BatchRenderer::onSceneLoadFailed);
+}
+
+BatchRenderer::~BatchRenderer()
+{
+    this->collectWrites(true);
+    delete mSceneWidget;
+}
+
+bool BatchRenderer::parseCameraPresets(QString const &text, std::vector<CameraPreset> &presets)
+{
+    static CameraPreset const NAMED_PRESETS[] = {
+        { "front", 0.0f, 0.0f },
+        { "back", 180.0f, 0.0f },
+        { "left", 90.0f, 0.0f },
+        { "right", -90.0f, 0.0f },
+        { "top", 0.0f, 90.0f },
+        { "bottom", 0.0f, -90.0f },
+        { "iso", -45.0f, 30.0f }
+    };
+
+    presets.clear();
+    QStringList items = text.split(',');
+    for (QString item : items) {
+        item = item.trimmed();
+        if (item.isEmpty()) continue;
+        bool found = false;
+        for (CameraPreset const &named : NAMED_PRESETS) {
+            if (item.compare(named.name, Qt::CaseInsensitive) == 0) {
+                presets.push_back(named);
+                found = true;
+                break;
+            }
+        }
+        if (found) continue;
+
+        QStringList angles = item.split(':');
+        bool yawValid = false, pitchValid = false;
+        CameraPreset preset;
+        preset.yaw = angles.size() == 2 ? angles[0].toFloat(&yawValid) : 0.0f;
+        preset.pitch = angles.size() == 2 ? angles[1].toFloat(&pitchValid) : 0.0f;
+        if (!yawValid || !pitchValid) return false;
+        preset.name = QString("%1_%2").arg(angles[0]).arg(angles[1]);
+        presets.push_back(preset);
+    }
+    return !presets.empty();
+}
+
+bool BatchRenderer::parseAntiAliasing(QString const &text, SceneWidget::AntiAliasing &mode)
+{
+    static char const * const NAMES[] = { "off", "msaa2", "msaa4", "msaa8", "msaa16", "fxaa" };
+    for (int i = 0; i < static_cast<int>(sizeof(NAMES)/sizeof(NAMES[0])); ++i) {
+        if (text.compare(NAMES[i], Qt::CaseInsensitive) == 0) {
+            mode = static_cast<SceneWidget::AntiAliasing>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void BatchRenderer::start()
+{
+    mNextFile = 0;
+    mRenderedNumber = 0;
+    mFailedFiles.clear();
+    mTimer.start();
+    if (!QDir().mkpath(mOutputDir)) {
+        LOG_ERROR_QSTRING(tr("Fail to create the output directory %1").arg(mOutputDir));
+        mFailedFiles = mInputFiles;
+        emit finished(this->failedNumber());
+        return;
+    }
+
+    // initialized and resized by showing, the images are grabbed at this size
+    mSceneWidget->resize(mImageSize);
+    mSceneWidget->show();
+    if (!this->loadNext()) this->finish();
+}
+
+bool BatchRenderer::loadNext()
+{
+    if (mNextFile >= mInputFiles.size()) return false;
+    mSceneWidget->loadSceneFromFile(mInputFiles[mNextFile++]);
+    return true;
+}
+
+void BatchRenderer::onSceneLoaded(QString const &pathName)
+{
+    // the next one is loaded in the background while this one is rendered
+    bool loading = this->loadNext();
+    this->renderScene(pathName);
+    this->collectWrites(false);
+    if (!loading) this->finish();
+}
+
+void BatchRenderer::onSceneLoadFailed(QString const &pathName)
+{
+    LOG_ERROR_QSTRING(tr("Fail to load scene from %1, no images rendered").arg(pathName));
+    if (!mFailedFiles.contains(pathName)) mFailedFiles.append(pathName);
+    if (!this->loadNext()) this->finish();
+}
+
+void BatchRenderer::renderScene(QString const &pathName)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QDir outputDir(mOutputDir);
+    QString baseName = QFileInfo(pathName).completeBaseName();
+    for (CameraPreset const &preset : mCameraPresets) {
+        mSceneWidget->resetView(preset.yaw, preset.pitch);
+        // drawn by paintGL() and read back from the framebuffer object
+        QImage image = mSceneWidget->grabFramebuffer();
+        if (image.isNull()) {
+            LOG_ERROR_QSTRING(tr("Fail to render %1 from view %2").arg(pathName).arg(preset.name));
+            if (!mFailedFiles.contains(pathName)) mFailedFiles.append(pathName);
+            continue;
+        }
+
+        QString imageFilePath = outputDir.filePath(QString("%1_%2.%3").arg(baseName).arg(preset.name).arg(mImageFormat));
+        ImageWrite write;
+        write.sceneFilePath = pathName;
+        write.result = QtConcurrent::run([image, imageFilePath]() -> bool {
+            return image.save(imageFilePath);
+        });
+        mWrites.push_back(write);
+    }
+    ++mRenderedNumber;
+    LOG_INFO_QSTRING(tr("Rendered %1 from %2 views in %3 ms (%4 of %5)").arg(pathName).arg(mCameraPresets.size())
+                     .arg(timer.elapsed()).arg(mRenderedNumber).arg(mInputFiles.size()));
+}
+
+void BatchRenderer::collectWrites(bool wait)
+{
+    std::vector<ImageWrite> pending;
+    for (ImageWrite &write : mWrites) {
+        if (!wait && !write.result.isFinished()) {
+            pending.push_back(write);
+            continue;
+        }
+        if (!write.result.result()) {
+            LOG_ERROR_QSTRING(tr("Fail to write an image of %1").arg(write.sceneFilePath));
+            if (!mFailedFiles.contains(write.sceneFilePath)) mFailedFiles.append(write.sceneFilePath);
+        }
+    }
+    mWrites.swap(pending);
+}
+
+void BatchRenderer::finish()
+{
+    this->collectWrites(true);
+    mSceneWidget->hide();
+    LOG_INFO_QSTRING(tr("Batch rendering of %1 files finished in %2 s, %3 failed").arg(mInputFiles.size())
+                     .arg(mTimer.elapsed() / 1000.0, 0, 'f', 1).arg(this->failedNumber()));
+    emit finished(this->failedNumber());
+}
@@ -0,0 +1,414 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "BoundingVolumeHierarchy.h"
+#include "Frustum.h"
+
+#include <QtConcurrent/QtConcurrentRun>
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+
+#define BVH_BIN_NUMBER 16
+#define BVH_MAX_SAH_DEPTH 48            // median splits beyond, to bound the depth
+#define BVH_PARALLEL_THRESHOLD 16384    // subtrees with more primitives are built in parallel
+
+namespace {
+
+inline void set_empty_bounds(float *bounds)
+{
+    bounds[0] = bounds[2] = bounds[4] = std::numeric_limits<float>::max();
+    bounds[1] = bounds[3] = bounds[5] = -std::numeric_limits<float>::max();
+}
+
+inline void merge_bounds(float *bounds, float const *other)
+{
+    for (int i=0; i<6; i+=2) {
+        if (other[i] < bounds[i]) bounds[i] = other[i];
+        if (other[i+1] > bounds[i+1]) bounds[i+1] = other[i+1];
+    }
+}
+
+inline float half_surface_area(float const *bounds)
+{
+    if (bounds[0] > bounds[1]) return 0.0f;
+    float dx = bounds[1]-bounds[0], dy = bounds[3]-bounds[2], dz = bounds[5]-bounds[4];
+    return dx*dy + dy*dz + dz*dx;
+}
+
+inline bool overlaps(float const *a, float const *b)
+{
+    return a[0] <= b[1] && a[1] >= b[0] && a[2] <= b[3] && a[3] >= b[2] && a[4] <= b[5] && a[5] >= b[4];
+}
+
+/**
+ * @brief slab test of the ray against the box
+ * @return whether the box is hit within [0, maxDistance], with the entering distance in near
+ */
+inline bool intersect_ray(glm::vec3 const &origin, glm::vec3 const &invDir, float const *bounds, float maxDistance, float &near)
+{
+    float t0 = 0.0f, t1 = maxDistance;
+    for (int i=0; i<3; ++i) {
+        float tn = (bounds[i*2] - origin[i]) * invDir[i];
+        float tf = (bounds[i*2+1] - origin[i]) * invDir[i];
+        if (tn > tf) std::swap(tn, tf);
+        // NaN (the origin on a slab of a parallel axis) does not narrow the range
+        if (tn > t0) t0 = tn;
+        if (tf < t1) t1 = tf;
+        if (t0 > t1) return false;
+    }
+    near = t0;
+    return true;
+}
+
+inline glm::vec3 inverse_direction(glm::vec3 const &dir)
+{
+    float inf = std::numeric_limits<float>::infinity();
+    return glm::vec3(dir.x != 0.0f ? 1.0f/dir.x : inf,
+                     dir.y != 0.0f ? 1.0f/dir.y : inf,
+                     dir.z != 0.0f ? 1.0f/dir.z : inf);
+}
+
+struct Bin
+{
+    float bounds[6];
+    unsigned int count;
+};
+
+} // namespace
+
+BoundingVolumeHierarchy::BoundingVolumeHierarchy()
+{
+    set_empty_bounds(mBounds);
+}
+
+void BoundingVolumeHierarchy::build(float const *boxes, size_t primitiveNumber, unsigned int maxLeafSize)
+{
+    this->clear();
+    if (maxLeafSize < 1) maxLeafSize = 1;
+
+    mBoxes.assign(boxes, boxes+primitiveNumber*6);
+    std::vector<float> centroids(primitiveNumber*3);
+    mPrimitives.reserve(primitiveNumber);
+    for (size_t i=0; i<primitiveNumber; ++i) {
+        float const *box = boxes + i*6;
+        if (box[0] > box[1]) continue;
+        centroids[i*3] = (box[0]+box[1])*0.5f;
+        centroids[i*3+1] = (box[2]+box[3])*0.5f;
+        centroids[i*3+2] = (box[4]+box[5])*0.5f;
+        mPrimitives.push_back(static_cast<unsigned int>(i));
+    }
+    if (mPrimitives.empty()) return;
+
+    mNodes.reserve(mPrimitives.size()*2/maxLeafSize + 1);
+    this->buildRange(0, static_cast<unsigned int>(mPrimitives.size()), 0, centroids.data(), maxLeafSize, mNodes);
+
+    mNodeParents.assign(mNodes.size(), static_cast<unsigned int>(-1));
+    mPrimitiveLeaves.assign(primitiveNumber, static_cast<unsigned int>(-1));
+    for (size_t i=0; i<mNodes.size(); ++i) {
+        Node const &node = mNodes[i];
+        if (node.rightOffset > 0) {
+            mNodeParents[i+1] = static_cast<unsigned int>(i);
+            mNodeParents[i+node.rightOffset] = static_cast<unsigned int>(i);
+        } else {
+            for (unsigned int j=node.primitiveBegin; j<node.primitiveBegin+node.primitiveNumber; ++j) {
+                mPrimitiveLeaves[mPrimitives[j]] = static_cast<unsigned int>(i);
+            }
+        }
+    }
+    std::copy(mNodes[0].bounds, mNodes[0].bounds+6, mBounds);
+}
+
+void BoundingVolumeHierarchy::buildRange(unsigned int begin, unsigned int end, unsigned int depth, float const *centroids,
+                                         unsigned int maxLeafSize, std::vector<Node> &nodes)
+{
+    size_t nodeIndex = nodes.size();
+    nodes.emplace_back();
+
+    Node node;
+    node.primitiveBegin = begin;
+    node.primitiveNumber = end - begin;
+    node.rightOffset = 0;
+    float centroidBounds[6];
+    set_empty_bounds(node.bounds);
+    set_empty_bounds(centroidBounds);
+    for (unsigned int i=begin; i<end; ++i) {
+        unsigned int p = mPrimitives[i];
+        merge_bounds(node.bounds, &mBoxes[p*6]);
+        float const *c = centroids + p*3;
+        float cb[6] = {c[0], c[0], c[1], c[1], c[2], c[2]};
+        merge_bounds(centroidBounds, cb);
+    }
+
+    unsigned int count = end - begin;
+    if (count <= maxLeafSize) {
+        nodes[nodeIndex] = node;
+        return;
+    }
+
+    // binned SAH, the costs are relative to the area of the node
+    int bestAxis = -1;
+    unsigned int bestBin = 0;
+    float bestCost = std::numeric_limits<float>::max();
+    if (depth < BVH_MAX_SAH_DEPTH) {
+        for (int axis=0; axis<3; ++axis) {
+            float cmin = centroidBounds[axis*2];
+            float extent = centroidBounds[axis*2+1] - cmin;
+            if (!(extent > 0.0f)) continue;
+            float scale = BVH_BIN_NUMBER / extent;
+
+            Bin bins[BVH_BIN_NUMBER];
+            for (Bin &bin : bins) {
+                set_empty_bounds(bin.bounds);
+                bin.count = 0;
+            }
+            for (unsigned int i=begin; i<end; ++i) {
+                unsigned int p = mPrimitives[i];
+                unsigned int b = std::min(static_cast<unsigned int>((centroids[p*3+axis] - cmin) * scale), BVH_BIN_NUMBER-1u);
+                merge_bounds(bins[b].bounds, &mBoxes[p*6]);
+                ++bins[b].count;
+            }
+
+            float rightAreas[BVH_BIN_NUMBER];
+            unsigned int rightCounts[BVH_BIN_NUMBER];
+            float bounds[6];
+            set_empty_bounds(bounds);
+            unsigned int n = 0;
+            for (unsigned int b=BVH_BIN_NUMBER-1; b>0; --b) {
+                merge_bounds(bounds, bins[b].bounds);
+                n += bins[b].count;
+                rightAreas[b] = half_surface_area(bounds);
+                rightCounts[b] = n;
+            }
+            set_empty_bounds(bounds);
+            n = 0;
+            for (unsigned int b=0; b<BVH_BIN_NUMBER-1; ++b) {
+                merge_bounds(bounds, bins[b].bounds);
+                n += bins[b].count;
+                if (n == 0 || rightCounts[b+1] == 0) continue;
+                float cost = half_surface_area(bounds)*n + rightAreas[b+1]*rightCounts[b+1];
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestBin = b;
+                }
+            }
+        }
+    }
+
+    float nodeArea = half_surface_area(node.bounds);
+    // traversal cost of 1 against a primitive test, stay a leaf if the split does not pay
+    if (bestAxis >= 0 && nodeArea > 0.0f && count <= maxLeafSize*4 && nodeArea + bestCost >= nodeArea*count) {
+        nodes[nodeIndex] = node;
+        return;
+    }
+
+    unsigned int mid;
+    if (bestAxis >= 0) {
+        float cmin = centroidBounds[bestAxis*2];
+        float scale = BVH_BIN_NUMBER / (centroidBounds[bestAxis*2+1] - cmin);
+        unsigned int *first = mPrimitives.data();
+        mid = static_cast<unsigned int>(std::partition(first+begin, first+end, [&](unsigned int p) {
+            return std::min(static_cast<unsigned int>((centroids[p*3+bestAxis] - cmin) * scale), BVH_BIN_NUMBER-1u) <= bestBin;
+        }) - first);
+    } else {
+        // coincident centroids (or too deep), split in halves along the widest axis
+        int axis = 0;
+        for (int i=1; i<3; ++i) {
+            if (centroidBounds[i*2+1]-centroidBounds[i*2] > centroidBounds[axis*2+1]-centroidBounds[axis*2]) axis = i;
+        }
+        mid = begin + count/2;
+        unsigned int *first = mPrimitives.data();
+        std::nth_element(first+begin, first+mid, first+end, [&](unsigned int a, unsigned int b) {
+            return centroids[a*3+axis] < centroids[b*3+axis];
+        });
+    }
+
+    if (count >= BVH_PARALLEL_THRESHOLD) {
+        // the ranges are disjoint, the right subtree goes into its own array to be appended
+        std::vector<Node> rightNodes;
+        QFuture<void> rightFuture = QtConcurrent::run([&]() {
+            this->buildRange(mid, end, depth+1, centroids, maxLeafSize, rightNodes);
+        });
+        this->buildRange(begin, mid, depth+1, centroids, maxLeafSize, nodes);
+        rightFuture.waitForFinished();
+        node.rightOffset = static_cast<unsigned int>(nodes.size() - nodeIndex);
+        nodes.insert(nodes.end(), rightNodes.begin(), rightNodes.end());
+    } else {
+        this->buildRange(begin, mid, depth+1, centroids, maxLeafSize, nodes);
+        node.rightOffset = static_cast<unsigned int>(nodes.size() - nodeIndex);
+        this->buildRange(mid, end, depth+1, centroids, maxLeafSize, nodes);
+    }
+    nodes[nodeIndex] = node;
+}
+
+void BoundingVolumeHierarchy::clear()
+{
+    mNodes.clear();
+    mPrimitives.clear();
+    mBoxes.clear();
+    mNodeParents.clear();
+    mPrimitiveLeaves.clear();
+    set_empty_bounds(mBounds);
+}
+
+void BoundingVolumeHierarchy::refit(float const *boxes, std::vector<unsigned int> const *changedPrimitives)
+{
+    if (mNodes.empty()) return;
+
+    // only the changed leaves and their ancestors, unless all of them are changed
+    std::vector<std::uint8_t> nodeChanged;
+    if (changedPrimitives) {
+        nodeChanged.assign(mNodes.size(), 0);
+        for (unsigned int p : *changedPrimitives) {
+            std::copy(boxes + p*6, boxes + p*6 + 6, &mBoxes[p*6]);
+            unsigned int n = mPrimitiveLeaves[p];
+            while (n != static_cast<unsigned int>(-1) && !nodeChanged[n]) {
+                nodeChanged[n] = 1;
+                n = mNodeParents[n];
+            }
+        }
+    } else {
+        mBoxes.assign(boxes, boxes + mBoxes.size());
+    }
+
+    // the children follow their parents
+    for (size_t i=mNodes.size(); i>0; --i) {
+        if (changedPrimitives && !nodeChanged[i-1]) continue;
+        Node &node = mNodes[i-1];
+        set_empty_bounds(node.bounds);
+        if (node.rightOffset > 0) {
+            merge_bounds(node.bounds, mNodes[i].bounds);
+            merge_bounds(node.bounds, mNodes[i-1+node.rightOffset].bounds);
+        } else {
+            for (unsigned int j=node.primitiveBegin; j<node.primitiveBegin+node.primitiveNumber; ++j) {
+                merge_bounds(node.bounds, &mBoxes[mPrimitives[j]*6]);
+            }
+        }
+    }
+    std::copy(mNodes[0].bounds, mNodes[0].bounds+6, mBounds);
+}
+
+void BoundingVolumeHierarchy::queryFrustum(Frustum const &frustum, std::vector<unsigned int> &primitives) const
+{
+    if (mNodes.empty()) return;
+    std::vector<unsigned int> stack(1, 0);
+    while (!stack.empty()) {
+        unsigned int n = stack.back();
+        stack.pop_back();
+        Node const &node = mNodes[n];
+        Frustum::Intersection result = frustum.classify(node.bounds);
+        if (result == Frustum::OUTSIDE) continue;
+        if (result == Frustum::INSIDE) {
+            primitives.insert(primitives.end(), mPrimitives.begin()+node.primitiveBegin,
+                              mPrimitives.begin()+node.primitiveBegin+node.primitiveNumber);
+        } else if (node.rightOffset > 0) {
+            stack.push_back(n + node.rightOffset);
+            stack.push_back(n + 1);
+        } else {
+            for (unsigned int j=node.primitiveBegin; j<node.primitiveBegin+node.primitiveNumber; ++j) {
+                if (frustum.intersects(&mBoxes[mPrimitives[j]*6])) primitives.push_back(mPrimitives[j]);
+            }
+        }
+    }
+}
+
+void BoundingVolumeHierarchy::queryBox(float const *bounds, std::vector<unsigned int> &primitives) const
+{
+    if (mNodes.empty()) return;
+    std::vector<unsigned int> stack(1, 0);
+    while (!stack.empty()) {
+        unsigned int n = stack.back();
+        stack.pop_back();
+        Node const &node = mNodes[n];
+        if (!overlaps(node.bounds, bounds)) continue;
+        if (node.rightOffset > 0) {
+            stack.push_back(n + node.rightOffset);
+            stack.push_back(n + 1);
+        } else {
+            for (unsigned int j=node.primitiveBegin; j<node.primitiveBegin+node.primitiveNumber; ++j) {
+                if (overlaps(&mBoxes[mPrimitives[j]*6], bounds)) primitives.push_back(mPrimitives[j]);
+            }
+        }
+    }
+}
+
+void BoundingVolumeHierarchy::queryRay(glm::vec3 const &origin, glm::vec3 const &direction, float maxDistance, std::vector<unsigned int> &primitives) const
+{
+    if (mNodes.empty()) return;
+    glm::vec3 invDir = inverse_direction(direction);
+    float near;
+    std::vector<unsigned int> stack(1, 0);
+    while (!stack.empty()) {
+        unsigned int n = stack.back();
+        stack.pop_back();
+        Node const &node = mNodes[n];
+        if (!intersect_ray(origin, invDir, node.bounds, maxDistance, near)) continue;
+        if (node.rightOffset > 0) {
+            stack.push_back(n + node.rightOffset);
+            stack.push_back(n + 1);
+        } else {
+            for (unsigned int j=node.primitiveBegin; j<node.primitiveBegin+node.primitiveNumber; ++j) {
+                if (intersect_ray(origin, invDir, &mBoxes[mPrimitives[j]*6], maxDistance, near)) primitives.push_back(mPrimitives[j]);
+            }
+        }
+    }
+}
+
+int BoundingVolumeHierarchy::raycast(glm::vec3 const &origin, glm::vec3 const &direction, float &distance,
+                                     std::function<bool (unsigned int, float &)> const &intersect) const
+{
+    if (mNodes.empty()) return -1;
+    glm::vec3 invDir = inverse_direction(direction);
+    int hit = -1;
+    float near;
+    // pairs of the node and its entering distance
+    std::vector<std::pair<unsigned int, float>> stack;
+    if (intersect_ray(origin, invDir, mNodes[0].bounds, distance, near)) stack.emplace_back(0, near);
+    while (!stack.empty()) {
+        unsigned int n = stack.back().first;
+        float nodeNear = stack.back().second;
+        stack.pop_back();
+        if (nodeNear > distance) continue;
+        Node const &node = mNodes[n];
+        if (node.rightOffset > 0) {
+            float leftNear, rightNear;
+            bool leftHit = intersect_ray(origin, invDir, mNodes[n+1].bounds, distance, leftNear);
+            bool rightHit = intersect_ray(origin, invDir, mNodes[n+node.rightOffset].bounds, distance, rightNear);
+            // the nearer one on the top
+            if (leftHit && rightHit && leftNear > rightNear) {
+                stack.emplace_back(n+1, leftNear);
+                stack.emplace_back(n+node.rightOffset, rightNear);
+            } else {
+                if (rightHit) stack.emplace_back(n+node.rightOffset, rightNear);
+                if (leftHit) stack.emplace_back(n+1, leftNear);
+            }
+        } else {
+            for (unsigned int j=node.primitiveBegin; j<node.primitiveBegin+node.primitiveNumber; ++j) {
+                unsigned int p = mPrimitives[j];
+                if (!intersect_ray(origin, invDir, &mBoxes[p*6], distance, near)) continue;
+                if (intersect(p, distance)) hit = static_cast<int>(p);
+            }
+        }
+    }
+    return hit;
+}
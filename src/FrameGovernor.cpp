@@ -0,0 +1,174 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "FrameGovernor.h"
+
+#include <QOpenGLExtraFunctions>
+
+#include <algorithm>
+#include <cmath>
+
+#define FRAME_TIME_SMOOTHING 0.25f     // weight of a new frame time in the moving average
+#define FRAME_TIME_TOLERANCE 0.1f      // relative to the target, within which the scale is kept
+#define SCALE_GAIN 0.5f                // fraction of the way to the expected scale per frame
+#define SCALE_STEP 0.0625f
+
+FrameGovernor::FrameGovernor()
+{
+    mTargetFrameTime = 1000.0f / 60.0f;
+    mMinScale = 0.25f;
+    mScale = 1.0f;
+    mFrameTime = 0.0f;
+    mFrameNumber = 0;
+}
+
+void FrameGovernor::setTargetFrameTime(float ms)
+{
+    mTargetFrameTime = std::max(ms, 1.0f);
+}
+
+void FrameGovernor::setMinScale(float scale)
+{
+    mMinScale = std::min(std::max(scale, SCALE_STEP), 1.0f);
+    mScale = std::max(mScale, mMinScale);
+}
+
+bool FrameGovernor::addFrameTime(float ms)
+{
+    if (!(ms > 0.0f)) return false;
+    mFrameTime = mFrameNumber == 0 ? ms : mFrameTime + (ms - mFrameTime) * FRAME_TIME_SMOOTHING;
+    ++mFrameNumber;
+    if (std::fabs(mFrameTime - mTargetFrameTime) <= mTargetFrameTime * FRAME_TIME_TOLERANCE) return false;
+
+    // the frame time goes with the number of pixels
+    float expected = mScale * std::sqrt(mTargetFrameTime / mFrameTime);
+    float scale = mScale + (expected - mScale) * SCALE_GAIN;
+    scale = std::round(scale / SCALE_STEP) * SCALE_STEP;
+    scale = std::min(std::max(scale, mMinScale), 1.0f);
+    if (scale == mScale) return false;
+
+    // the average is carried over to the new scale, to settle down without waiting for it
+    mFrameTime *= (scale * scale) / (mScale * mScale);
+    mScale = scale;
+    return true;
+}
+
+void FrameGovernor::restart()
+{
+    mFrameTime = 0.0f;
+    mFrameNumber = 0;
+}
+
+void FrameGovernor::reset()
+{
+    this->restart();
+    mScale = 1.0f;
+}
+
+FrameTimer::FrameTimer()
+{
+    mOpenGLContext = nullptr;
+    std::fill(mQueries, mQueries+FRAME_TIMER_QUERIES, 0);
+    mQueryBegin = 0;
+    mQueryNumber = 0;
+    mTiming = false;
+    mCpuTime = -1.0f;
+}
+
+FrameTimer::~FrameTimer()
+{
+    // the queries go with the context otherwise
+    if (mOpenGLContext && QOpenGLContext::currentContext() == mOpenGLContext) this->destroyGL();
+}
+
+void FrameTimer::initializeGL(QOpenGLContext *glCtx)
+{
+    this->destroyGL();
+    mOpenGLContext = glCtx;
+    // the timer queries of OpenGL ES come by other entry points (GL_EXT_disjoint_timer_query)
+    bool supported = !glCtx->isOpenGLES() &&
+                     (glCtx->format().version() >= qMakePair(3, 3) || glCtx->hasExtension("GL_ARB_timer_query"));
+    if (supported) {
+        glCtx->extraFunctions()->glGenQueries(FRAME_TIMER_QUERIES, mQueries);
+    }
+}
+
+void FrameTimer::destroyGL()
+{
+    if (mOpenGLContext && this->isGpuTimer()) {
+        mOpenGLContext->extraFunctions()->glDeleteQueries(FRAME_TIMER_QUERIES, mQueries);
+    }
+    std::fill(mQueries, mQueries+FRAME_TIMER_QUERIES, 0);
+    mQueryBegin = 0;
+    mQueryNumber = 0;
+    mTiming = false;
+    mCpuTime = -1.0f;
+}
+
+void FrameTimer::begin()
+{
+    mTiming = false;
+    if (this->isGpuTimer()) {
+        // all in flight, this frame is left out
+        if (mQueryNumber == FRAME_TIMER_QUERIES) return;
+        GLuint query = mQueries[(mQueryBegin + mQueryNumber) % FRAME_TIMER_QUERIES];
+        mOpenGLContext->extraFunctions()->glBeginQuery(GL_TIME_ELAPSED, query);
+    } else {
+        mCpuTimer.start();
+    }
+    mTiming = true;
+}
+
+void FrameTimer::end()
+{
+    if (!mTiming) return;
+    mTiming = false;
+    if (this->isGpuTimer()) {
+        mOpenGLContext->extraFunctions()->glEndQuery(GL_TIME_ELAPSED);
+        ++mQueryNumber;
+    } else {
+        mCpuTime = static_cast<float>(mCpuTimer.nsecsElapsed()) * 1.0e-6f;
+    }
+}
+
+bool FrameTimer::takeFrameTime(float &ms)
+{
+    if (!this->isGpuTimer()) {
+        if (mCpuTime < 0.0f) return false;
+        ms = mCpuTime;
+        mCpuTime = -1.0f;
+        return true;
+    }
+
+    if (mQueryNumber == 0) return false;
+    QOpenGLExtraFunctions *glFuncs = mOpenGLContext->extraFunctions();
+    GLuint query = mQueries[mQueryBegin];
+    GLuint available = 0;
+    glFuncs->glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available) return false;
+    // in nanoseconds, enough for the frames of up to 4 seconds
+    GLuint elapsed = 0;
+    glFuncs->glGetQueryObjectuiv(query, GL_QUERY_RESULT, &elapsed);
+    mQueryBegin = (mQueryBegin + 1) % FRAME_TIMER_QUERIES;
+    --mQueryNumber;
+    ms = static_cast<float>(elapsed) * 1.0e-6f;
+    return true;
+}
@@ -0,0 +1,80 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "Frustum.h"
+
+#include <cmath>
+
+Frustum::Frustum()
+{
+    this->setMatrix(glm::mat4x4(1.0f));
+}
+
+void Frustum::setMatrix(glm::mat4x4 const &mat)
+{
+    // the rows of the (column-major) matrix
+    glm::vec4 row0(mat[0][0], mat[1][0], mat[2][0], mat[3][0]);
+    glm::vec4 row1(mat[0][1], mat[1][1], mat[2][1], mat[3][1]);
+    glm::vec4 row2(mat[0][2], mat[1][2], mat[2][2], mat[3][2]);
+    glm::vec4 row3(mat[0][3], mat[1][3], mat[2][3], mat[3][3]);
+
+    mPlanes[0] = row3 + row0;
+    mPlanes[1] = row3 - row0;
+    mPlanes[2] = row3 + row1;
+    mPlanes[3] = row3 - row1;
+    mPlanes[4] = row3 + row2;
+    mPlanes[5] = row3 - row2;
+    for (glm::vec4 &p : mPlanes) {
+        float len = std::sqrt(p.x*p.x + p.y*p.y + p.z*p.z);
+        if (len > 0.0f) p /= len;
+    }
+}
+
+bool Frustum::intersects(float const *bounds) const
+{
+    if (bounds[0] > bounds[1]) return false; // empty
+    for (glm::vec4 const &p : mPlanes) {
+        // the corner farthest along the normal
+        float x = p.x > 0.0f ? bounds[1] : bounds[0];
+        float y = p.y > 0.0f ? bounds[3] : bounds[2];
+        float z = p.z > 0.0f ? bounds[5] : bounds[4];
+        if (p.x*x + p.y*y + p.z*z + p.w < 0.0f) return false;
+    }
+    return true;
+}
+
+Frustum::Intersection Frustum::classify(float const *bounds) const
+{
+    if (bounds[0] > bounds[1]) return OUTSIDE; // empty
+    Intersection result = INSIDE;
+    for (glm::vec4 const &p : mPlanes) {
+        float x = p.x > 0.0f ? bounds[1] : bounds[0];
+        float y = p.y > 0.0f ? bounds[3] : bounds[2];
+        float z = p.z > 0.0f ? bounds[5] : bounds[4];
+        if (p.x*x + p.y*y + p.z*z + p.w < 0.0f) return OUTSIDE;
+        // the corner nearest along the normal
+        x = p.x > 0.0f ? bounds[0] : bounds[1];
+        y = p.y > 0.0f ? bounds[2] : bounds[3];
+        z = p.z > 0.0f ? bounds[4] : bounds[5];
+        if (p.x*x + p.y*y + p.z*z + p.w < 0.0f) result = INTERSECTING;
+    }
+    return result;
+}
@@ -23,16 +23,50 @@
 #include "LogUtils.h"
 
 #include <QOpenGLShaderProgram>
+#include <QFile>
 //#include <QMessageBox>
 
 QString const SHADER_PATH = ":/shaders/";
 
-bool compile_shader_program(QString const &pn, QOpenGLShaderProgram *p, QString const &vs, QString const &fs)
+static bool read_shader_source(QString const &fileName, QByteArray &source)
+{
+    QFile file(SHADER_PATH+fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        LOG_ERROR_QSTRING(QString("Fail to open shader file %1!").arg(fileName));
+        return false;
+    }
+    source = file.readAll();
+    return true;
+}
+
+static bool add_vertex_shader(QOpenGLShaderProgram *p, QString const &vs, QStringList const &vsSnippets)
+{
+    if (vsSnippets.isEmpty()) return p->addShaderFromSourceFile(QOpenGLShader::Vertex, SHADER_PATH+vs);
+
+    QByteArray source, snippets;
+    if (!read_shader_source(vs, source)) return false;
+    for (QString const &snippet : vsSnippets) {
+        QByteArray snippetSource;
+        if (!read_shader_source(snippet, snippetSource)) return false;
+        snippets += snippetSource;
+        snippets += '\n';
+    }
+    // the #version directive must stay the first line
+    int pos = 0;
+    if (source.startsWith("#version")) {
+        pos = source.indexOf('\n');
+        pos = pos < 0 ? source.size() : pos+1;
+    }
+    source.insert(pos, snippets);
+    return p->addShaderFromSourceCode(QOpenGLShader::Vertex, source);
+}
+
+bool compile_shader_program(QString const &pn, QOpenGLShaderProgram *p, QString const &vs, QString const &fs, QStringList const &vsSnippets)
 {
     if (!p) return false;
 
     QString logtitle, logstr;
-    if (!p->addShaderFromSourceFile(QOpenGLShader::Vertex, SHADER_PATH+vs)) {
+    if (!add_vertex_shader(p, vs, vsSnippets)) {
         logtitle = QString("%1: Vertex Shader %2 Error").arg(pn).arg(vs);
         logstr =  p->log();
         //QMessageBox::critical(this, logtitle, logstr);
@@ -88,11 +122,11 @@ bool link_shader_program(QString const &pn, QOpenGLShaderProgram *p)
     return true;
 }
 
-bool initialize_shader_program(QString const &pn, QOpenGLShaderProgram *p, QString const &vs, QString const &fs)
+bool initialize_shader_program(QString const &pn, QOpenGLShaderProgram *p, QString const &vs, QString const &fs, QStringList const &vsSnippets)
 {
     if (!p) return false;
 
-    if (!compile_shader_program(pn, p, vs, fs)) return false;
+    if (!compile_shader_program(pn, p, vs, fs, vsSnippets)) return false;
     if (!link_shader_program(pn, p)) return false;
 
     LOG_INFO_QSTRING(QString("Shader program %1 (%2, %3) initialized successfully!").arg(pn).arg(vs).arg(fs));
@@ -100,11 +134,12 @@ bool initialize_shader_program(QString const &pn, QOpenGLShaderProgram *p, QStri
     return true;
 }
 
-bool initialize_shader_program_comp(const QString &pn, QOpenGLShaderProgram *p, const QString &vs, const QString &fs, std::function<void (QOpenGLShaderProgram *)> bindAttributes)
+bool initialize_shader_program_comp(const QString &pn, QOpenGLShaderProgram *p, const QString &vs, const QString &fs, std::function<void (QOpenGLShaderProgram *)> bindAttributes,
+                                    QStringList const &vsSnippets)
 {
     if (!p) return false;
 
-    if (!compile_shader_program(pn, p, vs, fs)) return false;
+    if (!compile_shader_program(pn, p, vs, fs, vsSnippets)) return false;
     if (bindAttributes) bindAttributes(p);
     if (!link_shader_program(pn, p)) return false;
 
@@ -0,0 +1,389 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "GeometryArena.h"
+#include "OpenGLRenderableEntity.h"
+#include "LogUtils.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLExtraFunctions>
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+
+#ifndef GL_HALF_FLOAT
+#define GL_HALF_FLOAT 0x140B // OpenGL 3.0, OpenGL ES 3.0
+#endif
+#ifndef GL_COPY_WRITE_BUFFER
+#define GL_COPY_WRITE_BUFFER 0x8F37 // OpenGL 3.1, OpenGL ES 3.0
+#endif
+
+// size of the buffers of a page (larger for a renderable not fitting in)
+static size_t const PAGE_VERTEX_BYTES = 32u << 20;
+static size_t const PAGE_INDEX_BYTES = 16u << 20;
+// the indices of both sizes share the index buffer
+static size_t const INDEX_ALIGNMENT = 4;
+
+void setup_vertex_attributes(QOpenGLFunctions *glFuncs, GeometryFormat const &format, const char *base)
+{
+    if (format.layout == VERTEX_LAYOUT_COMPACT) {
+        // dequantized by positionTransform(), the normals are decoded in the shaders
+        glFuncs->glEnableVertexAttribArray(VertexAttribute::POSITION);
+        glFuncs->glVertexAttribPointer(VertexAttribute::POSITION, 3, GL_UNSIGNED_SHORT, GL_TRUE, format.stride, base);
+        if (format.hasNormal) {
+            glFuncs->glEnableVertexAttribArray(VertexAttribute::NORMAL);
+            glFuncs->glVertexAttribPointer(VertexAttribute::NORMAL, 2, GL_SHORT, GL_TRUE, format.stride, base + 4*sizeof(unsigned short));
+        }
+        if (format.texCoordComponents > 0) {
+            glFuncs->glEnableVertexAttribArray(VertexAttribute::TEXCOORD);
+            glFuncs->glVertexAttribPointer(VertexAttribute::TEXCOORD, format.texCoordComponents, GL_HALF_FLOAT, GL_FALSE, format.stride, base + compact_texcoord_offset(format.hasNormal));
+        }
+    } else {
+        const float *floatBase = reinterpret_cast<const float*>(base);
+        glFuncs->glEnableVertexAttribArray(VertexAttribute::POSITION);
+        glFuncs->glVertexAttribPointer(VertexAttribute::POSITION, 3, GL_FLOAT, GL_FALSE, format.stride, floatBase);
+        glFuncs->glEnableVertexAttribArray(VertexAttribute::NORMAL);
+        glFuncs->glVertexAttribPointer(VertexAttribute::NORMAL, 3, GL_FLOAT, GL_FALSE, format.stride, floatBase + 3);
+        if (format.texCoordComponents > 0) {
+            glFuncs->glEnableVertexAttribArray(VertexAttribute::TEXCOORD);
+            glFuncs->glVertexAttribPointer(VertexAttribute::TEXCOORD, format.texCoordComponents, GL_FLOAT, GL_FALSE, format.stride, floatBase + 6);
+        }
+    }
+}
+
+void setup_instance_attributes(QOpenGLExtraFunctions *glFuncs, GLuint instanceBuffer, size_t instanceOffset)
+{
+    GLsizei stride = sizeof(RenderableInstance);
+    const char *modelBase = (const char*)0 + instanceOffset + offsetof(RenderableInstance, modelMatrix);
+    const char *normalBase = (const char*)0 + instanceOffset + offsetof(RenderableInstance, normalMatrix);
+    glFuncs->glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (GLuint c = 0; c < 4; ++c) {
+        glFuncs->glEnableVertexAttribArray(VertexAttribute::INSTANCE_MATRIX + c);
+        glFuncs->glVertexAttribPointer(VertexAttribute::INSTANCE_MATRIX + c, 4, GL_FLOAT, GL_FALSE, stride, modelBase + c*4*sizeof(float));
+        glFuncs->glVertexAttribDivisor(VertexAttribute::INSTANCE_MATRIX + c, 1);
+    }
+    for (GLuint c = 0; c < 3; ++c) {
+        glFuncs->glEnableVertexAttribArray(VertexAttribute::INSTANCE_NORMAL_MATRIX + c);
+        glFuncs->glVertexAttribPointer(VertexAttribute::INSTANCE_NORMAL_MATRIX + c, 3, GL_FLOAT, GL_FALSE, stride, normalBase + c*3*sizeof(float));
+        glFuncs->glVertexAttribDivisor(VertexAttribute::INSTANCE_NORMAL_MATRIX + c, 1);
+    }
+    glFuncs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+RangeAllocator::RangeAllocator(size_t capacity)
+{
+    mCapacity = capacity;
+    mFreeSize = capacity;
+    if (capacity > 0) mFreeRanges.emplace(0, capacity);
+}
+
+size_t RangeAllocator::allocate(size_t size, size_t alignment)
+{
+    if (size == 0) return INVALID_OFFSET;
+    for (std::map<size_t, size_t>::iterator it = mFreeRanges.begin(); it != mFreeRanges.end(); ++it) {
+        size_t rangeBegin = it->first;
+        size_t rangeEnd = it->first + it->second;
+        size_t offset = (rangeBegin + alignment - 1) / alignment * alignment;
+        if (offset + size > rangeEnd) continue;
+
+        // keep the parts of the range before and after the allocation
+        mFreeRanges.erase(it);
+        if (offset > rangeBegin) mFreeRanges.emplace(rangeBegin, offset - rangeBegin);
+        if (offset + size < rangeEnd) mFreeRanges.emplace(offset + size, rangeEnd - offset - size);
+        mFreeSize -= size;
+        return offset;
+    }
+    return INVALID_OFFSET;
+}
+
+void RangeAllocator::free(size_t offset, size_t size)
+{
+    if (size == 0) return;
+    mFreeSize += size;
+    std::map<size_t, size_t>::iterator next = mFreeRanges.lower_bound(offset);
+    // merge with the following range
+    if (next != mFreeRanges.end() && offset + size == next->first) {
+        size += next->second;
+        next = mFreeRanges.erase(next);
+    }
+    // merge with the preceding range
+    if (next != mFreeRanges.begin()) {
+        std::map<size_t, size_t>::iterator prev = std::prev(next);
+        if (prev->first + prev->second == offset) {
+            prev->second += size;
+            return;
+        }
+    }
+    mFreeRanges.emplace_hint(next, offset, size);
+}
+
+GeometryArena * GeometryArena::instance(QOpenGLContext const *glCtx)
+{
+    if (glCtx == nullptr) return nullptr;
+    QOpenGLContext *ctx = const_cast<QOpenGLContext *>(glCtx);
+    // owned by the context, the vertex array objects are not shared in the share group
+    GeometryArena *arena = ctx->findChild<GeometryArena *>(QString(), Qt::FindDirectChildrenOnly);
+    if (arena == nullptr) {
+        arena = new GeometryArena(ctx);
+        if (!arena->isSupported()) {
+            LOG_INFO("Draws with base vertex not supported, the geometry arena is not used.");
+        }
+    }
+    // the renderables take their own buffers otherwise
+    return arena->isSupported() ? arena : nullptr;
+}
+
+void GeometryArena::release(QOpenGLContext const *glCtx)
+{
+    if (glCtx == nullptr) return;
+    GeometryArena *arena = glCtx->findChild<GeometryArena *>(QString(), Qt::FindDirectChildrenOnly);
+    delete arena;
+}
+
+GeometryArena::GeometryArena(QOpenGLContext *glCtx) : QObject(glCtx)
+{
+    mOpenGLContext = glCtx;
+    mBoundVertexArray = 0;
+    mDrawElementsBaseVertex = nullptr;
+    mDrawElementsInstancedBaseVertex = nullptr;
+    mMultiDrawElementsIndirect = nullptr;
+
+    // OpenGL 3.2 or OpenGL ES 3.2
+    if (glCtx->format().version() >= qMakePair(3, 2)) {
+        mDrawElementsBaseVertex = reinterpret_cast<DrawElementsBaseVertexFunc>(glCtx->getProcAddress("glDrawElementsBaseVertex"));
+        mDrawElementsInstancedBaseVertex = reinterpret_cast<DrawElementsInstancedBaseVertexFunc>(glCtx->getProcAddress("glDrawElementsInstancedBaseVertex"));
+    }
+    // the per-draw data are fetched through the base instances
+    bool indirect = !glCtx->isOpenGLES() &&
+                    (glCtx->format().version() >= qMakePair(4, 3) ||
+                     (glCtx->hasExtension("GL_ARB_multi_draw_indirect") &&
+                      (glCtx->format().version() >= qMakePair(4, 2) || glCtx->hasExtension("GL_ARB_base_instance"))));
+    if (indirect) {
+        mMultiDrawElementsIndirect = reinterpret_cast<MultiDrawElementsIndirectFunc>(glCtx->getProcAddress("glMultiDrawElementsIndirect"));
+    }
+}
+
+GeometryArena::~GeometryArena()
+{
+    // the resources go with the context otherwise
+    if (QOpenGLContext::currentContext() == mOpenGLContext) this->destroyGL();
+}
+
+void GeometryArena::destroyGL()
+{
+    QOpenGLExtraFunctions *glFuncs = mOpenGLContext->extraFunctions();
+    for (Page &page : mPages) {
+        glFuncs->glDeleteVertexArrays(1, &page.vertexArray);
+        glFuncs->glDeleteBuffers(1, &page.vertexBuffer);
+        glFuncs->glDeleteBuffers(1, &page.indexBuffer);
+    }
+    mPages.clear();
+    mBoundVertexArray = 0;
+}
+
+int GeometryArena::createPage(GeometryFormat const &format, size_t vertexCapacity, size_t indexCapacity)
+{
+    QOpenGLExtraFunctions *glFuncs = mOpenGLContext->extraFunctions();
+    this->releaseVertexArray();
+
+    // drain the errors left by others, which would be taken for a failed allocation below
+    while (glFuncs->glGetError() != GL_NO_ERROR) {}
+
+    Page page;
+    page.format = format;
+    page.vertices = RangeAllocator(vertexCapacity);
+    page.indices = RangeAllocator(indexCapacity);
+    glFuncs->glGenBuffers(1, &page.vertexBuffer);
+    glFuncs->glGenBuffers(1, &page.indexBuffer);
+    glFuncs->glGenVertexArrays(1, &page.vertexArray);
+
+    glFuncs->glBindVertexArray(page.vertexArray);
+    glFuncs->glBindBuffer(GL_ARRAY_BUFFER, page.vertexBuffer);
+    glFuncs->glBufferData(GL_ARRAY_BUFFER, vertexCapacity*format.stride, nullptr, GL_STATIC_DRAW);
+    glFuncs->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, page.indexBuffer);
+    glFuncs->glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCapacity, nullptr, GL_STATIC_DRAW);
+    setup_vertex_attributes(glFuncs, format, nullptr);
+    glFuncs->glBindVertexArray(0);
+    glFuncs->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    if (glFuncs->glGetError() == GL_OUT_OF_MEMORY) {
+        glFuncs->glDeleteVertexArrays(1, &page.vertexArray);
+        glFuncs->glDeleteBuffers(1, &page.vertexBuffer);
+        glFuncs->glDeleteBuffers(1, &page.indexBuffer);
+        LOG_ERROR("Out of memory for the geometry arena!");
+        return -1;
+    }
+
+    mPages.push_back(page);
+    return static_cast<int>(mPages.size()) - 1;
+}
+
+bool GeometryArena::allocate(GeometryFormat const &format, unsigned int vertexNumber, size_t indexBytes, GeometryAllocation &allocation)
+{
+    this->free(allocation);
+    if (vertexNumber == 0 || indexBytes == 0 || format.stride == 0) return false;
+
+    for (size_t i = 0; i <= mPages.size(); ++i) {
+        int pageIndex = static_cast<int>(i);
+        if (i == mPages.size()) {
+            // no room in the pages of the format
+            size_t vertexCapacity = std::max(PAGE_VERTEX_BYTES / format.stride, static_cast<size_t>(vertexNumber));
+            size_t indexCapacity = std::max(PAGE_INDEX_BYTES, (indexBytes + INDEX_ALIGNMENT - 1) / INDEX_ALIGNMENT * INDEX_ALIGNMENT);
+            pageIndex = this->createPage(format, vertexCapacity, indexCapacity);
+            if (pageIndex < 0) return false;
+        }
+        Page &page = mPages[pageIndex];
+        if (!(page.format == format)) continue;
+        if (page.vertices.freeSize() < vertexNumber || page.indices.freeSize() < indexBytes) continue;
+
+        size_t vertexOffset = page.vertices.allocate(vertexNumber);
+        if (vertexOffset == RangeAllocator::INVALID_OFFSET) continue;
+        size_t indexOffset = page.indices.allocate(indexBytes, INDEX_ALIGNMENT);
+        if (indexOffset == RangeAllocator::INVALID_OFFSET) {
+            page.vertices.free(vertexOffset, vertexNumber);
+            continue;
+        }
+
+        allocation.page = pageIndex;
+        allocation.vertexOffset = static_cast<unsigned int>(vertexOffset);
+        allocation.vertexNumber = vertexNumber;
+        allocation.indexOffset = indexOffset;
+        allocation.indexBytes = indexBytes;
+        return true;
+    }
+    return false;
+}
+
+void GeometryArena::free(GeometryAllocation &allocation)
+{
+    if (!allocation.isValid()) return;
+    if (allocation.page < static_cast<int>(mPages.size())) {
+        Page &page = mPages[allocation.page];
+        page.vertices.free(allocation.vertexOffset, allocation.vertexNumber);
+        page.indices.free(allocation.indexOffset, allocation.indexBytes);
+    }
+    allocation = GeometryAllocation();
+}
+
+bool GeometryArena::writeVertices(GeometryAllocation const &allocation, std::function<void(void *)> const &writer)
+{
+    if (!allocation.isValid()) return false;
+    Page const &page = mPages[allocation.page];
+    QOpenGLExtraFunctions *glFuncs = mOpenGLContext->extraFunctions();
+    GLintptr offset = static_cast<GLintptr>(allocation.vertexOffset) * page.format.stride;
+    GLsizeiptr bytes = static_cast<GLsizeiptr>(allocation.vertexNumber) * page.format.stride;
+
+    // not through GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER, which may be in use by vertex array objects.
+    // Only the range of the allocation is mapped, but synchronized: a freed range goes back to the
+    // allocator at once, thus a reused one may still be read by the draws of the frames in flight.
+    glFuncs->glBindBuffer(GL_COPY_WRITE_BUFFER, page.vertexBuffer);
+    void *mapped = glFuncs->glMapBufferRange(GL_COPY_WRITE_BUFFER, offset, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+    bool written = false;
+    if (mapped) {
+        writer(mapped);
+        written = glFuncs->glUnmapBuffer(GL_COPY_WRITE_BUFFER) == GL_TRUE;
+    }
+    if (!written) {
+        // glMapBufferRange failed (or the mapped data got corrupted)
+        std::vector<unsigned char> vertexData(bytes);
+        writer(vertexData.data());
+        glFuncs->glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, vertexData.data());
+    }
+    glFuncs->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return true;
+}
+
+bool GeometryArena::writeIndices(GeometryAllocation const &allocation, void const *indices)
+{
+    if (!allocation.isValid()) return false;
+    Page const &page = mPages[allocation.page];
+    QOpenGLExtraFunctions *glFuncs = mOpenGLContext->extraFunctions();
+    glFuncs->glBindBuffer(GL_COPY_WRITE_BUFFER, page.indexBuffer);
+    glFuncs->glBufferSubData(GL_COPY_WRITE_BUFFER, allocation.indexOffset, allocation.indexBytes, indices);
+    glFuncs->glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    return true;
+}
+
+void GeometryArena::bindVertexArray(GeometryAllocation const &allocation)
+{
+    if (!allocation.isValid()) return;
+    GLuint vertexArray = mPages[allocation.page].vertexArray;
+    if (vertexArray == mBoundVertexArray) return;
+    mOpenGLContext->extraFunctions()->glBindVertexArray(vertexArray);
+    mBoundVertexArray = vertexArray;
+}
+
+void GeometryArena::releaseVertexArray()
+{
+    mOpenGLContext->extraFunctions()->glBindVertexArray(0);
+    mBoundVertexArray = 0;
+}
+
+void GeometryArena::drawElements(GeometryAllocation const &allocation, GLsizei indexCount, GLenum indexType, size_t indexOffset, GLint baseVertex, GLsizei instanceNumber)
+{
+    if (!allocation.isValid()) return;
+    const char *indices = (const char*)0 + allocation.indexOffset + indexOffset;
+    GLint base = static_cast<GLint>(allocation.vertexOffset) + baseVertex;
+    if (instanceNumber > 0) {
+        mDrawElementsInstancedBaseVertex(GL_TRIANGLES, indexCount, indexType, indices, instanceNumber, base);
+    } else {
+        mDrawElementsBaseVertex(GL_TRIANGLES, indexCount, indexType, indices, base);
+    }
+}
+
+void GeometryArena::multiDrawElementsIndirect(GLenum indexType, size_t commandOffset, GLsizei commandNumber)
+{
+    if (!mMultiDrawElementsIndirect || commandNumber <= 0) return;
+    mMultiDrawElementsIndirect(GL_TRIANGLES, indexType, (const char*)0 + commandOffset, commandNumber, 0);
+}
+
+DrawElementsIndirectCommand GeometryArena::indirectCommand(GeometryAllocation const &allocation, GLuint indexCount, unsigned int indexSize,
+                                                           GLuint firstIndex, GLint baseVertex, GLuint instanceNumber, GLuint baseInstance)
+{
+    // the index offsets are aligned for both sizes
+    DrawElementsIndirectCommand command;
+    command.count = indexCount;
+    command.instanceCount = instanceNumber;
+    command.firstIndex = static_cast<GLuint>(allocation.indexOffset / indexSize) + firstIndex;
+    command.baseVertex = static_cast<GLint>(allocation.vertexOffset) + baseVertex;
+    command.baseInstance = baseInstance;
+    return command;
+}
+
+size_t GeometryArena::capacityBytes() const
+{
+    size_t bytes = 0;
+    for (Page const &page : mPages) {
+        bytes += page.vertices.capacity()*page.format.stride + page.indices.capacity();
+    }
+    return bytes;
+}
+
+size_t GeometryArena::freeBytes() const
+{
+    size_t bytes = 0;
+    for (Page const &page : mPages) {
+        bytes += page.vertices.freeSize()*page.format.stride + page.indices.freeSize();
+    }
+    return bytes;
+}
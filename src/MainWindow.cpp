@@ -22,7 +22,10 @@
 #include "MainWindow.h"
 #include "./ui_MainWindow.h"
 
+#include <QActionGroup>
 #include <QFileDialog>
+#include <QLabel>
+#include <QProgressBar>
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent)
@@ -30,7 +33,34 @@ MainWindow::MainWindow(QWidget *parent)
 {
     ui->setupUi(this);
 
+    mLoadProgressBar = new QProgressBar(this);
+    mLoadProgressBar->setRange(0, 100);
+    mLoadProgressBar->setMaximumWidth(200);
+    mLoadProgressBar->hide();
+    ui->statusbar->addPermanentWidget(mLoadProgressBar);
+
+    mFrameLabel = new QLabel(this);
+    ui->statusbar->addPermanentWidget(mFrameLabel);
+
+    // in the order of SceneWidget::AntiAliasing
+    QStringList antiAliasingNames;
+    antiAliasingNames << tr("Off") << tr("MSAA 2x") << tr("MSAA 4x") << tr("MSAA 8x") << tr("MSAA 16x") << tr("FXAA");
+    QActionGroup *antiAliasingGroup = new QActionGroup(this);
+    for (int i = 0; i < antiAliasingNames.size(); ++i) {
+        QAction *action = ui->menuAntiAliasing->addAction(antiAliasingNames[i]);
+        action->setCheckable(true);
+        action->setChecked(i == ui->sceneWidget->antiAliasing());
+        action->setData(i);
+        antiAliasingGroup->addAction(action);
+    }
+
     this->connect(ui->actionFileOpen, SIGNAL(triggered()), this, SLOT(openFile()));
+    this->connect(ui->sceneWidget, SIGNAL(sceneLoadProgress(int,QString)), this, SLOT(updateLoadProgress(int,QString)));
+    this->connect(ui->sceneWidget, SIGNAL(sceneLoaded(QString)), this, SLOT(onSceneLoaded(QString)));
+    this->connect(ui->sceneWidget, SIGNAL(sceneLoadFailed(QString)), this, SLOT(onSceneLoadFailed(QString)));
+    this->connect(ui->sceneWidget, SIGNAL(entityPicked(QString,uint,QVector3D)), this, SLOT(onEntityPicked(QString,uint,QVector3D)));
+    this->connect(ui->sceneWidget, SIGNAL(frameRendered(float,float)), this, SLOT(onFrameRendered(float,float)));
+    this->connect(antiAliasingGroup, SIGNAL(triggered(QAction*)), this, SLOT(setAntiAliasing(QAction*)));
 }
 
 MainWindow::~MainWindow()
@@ -47,3 +77,42 @@ void MainWindow::openFile()
     ui->sceneWidget->loadSceneFromFile(fileName);
 }
 
+void MainWindow::updateLoadProgress(int percent, QString const &stage)
+{
+    mLoadProgressBar->setValue(percent);
+    mLoadProgressBar->show();
+    ui->statusbar->showMessage(stage);
+}
+
+void MainWindow::onSceneLoaded(QString const &pathName)
+{
+    mLoadProgressBar->hide();
+    ui->statusbar->showMessage(tr("Scene loaded from %1").arg(pathName), 5000);
+}
+
+void MainWindow::onSceneLoadFailed(QString const &pathName)
+{
+    mLoadProgressBar->hide();
+    ui->statusbar->showMessage(tr("Fail to load scene from %1").arg(pathName), 5000);
+}
+
+void MainWindow::onEntityPicked(QString const &name, unsigned int triangle, QVector3D const &position)
+{
+    ui->statusbar->showMessage(tr("Picked %1, triangle %2 at (%3, %4, %5)").arg(name).arg(triangle)
+                               .arg(position.x()).arg(position.y()).arg(position.z()), 5000);
+}
+
+void MainWindow::onFrameRendered(float frameTime, float renderScale)
+{
+    // the frame time is the smoothed one of the frames rendered while interacting
+    if (frameTime > 0.0f) {
+        mFrameLabel->setText(tr("%1 ms, resolution %2%").arg(frameTime, 0, 'f', 1).arg(qRound(renderScale * 100.0f)));
+    } else {
+        mFrameLabel->setText(tr("resolution %1%").arg(qRound(renderScale * 100.0f)));
+    }
+}
+
+void MainWindow::setAntiAliasing(QAction *action)
+{
+    ui->sceneWidget->setAntiAliasing(static_cast<SceneWidget::AntiAliasing>(action->data().toInt()));
+}
@@ -0,0 +1,699 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "MeshCache.h"
+#include "SceneLoader.h"
+#include "LogUtils.h"
+#include "OpenGLMaterialEntity.h"
+#include "OpenGLRenderableEntity.h"
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include "assimp/scene.h"
+
+#include <algorithm>
+#include <cstring>
+#include <functional>
+#include <numeric>
+
+namespace {
+
+/*
+ * Layout of the cache file (all offsets are in bytes from the beginning of the file):
+ *
+ *   CacheHeader
+ *   CacheMaterial[numMaterials]
+ *   CacheMesh[numMeshes]
+ *   CacheNode[numNodes]         (pre-order, parent before its children)
+ *   quint32[numNodeMeshes]      (mesh indices referred by the nodes)
+ *   CacheLight[numLights]
+ *   string table                (UTF-8, not terminated)
+ *   interleaved vertex data, index data (16-bit or 32-bit, the full detail followed by the levels of detail),
+ *   sections, errors of the levels and sections of the levels of each mesh (16-byte aligned)
+ */
+
+char const CACHE_MAGIC[8] = { 'C', 'G', 'Q', 'T', 'M', 'S', 'H', 'C' };
+quint32 const CACHE_BYTE_ORDER_MARK = 0x01020304;
+unsigned int const CACHE_MAX_TEXTURE_CHANNELS = 8; // AI_MAX_NUMBER_OF_TEXTURECOORDS
+quint64 const CACHE_ALIGNMENT = 16;
+
+struct CacheHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 byteOrderMark;
+    quint32 importFlags;
+    quint32 meshOptions;
+    quint32 numMaterials;
+    quint32 numMeshes;
+    quint32 numNodes;
+    quint32 numNodeMeshes;
+    quint32 numLights;
+    qint64 sourceSize;
+    qint64 sourceModifiedTime;
+    quint64 materialOffset;
+    quint64 meshOffset;
+    quint64 nodeOffset;
+    quint64 nodeMeshOffset;
+    quint64 lightOffset;
+    quint64 stringOffset;
+    quint64 stringSize;
+    quint64 fileSize;
+};
+
+struct CacheString
+{
+    quint32 offset;
+    quint32 length;
+};
+
+struct CacheMaterial
+{
+    quint32 valid;
+    CacheString name;
+    CacheString diffuseTexture;
+    float ambient[4];
+    float diffuse[4];
+    float emission[4];
+    float specular[4];
+    float shininess;
+};
+
+struct CacheMesh
+{
+    quint32 valid;
+    CacheString name;
+    quint32 materialIndex;
+    quint32 vertexNumber;
+    quint32 vertexLayout;
+    quint32 vertexStride;
+    quint32 indexNumber;        // of the full detail
+    quint32 indexDataNumber;    // including the levels of detail
+    quint32 indexSize;
+    quint32 sectionNumber;
+    quint32 levelNumber;        // the simplified levels, each with sectionNumber sections
+    quint32 hasNormal;
+    quint32 textureChannels;
+    quint32 textureComponents[CACHE_MAX_TEXTURE_CHANNELS];
+    float bounds[6];
+    quint64 vertexDataOffset;
+    quint64 indexDataOffset;
+    quint64 sectionDataOffset;
+    quint64 levelErrorOffset;   // float[levelNumber]
+    quint64 levelSectionOffset; // CacheSection[levelNumber*sectionNumber]
+};
+
+struct CacheSection
+{
+    quint32 indexOffset;
+    quint32 indexNumber;
+    quint32 vertexOffset;
+    quint32 vertexNumber;
+};
+
+struct CacheNode
+{
+    qint32 parent;
+    CacheString name;
+    quint32 meshBegin;
+    quint32 meshCount;
+    float transformation[16];   // row-major, as aiMatrix4x4
+};
+
+struct CacheLight
+{
+    quint32 type;
+    CacheString name;
+    float position[3];
+    float direction[3];
+    float colorAmbient[3];
+    float colorDiffuse[3];
+    float colorSpecular[3];
+};
+
+static_assert(sizeof(aiMatrix4x4) == 16*sizeof(float), "aiMatrix4x4 is expected to be 16 packed floats");
+
+inline quint64 align_offset(quint64 offset)
+{
+    return (offset + CACHE_ALIGNMENT - 1) / CACHE_ALIGNMENT * CACHE_ALIGNMENT;
+}
+
+/**
+ * @brief Read-only memory mapping of a cache file, shared by the renderables referring to it
+ */
+class MappedCacheFile
+{
+public:
+    MappedCacheFile(QString const &filePath) : mFile(filePath), mData(nullptr), mSize(0) {}
+    ~MappedCacheFile() {
+        if (mData) mFile.unmap(mData);
+        mFile.close();
+    }
+
+    bool map() {
+        if (!mFile.open(QIODevice::ReadOnly)) return false;
+        mSize = mFile.size();
+        if (mSize < static_cast<qint64>(sizeof(CacheHeader))) return false;
+        mData = mFile.map(0, mSize);
+        return (mData != nullptr);
+    }
+
+    uchar const * data() const { return mData; }
+    qint64 size() const { return mSize; }
+
+    bool contains(quint64 offset, quint64 size) const {
+        return offset <= static_cast<quint64>(mSize) && size <= static_cast<quint64>(mSize) - offset;
+    }
+
+    template <typename T>
+    T const * at(quint64 offset) const { return reinterpret_cast<T const *>(mData + offset); }
+
+private:
+    QFile mFile;
+    uchar *mData;
+    qint64 mSize;
+};
+
+typedef std::shared_ptr<MappedCacheFile> MappedCacheFilePtr;
+
+QString cache_string(MappedCacheFile const &cacheFile, CacheHeader const *header, CacheString const &str)
+{
+    if (str.length == 0 || static_cast<quint64>(str.offset) + str.length > header->stringSize) return QString();
+    return QString::fromUtf8(cacheFile.at<char>(header->stringOffset + str.offset), str.length);
+}
+
+bool check_cache_header(MappedCacheFile const &cacheFile, CacheHeader const *header, QFileInfo const &sourceInfo,
+                        unsigned int importFlags, unsigned int meshOptions)
+{
+    if (std::memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) != 0) return false;
+    if (header->version != MESH_CACHE_VERSION || header->byteOrderMark != CACHE_BYTE_ORDER_MARK) return false;
+    if (header->importFlags != importFlags || header->meshOptions != meshOptions) return false;
+    if (header->sourceSize != sourceInfo.size()) return false;
+    if (header->sourceModifiedTime != sourceInfo.lastModified().toMSecsSinceEpoch()) return false;
+    if (header->fileSize != static_cast<quint64>(cacheFile.size())) return false;
+    if (header->numNodes == 0) return false;
+
+    return cacheFile.contains(header->materialOffset, static_cast<quint64>(header->numMaterials)*sizeof(CacheMaterial)) &&
+           cacheFile.contains(header->meshOffset, static_cast<quint64>(header->numMeshes)*sizeof(CacheMesh)) &&
+           cacheFile.contains(header->nodeOffset, static_cast<quint64>(header->numNodes)*sizeof(CacheNode)) &&
+           cacheFile.contains(header->nodeMeshOffset, static_cast<quint64>(header->numNodeMeshes)*sizeof(quint32)) &&
+           cacheFile.contains(header->lightOffset, static_cast<quint64>(header->numLights)*sizeof(CacheLight)) &&
+           cacheFile.contains(header->stringOffset, header->stringSize);
+}
+
+template <typename T>
+bool check_cache_indices(T const *indexData, CacheSection const &section)
+{
+    // the indices are relative to the first vertex of the section
+    for (quint32 i=0; i<section.indexNumber; ++i) {
+        if (indexData[section.indexOffset+i] >= section.vertexNumber) return false;
+    }
+    return true;
+}
+
+bool check_cache_section(MappedCacheFile const &cacheFile, CacheMesh const &cm, CacheSection const &section, quint32 indexEnd)
+{
+    if (static_cast<quint64>(section.indexOffset) + section.indexNumber > indexEnd) return false;
+    if (static_cast<quint64>(section.vertexOffset) + section.vertexNumber > cm.vertexNumber) return false;
+    if (cm.indexSize == sizeof(quint16)) return check_cache_indices(cacheFile.at<quint16>(cm.indexDataOffset), section);
+    return check_cache_indices(cacheFile.at<quint32>(cm.indexDataOffset), section);
+}
+
+bool check_cache_mesh(MappedCacheFile const &cacheFile, CacheMesh const &cm)
+{
+    if (!cm.valid) return true;
+    if (cm.textureChannels > CACHE_MAX_TEXTURE_CHANNELS) return false;
+    for (quint32 i=0; i<cm.textureChannels; ++i) {
+        if (cm.textureComponents[i] > 3) return false;
+    }
+    if (cm.vertexStride < vertex_stride(static_cast<VertexLayout>(cm.vertexLayout), cm.hasNormal != 0, cm.textureComponents, cm.textureChannels)) return false;
+    if (cm.indexSize != sizeof(quint16) && cm.indexSize != sizeof(quint32)) return false;
+    if (cm.vertexLayout != VERTEX_LAYOUT_FLOAT && cm.vertexLayout != VERTEX_LAYOUT_COMPACT) return false;
+    if (cm.vertexStride == 0 || cm.vertexStride % 4 != 0) return false;
+    if (cm.vertexDataOffset % sizeof(float) != 0 || cm.indexDataOffset % cm.indexSize != 0 || cm.sectionDataOffset % sizeof(quint32) != 0) return false;
+    if (cm.levelErrorOffset % sizeof(float) != 0 || cm.levelSectionOffset % sizeof(quint32) != 0) return false;
+    if (cm.indexDataNumber < cm.indexNumber || cm.levelNumber >= MAX_RENDERABLE_LEVELS) return false;
+    bool contained = cacheFile.contains(cm.vertexDataOffset, static_cast<quint64>(cm.vertexNumber)*cm.vertexStride) &&
+                     cacheFile.contains(cm.indexDataOffset, static_cast<quint64>(cm.indexDataNumber)*cm.indexSize) &&
+                     cacheFile.contains(cm.sectionDataOffset, static_cast<quint64>(cm.sectionNumber)*sizeof(CacheSection)) &&
+                     cacheFile.contains(cm.levelErrorOffset, static_cast<quint64>(cm.levelNumber)*sizeof(float)) &&
+                     cacheFile.contains(cm.levelSectionOffset, static_cast<quint64>(cm.levelNumber)*cm.sectionNumber*sizeof(CacheSection));
+    if (!contained) return false;
+
+    // every index must refer to a vertex of its section, otherwise the picking and the draws
+    // would read past the vertex data (a single section covers the whole mesh if none stored)
+    if (cm.sectionNumber == 0) {
+        CacheSection whole = { 0, cm.indexNumber, 0, cm.vertexNumber };
+        return cm.levelNumber == 0 && check_cache_section(cacheFile, cm, whole, cm.indexNumber);
+    }
+    CacheSection const *sections = cacheFile.at<CacheSection>(cm.sectionDataOffset);
+    for (quint32 si=0; si<cm.sectionNumber; ++si) {
+        if (!check_cache_section(cacheFile, cm, sections[si], cm.indexNumber)) return false;
+    }
+    // the levels follow the full detail within the stored index data
+    CacheSection const *levelSections = cacheFile.at<CacheSection>(cm.levelSectionOffset);
+    quint64 levelSectionNumber = static_cast<quint64>(cm.levelNumber)*cm.sectionNumber;
+    for (quint64 i=0; i<levelSectionNumber; ++i) {
+        if (!check_cache_section(cacheFile, cm, levelSections[i], cm.indexDataNumber)) return false;
+    }
+    return true;
+}
+
+bool check_cache_nodes(CacheHeader const *header, CacheNode const *nodes, quint32 const *nodeMeshes)
+{
+    for (quint32 i=0; i<header->numNodes; ++i) {
+        CacheNode const &cn = nodes[i];
+        // nodes are stored in pre-order, only the first one is the root
+        if ((i == 0) != (cn.parent < 0)) return false;
+        if (cn.parent >= static_cast<qint32>(i)) return false;
+        if (static_cast<quint64>(cn.meshBegin) + cn.meshCount > header->numNodeMeshes) return false;
+        for (quint32 mi=0; mi<cn.meshCount; ++mi) {
+            if (nodeMeshes[cn.meshBegin+mi] >= header->numMeshes) return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief rebuild the scene graph (without meshes and materials) from the cached nodes and lights
+ */
+aiScene * build_cache_scene(MappedCacheFile const &cacheFile, CacheHeader const *header)
+{
+    CacheNode const *cacheNodes = cacheFile.at<CacheNode>(header->nodeOffset);
+    quint32 const *nodeMeshes = cacheFile.at<quint32>(header->nodeMeshOffset);
+    CacheLight const *cacheLights = cacheFile.at<CacheLight>(header->lightOffset);
+
+    std::vector<aiNode *> nodes(header->numNodes);
+    std::vector<unsigned int> childNumbers(header->numNodes, 0);
+    for (quint32 i=0; i<header->numNodes; ++i) {
+        CacheNode const &cn = cacheNodes[i];
+        aiNode *node = new aiNode(cache_string(cacheFile, header, cn.name).toStdString());
+        std::memcpy(&node->mTransformation.a1, cn.transformation, sizeof(cn.transformation));
+        if (cn.meshCount > 0) {
+            node->mNumMeshes = cn.meshCount;
+            node->mMeshes = new unsigned int[cn.meshCount];
+            std::copy(nodeMeshes+cn.meshBegin, nodeMeshes+cn.meshBegin+cn.meshCount, node->mMeshes);
+        }
+        if (cn.parent >= 0) ++childNumbers[cn.parent];
+        nodes[i] = node;
+    }
+    for (quint32 i=0; i<header->numNodes; ++i) {
+        if (childNumbers[i] > 0) nodes[i]->mChildren = new aiNode*[childNumbers[i]];
+    }
+    for (quint32 i=1; i<header->numNodes; ++i) {
+        aiNode *parent = nodes[cacheNodes[i].parent];
+        nodes[i]->mParent = parent;
+        parent->mChildren[parent->mNumChildren++] = nodes[i];
+    }
+
+    aiScene *scene = new aiScene;
+    scene->mRootNode = nodes[0];
+
+    if (header->numLights > 0) {
+        scene->mNumLights = header->numLights;
+        scene->mLights = new aiLight*[header->numLights];
+        for (quint32 i=0; i<header->numLights; ++i) {
+            CacheLight const &cl = cacheLights[i];
+            aiLight *light = new aiLight;
+            light->mName.Set(cache_string(cacheFile, header, cl.name).toStdString());
+            light->mType = static_cast<aiLightSourceType>(cl.type);
+            light->mPosition = aiVector3D(cl.position[0], cl.position[1], cl.position[2]);
+            light->mDirection = aiVector3D(cl.direction[0], cl.direction[1], cl.direction[2]);
+            light->mColorAmbient = aiColor3D(cl.colorAmbient[0], cl.colorAmbient[1], cl.colorAmbient[2]);
+            light->mColorDiffuse = aiColor3D(cl.colorDiffuse[0], cl.colorDiffuse[1], cl.colorDiffuse[2]);
+            light->mColorSpecular = aiColor3D(cl.colorSpecular[0], cl.colorSpecular[1], cl.colorSpecular[2]);
+            scene->mLights[i] = light;
+        }
+    }
+
+    return scene;
+}
+
+void collect_cache_nodes(aiNode const *node, qint32 parent, std::vector<CacheNode> &nodes, std::vector<quint32> &nodeMeshes,
+                         std::function<CacheString (QString const &)> const &addString)
+{
+    if (node == nullptr) return;
+
+    CacheNode cn;
+    cn.parent = parent;
+    cn.name = addString(node->mName.C_Str());
+    cn.meshBegin = static_cast<quint32>(nodeMeshes.size());
+    cn.meshCount = node->mNumMeshes;
+    std::memcpy(cn.transformation, &node->mTransformation.a1, sizeof(cn.transformation));
+    nodeMeshes.insert(nodeMeshes.end(), node->mMeshes, node->mMeshes + node->mNumMeshes);
+
+    qint32 nodeIndex = static_cast<qint32>(nodes.size());
+    nodes.emplace_back(cn);
+    for (unsigned int i=0; i<node->mNumChildren; ++i) {
+        collect_cache_nodes(node->mChildren[i], nodeIndex, nodes, nodeMeshes, addString);
+    }
+}
+
+inline void copy_color(float dst[3], aiColor3D const &c) {
+    dst[0] = c.r;
+    dst[1] = c.g;
+    dst[2] = c.b;
+}
+
+inline void copy_vector(float dst[3], aiVector3D const &v) {
+    dst[0] = v.x;
+    dst[1] = v.y;
+    dst[2] = v.z;
+}
+
+} // namespace
+
+QString mesh_cache_directory()
+{
+    return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).absoluteFilePath("meshes");
+}
+
+QString mesh_cache_file_path(QString const &sourceFilePath, unsigned int importFlags, unsigned int meshOptions)
+{
+    QFileInfo sourceInfo(sourceFilePath);
+    if (!sourceInfo.exists()) return QString();
+
+    QString key = QString("%1|%2|%3|%4|%5|%6")
+        .arg(sourceInfo.canonicalFilePath())
+        .arg(sourceInfo.size())
+        .arg(sourceInfo.lastModified().toMSecsSinceEpoch())
+        .arg(importFlags)
+        .arg(meshOptions)
+        .arg(MESH_CACHE_VERSION);
+    QByteArray keyHash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+    return QDir(mesh_cache_directory()).absoluteFilePath(QString::fromLatin1(keyHash) + ".mcache");
+}
+
+SceneDataPtr load_mesh_cache(QString const &sourceFilePath, unsigned int importFlags, unsigned int meshOptions)
+{
+    QString cacheFilePath = mesh_cache_file_path(sourceFilePath, importFlags, meshOptions);
+    if (cacheFilePath.isEmpty() || !QFileInfo::exists(cacheFilePath)) return SceneDataPtr();
+
+    MappedCacheFilePtr cacheFile = std::make_shared<MappedCacheFile>(cacheFilePath);
+    CacheHeader const *header = nullptr;
+    if (cacheFile->map()) {
+        header = cacheFile->at<CacheHeader>(0);
+        if (!check_cache_header(*cacheFile, header, QFileInfo(sourceFilePath), importFlags, meshOptions)) header = nullptr;
+    }
+    if (header == nullptr) {
+        LOG_WARNING_QSTRING(QString("Invalid mesh cache file %1 ignored.").arg(cacheFilePath));
+        return SceneDataPtr();
+    }
+
+    CacheMaterial const *cacheMaterials = cacheFile->at<CacheMaterial>(header->materialOffset);
+    CacheMesh const *cacheMeshes = cacheFile->at<CacheMesh>(header->meshOffset);
+    bool valid = check_cache_nodes(header, cacheFile->at<CacheNode>(header->nodeOffset), cacheFile->at<quint32>(header->nodeMeshOffset));
+    for (quint32 i=0; valid && i<header->numMeshes; ++i) {
+        valid = check_cache_mesh(*cacheFile, cacheMeshes[i]);
+    }
+    if (!valid) {
+        LOG_WARNING_QSTRING(QString("Corrupted mesh cache file %1 ignored.").arg(cacheFilePath));
+        return SceneDataPtr();
+    }
+
+    SceneDataPtr sceneData = std::make_shared<SceneData>();
+    sceneData->scene.reset(build_cache_scene(*cacheFile, header));
+    sceneData->sourceFilePath = sourceFilePath;
+
+    for (quint32 i=0; i<header->numMaterials; ++i) {
+        CacheMaterial const &cm = cacheMaterials[i];
+        if (!cm.valid) {
+            sceneData->materials.emplace_back(OpenGLMaterialEntityPtr());
+            continue;
+        }
+        OpenGLMaterialEntityPtr material = std::make_shared<OpenGLMaterialEntity>();
+        material->setName(cache_string(*cacheFile, header, cm.name));
+        material->setAmbient(cm.ambient[0], cm.ambient[1], cm.ambient[2], cm.ambient[3]);
+        material->setDiffuse(cm.diffuse[0], cm.diffuse[1], cm.diffuse[2], cm.diffuse[3]);
+        material->setEmission(cm.emission[0], cm.emission[1], cm.emission[2], cm.emission[3]);
+        material->setSpecular(cm.specular[0], cm.specular[1], cm.specular[2], cm.specular[3]);
+        material->setShininess(cm.shininess);
+        material->setDiffuseTextureFilePath(cache_string(*cacheFile, header, cm.diffuseTexture));
+        sceneData->materials.emplace_back(material);
+    }
+
+    for (quint32 i=0; i<header->numMeshes; ++i) {
+        CacheMesh const &cm = cacheMeshes[i];
+        OpenGLRenderableEntityPtr renderable;
+        if (cm.valid) {
+            RenderableDataView view;
+            view.vertexNumber = cm.vertexNumber;
+            view.vertexLayout = static_cast<VertexLayout>(cm.vertexLayout);
+            view.vertexStride = cm.vertexStride;
+            view.indexNumber = cm.indexNumber;
+            view.indexDataNumber = cm.indexDataNumber;
+            view.indexSize = cm.indexSize;
+            view.hasNormal = (cm.hasNormal != 0);
+            view.textureComponents.assign(cm.textureComponents, cm.textureComponents + cm.textureChannels);
+            std::copy(cm.bounds, cm.bounds+6, view.bounds);
+            view.vertexData = cacheFile->at<void>(cm.vertexDataOffset);
+            view.indexData = cacheFile->at<void>(cm.indexDataOffset);
+            CacheSection const *sections = cacheFile->at<CacheSection>(cm.sectionDataOffset);
+            for (quint32 si=0; si<cm.sectionNumber; ++si) {
+                RenderableSection section = { sections[si].indexOffset, sections[si].indexNumber, sections[si].vertexOffset, sections[si].vertexNumber };
+                view.sections.emplace_back(section);
+            }
+            float const *levelErrors = cacheFile->at<float>(cm.levelErrorOffset);
+            CacheSection const *levelSections = cacheFile->at<CacheSection>(cm.levelSectionOffset);
+            for (quint32 li=0; li<cm.levelNumber; ++li) {
+                RenderableLevel level;
+                level.error = levelErrors[li];
+                for (quint32 si=0; si<cm.sectionNumber; ++si) {
+                    CacheSection const &cs = levelSections[li*cm.sectionNumber + si];
+                    RenderableSection section = { cs.indexOffset, cs.indexNumber, cs.vertexOffset, cs.vertexNumber };
+                    level.sections.emplace_back(section);
+                }
+                view.levels.emplace_back(level);
+            }
+
+            renderable = std::make_shared<OpenGLRenderableEntity>();
+            if (renderable->loadData(view, cacheFile)) {
+                renderable->setName(cache_string(*cacheFile, header, cm.name));
+                if (cm.materialIndex < sceneData->materials.size()) {
+                    renderable->setMaterial(sceneData->materials[cm.materialIndex]);
+                }
+            } else {
+                renderable.reset();
+            }
+        }
+        // a null pointer holds the place to keep consistent with the scene structure of assimp
+        sceneData->renderables.emplace_back(renderable);
+    }
+
+    LOG_INFO_QSTRING(QString("Scene loaded from mesh cache %1.").arg(cacheFilePath));
+    return sceneData;
+}
+
+bool save_mesh_cache(SceneDataPtr const &sceneData, unsigned int importFlags, unsigned int meshOptions)
+{
+    if (!sceneData || !sceneData->scene) return false;
+
+    QString cacheFilePath = mesh_cache_file_path(sceneData->sourceFilePath, importFlags, meshOptions);
+    if (cacheFilePath.isEmpty()) return false;
+    if (!QDir().mkpath(mesh_cache_directory())) {
+        LOG_WARNING_QSTRING(QString("Fail to create mesh cache directory %1!").arg(mesh_cache_directory()));
+        return false;
+    }
+
+    aiScene const *scene = sceneData->scene.get();
+    QFileInfo sourceInfo(sceneData->sourceFilePath);
+
+    QByteArray strings;
+    std::function<CacheString (QString const &)> addString = [&strings](QString const &str) -> CacheString {
+        QByteArray utf8 = str.toUtf8();
+        CacheString cs;
+        cs.offset = static_cast<quint32>(strings.size());
+        cs.length = static_cast<quint32>(utf8.size());
+        strings.append(utf8);
+        return cs;
+    };
+
+    std::vector<CacheMaterial> materials(sceneData->materials.size());
+    for (size_t i=0; i<materials.size(); ++i) {
+        OpenGLMaterialEntityPtr material = sceneData->materials[i];
+        CacheMaterial &cm = materials[i];
+        cm.valid = material ? 1 : 0;
+        if (!material) continue;
+        cm.name = addString(material->name());
+        cm.diffuseTexture = addString(material->diffuseTextureFilePath());
+        std::copy(material->ambient(), material->ambient()+4, cm.ambient);
+        std::copy(material->diffuse(), material->diffuse()+4, cm.diffuse);
+        std::copy(material->emission(), material->emission()+4, cm.emission);
+        std::copy(material->specular(), material->specular()+4, cm.specular);
+        cm.shininess = material->shininess();
+    }
+
+    std::vector<CacheNode> nodes;
+    std::vector<quint32> nodeMeshes;
+    collect_cache_nodes(scene->mRootNode, -1, nodes, nodeMeshes, addString);
+    if (nodes.empty()) return false;
+
+    std::vector<CacheLight> lights(scene->mNumLights);
+    for (unsigned int i=0; i<scene->mNumLights; ++i) {
+        aiLight const *light = scene->mLights[i];
+        CacheLight &cl = lights[i];
+        cl.type = static_cast<quint32>(light->mType);
+        cl.name = addString(light->mName.C_Str());
+        copy_vector(cl.position, light->mPosition);
+        copy_vector(cl.direction, light->mDirection);
+        copy_color(cl.colorAmbient, light->mColorAmbient);
+        copy_color(cl.colorDiffuse, light->mColorDiffuse);
+        copy_color(cl.colorSpecular, light->mColorSpecular);
+    }
+
+    CacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = MESH_CACHE_VERSION;
+    header.byteOrderMark = CACHE_BYTE_ORDER_MARK;
+    header.importFlags = importFlags;
+    header.meshOptions = meshOptions;
+    header.numMaterials = static_cast<quint32>(materials.size());
+    header.numMeshes = static_cast<quint32>(sceneData->renderables.size());
+    header.numNodes = static_cast<quint32>(nodes.size());
+    header.numNodeMeshes = static_cast<quint32>(nodeMeshes.size());
+    header.numLights = static_cast<quint32>(lights.size());
+    header.sourceSize = sourceInfo.size();
+    header.sourceModifiedTime = sourceInfo.lastModified().toMSecsSinceEpoch();
+
+    std::vector<CacheMesh> meshes(sceneData->renderables.size());
+
+    // the tables first, then the strings and the bulk data
+    quint64 offset = align_offset(sizeof(CacheHeader));
+    header.materialOffset = offset;
+    offset = align_offset(offset + materials.size()*sizeof(CacheMaterial));
+    header.meshOffset = offset;
+    offset = align_offset(offset + meshes.size()*sizeof(CacheMesh));
+    header.nodeOffset = offset;
+    offset = align_offset(offset + nodes.size()*sizeof(CacheNode));
+    header.nodeMeshOffset = offset;
+    offset = align_offset(offset + nodeMeshes.size()*sizeof(quint32));
+    header.lightOffset = offset;
+    offset = align_offset(offset + lights.size()*sizeof(CacheLight));
+
+    for (size_t i=0; i<meshes.size(); ++i) {
+        OpenGLRenderableEntityPtr renderable = sceneData->renderables[i];
+        CacheMesh &cm = meshes[i];
+        cm.valid = renderable ? 1 : 0;
+        if (!renderable) continue;
+        cm.name = addString(renderable->name());
+        cm.materialIndex = (i < scene->mNumMeshes) ? scene->mMeshes[i]->mMaterialIndex : 0;
+        cm.vertexNumber = renderable->vertexNumber();
+        cm.vertexLayout = static_cast<quint32>(renderable->vertexLayout());
+        cm.vertexStride = renderable->vertexStride();
+        cm.indexNumber = renderable->indexNumber();
+        cm.indexDataNumber = renderable->indexDataNumber();
+        cm.indexSize = renderable->indexSize();
+        cm.sectionNumber = static_cast<quint32>(renderable->sections().size());
+        cm.levelNumber = static_cast<quint32>(renderable->levels().size());
+        cm.hasNormal = renderable->hasNormal() ? 1 : 0;
+        std::vector<unsigned int> const &texComps = renderable->textureComponents();
+        cm.textureChannels = static_cast<quint32>(std::min<size_t>(texComps.size(), CACHE_MAX_TEXTURE_CHANNELS));
+        std::copy(texComps.begin(), texComps.begin()+cm.textureChannels, cm.textureComponents);
+        std::copy(renderable->bounds(), renderable->bounds()+6, cm.bounds);
+    }
+
+    header.stringOffset = offset;
+    header.stringSize = static_cast<quint64>(strings.size());
+    offset = align_offset(offset + header.stringSize);
+
+    for (size_t i=0; i<meshes.size(); ++i) {
+        CacheMesh &cm = meshes[i];
+        if (!cm.valid) continue;
+        cm.vertexDataOffset = offset;
+        offset = align_offset(offset + static_cast<quint64>(cm.vertexNumber)*cm.vertexStride);
+        cm.indexDataOffset = offset;
+        offset = align_offset(offset + static_cast<quint64>(cm.indexDataNumber)*cm.indexSize);
+        cm.sectionDataOffset = offset;
+        offset = align_offset(offset + static_cast<quint64>(cm.sectionNumber)*sizeof(CacheSection));
+        cm.levelErrorOffset = offset;
+        offset = align_offset(offset + static_cast<quint64>(cm.levelNumber)*sizeof(float));
+        cm.levelSectionOffset = offset;
+        offset = align_offset(offset + static_cast<quint64>(cm.levelNumber)*cm.sectionNumber*sizeof(CacheSection));
+    }
+    header.fileSize = offset;
+
+    // written into a temporary file first, so that a partial cache file never shows up
+    QString tempFilePath = QString("%1.%2.tmp").arg(cacheFilePath).arg(QCoreApplication::applicationPid());
+    QFile file(tempFilePath);
+    uchar *dst = nullptr;
+    if (file.open(QIODevice::ReadWrite | QIODevice::Truncate) && file.resize(static_cast<qint64>(header.fileSize))) {
+        dst = file.map(0, static_cast<qint64>(header.fileSize));
+    }
+    if (dst == nullptr) {
+        LOG_WARNING_QSTRING(QString("Fail to write mesh cache file %1!").arg(tempFilePath));
+        file.close();
+        file.remove();
+        return false;
+    }
+
+    std::memcpy(dst, &header, sizeof(header));
+    if (!materials.empty()) std::memcpy(dst + header.materialOffset, materials.data(), materials.size()*sizeof(CacheMaterial));
+    if (!meshes.empty()) std::memcpy(dst + header.meshOffset, meshes.data(), meshes.size()*sizeof(CacheMesh));
+    std::memcpy(dst + header.nodeOffset, nodes.data(), nodes.size()*sizeof(CacheNode));
+    if (!nodeMeshes.empty()) std::memcpy(dst + header.nodeMeshOffset, nodeMeshes.data(), nodeMeshes.size()*sizeof(quint32));
+    if (!lights.empty()) std::memcpy(dst + header.lightOffset, lights.data(), lights.size()*sizeof(CacheLight));
+    if (!strings.isEmpty()) std::memcpy(dst + header.stringOffset, strings.constData(), strings.size());
+
+    // the vertices are interleaved straight into the mapped file
+    std::vector<size_t> meshIndices(meshes.size());
+    std::iota(meshIndices.begin(), meshIndices.end(), 0);
+    QtConcurrent::blockingMap(meshIndices, [&](size_t i) {
+        if (!meshes[i].valid) return;
+        OpenGLRenderableEntityPtr renderable = sceneData->renderables[i];
+        renderable->writeVertexData(dst + meshes[i].vertexDataOffset);
+        std::memcpy(dst + meshes[i].indexDataOffset, renderable->indexData(), static_cast<size_t>(meshes[i].indexDataNumber)*meshes[i].indexSize);
+        CacheSection *sections = reinterpret_cast<CacheSection *>(dst + meshes[i].sectionDataOffset);
+        for (RenderableSection const &section : renderable->sections()) {
+            CacheSection cs = { section.indexOffset, section.indexNumber, section.vertexOffset, section.vertexNumber };
+            *sections++ = cs;
+        }
+        float *levelErrors = reinterpret_cast<float *>(dst + meshes[i].levelErrorOffset);
+        CacheSection *levelSections = reinterpret_cast<CacheSection *>(dst + meshes[i].levelSectionOffset);
+        for (RenderableLevel const &level : renderable->levels()) {
+            *levelErrors++ = level.error;
+            for (RenderableSection const &section : level.sections) {
+                CacheSection cs = { section.indexOffset, section.indexNumber, section.vertexOffset, section.vertexNumber };
+                *levelSections++ = cs;
+            }
+        }
+    });
+
+    file.unmap(dst);
+    file.close();
+
+    QFile::remove(cacheFilePath);
+    if (!QFile::rename(tempFilePath, cacheFilePath)) {
+        LOG_WARNING_QSTRING(QString("Fail to write mesh cache file %1!").arg(cacheFilePath));
+        QFile::remove(tempFilePath);
+        return false;
+    }
+
+    LOG_INFO_QSTRING(QString("Mesh cache saved to %1.").arg(cacheFilePath));
+    return true;
+}
@@ -0,0 +1,559 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "MeshOptimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <unordered_map>
+
+namespace {
+
+// parameters of the vertex scores of Forsyth's algorithm
+int const FORSYTH_CACHE_SIZE = 32;
+float const FORSYTH_CACHE_DECAY_POWER = 1.5f;
+float const FORSYTH_LAST_TRIANGLE_SCORE = 0.75f;
+float const FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+float const FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+unsigned int const INVALID_INDEX = std::numeric_limits<unsigned int>::max();
+
+/**
+ * @brief sum of the squared distances to a set of planes, weighted by the areas of
+ *        their triangles: p^T*A*p + 2*b^T*p + c (A is symmetric)
+ */
+struct Quadric
+{
+    double a00, a11, a22, a01, a02, a12;
+    double b0, b1, b2;
+    double c;
+    double weight;
+};
+
+void add_plane_quadric(Quadric &q, double const *n, double d, double weight)
+{
+    q.a00 += weight*n[0]*n[0];
+    q.a11 += weight*n[1]*n[1];
+    q.a22 += weight*n[2]*n[2];
+    q.a01 += weight*n[0]*n[1];
+    q.a02 += weight*n[0]*n[2];
+    q.a12 += weight*n[1]*n[2];
+    q.b0 += weight*n[0]*d;
+    q.b1 += weight*n[1]*d;
+    q.b2 += weight*n[2]*d;
+    q.c += weight*d*d;
+    q.weight += weight;
+}
+
+void add_quadric(Quadric &q, Quadric const &o)
+{
+    q.a00 += o.a00; q.a11 += o.a11; q.a22 += o.a22;
+    q.a01 += o.a01; q.a02 += o.a02; q.a12 += o.a12;
+    q.b0 += o.b0; q.b1 += o.b1; q.b2 += o.b2;
+    q.c += o.c;
+    q.weight += o.weight;
+}
+
+// the weighted sum of the squared distances from the point to the planes
+double quadric_value(Quadric const &q, float const *p)
+{
+    double x = p[0], y = p[1], z = p[2];
+    double r = q.a00*x*x + q.a11*y*y + q.a22*z*z + 2.0*(q.a01*x*y + q.a02*x*z + q.a12*y*z) +
+               2.0*(q.b0*x + q.b1*y + q.b2*z) + q.c;
+    return std::fabs(r);
+}
+
+void triangle_normal(float const *p0, float const *p1, float const *p2, double *n)
+{
+    double e1[3] = { double(p1[0])-p0[0], double(p1[1])-p0[1], double(p1[2])-p0[2] };
+    double e2[3] = { double(p2[0])-p0[0], double(p2[1])-p0[1], double(p2[2])-p0[2] };
+    n[0] = e1[1]*e2[2] - e1[2]*e2[1];
+    n[1] = e1[2]*e2[0] - e1[0]*e2[2];
+    n[2] = e1[0]*e2[1] - e1[1]*e2[0];
+}
+
+inline std::uint64_t edge_key(unsigned int a, unsigned int b)
+{
+    return a < b ? (std::uint64_t(a) << 32) | b : (std::uint64_t(b) << 32) | a;
+}
+
+/**
+ * @brief the vertices which must not be collapsed: on the borders, on the non-manifold
+ *        edges or sharing their positions with other vertices (the seams of attributes)
+ */
+std::vector<std::uint8_t> locked_vertices(unsigned int const *indices, size_t indexNumber, float const *positions,
+                                          size_t positionStride, unsigned int vertexNumber)
+{
+    std::vector<std::uint8_t> locked(vertexNumber, 0);
+
+    // weld the vertices at the same position, each group is represented by its first vertex
+    std::vector<unsigned int> order(vertexNumber);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [positions, positionStride](unsigned int a, unsigned int b) {
+        float const *pa = positions + a*positionStride;
+        float const *pb = positions + b*positionStride;
+        return std::lexicographical_compare(pa, pa+3, pb, pb+3);
+    });
+    std::vector<unsigned int> welded(vertexNumber);
+    for (size_t i=0; i<order.size(); ) {
+        size_t groupEnd = i + 1;
+        float const *p = positions + order[i]*positionStride;
+        while (groupEnd < order.size() && std::equal(p, p+3, positions + order[groupEnd]*positionStride)) ++groupEnd;
+        for (size_t k=i; k<groupEnd; ++k) {
+            welded[order[k]] = order[i];
+            if (groupEnd - i > 1) locked[order[k]] = 1;
+        }
+        i = groupEnd;
+    }
+
+    // the edges used by other than two triangles, in the welded space as the seams are not borders
+    std::unordered_map<std::uint64_t, unsigned int> edgeCounts;
+    edgeCounts.reserve(indexNumber);
+    for (size_t i=0; i<indexNumber; i+=3) {
+        for (int k=0; k<3; ++k) {
+            ++edgeCounts[edge_key(welded[indices[i+k]], welded[indices[i+(k+1)%3]])];
+        }
+    }
+    for (size_t i=0; i<indexNumber; i+=3) {
+        for (int k=0; k<3; ++k) {
+            unsigned int a = indices[i+k], b = indices[i+(k+1)%3];
+            if (edgeCounts[edge_key(welded[a], welded[b])] != 2) locked[a] = locked[b] = 1;
+        }
+    }
+    return locked;
+}
+
+float vertex_score(int cachePosition, unsigned int remainingTriangles)
+{
+    if (remainingTriangles == 0) return -1.0f;
+
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        if (cachePosition < 3) {
+            // the vertices of the last triangle get a fixed score, so that the strips are not favored too much
+            score = FORSYTH_LAST_TRIANGLE_SCORE;
+        } else {
+            float scaler = 1.0f / (FORSYTH_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cachePosition - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+        }
+    }
+    // boost the vertices with few triangles left, to get rid of the lone triangles early
+    score += FORSYTH_VALENCE_BOOST_SCALE * std::pow(static_cast<float>(remainingTriangles), -FORSYTH_VALENCE_BOOST_POWER);
+    return score;
+}
+
+/**
+ * @brief FIFO post-transform vertex cache simulated with time stamps
+ */
+class VertexCacheSimulator
+{
+public:
+    VertexCacheSimulator(unsigned int vertexNumber, unsigned int cacheSize)
+        : mTimeStamps(vertexNumber, 0), mCacheSize(cacheSize), mTime(cacheSize + 1) {}
+
+    // returns true if the vertex misses the cache
+    bool access(unsigned int v) {
+        if (mTime - mTimeStamps[v] <= mCacheSize) return false;
+        mTimeStamps[v] = mTime++;
+        return true;
+    }
+
+    unsigned int accessTriangle(unsigned int const *tri) {
+        return (this->access(tri[0]) ? 1 : 0) + (this->access(tri[1]) ? 1 : 0) + (this->access(tri[2]) ? 1 : 0);
+    }
+
+    void clear() { mTime += mCacheSize + 1; }
+
+private:
+    std::vector<unsigned int> mTimeStamps;
+    unsigned int mCacheSize;
+    unsigned int mTime;
+};
+
+} // namespace
+
+float compute_acmr(unsigned int const *indices, size_t indexNumber, unsigned int vertexNumber, unsigned int cacheSize)
+{
+    size_t triNumber = indexNumber / 3;
+    if (triNumber == 0) return 0.0f;
+
+    VertexCacheSimulator cache(vertexNumber, cacheSize);
+    size_t misses = 0;
+    for (size_t t=0; t<triNumber; ++t) {
+        misses += cache.accessTriangle(indices + t*3);
+    }
+    return static_cast<float>(misses) / static_cast<float>(triNumber);
+}
+
+void optimize_vertex_cache(unsigned int *indices, size_t indexNumber, unsigned int vertexNumber)
+{
+    size_t triNumber = indexNumber / 3;
+    if (triNumber == 0 || vertexNumber == 0) return;
+
+    // the triangles adjacent to each vertex, the ones not emitted yet are kept in front
+    std::vector<unsigned int> adjacencyOffsets(vertexNumber + 1, 0);
+    for (size_t i=0; i<triNumber*3; ++i) {
+        ++adjacencyOffsets[indices[i] + 1];
+    }
+    std::partial_sum(adjacencyOffsets.begin(), adjacencyOffsets.end(), adjacencyOffsets.begin());
+    std::vector<unsigned int> adjacency(triNumber*3);
+    std::vector<unsigned int> remaining(vertexNumber, 0);
+    for (size_t t=0; t<triNumber; ++t) {
+        for (int k=0; k<3; ++k) {
+            unsigned int v = indices[t*3+k];
+            adjacency[adjacencyOffsets[v] + remaining[v]++] = static_cast<unsigned int>(t);
+        }
+    }
+
+    std::vector<int> cachePositions(vertexNumber, -1);
+    std::vector<float> vertexScores(vertexNumber);
+    for (unsigned int v=0; v<vertexNumber; ++v) {
+        vertexScores[v] = vertex_score(-1, remaining[v]);
+    }
+    std::vector<float> triangleScores(triNumber);
+    unsigned int bestTriangle = INVALID_INDEX;
+    float bestScore = -1.0f;
+    for (size_t t=0; t<triNumber; ++t) {
+        unsigned int const *tri = indices + t*3;
+        triangleScores[t] = vertexScores[tri[0]] + vertexScores[tri[1]] + vertexScores[tri[2]];
+        if (triangleScores[t] > bestScore) {
+            bestScore = triangleScores[t];
+            bestTriangle = static_cast<unsigned int>(t);
+        }
+    }
+
+    std::vector<bool> emitted(triNumber, false);
+    std::vector<unsigned int> output;
+    output.reserve(triNumber*3);
+    unsigned int cache[FORSYTH_CACHE_SIZE + 3];
+    int cacheCount = 0;
+    size_t scanPosition = 0;
+
+    for (size_t emittedNumber=0; emittedNumber<triNumber; ++emittedNumber) {
+        if (bestTriangle == INVALID_INDEX) {
+            // no candidate around the cache, continue from the first triangle left
+            while (emitted[scanPosition]) ++scanPosition;
+            bestTriangle = static_cast<unsigned int>(scanPosition);
+        }
+
+        unsigned int const *tri = indices + static_cast<size_t>(bestTriangle)*3;
+        emitted[bestTriangle] = true;
+        output.insert(output.end(), tri, tri+3);
+
+        // drop the triangle from the adjacency of its vertices
+        for (int k=0; k<3; ++k) {
+            unsigned int v = tri[k];
+            unsigned int *adj = adjacency.data() + adjacencyOffsets[v];
+            for (unsigned int a=0; a<remaining[v]; ++a) {
+                if (adj[a] == bestTriangle) {
+                    std::swap(adj[a], adj[remaining[v]-1]);
+                    --remaining[v];
+                    break;
+                }
+            }
+        }
+
+        // the vertices of the triangle move to the front of the LRU cache
+        unsigned int newCache[FORSYTH_CACHE_SIZE + 3];
+        int newCount = 0;
+        for (int k=0; k<3; ++k) {
+            if (std::find(newCache, newCache+newCount, tri[k]) == newCache+newCount) newCache[newCount++] = tri[k];
+        }
+        for (int c=0; c<cacheCount; ++c) {
+            if (cache[c] != tri[0] && cache[c] != tri[1] && cache[c] != tri[2]) newCache[newCount++] = cache[c];
+        }
+
+        // update the scores of the vertices in (or just dropped out of) the cache
+        for (int c=0; c<newCount; ++c) {
+            unsigned int v = newCache[c];
+            cachePositions[v] = (c < FORSYTH_CACHE_SIZE) ? c : -1;
+            vertexScores[v] = vertex_score(cachePositions[v], remaining[v]);
+        }
+        cacheCount = std::min(newCount, FORSYTH_CACHE_SIZE);
+        for (int c=0; c<cacheCount; ++c) cache[c] = newCache[c];
+
+        // the next triangle is the best one around the cache
+        bestTriangle = INVALID_INDEX;
+        bestScore = -1.0f;
+        for (int c=0; c<newCount; ++c) {
+            unsigned int v = newCache[c];
+            unsigned int const *adj = adjacency.data() + adjacencyOffsets[v];
+            for (unsigned int a=0; a<remaining[v]; ++a) {
+                unsigned int t = adj[a];
+                unsigned int const *at = indices + static_cast<size_t>(t)*3;
+                triangleScores[t] = vertexScores[at[0]] + vertexScores[at[1]] + vertexScores[at[2]];
+                if (triangleScores[t] > bestScore) {
+                    bestScore = triangleScores[t];
+                    bestTriangle = t;
+                }
+            }
+        }
+    }
+
+    std::copy(output.begin(), output.end(), indices);
+}
+
+void optimize_overdraw(unsigned int *indices, size_t indexNumber, float const *positions, size_t positionStride,
+                       unsigned int vertexNumber, float threshold)
+{
+    size_t triNumber = indexNumber / 3;
+    if (triNumber < 2 || vertexNumber == 0) return;
+
+    // hard boundaries, where the cache restarts (none of the vertices of the triangle is cached)
+    std::vector<size_t> hardClusters;
+    {
+        VertexCacheSimulator cache(vertexNumber, MESH_OPTIMIZER_MEASURE_CACHE_SIZE);
+        for (size_t t=0; t<triNumber; ++t) {
+            if (cache.accessTriangle(indices + t*3) == 3 || t == 0) hardClusters.push_back(t);
+        }
+    }
+    hardClusters.push_back(triNumber);
+
+    // soft boundaries, so that each cluster keeps the ACMR within the threshold even starting with a cold cache
+    float targetAcmr = compute_acmr(indices, indexNumber, vertexNumber) * threshold;
+    std::vector<size_t> clusters;
+    {
+        VertexCacheSimulator cache(vertexNumber, MESH_OPTIMIZER_MEASURE_CACHE_SIZE);
+        for (size_t hc=0; hc+1<hardClusters.size(); ++hc) {
+            size_t clusterBegin = hardClusters[hc];
+            size_t misses = 0;
+            cache.clear();
+            clusters.push_back(clusterBegin);
+            for (size_t t=hardClusters[hc]; t<hardClusters[hc+1]; ++t) {
+                misses += cache.accessTriangle(indices + t*3);
+                if (t+1 < hardClusters[hc+1] && misses <= targetAcmr * (t + 1 - clusterBegin)) {
+                    clusterBegin = t + 1;
+                    misses = 0;
+                    cache.clear();
+                    clusters.push_back(clusterBegin);
+                }
+            }
+        }
+    }
+    clusters.push_back(triNumber);
+    size_t clusterNumber = clusters.size() - 1;
+    if (clusterNumber < 2) return;
+
+    // area weighted centroid and normal of each cluster
+    std::vector<float> clusterData(clusterNumber*6, 0.0f);
+    float meshCentroid[3] = { 0.0f, 0.0f, 0.0f };
+    float meshArea = 0.0f;
+    for (size_t c=0; c<clusterNumber; ++c) {
+        float *centroid = clusterData.data() + c*6;
+        float *normal = centroid + 3;
+        float clusterArea = 0.0f;
+        for (size_t t=clusters[c]; t<clusters[c+1]; ++t) {
+            float const *p0 = positions + indices[t*3]*positionStride;
+            float const *p1 = positions + indices[t*3+1]*positionStride;
+            float const *p2 = positions + indices[t*3+2]*positionStride;
+            float e1[3] = { p1[0]-p0[0], p1[1]-p0[1], p1[2]-p0[2] };
+            float e2[3] = { p2[0]-p0[0], p2[1]-p0[1], p2[2]-p0[2] };
+            float n[3] = { e1[1]*e2[2]-e1[2]*e2[1], e1[2]*e2[0]-e1[0]*e2[2], e1[0]*e2[1]-e1[1]*e2[0] };
+            float area = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+            for (int k=0; k<3; ++k) {
+                centroid[k] += (p0[k] + p1[k] + p2[k]) * (area / 3.0f);
+                normal[k] += n[k];
+            }
+            clusterArea += area;
+        }
+        for (int k=0; k<3; ++k) meshCentroid[k] += centroid[k];
+        meshArea += clusterArea;
+        if (clusterArea > 0.0f) {
+            for (int k=0; k<3; ++k) centroid[k] /= clusterArea;
+        }
+    }
+    if (meshArea > 0.0f) {
+        for (int k=0; k<3; ++k) meshCentroid[k] /= meshArea;
+    }
+
+    // the clusters facing outwards occlude the others
+    std::vector<float> sortKeys(clusterNumber, 0.0f);
+    for (size_t c=0; c<clusterNumber; ++c) {
+        float const *centroid = clusterData.data() + c*6;
+        float const *normal = centroid + 3;
+        float len = std::sqrt(normal[0]*normal[0] + normal[1]*normal[1] + normal[2]*normal[2]);
+        if (len <= 0.0f) continue;
+        sortKeys[c] = ((centroid[0]-meshCentroid[0])*normal[0] +
+                       (centroid[1]-meshCentroid[1])*normal[1] +
+                       (centroid[2]-meshCentroid[2])*normal[2]) / len;
+    }
+    std::vector<size_t> order(clusterNumber);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+
+    std::vector<unsigned int> output;
+    output.reserve(triNumber*3);
+    for (size_t c : order) {
+        output.insert(output.end(), indices + clusters[c]*3, indices + clusters[c+1]*3);
+    }
+    std::copy(output.begin(), output.end(), indices);
+}
+
+std::vector<unsigned int> optimize_vertex_fetch(unsigned int *indices, size_t indexNumber, unsigned int vertexNumber)
+{
+    std::vector<unsigned int> newIndices(vertexNumber, INVALID_INDEX);
+    std::vector<unsigned int> remap;
+    remap.reserve(vertexNumber);
+    for (size_t i=0; i<indexNumber; ++i) {
+        unsigned int &newIndex = newIndices[indices[i]];
+        if (newIndex == INVALID_INDEX) {
+            newIndex = static_cast<unsigned int>(remap.size());
+            remap.emplace_back(indices[i]);
+        }
+        indices[i] = newIndex;
+    }
+    return remap;
+}
+
+size_t simplify_mesh(unsigned int *indices, size_t indexNumber, float const *positions, size_t positionStride,
+                     unsigned int vertexNumber, size_t targetIndexNumber, float targetError, float *resultError)
+{
+    indexNumber = indexNumber / 3 * 3;
+    if (resultError) *resultError = 0.0f;
+    if (indexNumber <= targetIndexNumber || vertexNumber == 0) return indexNumber;
+
+    std::vector<std::uint8_t> locked = locked_vertices(indices, indexNumber, positions, positionStride, vertexNumber);
+
+    // the planes of the triangles around each vertex
+    Quadric const zero = { 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0, 0.0 };
+    std::vector<Quadric> quadrics(vertexNumber, zero);
+    for (size_t i=0; i<indexNumber; i+=3) {
+        float const *p0 = positions + indices[i]*positionStride;
+        double n[3];
+        triangle_normal(p0, positions + indices[i+1]*positionStride, positions + indices[i+2]*positionStride, n);
+        double len = std::sqrt(n[0]*n[0] + n[1]*n[1] + n[2]*n[2]);
+        if (len <= 0.0) continue;
+        n[0] /= len; n[1] /= len; n[2] /= len;
+        double d = -(n[0]*p0[0] + n[1]*p0[1] + n[2]*p0[2]);
+        for (int k=0; k<3; ++k) add_plane_quadric(quadrics[indices[i+k]], n, d, len*0.5);
+    }
+
+    struct Collapse
+    {
+        unsigned int source;
+        unsigned int target;
+        double error;   // squared distance
+    };
+
+    double errorLimit = static_cast<double>(targetError)*targetError;
+    double maxError = 0.0;
+    std::vector<unsigned int> remap(vertexNumber);
+    std::iota(remap.begin(), remap.end(), 0);
+    std::vector<std::uint64_t> edges;
+    std::vector<Collapse> collapses;
+    std::vector<unsigned int> triangleOffsets, vertexTriangles;
+    std::vector<std::uint8_t> touched;
+    while (indexNumber > targetIndexNumber) {
+        // the cheaper direction of each edge, the locked vertices stay
+        edges.clear();
+        for (size_t i=0; i<indexNumber; i+=3) {
+            for (int k=0; k<3; ++k) edges.push_back(edge_key(indices[i+k], indices[i+(k+1)%3]));
+        }
+        std::sort(edges.begin(), edges.end());
+        edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+        collapses.clear();
+        for (std::uint64_t edge : edges) {
+            unsigned int a = static_cast<unsigned int>(edge >> 32), b = static_cast<unsigned int>(edge & 0xffffffffu);
+            Quadric q = quadrics[a];
+            add_quadric(q, quadrics[b]);
+            double weight = q.weight > 0.0 ? q.weight : 1.0;
+            Collapse collapse = { a, b, std::numeric_limits<double>::max() };
+            if (!locked[a]) collapse.error = quadric_value(q, positions + b*positionStride) / weight;
+            if (!locked[b]) {
+                double error = quadric_value(q, positions + a*positionStride) / weight;
+                if (error < collapse.error) {
+                    collapse.source = b;
+                    collapse.target = a;
+                    collapse.error = error;
+                }
+            }
+            if ((!locked[a] || !locked[b]) && collapse.error <= errorLimit) collapses.push_back(collapse);
+        }
+        if (collapses.empty()) break;
+        std::sort(collapses.begin(), collapses.end(), [](Collapse const &a, Collapse const &b) { return a.error < b.error; });
+
+        // the triangles around each vertex, for checking the flips
+        triangleOffsets.assign(vertexNumber+1, 0);
+        for (size_t i=0; i<indexNumber; ++i) ++triangleOffsets[indices[i]+1];
+        std::partial_sum(triangleOffsets.begin(), triangleOffsets.end(), triangleOffsets.begin());
+        vertexTriangles.resize(indexNumber);
+        for (size_t i=0; i<indexNumber; ++i) vertexTriangles[triangleOffsets[indices[i]]++] = static_cast<unsigned int>(i/3);
+        for (unsigned int v=vertexNumber; v>0; --v) triangleOffsets[v] = triangleOffsets[v-1];
+        triangleOffsets[0] = 0;
+
+        // an interior edge collapse removes two triangles
+        size_t triangleGoal = (indexNumber - targetIndexNumber) / 3;
+        size_t removedTriangles = 0;
+        touched.assign(vertexNumber, 0);
+        for (Collapse const &collapse : collapses) {
+            if (removedTriangles >= triangleGoal) break;
+            if (touched[collapse.source] || touched[collapse.target]) continue;
+
+            float const *target = positions + collapse.target*positionStride;
+            bool flipped = false;
+            for (unsigned int t=triangleOffsets[collapse.source]; !flipped && t<triangleOffsets[collapse.source+1]; ++t) {
+                unsigned int const *tri = indices + vertexTriangles[t]*3;
+                if (tri[0] == collapse.target || tri[1] == collapse.target || tri[2] == collapse.target) continue;
+                float const *p[3], *q[3];
+                for (int k=0; k<3; ++k) {
+                    p[k] = positions + tri[k]*positionStride;
+                    q[k] = (tri[k] == collapse.source) ? target : p[k];
+                }
+                double before[3], after[3];
+                triangle_normal(p[0], p[1], p[2], before);
+                triangle_normal(q[0], q[1], q[2], after);
+                double dot = before[0]*after[0] + before[1]*after[1] + before[2]*after[2];
+                bool degenerate = before[0] == 0.0 && before[1] == 0.0 && before[2] == 0.0;
+                flipped = !degenerate && dot <= 0.0;
+            }
+            if (flipped) continue;
+
+            // the triangles around the source are changed, none of their vertices collapses again in this pass
+            for (unsigned int t=triangleOffsets[collapse.source]; t<triangleOffsets[collapse.source+1]; ++t) {
+                unsigned int const *tri = indices + vertexTriangles[t]*3;
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+            }
+            touched[collapse.target] = 1;
+            remap[collapse.source] = collapse.target;
+            add_quadric(quadrics[collapse.target], quadrics[collapse.source]);
+            maxError = std::max(maxError, collapse.error);
+            removedTriangles += 2;
+        }
+        if (removedTriangles == 0) break;
+
+        // drop the triangles degenerated by the collapses
+        size_t newIndexNumber = 0;
+        for (size_t i=0; i<indexNumber; i+=3) {
+            unsigned int a = remap[indices[i]], b = remap[indices[i+1]], c = remap[indices[i+2]];
+            if (a == b || b == c || a == c) continue;
+            indices[newIndexNumber++] = a;
+            indices[newIndexNumber++] = b;
+            indices[newIndexNumber++] = c;
+        }
+        indexNumber = newIndexNumber;
+    }
+
+    if (resultError) *resultError = static_cast<float>(std::sqrt(maxError));
+    return indexNumber;
+}
@@ -0,0 +1,308 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "OcclusionCuller.h"
+#include "OpenGLRenderableEntity.h"
+#include "RenderScene.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+
+#include "glm/vec4.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define OCCLUSIONCULLER_USE_SSE
+#   include <emmintrin.h>
+#endif
+
+// the tiles are rasterized independently by the workers (the width is a multiple of 4 for SSE)
+#define OCCLUSION_TILE_WIDTH 32
+#define OCCLUSION_TILE_HEIGHT 16
+
+OcclusionCuller::OcclusionCuller()
+{
+    mBufferWidth = 256;
+    mBufferHeight = 128;
+    mViewportAspect = 2.0f;
+    mMaxOccluderNumber = 32;
+    mMaxOccluderTriangles = 2048;
+    mMinOccluderSize = 0.05f;
+    mViewProjMatrix = glm::mat4x4(1.0f);
+    mOccluderNumber = 0;
+    mOccluderTriangleNumber = 0;
+    mOccludedInstanceNumber = 0;
+}
+
+void OcclusionCuller::setBufferWidth(int width)
+{
+    mBufferWidth = std::max(1, (width + OCCLUSION_TILE_WIDTH - 1) / OCCLUSION_TILE_WIDTH) * OCCLUSION_TILE_WIDTH;
+    int height = static_cast<int>(std::ceil(mBufferWidth / mViewportAspect));
+    mBufferHeight = std::max(1, (height + OCCLUSION_TILE_HEIGHT - 1) / OCCLUSION_TILE_HEIGHT) * OCCLUSION_TILE_HEIGHT;
+}
+
+void OcclusionCuller::setViewportSize(int width, int height)
+{
+    if (width <= 0 || height <= 0) return;
+    mViewportAspect = static_cast<float>(width) / height;
+    this->setBufferWidth(mBufferWidth);
+}
+
+void OcclusionCuller::renderOccluders(RenderScene const &scene, OpenGLRenderableEntityArray const &renderables,
+                                      std::vector<unsigned int> const &instances, glm::mat4x4 const &viewProjMat)
+{
+    mViewProjMatrix = viewProjMat;
+    mDepthBuffer.assign(static_cast<size_t>(mBufferWidth)*mBufferHeight, 1.0f);
+    int tileNum = (mBufferWidth/OCCLUSION_TILE_WIDTH) * (mBufferHeight/OCCLUSION_TILE_HEIGHT);
+    mTileMaxDepths.assign(tileNum, 1.0f);
+    mTileBins.resize(tileNum);
+    for (std::vector<unsigned int> &bin : mTileBins) bin.clear();
+    mTriangles.clear();
+    mOccluderNumber = 0;
+    mOccluderTriangleNumber = 0;
+
+    // the largest ones on the screen, by the radius of the bounds over the distance
+    std::vector<std::pair<float, unsigned int>> candidates;
+    for (unsigned int instance : instances) {
+        OpenGLRenderableEntityPtr const &re = renderables[scene.instanceMesh(instance)];
+        if (!re || !re->isDrawable() || re->triangleNumber() > mMaxOccluderTriangles) continue;
+        float const *b = scene.instanceBounds(instance);
+        glm::vec4 center((b[0]+b[1])*0.5f, (b[2]+b[3])*0.5f, (b[4]+b[5])*0.5f, 1.0f);
+        float w = (mViewProjMatrix * center).w;
+        if (w <= 0.0f) continue;
+        float dx = b[1]-b[0], dy = b[3]-b[2], dz = b[5]-b[4];
+        float size = std::sqrt(dx*dx + dy*dy + dz*dz) * 0.5f / w;
+        if (size >= mMinOccluderSize) candidates.emplace_back(size, instance);
+    }
+    size_t occluderNum = std::min(candidates.size(), static_cast<size_t>(std::max(mMaxOccluderNumber, 0)));
+    std::partial_sort(candidates.begin(), candidates.begin()+occluderNum, candidates.end(),
+                      [](std::pair<float, unsigned int> const &a, std::pair<float, unsigned int> const &b) {
+                          return a.first > b.first;
+                      });
+    if (occluderNum == 0) return;
+
+    // transform the occluders into the screen space in parallel
+    std::vector<std::vector<ScreenTriangle>> occluderTriangles(occluderNum);
+    std::vector<size_t> occluderIndices(occluderNum);
+    std::iota(occluderIndices.begin(), occluderIndices.end(), 0);
+    float const w = static_cast<float>(mBufferWidth), h = static_cast<float>(mBufferHeight);
+    QtConcurrent::blockingMap(occluderIndices, [&](size_t i) {
+        unsigned int instance = candidates[i].second;
+        OpenGLRenderableEntityPtr const &re = renderables[scene.instanceMesh(instance)];
+        glm::mat4x4 mvp = mViewProjMatrix * scene.worldMatrix(scene.instanceNode(instance));
+        std::vector<ScreenTriangle> &triangles = occluderTriangles[i];
+        triangles.reserve(re->triangleNumber());
+        unsigned int vertices[3];
+        for (unsigned int t = 0; t < re->triangleNumber(); ++t) {
+            re->triangleVertices(t, vertices);
+            glm::vec4 clip[3];
+            bool crossNear = false;
+            for (int k = 0; k < 3; ++k) {
+                clip[k] = mvp * glm::vec4(re->vertexPosition(vertices[k]), 1.0f);
+                if (clip[k].z < -clip[k].w || clip[k].w <= 0.0f) crossNear = true;
+            }
+            // left out without clipping, fewer occluders never cull wrong
+            if (crossNear) continue;
+            if ((clip[0].x > clip[0].w && clip[1].x > clip[1].w && clip[2].x > clip[2].w) ||
+                (clip[0].x < -clip[0].w && clip[1].x < -clip[1].w && clip[2].x < -clip[2].w) ||
+                (clip[0].y > clip[0].w && clip[1].y > clip[1].w && clip[2].y > clip[2].w) ||
+                (clip[0].y < -clip[0].w && clip[1].y < -clip[1].w && clip[2].y < -clip[2].w)) continue;
+            ScreenTriangle st;
+            for (int k = 0; k < 3; ++k) {
+                float invW = 1.0f / clip[k].w;
+                st.x[k] = (clip[k].x * invW * 0.5f + 0.5f) * w;
+                st.y[k] = (clip[k].y * invW * 0.5f + 0.5f) * h;
+                st.z[k] = clip[k].z * invW * 0.5f + 0.5f;
+            }
+            triangles.push_back(st);
+        }
+    });
+
+    // bin the triangles to the tiles they overlap
+    int tilesX = mBufferWidth / OCCLUSION_TILE_WIDTH;
+    int tilesY = mBufferHeight / OCCLUSION_TILE_HEIGHT;
+    for (std::vector<ScreenTriangle> const &triangles : occluderTriangles) {
+        for (ScreenTriangle const &st : triangles) {
+            float minX = std::min(st.x[0], std::min(st.x[1], st.x[2]));
+            float maxX = std::max(st.x[0], std::max(st.x[1], st.x[2]));
+            float minY = std::min(st.y[0], std::min(st.y[1], st.y[2]));
+            float maxY = std::max(st.y[0], std::max(st.y[1], st.y[2]));
+            int tx0 = std::max(0, static_cast<int>(std::floor(minX)) / OCCLUSION_TILE_WIDTH);
+            int tx1 = std::min(tilesX-1, static_cast<int>(std::floor(maxX)) / OCCLUSION_TILE_WIDTH);
+            int ty0 = std::max(0, static_cast<int>(std::floor(minY)) / OCCLUSION_TILE_HEIGHT);
+            int ty1 = std::min(tilesY-1, static_cast<int>(std::floor(maxY)) / OCCLUSION_TILE_HEIGHT);
+            if (tx0 > tx1 || ty0 > ty1) continue;
+            unsigned int index = static_cast<unsigned int>(mTriangles.size());
+            mTriangles.push_back(st);
+            for (int ty = ty0; ty <= ty1; ++ty) {
+                for (int tx = tx0; tx <= tx1; ++tx) {
+                    mTileBins[ty*tilesX+tx].push_back(index);
+                }
+            }
+        }
+    }
+    mOccluderNumber = occluderNum;
+    mOccluderTriangleNumber = mTriangles.size();
+
+    std::vector<int> tiles(tileNum);
+    std::iota(tiles.begin(), tiles.end(), 0);
+    QtConcurrent::blockingMap(tiles, [this](int tile) {
+        this->rasterizeTile(tile);
+    });
+}
+
+void OcclusionCuller::rasterizeTile(int tile)
+{
+    int tilesX = mBufferWidth / OCCLUSION_TILE_WIDTH;
+    int tileX0 = (tile % tilesX) * OCCLUSION_TILE_WIDTH;
+    int tileY0 = (tile / tilesX) * OCCLUSION_TILE_HEIGHT;
+    int tileX1 = tileX0 + OCCLUSION_TILE_WIDTH - 1;
+    int tileY1 = tileY0 + OCCLUSION_TILE_HEIGHT - 1;
+
+    for (unsigned int index : mTileBins[tile]) {
+        ScreenTriangle const &st = mTriangles[index];
+        float x0 = st.x[0], y0 = st.y[0], z0 = st.z[0];
+        float x1 = st.x[1], y1 = st.y[1], z1 = st.z[1];
+        float x2 = st.x[2], y2 = st.y[2], z2 = st.z[2];
+        float area = (x1-x0)*(y2-y0) - (x2-x0)*(y1-y0);
+        // both sides are taken, counter-clockwise from now on
+        if (area < 0.0f) {
+            std::swap(x1, x2);
+            std::swap(y1, y2);
+            std::swap(z1, z2);
+            area = -area;
+        }
+        if (!(area > 0.0f)) continue;
+
+        int minX = std::max(tileX0, static_cast<int>(std::floor(std::min(x0, std::min(x1, x2)))));
+        int maxX = std::min(tileX1, static_cast<int>(std::floor(std::max(x0, std::max(x1, x2)))));
+        int minY = std::max(tileY0, static_cast<int>(std::floor(std::min(y0, std::min(y1, y2)))));
+        int maxY = std::min(tileY1, static_cast<int>(std::floor(std::max(y0, std::max(y1, y2)))));
+        if (minX > maxX || minY > maxY) continue;
+
+        // edge functions a*x+b*y+c, non-negative inside, and the depth plane
+        float a0 = y0-y1, b0 = x1-x0, c0 = x0*y1 - x1*y0;
+        float a1 = y1-y2, b1 = x2-x1, c1 = x1*y2 - x2*y1;
+        float a2 = y2-y0, b2 = x0-x2, c2 = x2*y0 - x0*y2;
+        float invArea = 1.0f / area;
+        float za = ((z1-z0)*(y2-y0) - (z2-z0)*(y1-y0)) * invArea;
+        float zb = ((z2-z0)*(x1-x0) - (z1-z0)*(x2-x0)) * invArea;
+        float zc = z0 - za*x0 - zb*y0;
+
+        minX &= ~3; // whole groups of 4 pixels, still within the tile
+        for (int py = minY; py <= maxY; ++py) {
+            float cy = py + 0.5f;
+            float *row = &mDepthBuffer[static_cast<size_t>(py)*mBufferWidth];
+#ifdef OCCLUSIONCULLER_USE_SSE
+            __m128 offsets = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+            __m128 zero = _mm_setzero_ps();
+            __m128 e0y = _mm_set1_ps(b0*cy + c0), e1y = _mm_set1_ps(b1*cy + c1), e2y = _mm_set1_ps(b2*cy + c2);
+            __m128 zy = _mm_set1_ps(zb*cy + zc);
+            for (int px = minX; px <= maxX; px += 4) {
+                __m128 cx = _mm_add_ps(_mm_set1_ps(static_cast<float>(px)), offsets);
+                __m128 e0 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a0), cx), e0y);
+                __m128 e1 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a1), cx), e1y);
+                __m128 e2 = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(a2), cx), e2y);
+                __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+                if (_mm_movemask_ps(inside) == 0) continue;
+                __m128 z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(za), cx), zy);
+                __m128 old = _mm_loadu_ps(row + px);
+                __m128 nearer = _mm_min_ps(old, z);
+                _mm_storeu_ps(row + px, _mm_or_ps(_mm_and_ps(inside, nearer), _mm_andnot_ps(inside, old)));
+            }
+#else
+            for (int px = minX; px <= maxX; ++px) {
+                float cx = px + 0.5f;
+                if (a0*cx + b0*cy + c0 < 0.0f || a1*cx + b1*cy + c1 < 0.0f || a2*cx + b2*cy + c2 < 0.0f) continue;
+                float z = za*cx + zb*cy + zc;
+                if (z < row[px]) row[px] = z;
+            }
+#endif
+        }
+    }
+
+    float maxDepth = 0.0f;
+    for (int py = tileY0; py <= tileY1; ++py) {
+        float const *row = &mDepthBuffer[static_cast<size_t>(py)*mBufferWidth];
+        for (int px = tileX0; px <= tileX1; ++px) {
+            maxDepth = std::max(maxDepth, row[px]);
+        }
+    }
+    mTileMaxDepths[tile] = maxDepth;
+}
+
+bool OcclusionCuller::isOccluded(float const *bounds) const
+{
+    if (mTriangles.empty() || bounds[0] > bounds[1]) return false;
+
+    float minX = static_cast<float>(mBufferWidth), maxX = 0.0f;
+    float minY = static_cast<float>(mBufferHeight), maxY = 0.0f;
+    float minZ = 1.0f;
+    for (int i = 0; i < 8; ++i) {
+        glm::vec4 clip = mViewProjMatrix * glm::vec4(bounds[(i&1)], bounds[2+((i>>1)&1)], bounds[4+((i>>2)&1)], 1.0f);
+        // crossing the near plane
+        if (clip.w <= 0.0f || clip.z < -clip.w) return false;
+        float invW = 1.0f / clip.w;
+        float x = (clip.x * invW * 0.5f + 0.5f) * mBufferWidth;
+        float y = (clip.y * invW * 0.5f + 0.5f) * mBufferHeight;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        minZ = std::min(minZ, clip.z * invW * 0.5f + 0.5f);
+    }
+
+    int px0 = std::max(0, static_cast<int>(std::floor(minX)));
+    int px1 = std::min(mBufferWidth-1, static_cast<int>(std::floor(maxX)));
+    int py0 = std::max(0, static_cast<int>(std::floor(minY)));
+    int py1 = std::min(mBufferHeight-1, static_cast<int>(std::floor(maxY)));
+    if (px0 > px1 || py0 > py1) return false;
+
+    // the tiles entirely nearer than the bounds are skipped, the others are looked into
+    int tilesX = mBufferWidth / OCCLUSION_TILE_WIDTH;
+    for (int ty = py0/OCCLUSION_TILE_HEIGHT; ty <= py1/OCCLUSION_TILE_HEIGHT; ++ty) {
+        for (int tx = px0/OCCLUSION_TILE_WIDTH; tx <= px1/OCCLUSION_TILE_WIDTH; ++tx) {
+            if (mTileMaxDepths[ty*tilesX+tx] < minZ) continue;
+            int x0 = std::max(px0, tx*OCCLUSION_TILE_WIDTH);
+            int x1 = std::min(px1, tx*OCCLUSION_TILE_WIDTH + OCCLUSION_TILE_WIDTH - 1);
+            int y0 = std::max(py0, ty*OCCLUSION_TILE_HEIGHT);
+            int y1 = std::min(py1, ty*OCCLUSION_TILE_HEIGHT + OCCLUSION_TILE_HEIGHT - 1);
+            for (int py = y0; py <= y1; ++py) {
+                float const *row = &mDepthBuffer[static_cast<size_t>(py)*mBufferWidth];
+                for (int px = x0; px <= x1; ++px) {
+                    if (row[px] >= minZ) return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+void OcclusionCuller::cullInstances(RenderScene const &scene, std::vector<unsigned int> &instances)
+{
+    size_t number = instances.size();
+    instances.erase(std::remove_if(instances.begin(), instances.end(), [&](unsigned int instance) {
+        return this->isOccluded(scene.instanceBounds(instance));
+    }), instances.end());
+    mOccludedInstanceNumber = number - instances.size();
+}
@@ -34,7 +34,7 @@ OpenGLMaterialEntity::OpenGLMaterialEntity()
     this->setSpecular(0.5f, 0.5f, 0.5f, 1.0f);
     this->setEmission(0.0f, 0.0f, 0.0f, 0.0f);
     this->setShininess(50.0f);
-    mDiffuseTexture = nullptr;
+    mDiffuseTextureHasAlpha = false;
     mOpenGLContext = nullptr;
     mIsValid = true;
 }
@@ -52,7 +52,8 @@ void OpenGLMaterialEntity::destroyGL(QOpenGLContext const *glCtx)
         return;
     }
     mOpenGLContext = nullptr;
-    DELETE_OPENGL_RESOURCE(mDiffuseTexture);
+    mDiffuseTexture.reset(); // released by the last material using it
+    mDiffuseTextureHasAlpha = false;
     mIsValid = false;
 
 }
@@ -87,18 +88,6 @@ void OpenGLMaterialEntity::setShininess(GLfloat s)
     mShininess = s;
 }
 
-QOpenGLTexture * load_texture(QOpenGLTexture *tex, QString const &imageFilePath)
-{
-    QImage img = QImage(imageFilePath).mirrored();
-    if (!tex) {
-        tex = new QOpenGLTexture(img);
-    } else {
-        tex->destroy();
-        tex->setData(img);
-    }
-    return tex;
-}
-
 bool OpenGLMaterialEntity::loadDiffuseTexture(QOpenGLContext const *glCtx, QString const &imageFilePath)
 {
     if (glCtx == nullptr) {
@@ -112,15 +101,13 @@ bool OpenGLMaterialEntity::loadDiffuseTexture(QOpenGLContext const *glCtx, QStri
         mOpenGLContext = glCtx;
     }
 
-    mDiffuseTexture = load_texture(mDiffuseTexture, imageFilePath);
-    if (!mDiffuseTexture || !mDiffuseTexture->isCreated() || !mDiffuseTexture->isStorageAllocated()) return false;
-
-    mDiffuseTexture->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
-    mDiffuseTexture->setMagnificationFilter(QOpenGLTexture::Linear);
-    return true;
+    // the texture object may be shared with other materials, thus never modified here
+    mDiffuseTextureHasAlpha = false;
+    mDiffuseTexture = TextureCache::instance(glCtx)->texture(imageFilePath, &mDiffuseTextureHasAlpha);
+    return this->diffuseTextureReady();
 }
 
-bool OpenGLMaterialEntity::loadData(QOpenGLContext const *glCtx, aiMaterial const *material, QString const &textureFilePath)
+bool OpenGLMaterialEntity::loadData(aiMaterial const *material, QString const &textureFilePath)
 {
     mIsValid = false;
 
@@ -140,7 +127,22 @@ bool OpenGLMaterialEntity::loadData(QOpenGLContext const *glCtx, aiMaterial cons
 
     aiString texFilePath;
     if (material->GetTexture(aiTextureType_DIFFUSE, 0, &texFilePath) == aiReturn_SUCCESS) {
-        if (!this->loadDiffuseTexture(glCtx, QDir(textureFilePath).absoluteFilePath(texFilePath.C_Str()))) {
+        mDiffuseTextureFilePath = QDir(textureFilePath).absoluteFilePath(texFilePath.C_Str());
+    } else {
+        mDiffuseTextureFilePath.clear();
+    }
+
+    mIsValid = true;
+    return mIsValid;
+}
+
+bool OpenGLMaterialEntity::uploadData(QOpenGLContext const *glCtx)
+{
+    if (!mIsValid) return false;
+
+    if (!mDiffuseTextureFilePath.isEmpty()) {
+        if (!this->loadDiffuseTexture(glCtx, mDiffuseTextureFilePath)) {
+            mIsValid = false;
             return false;
         }
         LOG_INFO("diffuse map texture loaded.");
@@ -148,11 +150,10 @@ bool OpenGLMaterialEntity::loadData(QOpenGLContext const *glCtx, aiMaterial cons
         LOG_INFO("no diffuse map texture.");
     }
 
-    mIsValid = true;
-    return mIsValid;
+    return true;
 }
 
-inline bool check_texture(QOpenGLTexture *tex)
+inline bool check_texture(OpenGLTexturePtr const &tex)
 {
     return (tex && tex->isCreated() && tex->isStorageAllocated());
 }
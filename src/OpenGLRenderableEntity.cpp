@@ -24,20 +24,62 @@
 #include <QOpenGLVertexArrayObject>
 #include <QOpenGLBuffer>
 #include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
 
 #include "AssimpHelper.h"
 #include "LogUtils.h"
 #include "GLUtils.h"
+#include "VertexFormat.h"
+#include "MeshOptimizer.h"
+#include "BoundingVolumeHierarchy.h"
+
+#include "glm/geometric.hpp"
+#include "glm/gtc/matrix_transform.hpp"
+
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <limits>
+
+// vertices addressable by 16-bit indices
+static unsigned int const MAX_SHORT_INDEX_VERTICES = 65536;
+
+template <typename T>
+inline void collect_triangle_indices(aiMesh const *mesh, std::vector<T> &indices)
+{
+    indices.reserve(mesh->mNumFaces*3);
+    for (unsigned int i = 0; i < mesh->mNumFaces; ++i) {
+        if (mesh->mFaces[i].mNumIndices != 3) continue; // ignore non-triangle face
+        indices.emplace_back(static_cast<T>(mesh->mFaces[i].mIndices[0]));
+        indices.emplace_back(static_cast<T>(mesh->mFaces[i].mIndices[1]));
+        indices.emplace_back(static_cast<T>(mesh->mFaces[i].mIndices[2]));
+    }
+}
+
+template <typename T>
+inline bool check_section_indices(std::vector<T> const &indexData, RenderableSection const &section, unsigned int vertexNumber)
+{
+    for (unsigned int i = 0; i < section.indexNumber; ++i) {
+        if (indexData[section.indexOffset+i] >= vertexNumber) return false;
+    }
+    return true;
+}
 
 OpenGLRenderableEntity::OpenGLRenderableEntity()
 {
-    mTriangleVAO = nullptr;
     mVertexBuffer = nullptr;
     mTriangleBuffer = nullptr;
     mOpenGLContext = nullptr;
+    mGeometryArena = nullptr;
+    mSourceMesh = nullptr;
+    mExternalVertexData = nullptr;
+    mVertexNumber = 0;
+    mTriangleNumber = 0;
+    mIndexType = GL_UNSIGNED_INT;
     mCenter[0] = mCenter[1] = mCenter[2] = 0.0f;
     mBounds[0] = mBounds[1] = mBounds[2] = mBounds[3] = mBounds[4] = mBounds[5] = 0.0f;
-    mComponentsPerVertex = 0;
+    mVertexLayout = VERTEX_LAYOUT_FLOAT;
+    mVertexStride = 0;
     mHasNormal = false;
     mHasTexCoords = false;
     mOpenGLSetup = false;
@@ -49,29 +91,7 @@ OpenGLRenderableEntity::~OpenGLRenderableEntity()
 {
 }
 
-inline void add_vector_2d(VertexDataBuffer &vbuf, aiVector2D const &v) {
-    vbuf.emplace_back(v.x);
-    vbuf.emplace_back(v.y);
-}
-
-inline void add_vector_2d(VertexDataBuffer &vbuf, aiVector3D const &v) {
-    vbuf.emplace_back(v.x);
-    vbuf.emplace_back(v.y);
-}
-
-inline void add_vector_3d(VertexDataBuffer &vbuf, aiVector3D const &v) {
-    vbuf.emplace_back(v.x);
-    vbuf.emplace_back(v.y);
-    vbuf.emplace_back(v.z);
-}
-
-inline void add_vector(VertexDataBuffer &vbuf, aiVector3D const &v, unsigned int compNum) {
-    if (compNum >= 1) vbuf.emplace_back(v.x);
-    if (compNum >= 2) vbuf.emplace_back(v.y);
-    if (compNum >= 3) vbuf.emplace_back(v.z);
-}
-
-bool OpenGLRenderableEntity::loadData(QOpenGLContext const *glCtx, aiMesh const *mesh)
+bool OpenGLRenderableEntity::loadData(aiMesh const *mesh, bool splitForShortIndices, VertexLayout vertexLayout)
 {
     if (mesh == nullptr) {
         return false;
@@ -89,39 +109,50 @@ bool OpenGLRenderableEntity::loadData(QOpenGLContext const *glCtx, aiMesh const
 
     this->clearData();
 
-    mComponentsPerVertex = 3;
-
     mHasNormal = (mesh->mNormals != nullptr);
-    if (mHasNormal) mComponentsPerVertex += 3;
 
     unsigned int texNum = mesh->GetNumUVChannels();
     mHasTexCoords = (texNum > 0);
     mTextureComponents.clear();
     for (unsigned int i=0; i<texNum; ++i) {
         mTextureComponents.emplace_back(mesh->mNumUVComponents[i]);
-        mComponentsPerVertex += mTextureComponents[i];
     }
 
+    // the vertex data is interleaved directly into the OpenGL buffer when uploading
+    mSourceMesh = mesh;
     mVertexNumber = mesh->mNumVertices;
-    for (unsigned int i = 0; i < mVertexNumber; ++i) {
-        add_vector_3d(mVertexData, mesh->mVertices[i]);
-
-        if (mHasNormal) add_vector_3d(mVertexData, mesh->mNormals[i].NormalizeSafe());
-
-        for (size_t ti=0; ti<mTextureComponents.size(); ++ti) {
-            add_vector(mVertexData, mesh->mTextureCoords[ti][i], mTextureComponents[ti]);
-        }
+    mVertexLayout = vertexLayout;
+    if (mVertexLayout == VERTEX_LAYOUT_COMPACT) {
+        mVertexStride = compact_vertex_stride(mesh);
+    } else {
+        mVertexStride = interleaved_components(mesh)*sizeof(float);
     }
 
-    for (unsigned int i = 0; i < mesh->mNumFaces; ++i) {
-        if (mesh->mFaces[i].mNumIndices != 3) continue; // ignore non-triangle face
-        mIndexData.emplace_back(mesh->mFaces[i].mIndices[0]);
-        mIndexData.emplace_back(mesh->mFaces[i].mIndices[1]);
-        mIndexData.emplace_back(mesh->mFaces[i].mIndices[2]);
+    if (mVertexNumber <= MAX_SHORT_INDEX_VERTICES) {
+        mIndexType = GL_UNSIGNED_SHORT;
+        collect_triangle_indices(mesh, mShortIndexData);
+        mTriangleNumber = mShortIndexData.size() / 3;
+    } else if (splitForShortIndices) {
+        this->splitSections(mesh);
+    } else {
+        mIndexType = GL_UNSIGNED_INT;
+        collect_triangle_indices(mesh, mIndexData);
+        mTriangleNumber = mIndexData.size() / 3;
+    }
+    if (mSections.empty()) {
+        RenderableSection section = { 0, mTriangleNumber*3, 0, mVertexNumber };
+        mSections.emplace_back(section);
     }
-    mTriangleNumber = mIndexData.size() / 3;
+
+    this->computeBounds(mesh);
 
     mDataLoaded = true;
+    return mDataLoaded;
+}
+
+bool OpenGLRenderableEntity::uploadData(QOpenGLContext const *glCtx)
+{
+    if (!mDataLoaded) return false;
     if (!this->setupGL(glCtx)) return false;
 
     mBufferSetup = false;
@@ -129,43 +160,508 @@ bool OpenGLRenderableEntity::loadData(QOpenGLContext const *glCtx, aiMesh const
     return this->setupBuffers();
 }
 
+void OpenGLRenderableEntity::splitSections(aiMesh const *mesh)
+{
+    // greedily gather the triangles into sections in their original order, each
+    // section takes its own copy of the vertices it refers to
+    unsigned int const unmapped = std::numeric_limits<unsigned int>::max();
+    std::vector<unsigned int> localIndices(mesh->mNumVertices, unmapped);
+    mIndexType = GL_UNSIGNED_SHORT;
+    mShortIndexData.reserve(mesh->mNumFaces*3);
+    mVertexRemap.reserve(mesh->mNumVertices);
+
+    RenderableSection section = { 0, 0, 0, 0 };
+    for (unsigned int i = 0; i < mesh->mNumFaces; ++i) {
+        if (mesh->mFaces[i].mNumIndices != 3) continue; // ignore non-triangle face
+        unsigned int const *tri = mesh->mFaces[i].mIndices;
+
+        unsigned int newVertices = 0;
+        for (unsigned int k = 0; k < 3; ++k) {
+            bool repeated = (k > 0 && tri[k] == tri[0]) || (k > 1 && tri[k] == tri[1]);
+            if (localIndices[tri[k]] == unmapped && !repeated) ++newVertices;
+        }
+        if (section.vertexNumber + newVertices > MAX_SHORT_INDEX_VERTICES) {
+            mSections.emplace_back(section);
+            for (size_t v = section.vertexOffset; v < mVertexRemap.size(); ++v) {
+                localIndices[mVertexRemap[v]] = unmapped;
+            }
+            section.indexOffset = static_cast<unsigned int>(mShortIndexData.size());
+            section.indexNumber = 0;
+            section.vertexOffset = static_cast<unsigned int>(mVertexRemap.size());
+            section.vertexNumber = 0;
+        }
+
+        for (unsigned int k = 0; k < 3; ++k) {
+            unsigned int &localIndex = localIndices[tri[k]];
+            if (localIndex == unmapped) {
+                localIndex = section.vertexNumber++;
+                mVertexRemap.emplace_back(tri[k]);
+            }
+            mShortIndexData.emplace_back(static_cast<unsigned short>(localIndex));
+        }
+        section.indexNumber += 3;
+    }
+    if (section.indexNumber > 0) mSections.emplace_back(section);
+
+    mVertexNumber = static_cast<unsigned int>(mVertexRemap.size());
+    mTriangleNumber = mShortIndexData.size() / 3;
+}
+
+bool OpenGLRenderableEntity::loadData(RenderableDataView const &data, std::shared_ptr<void const> const &dataOwner)
+{
+    if (data.vertexData == nullptr || data.indexData == nullptr) {
+        return false;
+    }
+
+    if (data.indexSize != sizeof(unsigned short) && data.indexSize != sizeof(unsigned int)) {
+        LOG_ERROR("Unsupported index size!");
+        return false;
+    }
+
+    if (data.vertexStride == 0 || data.vertexStride < vertex_stride(data.vertexLayout, data.hasNormal, data.textureComponents.data(),
+                                                                    static_cast<unsigned int>(data.textureComponents.size()))) {
+        LOG_ERROR("Invalid vertex stride!");
+        return false;
+    }
+
+    if (data.vertexNumber <= 0) {
+        LOG_ERROR("0 vertices in mesh!");
+        return false;
+    }
+
+    if (data.indexNumber < 3) {
+        LOG_ERROR("0 triangle face in mesh!");
+        return false;
+    }
+
+    if (data.indexDataNumber < data.indexNumber) {
+        LOG_ERROR("Invalid index data of mesh!");
+        return false;
+    }
+
+    this->clearData();
+
+    mHasNormal = data.hasNormal;
+    mTextureComponents = data.textureComponents;
+    mHasTexCoords = !mTextureComponents.empty();
+
+    mExternalVertexData = data.vertexData;
+    mExternalDataOwner = dataOwner;
+    mVertexNumber = data.vertexNumber;
+    mVertexLayout = data.vertexLayout;
+    mVertexStride = data.vertexStride;
+
+    unsigned int indexNumber = data.indexNumber/3*3;
+    mTriangleNumber = indexNumber / 3;
+
+    mSections = data.sections;
+    if (mSections.empty()) {
+        RenderableSection section = { 0, indexNumber, 0, mVertexNumber };
+        mSections.emplace_back(section);
+    }
+    for (RenderableSection const &section : mSections) {
+        bool valid = (static_cast<quint64>(section.indexOffset) + section.indexNumber <= indexNumber) &&
+                     (static_cast<quint64>(section.vertexOffset) + section.vertexNumber <= mVertexNumber) &&
+                     (data.indexSize != sizeof(unsigned short) || section.vertexNumber <= MAX_SHORT_INDEX_VERTICES);
+        if (!valid) {
+            LOG_ERROR("Invalid section of mesh!");
+            this->clearData();
+            return false;
+        }
+    }
+
+    // each level has the sections of the full detail, with the indices after them
+    mLevels = data.levels;
+    bool levelsValid = mLevels.size() < MAX_RENDERABLE_LEVELS;
+    for (RenderableLevel const &level : mLevels) {
+        levelsValid = levelsValid && level.sections.size() == mSections.size();
+        for (size_t i = 0; levelsValid && i < level.sections.size(); ++i) {
+            RenderableSection const &section = level.sections[i];
+            levelsValid = section.indexOffset >= indexNumber && section.indexNumber % 3 == 0 &&
+                          static_cast<quint64>(section.indexOffset) + section.indexNumber <= data.indexDataNumber &&
+                          section.vertexOffset == mSections[i].vertexOffset && section.vertexNumber == mSections[i].vertexNumber;
+        }
+    }
+    if (!levelsValid) {
+        LOG_ERROR("Invalid levels of detail of mesh!");
+        this->clearData();
+        return false;
+    }
+
+    // copied only once all the sections are known to be within the index data, the
+    // indices of the levels follow those of the full detail
+    mIndexType = data.indexSize == sizeof(unsigned short) ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+    if (mIndexType == GL_UNSIGNED_SHORT) {
+        unsigned short const *indexData = static_cast<unsigned short const *>(data.indexData);
+        mShortIndexData.assign(indexData, indexData + data.indexDataNumber);
+    } else {
+        unsigned int const *indexData = static_cast<unsigned int const *>(data.indexData);
+        mIndexData.assign(indexData, indexData + data.indexDataNumber);
+    }
+
+    // every index must refer to a vertex of its section, the levels have the vertices of the full detail
+    bool indicesValid = true;
+    for (size_t i = 0; indicesValid && i < mSections.size(); ++i) {
+        RenderableSection const &section = mSections[i];
+        indicesValid = mIndexType == GL_UNSIGNED_SHORT ? check_section_indices(mShortIndexData, section, section.vertexNumber)
+                                                       : check_section_indices(mIndexData, section, section.vertexNumber);
+        for (size_t li = 0; indicesValid && li < mLevels.size(); ++li) {
+            RenderableSection const &levelSection = mLevels[li].sections[i];
+            indicesValid = mIndexType == GL_UNSIGNED_SHORT ? check_section_indices(mShortIndexData, levelSection, section.vertexNumber)
+                                                           : check_section_indices(mIndexData, levelSection, section.vertexNumber);
+        }
+    }
+    if (!indicesValid) {
+        LOG_ERROR("Index out of the vertices of mesh!");
+        this->clearData();
+        return false;
+    }
+
+    std::copy(data.bounds, data.bounds+6, mBounds);
+    mCenter[0] = (mBounds[0] + mBounds[1]) * 0.5f;
+    mCenter[1] = (mBounds[2] + mBounds[3]) * 0.5f;
+    mCenter[2] = (mBounds[4] + mBounds[5]) * 0.5f;
+
+    mDataLoaded = true;
+    return mDataLoaded;
+}
+
+template <typename T>
+inline void read_section_indices(std::vector<T> const &indexData, RenderableSection const &section, std::vector<unsigned int> &indices)
+{
+    indices.assign(indexData.begin() + section.indexOffset, indexData.begin() + section.indexOffset + section.indexNumber);
+}
+
+template <typename T>
+inline void write_section_indices(std::vector<unsigned int> const &indices, RenderableSection const &section, std::vector<T> &indexData)
+{
+    for (size_t i = 0; i < indices.size(); ++i) {
+        indexData[section.indexOffset + i] = static_cast<T>(indices[i]);
+    }
+}
+
+bool OpenGLRenderableEntity::optimizeMesh(float *acmrBefore, float *acmrAfter)
+{
+    if (!mDataLoaded || mSourceMesh == nullptr) return false;
+    // the levels refer to the vertices before reordering
+    this->clearLevelsOfDetail();
+
+    std::vector<unsigned int> vertexRemap;
+    vertexRemap.reserve(mVertexNumber);
+    std::vector<unsigned int> indices;
+    std::vector<float> positions;
+    double missesBefore = 0.0, missesAfter = 0.0;
+    for (RenderableSection &section : mSections) {
+        if (mIndexType == GL_UNSIGNED_INT) read_section_indices(mIndexData, section, indices);
+        else read_section_indices(mShortIndexData, section, indices);
+
+        // positions of the vertices of the section, from the source mesh
+        positions.resize(static_cast<size_t>(section.vertexNumber)*3);
+        for (unsigned int v = 0; v < section.vertexNumber; ++v) {
+            unsigned int sv = section.vertexOffset + v;
+            aiVector3D const &p = mSourceMesh->mVertices[mVertexRemap.empty() ? sv : mVertexRemap[sv]];
+            positions[v*3] = p.x;
+            positions[v*3+1] = p.y;
+            positions[v*3+2] = p.z;
+        }
+
+        size_t triNumber = indices.size() / 3;
+        missesBefore += compute_acmr(indices.data(), indices.size(), section.vertexNumber) * triNumber;
+        optimize_vertex_cache(indices.data(), indices.size(), section.vertexNumber);
+        optimize_overdraw(indices.data(), indices.size(), positions.data(), 3, section.vertexNumber);
+        std::vector<unsigned int> fetchRemap = optimize_vertex_fetch(indices.data(), indices.size(), section.vertexNumber);
+        missesAfter += compute_acmr(indices.data(), indices.size(), static_cast<unsigned int>(fetchRemap.size())) * triNumber;
+
+        if (mIndexType == GL_UNSIGNED_INT) write_section_indices(indices, section, mIndexData);
+        else write_section_indices(indices, section, mShortIndexData);
+
+        // the vertices of the sections are gathered from the source mesh while uploading
+        unsigned int vertexOffset = static_cast<unsigned int>(vertexRemap.size());
+        for (unsigned int v : fetchRemap) {
+            unsigned int sv = section.vertexOffset + v;
+            vertexRemap.emplace_back(mVertexRemap.empty() ? sv : mVertexRemap[sv]);
+        }
+        section.vertexOffset = vertexOffset;
+        section.vertexNumber = static_cast<unsigned int>(fetchRemap.size());
+    }
+    mVertexRemap.swap(vertexRemap);
+    mVertexNumber = static_cast<unsigned int>(mVertexRemap.size());
+    // the source order is kept, the vertices are written straight from the mesh
+    bool identity = mVertexNumber == mSourceMesh->mNumVertices;
+    for (unsigned int v = 0; identity && v < mVertexNumber; ++v) {
+        identity = mVertexRemap[v] == v;
+    }
+    if (identity) mVertexRemap.clear();
+
+    if (acmrBefore) *acmrBefore = mTriangleNumber > 0 ? static_cast<float>(missesBefore / mTriangleNumber) : 0.0f;
+    if (acmrAfter) *acmrAfter = mTriangleNumber > 0 ? static_cast<float>(missesAfter / mTriangleNumber) : 0.0f;
+    return true;
+}
+
+unsigned int OpenGLRenderableEntity::buildLevelsOfDetail(unsigned int maxLevelNumber, unsigned int minTriangleNumber)
+{
+    this->clearLevelsOfDetail();
+    if (!mDataLoaded || mTriangleNumber < minTriangleNumber) return 0;
+    maxLevelNumber = std::min(maxLevelNumber, static_cast<unsigned int>(MAX_RENDERABLE_LEVELS-1));
+
+    std::vector<std::vector<unsigned int>> sectionIndices(mSections.size());
+    std::vector<std::vector<float>> sectionPositions(mSections.size());
+    for (size_t s = 0; s < mSections.size(); ++s) {
+        RenderableSection const &section = mSections[s];
+        if (mIndexType == GL_UNSIGNED_INT) read_section_indices(mIndexData, section, sectionIndices[s]);
+        else read_section_indices(mShortIndexData, section, sectionIndices[s]);
+        std::vector<float> &positions = sectionPositions[s];
+        positions.resize(static_cast<size_t>(section.vertexNumber)*3);
+        for (unsigned int v = 0; v < section.vertexNumber; ++v) {
+            glm::vec3 p = this->vertexPosition(section.vertexOffset + v);
+            positions[v*3] = p.x;
+            positions[v*3+1] = p.y;
+            positions[v*3+2] = p.z;
+        }
+    }
+
+    // each level is simplified from the previous one
+    size_t previousIndexNumber = this->indexNumber();
+    float error = 0.0f;
+    while (mLevels.size() < maxLevelNumber) {
+        size_t levelIndexNumber = 0;
+        float levelError = 0.0f;
+        for (size_t s = 0; s < mSections.size(); ++s) {
+            std::vector<unsigned int> &indices = sectionIndices[s];
+            float sectionError = 0.0f;
+            size_t targetIndexNumber = indices.size() / 6 * 3;
+            indices.resize(simplify_mesh(indices.data(), indices.size(), sectionPositions[s].data(), 3, mSections[s].vertexNumber,
+                                         targetIndexNumber, std::numeric_limits<float>::max(), &sectionError));
+            optimize_vertex_cache(indices.data(), indices.size(), mSections[s].vertexNumber);
+            levelIndexNumber += indices.size();
+            levelError = std::max(levelError, sectionError);
+        }
+        if (levelIndexNumber == 0 || levelIndexNumber*4 > previousIndexNumber*3) break;
+        previousIndexNumber = levelIndexNumber;
+        error += levelError;
+
+        RenderableLevel level;
+        level.error = error;
+        for (size_t s = 0; s < mSections.size(); ++s) {
+            RenderableSection section = mSections[s];
+            section.indexOffset = this->indexDataNumber();
+            section.indexNumber = static_cast<unsigned int>(sectionIndices[s].size());
+            if (mIndexType == GL_UNSIGNED_INT) mIndexData.insert(mIndexData.end(), sectionIndices[s].begin(), sectionIndices[s].end());
+            else mShortIndexData.insert(mShortIndexData.end(), sectionIndices[s].begin(), sectionIndices[s].end());
+            level.sections.emplace_back(section);
+        }
+        mLevels.emplace_back(level);
+    }
+    return static_cast<unsigned int>(mLevels.size());
+}
+
+void OpenGLRenderableEntity::clearLevelsOfDetail()
+{
+    mLevels.clear();
+    mIndexData.resize(mIndexType == GL_UNSIGNED_INT ? this->indexNumber() : 0);
+    if (mIndexType == GL_UNSIGNED_SHORT) mShortIndexData.resize(this->indexNumber());
+}
+
+unsigned int OpenGLRenderableEntity::selectLevel(float maxError) const
+{
+    unsigned int level = 0;
+    while (level < mLevels.size() && mLevels[level].error <= maxError) ++level;
+    return level;
+}
+
+glm::vec3 OpenGLRenderableEntity::vertexPosition(unsigned int vertex) const
+{
+    if (mSourceMesh) {
+        aiVector3D const &p = mSourceMesh->mVertices[mVertexRemap.empty() ? vertex : mVertexRemap[vertex]];
+        return glm::vec3(p.x, p.y, p.z);
+    }
+
+    unsigned char const *v = nullptr;
+    if (mExternalVertexData) {
+        v = static_cast<unsigned char const *>(mExternalVertexData) + static_cast<size_t>(vertex)*mVertexStride;
+    } else if (!mVertexData.empty()) {
+        v = reinterpret_cast<unsigned char const *>(mVertexData.data()) + static_cast<size_t>(vertex)*mVertexStride;
+    } else {
+        return glm::vec3(0.0f);
+    }
+
+    if (mVertexLayout == VERTEX_LAYOUT_COMPACT) {
+        unsigned short q[3];
+        std::memcpy(q, v, sizeof(q));
+        return glm::vec3(mBounds[0] + (mBounds[1]-mBounds[0]) * (q[0] / 65535.0f),
+                         mBounds[2] + (mBounds[3]-mBounds[2]) * (q[1] / 65535.0f),
+                         mBounds[4] + (mBounds[5]-mBounds[4]) * (q[2] / 65535.0f));
+    }
+    float p[3];
+    std::memcpy(p, v, sizeof(p));
+    return glm::vec3(p[0], p[1], p[2]);
+}
+
+void OpenGLRenderableEntity::triangleVertices(unsigned int triangle, unsigned int *vertices) const
+{
+    unsigned int index = triangle*3;
+    // the sections are in the order of their indices
+    auto it = std::upper_bound(mSections.begin(), mSections.end(), index, [](unsigned int i, RenderableSection const &section) {
+        return i < section.indexOffset;
+    });
+    unsigned int vertexOffset = it == mSections.begin() ? 0 : (it-1)->vertexOffset;
+    for (int i = 0; i < 3; ++i) {
+        vertices[i] = vertexOffset + (mIndexType == GL_UNSIGNED_INT ? mIndexData[index+i] : mShortIndexData[index+i]);
+    }
+}
+
+void OpenGLRenderableEntity::buildTriangleHierarchy()
+{
+    if (mTriangleHierarchy || !mDataLoaded) return;
+
+    std::vector<float> boxes(static_cast<size_t>(mTriangleNumber)*6);
+    unsigned int vertices[3];
+    for (unsigned int t = 0; t < mTriangleNumber; ++t) {
+        this->triangleVertices(t, vertices);
+        glm::vec3 p0 = this->vertexPosition(vertices[0]);
+        glm::vec3 p1 = this->vertexPosition(vertices[1]);
+        glm::vec3 p2 = this->vertexPosition(vertices[2]);
+        float *box = &boxes[static_cast<size_t>(t)*6];
+        for (int i = 0; i < 3; ++i) {
+            box[i*2] = std::min(p0[i], std::min(p1[i], p2[i]));
+            box[i*2+1] = std::max(p0[i], std::max(p1[i], p2[i]));
+        }
+    }
+    mTriangleHierarchy.reset(new BoundingVolumeHierarchy);
+    mTriangleHierarchy->build(boxes.data(), mTriangleNumber);
+}
+
+bool OpenGLRenderableEntity::intersectRay(glm::vec3 const &origin, glm::vec3 const &direction, float &distance, unsigned int &triangle)
+{
+    this->buildTriangleHierarchy();
+    if (!mTriangleHierarchy) return false;
+
+    int hit = mTriangleHierarchy->raycast(origin, direction, distance, [&](unsigned int t, float &d) -> bool {
+        // Moller-Trumbore, both sides of the triangle
+        unsigned int vertices[3];
+        this->triangleVertices(t, vertices);
+        glm::vec3 p0 = this->vertexPosition(vertices[0]);
+        glm::vec3 e1 = this->vertexPosition(vertices[1]) - p0;
+        glm::vec3 e2 = this->vertexPosition(vertices[2]) - p0;
+        glm::vec3 pv = glm::cross(direction, e2);
+        float det = glm::dot(e1, pv);
+        if (std::fabs(det) < std::numeric_limits<float>::min()) return false;
+        float invDet = 1.0f / det;
+        glm::vec3 tv = origin - p0;
+        float u = glm::dot(tv, pv) * invDet;
+        if (u < 0.0f || u > 1.0f) return false;
+        glm::vec3 qv = glm::cross(tv, e1);
+        float v = glm::dot(direction, qv) * invDet;
+        if (v < 0.0f || u + v > 1.0f) return false;
+        float t0 = glm::dot(e2, qv) * invDet;
+        if (t0 < 0.0f || t0 >= d) return false;
+        d = t0;
+        return true;
+    });
+    if (hit < 0) return false;
+    triangle = static_cast<unsigned int>(hit);
+    return true;
+}
+
+void OpenGLRenderableEntity::computeBounds(aiMesh const *mesh)
+{
+    for (unsigned int i = 0; i < mesh->mNumVertices; ++i) {
+        float vix = mesh->mVertices[i].x;
+        float viy = mesh->mVertices[i].y;
+        float viz = mesh->mVertices[i].z;
+        if (i == 0) {
+            mBounds[0] = mBounds[1] = vix;
+            mBounds[2] = mBounds[3] = viy;
+            mBounds[4] = mBounds[5] = viz;
+        } else {
+            if (vix < mBounds[0]) mBounds[0] = vix;
+            else if (vix > mBounds[1]) mBounds[1] = vix;
+            if (viy < mBounds[2]) mBounds[2] = viy;
+            else if (viy > mBounds[3]) mBounds[3] = viy;
+            if (viz < mBounds[4]) mBounds[4] = viz;
+            else if (viz > mBounds[5]) mBounds[5] = viz;
+        }
+    }
+    mCenter[0] = (mBounds[0] + mBounds[1]) * 0.5f;
+    mCenter[1] = (mBounds[2] + mBounds[3]) * 0.5f;
+    mCenter[2] = (mBounds[4] + mBounds[5]) * 0.5f;
+}
+
 void OpenGLRenderableEntity::clearData()
 {
     mCenter[0] = mCenter[1] = mCenter[2] = 0.0f;
     mBounds[0] = mBounds[1] = mBounds[2] = mBounds[3] = mBounds[4] = mBounds[5] = 0.0f;
-    mComponentsPerVertex = 0;
+    mVertexLayout = VERTEX_LAYOUT_FLOAT;
+    mVertexStride = 0;
     mHasNormal = false;
     mHasTexCoords = false;
     mDataLoaded = false;
     mBufferSetup = false;
 
+    mSourceMesh = nullptr;
+    mExternalVertexData = nullptr;
+    mExternalDataOwner.reset();
+    mVertexNumber = 0;
+    mTriangleNumber = 0;
     mVertexData.clear();
     mIndexData.clear();
+    mShortIndexData.clear();
+    mIndexType = GL_UNSIGNED_INT;
+    mSections.clear();
+    mLevels.clear();
+    mVertexRemap.clear();
+    mTriangleHierarchy.reset();
 }
 
-bool OpenGLRenderableEntity::setupGL(QOpenGLContext const *glCtx)
+void const * OpenGLRenderableEntity::indexData() const
 {
-    if (mOpenGLSetup) return true;
-    if (glCtx == nullptr) return false;
+    if (mIndexType == GL_UNSIGNED_INT) return mIndexData.data();
+    return mShortIndexData.data();
+}
 
-    mOpenGLContext = glCtx;
+glm::mat4x4 OpenGLRenderableEntity::positionTransform() const
+{
+    if (mVertexLayout != VERTEX_LAYOUT_COMPACT) return glm::mat4x4(1.0f);
+    glm::mat4x4 m = glm::translate(glm::mat4x4(1.0f), glm::vec3(mBounds[0], mBounds[2], mBounds[4]));
+    return glm::scale(m, glm::vec3(mBounds[1]-mBounds[0], mBounds[3]-mBounds[2], mBounds[5]-mBounds[4]));
+}
 
-    if (mVertexBuffer == nullptr) {
-        mVertexBuffer = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
-        mVertexBuffer->create();
-        mVertexBuffer->setUsagePattern(QOpenGLBuffer::DynamicDraw);
+void OpenGLRenderableEntity::writeSourceVertices(void *dst) const
+{
+    if (mVertexLayout == VERTEX_LAYOUT_COMPACT) {
+        write_compact_mesh_vertices(mSourceMesh, mBounds, dst);
+    } else {
+        interleave_mesh_vertices(mSourceMesh, static_cast<float *>(dst));
     }
+}
 
-    if (mTriangleBuffer == nullptr) {
-        mTriangleBuffer = new QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
-        mTriangleBuffer->create();
-        mTriangleBuffer->setUsagePattern(QOpenGLBuffer::StaticDraw);
+void OpenGLRenderableEntity::writeVertexData(void *dst) const
+{
+    if (mSourceMesh && mVertexRemap.empty()) {
+        this->writeSourceVertices(dst);
+    } else if (mSourceMesh) {
+        // gather the vertices of the split or reordered sections straight into the destination
+        unsigned int vertexNumber = static_cast<unsigned int>(mVertexRemap.size());
+        if (mVertexLayout == VERTEX_LAYOUT_COMPACT) {
+            write_compact_mesh_vertices(mSourceMesh, mVertexRemap.data(), vertexNumber, mBounds, dst);
+        } else {
+            interleave_mesh_vertices(mSourceMesh, mVertexRemap.data(), vertexNumber, static_cast<float *>(dst));
+        }
+    } else if (mExternalVertexData) {
+        std::memcpy(dst, mExternalVertexData, static_cast<size_t>(mVertexNumber)*mVertexStride);
+    } else if (!mVertexData.empty()) {
+        std::memcpy(dst, mVertexData.data(), mVertexData.size()*sizeof(float));
     }
+}
 
-    if (mTriangleVAO == nullptr) {
-        mTriangleVAO = new QOpenGLVertexArrayObject;
-        mTriangleVAO->create();
-    }
+bool OpenGLRenderableEntity::setupGL(QOpenGLContext const *glCtx)
+{
+    if (mOpenGLSetup) return true;
+    if (glCtx == nullptr) return false;
+
+    mOpenGLContext = glCtx;
+    // the buffers are taken from the arena if possible, created by setupBuffers() otherwise
+    mGeometryArena = GeometryArena::instance(glCtx);
 
     mOpenGLSetup = true;
     return mOpenGLSetup;
@@ -180,64 +676,179 @@ void OpenGLRenderableEntity::destroyGL(QOpenGLContext const *glCtx)
     }
 
     mOpenGLSetup = false;
+    mBufferSetup = false;
     mOpenGLContext = nullptr;
+    // the ranges are reused by the renderables uploaded later
+    if (mGeometryArena) mGeometryArena->free(mGeometryAllocation);
+    mGeometryArena = nullptr;
     DELETE_OPENGL_RESOURCE(mVertexBuffer);
     DELETE_OPENGL_RESOURCE(mTriangleBuffer);
-    DELETE_OPENGL_RESOURCE(mTriangleVAO);
+    for (QOpenGLVertexArrayObject *&vao : mTriangleVAOs) {
+        DELETE_OPENGL_RESOURCE(vao);
+    }
+    mTriangleVAOs.clear();
 }
 
-void OpenGLRenderableEntity::drawSurface(QOpenGLContext const *glCtx)
+void OpenGLRenderableEntity::drawSurface(QOpenGLContext const *glCtx, unsigned int level)
 {
-    if (mOpenGLContext != glCtx) return;
+    if (mOpenGLContext != glCtx || !mBufferSetup) return;
     QOpenGLFunctions *glFuncs = mOpenGLContext->functions();
-    QOpenGLVertexArrayObject::Binder triangleVAOBinder(mTriangleVAO);
-    glFuncs->glDrawElements(GL_TRIANGLES, mTriangleNumber*3, GL_UNSIGNED_INT, 0);
+    std::vector<RenderableSection> const &sections = this->levelSections(level);
+    if (mGeometryAllocation.isValid()) {
+        // the vertex array object is shared by the renderables in the same page
+        mGeometryArena->bindVertexArray(mGeometryAllocation);
+        for (RenderableSection const &section : sections) {
+            if (section.indexNumber == 0) continue;
+            mGeometryArena->drawElements(mGeometryAllocation, section.indexNumber, mIndexType, section.indexOffset*this->indexSize(), section.vertexOffset);
+        }
+        return;
+    }
+    if (mGeometryArena) mGeometryArena->releaseVertexArray();
+    // the sections of a level refer to the same vertices as those of the full detail
+    for (size_t i = 0; i < sections.size(); ++i) {
+        RenderableSection const &section = sections[i];
+        if (section.indexNumber == 0) continue;
+        QOpenGLVertexArrayObject::Binder triangleVAOBinder(mTriangleVAOs[i]);
+        glFuncs->glDrawElements(GL_TRIANGLES, section.indexNumber, mIndexType, (const char*)0 + section.indexOffset*this->indexSize());
+    }
+}
+
+void OpenGLRenderableEntity::drawSurfaceInstanced(QOpenGLContext const *glCtx, GLuint instanceBuffer, size_t instanceOffset, GLsizei instanceNumber, unsigned int level)
+{
+    if (mOpenGLContext != glCtx || !mBufferSetup || instanceNumber <= 0) return;
+    QOpenGLExtraFunctions *glFuncs = mOpenGLContext->extraFunctions();
+    bool inArena = mGeometryAllocation.isValid();
+    if (mGeometryArena && !inArena) mGeometryArena->releaseVertexArray();
+    std::vector<RenderableSection> const &sections = this->levelSections(level);
+    for (size_t i = 0; i < sections.size(); ++i) {
+        RenderableSection const &section = sections[i];
+        if (section.indexNumber == 0) continue;
+        if (inArena) {
+            mGeometryArena->bindVertexArray(mGeometryAllocation);
+        } else {
+            mTriangleVAOs[i]->bind();
+        }
+        // the instances of each batch are at their own offset, so the pointers are set for every draw
+        setup_instance_attributes(glFuncs, instanceBuffer, instanceOffset);
+        if (inArena) {
+            mGeometryArena->drawElements(mGeometryAllocation, section.indexNumber, mIndexType, section.indexOffset*this->indexSize(), section.vertexOffset, instanceNumber);
+        } else {
+            glFuncs->glDrawElementsInstanced(GL_TRIANGLES, section.indexNumber, mIndexType, (const char*)0 + section.indexOffset*this->indexSize(), instanceNumber);
+            mTriangleVAOs[i]->release();
+        }
+    }
+}
+
+GeometryFormat OpenGLRenderableEntity::geometryFormat() const
+{
+    GeometryFormat format;
+    format.layout = mVertexLayout;
+    format.stride = mVertexStride;
+    format.hasNormal = mHasNormal;
+    // currently, only one texture is used
+    format.texCoordComponents = mTextureComponents.empty() ? 0 : mTextureComponents[0];
+    return format;
+}
+
+bool OpenGLRenderableEntity::setupArenaBuffers()
+{
+    size_t indexBytes = static_cast<size_t>(this->indexDataNumber())*this->indexSize();
+    if (!mGeometryArena->allocate(this->geometryFormat(), mVertexNumber, indexBytes, mGeometryAllocation)) return false;
+
+    // interleave the vertices straight into the mapped range
+    mGeometryArena->writeVertices(mGeometryAllocation, [this](void *dst) { this->writeVertexData(dst); });
+    mGeometryArena->writeIndices(mGeometryAllocation, this->indexData());
+
+    // the own buffers of the previous upload are not needed any more
+    DELETE_OPENGL_RESOURCE(mVertexBuffer);
+    DELETE_OPENGL_RESOURCE(mTriangleBuffer);
+    for (QOpenGLVertexArrayObject *&vao : mTriangleVAOs) {
+        DELETE_OPENGL_RESOURCE(vao);
+    }
+    mTriangleVAOs.clear();
+    return true;
+}
+
+bool OpenGLRenderableEntity::appendIndirectCommands(std::vector<DrawElementsIndirectCommand> &commands, GLuint instanceNumber, GLuint baseInstance, unsigned int level) const
+{
+    if (!mBufferSetup || !mGeometryAllocation.isValid()) return false;
+    for (RenderableSection const &section : this->levelSections(level)) {
+        if (section.indexNumber == 0) continue;
+        commands.push_back(GeometryArena::indirectCommand(mGeometryAllocation, section.indexNumber, this->indexSize(),
+                                                          section.indexOffset, section.vertexOffset, instanceNumber, baseInstance));
+    }
+    return true;
 }
 
 bool OpenGLRenderableEntity::setupBuffers()
 {
     if (!mOpenGLSetup || !mDataLoaded) return false;
 
-    for (unsigned int i = 0; i < mVertexNumber; ++i) {
-        GLfloat vix = mVertexData[i*mComponentsPerVertex+0];
-        GLfloat viy = mVertexData[i*mComponentsPerVertex+1];
-        GLfloat viz = mVertexData[i*mComponentsPerVertex+2];
-        if (i == 0) {
-            mBounds[0] = mBounds[1] = vix;
-            mBounds[2] = mBounds[3] = viy;
-            mBounds[4] = mBounds[5] = viz;
-        } else {
-            if (vix < mBounds[0]) mBounds[0] = vix;
-            else if (vix > mBounds[1]) mBounds[1] = vix;
-            if (viy < mBounds[2]) mBounds[2] = viy;
-            else if (viy > mBounds[3]) mBounds[3] = viy;
-            if (viz < mBounds[4]) mBounds[4] = viz;
-            else if (viz > mBounds[5]) mBounds[5] = viz;
+    if (mGeometryArena) {
+        if (this->setupArenaBuffers()) {
+            mBufferSetup = true;
+            return mBufferSetup;
         }
+        LOG_WARNING_QSTRING(QString("No room in the geometry arena for %1, drawn from its own buffers.").arg(mName));
+    }
+
+    if (mVertexBuffer == nullptr) {
+        mVertexBuffer = new QOpenGLBuffer(QOpenGLBuffer::VertexBuffer);
+        mVertexBuffer->create();
+        mVertexBuffer->setUsagePattern(QOpenGLBuffer::DynamicDraw);
     }
-    mCenter[0] = (mBounds[0] + mBounds[1]) * 0.5f;
-    mCenter[1] = (mBounds[2] + mBounds[3]) * 0.5f;
-    mCenter[2] = (mBounds[4] + mBounds[5]) * 0.5f;
+
+    if (mTriangleBuffer == nullptr) {
+        mTriangleBuffer = new QOpenGLBuffer(QOpenGLBuffer::IndexBuffer);
+        mTriangleBuffer->create();
+        mTriangleBuffer->setUsagePattern(QOpenGLBuffer::StaticDraw);
+    }
+
+    // one vertex array object for each section, whose attributes start from its first vertex
+    while (mTriangleVAOs.size() > mSections.size()) {
+        DELETE_OPENGL_RESOURCE(mTriangleVAOs.back());
+        mTriangleVAOs.pop_back();
+    }
+    while (mTriangleVAOs.size() < mSections.size()) {
+        QOpenGLVertexArrayObject *vao = new QOpenGLVertexArrayObject;
+        vao->create();
+        mTriangleVAOs.emplace_back(vao);
+    }
+    if (mTriangleVAOs.empty()) return false;
+    if (mGeometryArena) mGeometryArena->releaseVertexArray();
 
     QOpenGLFunctions *glFuncs = mOpenGLContext->functions();
-    QOpenGLVertexArrayObject::Binder triangleVAOBinder(mTriangleVAO);
+    QOpenGLVertexArrayObject::Binder triangleVAOBinder(mTriangleVAOs[0]);
+    // interleave the vertices straight into the mapped buffer, saving both the
+    // intermediate CPU buffer and the copy made by glBufferData
+    int vertexBytes = static_cast<int>(mVertexNumber*mVertexStride);
     mVertexBuffer->bind();
-    mVertexBuffer->allocate(mVertexData.data(), mVertexData.size()*sizeof(float));
-    mTriangleBuffer->bind();
-    mTriangleBuffer->allocate(mIndexData.data(), mIndexData.size()*sizeof(unsigned int));
-
-    glFuncs->glEnableVertexAttribArray(VertexAttribute::POSITION);
-    glFuncs->glVertexAttribPointer(VertexAttribute::POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(float)*mComponentsPerVertex, 0);
-    glFuncs->glEnableVertexAttribArray(VertexAttribute::NORMAL);
-    glFuncs->glVertexAttribPointer(VertexAttribute::NORMAL, 3, GL_FLOAT, GL_FALSE, sizeof(float)*mComponentsPerVertex, (const float*)0 + 3);
-    if (!mTextureComponents.empty()) {
-        // currently, only one texture is used
-        GLint texCoordComps = mTextureComponents[0];
-        glFuncs->glEnableVertexAttribArray(VertexAttribute::TEXCOORD);
-        glFuncs->glVertexAttribPointer(VertexAttribute::TEXCOORD, texCoordComps, GL_FLOAT, GL_FALSE, sizeof(float)*mComponentsPerVertex, (const float*)0 + 6);
+    mVertexBuffer->allocate(vertexBytes);
+    void *mappedVertices = mVertexBuffer->mapRange(0, vertexBytes, QOpenGLBuffer::RangeWrite | QOpenGLBuffer::RangeInvalidateBuffer);
+    bool vertexWritten = false;
+    if (mappedVertices) {
+        this->writeVertexData(mappedVertices);
+        vertexWritten = mVertexBuffer->unmap();
     }
+    if (!vertexWritten) {
+        // glMapBufferRange not supported (or the mapped data got corrupted)
+        std::vector<unsigned char> vertexData(vertexBytes);
+        this->writeVertexData(vertexData.data());
+        mVertexBuffer->write(0, vertexData.data(), vertexBytes);
+    }
+    mTriangleBuffer->bind();
+    mTriangleBuffer->allocate(this->indexData(), this->indexDataNumber()*this->indexSize());
     triangleVAOBinder.release();
 
+    for (size_t i = 0; i < mSections.size(); ++i) {
+        QOpenGLVertexArrayObject::Binder sectionVAOBinder(mTriangleVAOs[i]);
+        mVertexBuffer->bind();
+        mTriangleBuffer->bind();
+
+        const char *base = (const char*)0 + static_cast<size_t>(mSections[i].vertexOffset)*mVertexStride;
+        setup_vertex_attributes(glFuncs, this->geometryFormat(), base);
+    }
+
     mBufferSetup = true;
     return mBufferSetup;
 }
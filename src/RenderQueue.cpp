@@ -0,0 +1,102 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "RenderQueue.h"
+
+#include <algorithm>
+#include <cstring>
+
+// bits of each field of the sort keys
+#define PROGRAM_KEY_BITS 4
+#define TEXTURE_KEY_BITS 12
+#define MATERIAL_KEY_BITS 12
+#define RENDERABLE_KEY_BITS 14
+#define LEVEL_KEY_BITS 2
+#define DEPTH_KEY_BITS 19
+
+/**
+ * @brief the depth quantized with its most significant bits, which keeps the order
+ *        of non-negative floats without knowing their range
+ */
+inline std::uint64_t depth_key(float depth)
+{
+    if (!(depth > 0.0f)) return 0;
+    std::uint32_t bits;
+    std::memcpy(&bits, &depth, sizeof(bits));
+    return bits >> (32 - DEPTH_KEY_BITS);
+}
+
+RenderQueue::RenderQueue()
+{
+}
+
+void RenderQueue::clear()
+{
+    mItems.clear();
+    mProgramIds.clear();
+    mTextureIds.clear();
+    mMaterialIds.clear();
+    mRenderableIds.clear();
+}
+
+unsigned int RenderQueue::stateId(std::unordered_map<void const *, unsigned int> &ids, void const *state, unsigned int bits)
+{
+    if (state == nullptr) return 0;
+    auto it = ids.find(state);
+    if (it != ids.end()) return it->second;
+    // the states beyond the range share the last id, thus merely sorted less well
+    unsigned int id = std::min(static_cast<unsigned int>(ids.size()) + 1, (1u << bits) - 1);
+    ids.emplace(state, id);
+    return id;
+}
+
+void RenderQueue::add(RenderItem item)
+{
+    std::uint64_t program = this->stateId(mProgramIds, item.program, PROGRAM_KEY_BITS);
+    std::uint64_t texture = this->stateId(mTextureIds, item.texture, TEXTURE_KEY_BITS);
+    std::uint64_t material = this->stateId(mMaterialIds, item.material, MATERIAL_KEY_BITS);
+    std::uint64_t renderable = 0;
+    if (item.instanced) {
+        // the instances at different levels of detail are drawn separately
+        std::uint64_t level = std::min(item.level, (1u << LEVEL_KEY_BITS) - 1);
+        renderable = (this->stateId(mRenderableIds, item.renderable, RENDERABLE_KEY_BITS) << LEVEL_KEY_BITS) | level;
+    }
+    std::uint64_t depth = depth_key(item.depth);
+    std::uint64_t states = (program << (TEXTURE_KEY_BITS + MATERIAL_KEY_BITS + RENDERABLE_KEY_BITS + LEVEL_KEY_BITS)) |
+                           (texture << (MATERIAL_KEY_BITS + RENDERABLE_KEY_BITS + LEVEL_KEY_BITS)) |
+                           (material << (RENDERABLE_KEY_BITS + LEVEL_KEY_BITS)) | renderable;
+
+    if (item.transparent) {
+        // back to front
+        depth = ((std::uint64_t(1) << DEPTH_KEY_BITS) - 1) - depth;
+        item.sortKey = (std::uint64_t(1) << 63) | (depth << (63 - DEPTH_KEY_BITS)) | states;
+    } else {
+        item.sortKey = (states << DEPTH_KEY_BITS) | depth;
+    }
+    mItems.push_back(item);
+}
+
+void RenderQueue::sort()
+{
+    std::sort(mItems.begin(), mItems.end(), [](RenderItem const &a, RenderItem const &b) {
+        return a.sortKey < b.sortKey;
+    });
+}
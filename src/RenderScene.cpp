@@ -0,0 +1,242 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "RenderScene.h"
+#include "AssimpHelper.h"
+#include "Frustum.h"
+#include "OpenGLRenderableEntity.h"
+#include "StaticBatchTable.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "glm/matrix.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define RENDERSCENE_USE_SSE
+#   include <emmintrin.h>
+#endif
+
+/**
+ * @brief dst = a * b for the column-major matrices (dst may alias neither a nor b)
+ */
+inline void multiply_mat4(glm::mat4x4 const &a, glm::mat4x4 const &b, glm::mat4x4 &dst)
+{
+#ifdef RENDERSCENE_USE_SSE
+    float const *pa = &a[0][0];
+    float const *pb = &b[0][0];
+    float *pd = &dst[0][0];
+    __m128 a0 = _mm_loadu_ps(pa);
+    __m128 a1 = _mm_loadu_ps(pa+4);
+    __m128 a2 = _mm_loadu_ps(pa+8);
+    __m128 a3 = _mm_loadu_ps(pa+12);
+    for (int j=0; j<4; ++j) {
+        __m128 col = _mm_mul_ps(a0, _mm_set1_ps(pb[j*4]));
+        col = _mm_add_ps(col, _mm_mul_ps(a1, _mm_set1_ps(pb[j*4+1])));
+        col = _mm_add_ps(col, _mm_mul_ps(a2, _mm_set1_ps(pb[j*4+2])));
+        col = _mm_add_ps(col, _mm_mul_ps(a3, _mm_set1_ps(pb[j*4+3])));
+        _mm_storeu_ps(pd+j*4, col);
+    }
+#else
+    dst = a * b;
+#endif
+}
+
+inline glm::mat3x3 normal_matrix(glm::mat4x4 const &mat)
+{
+    return glm::transpose(glm::inverse(glm::mat3x3(mat)));
+}
+
+inline void set_empty_bounds(float *bounds)
+{
+    bounds[0] = bounds[2] = bounds[4] = std::numeric_limits<float>::max();
+    bounds[1] = bounds[3] = bounds[5] = -std::numeric_limits<float>::max();
+}
+
+/**
+ * @brief bounds of the transformed box (the center is transformed, the half
+ *        extent by the absolute values of the linear part)
+ */
+inline void transform_bounds(glm::mat4x4 const &mat, float const *src, float *dst)
+{
+    if (src[0] > src[1]) {
+        set_empty_bounds(dst);
+        return;
+    }
+    glm::vec3 c((src[0]+src[1])*0.5f, (src[2]+src[3])*0.5f, (src[4]+src[5])*0.5f);
+    glm::vec3 e((src[1]-src[0])*0.5f, (src[3]-src[2])*0.5f, (src[5]-src[4])*0.5f);
+    for (int i=0; i<3; ++i) {
+        float center = mat[3][i] + mat[0][i]*c.x + mat[1][i]*c.y + mat[2][i]*c.z;
+        float extent = std::fabs(mat[0][i])*e.x + std::fabs(mat[1][i])*e.y + std::fabs(mat[2][i])*e.z;
+        dst[i*2] = center - extent;
+        dst[i*2+1] = center + extent;
+    }
+}
+
+RenderScene::RenderScene()
+{
+    mDirty = false;
+}
+
+void RenderScene::build(aiNode const *root, OpenGLRenderableEntityArray const &renderables, StaticBatchTable const *staticBatches)
+{
+    this->clear();
+    if (root == nullptr) return;
+
+    size_t meshNum = renderables.size();
+    mMeshBounds.resize(meshNum*6);
+    for (size_t i=0; i<meshNum; ++i) {
+        if (renderables[i]) std::copy(renderables[i]->bounds(), renderables[i]->bounds()+6, &mMeshBounds[i*6]);
+        else set_empty_bounds(&mMeshBounds[i*6]);
+    }
+
+    // depth-first pre-order, the children are pushed in reverse to keep their order
+    std::vector<std::pair<aiNode const *, int>> stack(1, std::make_pair(root, -1));
+    while (!stack.empty()) {
+        aiNode const *node = stack.back().first;
+        int parent = stack.back().second;
+        stack.pop_back();
+        int index = static_cast<int>(mSourceNodes.size());
+        mSourceNodes.push_back(node);
+        mParents.push_back(parent);
+        for (unsigned int j=node->mNumChildren; j>0; --j) {
+            if (node->mChildren[j-1] != nullptr) stack.emplace_back(node->mChildren[j-1], index);
+        }
+    }
+    size_t batchNum = staticBatches ? staticBatches->batchNumber() : 0;
+    if (batchNum > 0) {
+        mSourceNodes.push_back(nullptr);
+        mParents.push_back(-1);
+    }
+
+    size_t nodeNum = mSourceNodes.size();
+
+    mLocalMatrices.resize(nodeNum);
+    mWorldMatrices.resize(nodeNum);
+    mNormalMatrices.resize(nodeNum);
+    mNodeDirty.assign(nodeNum, 1);
+    mInstanceOffsets.resize(nodeNum+1);
+    mInstanceOffsets[0] = 0;
+    // the instances are counted as if without the batches, for looking up the merged ones
+    size_t sourceMeshNum = staticBatches ? std::min<size_t>(meshNum, staticBatches->sourceMeshNumber()) : meshNum;
+    size_t sourceInstance = 0;
+    for (size_t i=0; i<nodeNum; ++i) {
+        aiNode const *node = mSourceNodes[i];
+        if (node == nullptr) {
+            // the node of the static batches
+            mLocalMatrices[i] = glm::mat4x4(1.0f);
+            for (size_t b=0; b<batchNum; ++b) {
+                if (sourceMeshNum+b >= meshNum) break;
+                mInstanceMeshes.push_back(static_cast<unsigned int>(sourceMeshNum+b));
+                mInstanceNodes.push_back(static_cast<unsigned int>(i));
+            }
+            mInstanceOffsets[i+1] = static_cast<unsigned int>(mInstanceMeshes.size());
+            continue;
+        }
+        mLocalMatrices[i] = get_glm_mat4x4(node->mTransformation);
+        for (unsigned int j=0; j<node->mNumMeshes; ++j) {
+            if (node->mMeshes[j] >= sourceMeshNum) continue;
+            if (staticBatches && staticBatches->isInstanceBatched(sourceInstance++)) continue;
+            mInstanceMeshes.push_back(node->mMeshes[j]);
+            mInstanceNodes.push_back(static_cast<unsigned int>(i));
+        }
+        mInstanceOffsets[i+1] = static_cast<unsigned int>(mInstanceMeshes.size());
+    }
+    mInstanceBounds.resize(mInstanceMeshes.size()*6);
+    mDirty = true;
+    this->updateWorldTransforms();
+
+    mInstanceHierarchy.build(mInstanceBounds.data(), mInstanceMeshes.size());
+    mMovedInstances.clear();
+}
+
+void RenderScene::clear()
+{
+    mParents.clear();
+    mSourceNodes.clear();
+    mLocalMatrices.clear();
+    mWorldMatrices.clear();
+    mNormalMatrices.clear();
+    mNodeDirty.clear();
+    mInstanceOffsets.clear();
+    mInstanceMeshes.clear();
+    mInstanceNodes.clear();
+    mInstanceBounds.clear();
+    mMeshBounds.clear();
+    mInstanceHierarchy.clear();
+    mMovedInstances.clear();
+    mDirty = false;
+}
+
+void RenderScene::setLocalMatrix(size_t node, glm::mat4x4 const &mat)
+{
+    mLocalMatrices[node] = mat;
+    mNodeDirty[node] = 1;
+    mDirty = true;
+}
+
+void RenderScene::updateInstanceBounds(size_t node)
+{
+    for (unsigned int i=mInstanceOffsets[node]; i<mInstanceOffsets[node+1]; ++i) {
+        transform_bounds(mWorldMatrices[node], &mMeshBounds[mInstanceMeshes[i]*6], &mInstanceBounds[i*6]);
+        mMovedInstances.push_back(i);
+    }
+}
+
+bool RenderScene::updateWorldTransforms()
+{
+    if (!mDirty) return false;
+
+    size_t nodeNum = mParents.size();
+    std::uint8_t *dirty = mNodeDirty.data();
+    for (size_t i=0; i<nodeNum; ++i) {
+        int p = mParents[i];
+        if (p >= 0) dirty[i] |= dirty[p];
+        if (!dirty[i]) continue;
+        if (p >= 0) {
+            multiply_mat4(mWorldMatrices[p], mLocalMatrices[i], mWorldMatrices[i]);
+        } else {
+            mWorldMatrices[i] = mLocalMatrices[i];
+        }
+        mNormalMatrices[i] = normal_matrix(mWorldMatrices[i]);
+        this->updateInstanceBounds(i);
+    }
+    // cleared afterwards, the children look at the flags of their parents in the pass
+    std::fill(mNodeDirty.begin(), mNodeDirty.end(), 0);
+
+    if (!mInstanceHierarchy.isEmpty()) {
+        bool allMoved = mMovedInstances.size() == mInstanceMeshes.size();
+        mInstanceHierarchy.refit(mInstanceBounds.data(), allMoved ? nullptr : &mMovedInstances);
+    }
+    mMovedInstances.clear();
+
+    mDirty = false;
+    return true;
+}
+
+void RenderScene::cullInstances(Frustum const &frustum, std::vector<unsigned int> &instances) const
+{
+    instances.clear();
+    mInstanceHierarchy.queryFrustum(frustum, instances);
+    // back to the order of the nodes, for the instances of a node to be adjacent
+    std::sort(instances.begin(), instances.end());
+}
@@ -0,0 +1,323 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "SceneLoader.h"
+#include "LogUtils.h"
+#include "MeshCache.h"
+#include "OpenGLMaterialEntity.h"
+#include "OpenGLRenderableEntity.h"
+#include "RenderScene.h"
+#include "StaticBatchTable.h"
+#include "TextureLoader.h"
+
+#include <QFileInfo>
+#include <QFutureWatcher>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <numeric>
+
+#include "assimp/Importer.hpp"
+#include "assimp/ProgressHandler.hpp"
+#include "assimp/scene.h"
+#include "assimp/postprocess.h"
+
+// share of the overall progress taken by each loading stage
+static int const IMPORT_PROGRESS_END = 60;
+static int const MATERIAL_PROGRESS_END = 65;
+
+// the options changing the converted meshes, which are part of the key of the mesh cache
+inline unsigned int mesh_options(bool splitOversizedMeshes, bool optimizeMeshes, bool generateLevels, VertexLayout vertexLayout)
+{
+    return (splitOversizedMeshes ? 0x1u : 0u) | (optimizeMeshes ? 0x2u : 0u) | (generateLevels ? 0x4u : 0u) |
+           (static_cast<unsigned int>(vertexLayout) << 3);
+}
+
+/**
+ * @brief Progress handler forwarding the import progress of assimp to SceneLoader
+ *
+ * Returning false from Update() makes assimp abort the import, which is how a
+ * superseded request is stopped as early as possible.
+ */
+class SceneLoaderProgressHandler : public Assimp::ProgressHandler
+{
+public:
+    SceneLoaderProgressHandler(SceneLoader *loader, unsigned int ticket)
+        : mLoader(loader), mTicket(ticket), mLastPercent(-1) {}
+
+    virtual bool Update(float percentage = -1.0f) override {
+        if (mLoader->isCanceled(mTicket)) return false;
+        if (percentage < 0.0f) return true;
+        int percent = static_cast<int>(percentage * IMPORT_PROGRESS_END);
+        if (percent != mLastPercent) {
+            mLastPercent = percent;
+            mLoader->reportProgress(mTicket, percent, SceneLoader::tr("Importing"));
+        }
+        return true;
+    }
+
+private:
+    SceneLoader *mLoader;
+    unsigned int mTicket;
+    int mLastPercent;
+};
+
+SceneLoader::SceneLoader(QObject *parent) : QObject(parent)
+{
+    qRegisterMetaType<SceneDataPtr>("SceneDataPtr");
+
+    // requests are processed one by one, a superseded request stops early
+    mThreadPool.setMaxThreadCount(1);
+    mCacheThreadPool.setMaxThreadCount(1);
+    mCurrentTicket = 0;
+    mPendingRequests = 0;
+    mMeshCacheEnabled = true;
+    mSplitOversizedMeshes = false;
+    mVertexLayout = VERTEX_LAYOUT_FLOAT;
+    mMeshOptimizationEnabled = false;
+    mLevelsOfDetailEnabled = false;
+    mTriangleHierarchiesEnabled = true;
+    mStaticBatchingEnabled = false;
+    mTextureLoader = nullptr;
+}
+
+SceneLoader::~SceneLoader()
+{
+    this->cancel();
+    mThreadPool.waitForDone();
+    mCacheThreadPool.waitForDone();
+}
+
+unsigned int SceneLoader::importFlags()
+{
+    return aiProcess_Triangulate |
+           aiProcess_JoinIdenticalVertices |
+           aiProcess_GenSmoothNormals;
+}
+
+void SceneLoader::loadAsync(QString const &pathName)
+{
+    if (pathName.isEmpty()) return;
+
+    unsigned int ticket = ++mCurrentTicket;
+    if (ticket == 0) ticket = ++mCurrentTicket; // 0 is reserved for synchronous loading
+    ++mPendingRequests;
+
+    QFutureWatcher<SceneDataPtr> *watcher = new QFutureWatcher<SceneDataPtr>(this);
+    connect(watcher, &QFutureWatcherBase::finished, this, [this, watcher, ticket, pathName]() {
+        --mPendingRequests;
+        SceneDataPtr sceneData = watcher->result();
+        watcher->deleteLater();
+        if (this->isCanceled(ticket)) return;
+        if (sceneData) emit sceneLoaded(sceneData);
+        else emit loadFailed(pathName);
+    });
+    watcher->setFuture(QtConcurrent::run(&mThreadPool, [this, pathName, ticket]() -> SceneDataPtr {
+        return this->loadScene(pathName, ticket);
+    }));
+}
+
+SceneDataPtr SceneLoader::load(QString const &pathName)
+{
+    if (pathName.isEmpty()) return SceneDataPtr();
+    return this->loadScene(pathName, 0);
+}
+
+void SceneLoader::cancel()
+{
+    if (++mCurrentTicket == 0) ++mCurrentTicket;
+}
+
+void SceneLoader::reportProgress(unsigned int ticket, int percent, QString const &stage)
+{
+    if (this->isCanceled(ticket)) return;
+    emit progressChanged(percent, stage);
+}
+
+void SceneLoader::requestTextures(SceneDataPtr const &sceneData)
+{
+    if (mTextureLoader == nullptr) return;
+    QStringList imageFilePaths;
+    for (OpenGLMaterialEntityPtr const &me : sceneData->materials) {
+        if (me && !me->diffuseTextureFilePath().isEmpty()) imageFilePaths.append(me->diffuseTextureFilePath());
+    }
+    mTextureLoader->request(imageFilePaths);
+}
+
+void SceneLoader::buildRenderScene(SceneDataPtr const &sceneData)
+{
+    sceneData->renderScene = std::make_shared<RenderScene>();
+    sceneData->renderScene->build(sceneData->scene->mRootNode, sceneData->renderables, sceneData->staticBatches.get());
+}
+
+void SceneLoader::buildStaticBatches(SceneDataPtr const &sceneData, VertexLayout vertexLayout)
+{
+    StaticBatchTablePtr staticBatches = std::make_shared<StaticBatchTable>();
+    if (!staticBatches->build(sceneData->scene.get(), *sceneData->renderScene, sceneData->renderables, vertexLayout)) return;
+    sceneData->staticBatches = staticBatches;
+    // the render scene refers to the batches instead of the merged instances
+    this->buildRenderScene(sceneData);
+
+    unsigned int retiredMeshes = 0;
+    for (unsigned int i=0; i<staticBatches->sourceMeshNumber(); ++i) {
+        if (staticBatches->isMeshRetired(i)) ++retiredMeshes;
+    }
+    LOG_INFO_QSTRING(tr("Static batching, %1 instances merged into %2 batches, %3 meshes retired")
+                     .arg(staticBatches->sourceNumber()).arg(staticBatches->batchNumber()).arg(retiredMeshes));
+}
+
+void SceneLoader::buildTriangleHierarchies(SceneDataPtr const &sceneData)
+{
+    StaticBatchTablePtr staticBatches = sceneData->staticBatches;
+    QtConcurrent::blockingMap(sceneData->renderables, [&](OpenGLRenderableEntityPtr const &re) {
+        // the retired meshes are picked through the batches
+        if (staticBatches && staticBatches->isMeshRetired(static_cast<unsigned int>(&re - sceneData->renderables.data()))) return;
+        if (re) re->buildTriangleHierarchy();
+    });
+}
+
+SceneDataPtr SceneLoader::loadScene(QString const &pathName, unsigned int ticket)
+{
+    bool splitOversizedMeshes = mSplitOversizedMeshes;
+    bool optimizeMeshes = mMeshOptimizationEnabled;
+    bool generateLevels = mLevelsOfDetailEnabled;
+    VertexLayout vertexLayout = mVertexLayout;
+    unsigned int meshOptions = mesh_options(splitOversizedMeshes, optimizeMeshes, generateLevels, vertexLayout);
+    bool staticBatching = mStaticBatchingEnabled;
+
+    if (mMeshCacheEnabled && !staticBatching) {
+        this->reportProgress(ticket, 0, tr("Reading mesh cache"));
+        SceneDataPtr cachedSceneData = load_mesh_cache(pathName, importFlags(), meshOptions);
+        if (cachedSceneData) {
+            this->requestTextures(cachedSceneData);
+            this->buildRenderScene(cachedSceneData);
+            if (mTriangleHierarchiesEnabled) this->buildTriangleHierarchies(cachedSceneData);
+            this->reportProgress(ticket, 100, tr("Reading mesh cache"));
+            return cachedSceneData;
+        }
+    }
+
+    Assimp::Importer importer;
+    importer.SetProgressHandler(new SceneLoaderProgressHandler(this, ticket)); // owned by the importer
+
+    this->reportProgress(ticket, 0, tr("Importing"));
+    aiScene const *scene = importer.ReadFile(pathName.toLocal8Bit().constData(), importFlags());
+    if (scene == nullptr) {
+        if (!this->isCanceled(ticket)) {
+            LOG_ERROR_QSTRING(tr("Fail to read scene from file %1: %2").arg(pathName).arg(importer.GetErrorString()));
+        }
+        return SceneDataPtr();
+    }
+
+    SceneDataPtr sceneData = std::make_shared<SceneData>();
+    sceneData->scene.reset(importer.GetOrphanedScene());
+    sceneData->sourceFilePath = pathName;
+    scene = sceneData->scene.get();
+
+    this->reportProgress(ticket, IMPORT_PROGRESS_END, tr("Loading materials"));
+    QString textureFilePath = QFileInfo(pathName).canonicalPath();
+    for (unsigned int i=0; i<scene->mNumMaterials; ++i) {
+        aiMaterial const *sceneMaterial = scene->mMaterials[i];
+        OpenGLMaterialEntityPtr newMaterialEntity = std::make_shared<OpenGLMaterialEntity>();
+        if (newMaterialEntity->loadData(sceneMaterial, textureFilePath)) {
+            newMaterialEntity->setName(sceneMaterial->GetName().C_Str());
+            sceneData->materials.emplace_back(newMaterialEntity);
+        } else {
+            // hold the place to keep consistent with the scene structure of assimp
+            // 占位，保持与assimp导入的场景图中的material索引一致
+            sceneData->materials.emplace_back(OpenGLMaterialEntityPtr());
+        }
+    }
+
+    // the textures are decoded by the workers of the texture loader meanwhile
+    this->requestTextures(sceneData);
+
+    this->reportProgress(ticket, MATERIAL_PROGRESS_END, tr("Converting meshes"));
+    // meshes are independent of each other, thus converted in parallel by the
+    // global thread pool (only the CPU side work, uploading is done later in batch)
+    std::vector<unsigned int> meshIndices(scene->mNumMeshes);
+    std::iota(meshIndices.begin(), meshIndices.end(), 0);
+    sceneData->renderables.resize(scene->mNumMeshes);
+    std::atomic<unsigned int> convertedMeshes(0);
+    std::atomic<int> lastPercent(MATERIAL_PROGRESS_END);
+    std::vector<float> acmrBefore(scene->mNumMeshes, 0.0f), acmrAfter(scene->mNumMeshes, 0.0f);
+    QtConcurrent::blockingMap(meshIndices, [&](unsigned int i) {
+        if (this->isCanceled(ticket)) return;
+
+        aiMesh const *sceneMesh = scene->mMeshes[i];
+        OpenGLRenderableEntityPtr newRenderableEntity = std::make_shared<OpenGLRenderableEntity>();
+        if (newRenderableEntity->loadData(sceneMesh, splitOversizedMeshes, vertexLayout)) {
+            newRenderableEntity->setName(sceneMesh->mName.C_Str());
+            if (optimizeMeshes) newRenderableEntity->optimizeMesh(&acmrBefore[i], &acmrAfter[i]);
+            // simplified from the optimized mesh, sharing its vertices
+            if (generateLevels) newRenderableEntity->buildLevelsOfDetail();
+            if (sceneMesh->mMaterialIndex < sceneData->materials.size()) {
+                newRenderableEntity->setMaterial(sceneData->materials[sceneMesh->mMaterialIndex]);
+            }
+            sceneData->renderables[i] = newRenderableEntity;
+        }
+        // otherwise the null pointer holds the place to keep consistent with the scene structure of assimp
+        // 否则以空指针占位，保持与assimp导入的场景图中的mesh索引一致
+
+        int percent = MATERIAL_PROGRESS_END + (100 - MATERIAL_PROGRESS_END) * (++convertedMeshes) / scene->mNumMeshes;
+        int last = lastPercent.load();
+        while (percent > last && !lastPercent.compare_exchange_weak(last, percent)) {}
+        if (percent > last) this->reportProgress(ticket, percent, tr("Converting meshes"));
+    });
+
+    if (this->isCanceled(ticket)) return SceneDataPtr();
+
+    if (optimizeMeshes) {
+        // weighted by the triangles
+        double missesBefore = 0.0, missesAfter = 0.0, triangleNumber = 0.0;
+        for (unsigned int i=0; i<scene->mNumMeshes; ++i) {
+            if (!sceneData->renderables[i]) continue;
+            double meshTriangles = sceneData->renderables[i]->triangleNumber();
+            missesBefore += acmrBefore[i] * meshTriangles;
+            missesAfter += acmrAfter[i] * meshTriangles;
+            triangleNumber += meshTriangles;
+        }
+        if (triangleNumber > 0.0) {
+            LOG_INFO_QSTRING(tr("Meshes optimized, ACMR %1 -> %2").arg(missesBefore/triangleNumber, 0, 'f', 3).arg(missesAfter/triangleNumber, 0, 'f', 3));
+        }
+    }
+
+    this->buildRenderScene(sceneData);
+
+    // the cache keeps the meshes as imported, written in a pool of its own so that neither
+    // the display nor the next load waits for the disk (the renderables are not modified
+    // after loading). Not written with static batching, which merges the assimp meshes that
+    // a cached scene lacks, thus never reads the cache.
+    if (mMeshCacheEnabled && !staticBatching) {
+        SceneDataPtr cacheData = std::make_shared<SceneData>(*sceneData);
+        QtConcurrent::run(&mCacheThreadPool, [cacheData, meshOptions]() {
+            save_mesh_cache(cacheData, importFlags(), meshOptions);
+        });
+    }
+
+    if (staticBatching) {
+        this->reportProgress(ticket, 100, tr("Merging static batches"));
+        this->buildStaticBatches(sceneData, vertexLayout);
+    }
+    if (mTriangleHierarchiesEnabled) this->buildTriangleHierarchies(sceneData);
+
+    return sceneData;
+}
@@ -21,20 +21,62 @@
  */
 #include "SceneWidget.h"
 #include "AssimpHelper.h"
+#include "GeometryArena.h"
 #include "GLUtils.h"
 #include "LogUtils.h"
 #include "OpenGLMaterialEntity.h"
 #include "OpenGLRenderableEntity.h"
+#include "RenderScene.h"
+#include "SceneLoader.h"
+#include "StaticBatchTable.h"
+#include "TextureLoader.h"
 
 #include <QOpenGLShaderProgram>
+#include <QOpenGLTexture>
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLFramebufferObject>
+#include <QElapsedTimer>
+#include <QApplication>
+#include <QMouseEvent>
+#include <QFileInfo>
+
+#include <algorithm>
+#include <numeric>
 
 #include "glm/gtc/type_ptr.hpp"
 #include "glm/gtc/matrix_transform.hpp"
 
+#ifndef GL_MAX_SAMPLES
+#define GL_MAX_SAMPLES 0x8D57 // OpenGL 3.0 or OpenGL ES 3.0
+#endif
+#ifndef GL_READ_FRAMEBUFFER
+#define GL_READ_FRAMEBUFFER 0x8CA8
+#define GL_DRAW_FRAMEBUFFER 0x8CA9
+#endif
+
 SceneWidget::SceneWidget(QWidget *parent) : QOpenGLWidget(parent)
 {
     mPhongSimpleProgram = nullptr;
     mPhongTextureProgram = nullptr;
+    mPhongSimpleInstancedProgram = nullptr;
+    mPhongTextureInstancedProgram = nullptr;
+    mFxaaProgram = nullptr;
+    mFxaaSourceExtentLocation = mFxaaTexelSizeLocation = -1;
+    mScreenTriangleBuffer = 0;
+    mFrameUniformBuffer = 0;
+    mMaterialUniformBuffer = 0;
+    mMaterialUniformStride = sizeof(MaterialUniformData);
+
+    mSceneLoader = new SceneLoader(this);
+    connect(mSceneLoader, &SceneLoader::progressChanged, this, &SceneWidget::sceneLoadProgress);
+    connect(mSceneLoader, &SceneLoader::sceneLoaded, this, &SceneWidget::onSceneLoaded);
+    connect(mSceneLoader, &SceneLoader::loadFailed, this, &SceneWidget::sceneLoadFailed);
+
+    // the textures are decoded in the background and uploaded as soon as they are ready
+    // (created after the scene loader, which feeds it, so destroyed after it)
+    mTextureLoader = new TextureLoader(this);
+    mSceneLoader->setTextureLoader(mTextureLoader);
+    connect(mTextureLoader, &TextureLoader::imageDecoded, this, &SceneWidget::onTextureImageDecoded);
 
     set_float4(mBackgroundColor, 0.0f, 0.0f, 0.0f, 0.0f);
     mSceneCenter = glm::zero<glm::vec3>();
@@ -43,9 +85,40 @@ SceneWidget::SceneWidget(QWidget *parent) : QOpenGLWidget(parent)
     mCameraPanSpeed = 1.0f;
     mSceneRadius = 1.0f;
     mAngleFoV = 60.0f;
+    mViewRotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f);
+    mMouseDragged = false;
 
     mOpenGLInitialized = false;
     mNeedToAlignScene = false;
+
+    mStreamingEnabled = true;
+    mUploadTimeBudget = 8.0f;
+    mNextRenderableToUpload = 0;
+
+    mFrustumCullingEnabled = true;
+    mOcclusionCullingEnabled = false;
+    mCulledInstanceNumber = 0;
+    mOccludedInstanceNumber = 0;
+    mInstancingEnabled = true;
+    mLevelOfDetailEnabled = true;
+    mLevelOfDetailPixelError = 1.0f;
+    mInstanceBuffer = 0;
+    mDrawCallNumber = 0;
+    mIndirectDrawingEnabled = true;
+    mIndirectBuffer = 0;
+
+    mDynamicResolutionEnabled = true;
+    mInteracting = false;
+    mRenderScale = 1.0f;
+    mOffscreenBuffer = nullptr;
+    mIdleTimer.setSingleShot(true);
+    mIdleTimer.setInterval(250);
+    connect(&mIdleTimer, &QTimer::timeout, this, &SceneWidget::onInteractionIdle);
+
+    mAntiAliasing = ANTIALIASING_MSAA_4X;
+    mMaxSamples = 0;
+    mMultisampleBuffer = nullptr;
+    mMultisampleBufferSamples = 0;
 }
 
 SceneWidget::~SceneWidget()
@@ -57,10 +130,34 @@ SceneWidget::~SceneWidget()
 void SceneWidget::cleanupGL()
 {
     this->makeCurrent();
+    mTextureLoader->cancel();
+    mTextureLoader->releaseUploaded();
+    mTextureLoader->setTextureCache(nullptr);
     this->cleanupSceneGL();
+    // after the renderables, which free their ranges in it
+    GeometryArena::release(this->context());
     mDefaultMaterial->destroyGL(this->context());
     DELETE_OPENGL_RESOURCE(mPhongSimpleProgram);
     DELETE_OPENGL_RESOURCE(mPhongTextureProgram);
+    if (mFrameUniformBuffer) glDeleteBuffers(1, &mFrameUniformBuffer);
+    if (mMaterialUniformBuffer) glDeleteBuffers(1, &mMaterialUniformBuffer);
+    mFrameUniformBuffer = mMaterialUniformBuffer = 0;
+    DELETE_OPENGL_RESOURCE(mPhongSimpleInstancedProgram);
+    DELETE_OPENGL_RESOURCE(mPhongTextureInstancedProgram);
+    if (mInstanceBuffer) glDeleteBuffers(1, &mInstanceBuffer);
+    if (mIndirectBuffer) glDeleteBuffers(1, &mIndirectBuffer);
+    mInstanceBuffer = mIndirectBuffer = 0;
+    mMaterialUniformIndices.clear();
+    mFrameTimer.destroyGL();
+    delete mOffscreenBuffer;
+    mOffscreenBuffer = nullptr;
+    mTextureBlitter.destroy();
+    delete mMultisampleBuffer;
+    mMultisampleBuffer = nullptr;
+    DELETE_OPENGL_RESOURCE(mFxaaProgram);
+    mScreenTriangleArray.destroy();
+    if (mScreenTriangleBuffer) glDeleteBuffers(1, &mScreenTriangleBuffer);
+    mScreenTriangleBuffer = 0;
     this->doneCurrent();
 }
 
@@ -70,6 +167,7 @@ void SceneWidget::initializeGL()
 
     connect(this->context(), &QOpenGLContext::aboutToBeDestroyed, this, &SceneWidget::cleanupGL);
     this->initializeOpenGLFunctions(); // IMPORTANT!
+    mTextureLoader->setTextureCache(TextureCache::instance(this->context()));
 
     glClearColor(mBackgroundColor[0], mBackgroundColor[1], mBackgroundColor[2], mBackgroundColor[3]);
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -83,17 +181,20 @@ void SceneWidget::initializeGL()
     mTrackBall.setRadius(0.6f);
     mTrackBall.reset();
 
+    // the vertex shaders of the Phong programs share the decoding of the normals
+    QStringList const phongSnippets("normal_decode.glsl");
+
     mPhongSimpleProgram = new QOpenGLShaderProgram;
 #if defined(USE_COMPATIBILITY_PROFILE) || defined(USE_OPENGLES)
     if (!initialize_shader_program_comp("PhongSimple", mPhongSimpleProgram, "phong_simple_comp.vert", "phong_simple_comp.frag",
                                         [](QOpenGLShaderProgram *program) -> void {
                                             program->bindAttributeLocation("positionIn", VertexAttribute::POSITION);
                                             program->bindAttributeLocation("normalIn", VertexAttribute::NORMAL);
-                                        })) {
+                                        }, phongSnippets)) {
         return;
     }
 #else
-    if (!initialize_shader_program("PhongSimple", mPhongSimpleProgram, "phong_simple.vert", "phong_simple.frag")) {
+    if (!initialize_shader_program("PhongSimple", mPhongSimpleProgram, "phong_simple.vert", "phong_simple.frag", phongSnippets)) {
         return;
     }
 #endif
@@ -105,14 +206,97 @@ void SceneWidget::initializeGL()
                                             program->bindAttributeLocation("positionIn", VertexAttribute::POSITION);
                                             program->bindAttributeLocation("normalIn", VertexAttribute::NORMAL);
                                             program->bindAttributeLocation("texCoordIn", VertexAttribute::TEXCOORD);
-                                        })) {
+                                        }, phongSnippets)) {
         return;
     }
 #else
-    if (!initialize_shader_program("PhongTexture", mPhongTextureProgram, "phong_texture.vert", "phong_texture.frag")) {
+    if (!initialize_shader_program("PhongTexture", mPhongTextureProgram, "phong_texture.vert", "phong_texture.frag", phongSnippets)) {
+        return;
+    }
+#endif
+
+#ifdef USE_INSTANCED_DRAWING
+    // the instanced variants share the fragment shaders
+    mPhongSimpleInstancedProgram = new QOpenGLShaderProgram;
+    if (!initialize_shader_program("PhongSimpleInstanced", mPhongSimpleInstancedProgram, "phong_simple_instanced.vert", "phong_simple.frag", phongSnippets)) {
+        return;
+    }
+
+    mPhongTextureInstancedProgram = new QOpenGLShaderProgram;
+    if (!initialize_shader_program("PhongTextureInstanced", mPhongTextureInstancedProgram, "phong_texture_instanced.vert", "phong_texture.frag", phongSnippets)) {
         return;
     }
+
+    mPhongSimpleInstancedUniforms.resolve(mPhongSimpleInstancedProgram);
+    mPhongTextureInstancedUniforms.resolve(mPhongTextureInstancedProgram);
+    mPhongTextureInstancedProgram->bind();
+    glUniform1i(mPhongTextureInstancedUniforms.materialDiffuseMap, OpenGLMaterialEntity::TEXUNIT_DIFFUSE);
+    mPhongTextureInstancedProgram->release();
+    glGenBuffers(1, &mInstanceBuffer);
+    // taken only if the context supports the indirect draws, see indirectDrawingSupported()
+    glGenBuffers(1, &mIndirectBuffer);
+#endif
+
+    // the locations are looked up once, instead of by name for every draw
+    mPhongSimpleUniforms.resolve(mPhongSimpleProgram);
+    mPhongTextureUniforms.resolve(mPhongTextureProgram);
+    mPhongTextureProgram->bind();
+    glUniform1i(mPhongTextureUniforms.materialDiffuseMap, OpenGLMaterialEntity::TEXUNIT_DIFFUSE);
+    mPhongTextureProgram->release();
+
+#ifdef USE_UNIFORM_BUFFERS
+    // the range of each material is bound on its own, so the offsets are aligned as required
+    GLint alignment = 1;
+    glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = std::max(alignment, 1);
+    mMaterialUniformStride = (static_cast<GLint>(sizeof(MaterialUniformData)) + alignment - 1) / alignment * alignment;
+    glGenBuffers(1, &mFrameUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, mFrameUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniformData), nullptr, GL_DYNAMIC_DRAW);
+    glGenBuffers(1, &mMaterialUniformBuffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
 #endif
+    this->uploadMaterialUniforms();
+    mFrameTimer.initializeGL(this->context());
+
+    // the multisampled buffers are resolved by blitting
+    mMaxSamples = 0;
+    if (QOpenGLFramebufferObject::hasOpenGLFramebufferObjects() && QOpenGLFramebufferObject::hasOpenGLFramebufferBlit()) {
+        glGetIntegerv(GL_MAX_SAMPLES, &mMaxSamples);
+    }
+
+    // FXAA is left out if not compiled, the scene is still rendered
+    mFxaaProgram = new QOpenGLShaderProgram;
+#if defined(USE_COMPATIBILITY_PROFILE) || defined(USE_OPENGLES)
+    bool fxaa = initialize_shader_program_comp("FXAA", mFxaaProgram, "fxaa_comp.vert", "fxaa_comp.frag",
+                                               [](QOpenGLShaderProgram *program) -> void {
+                                                   program->bindAttributeLocation("positionIn", VertexAttribute::POSITION);
+                                               });
+#else
+    bool fxaa = initialize_shader_program("FXAA", mFxaaProgram, "fxaa.vert", "fxaa.frag");
+#endif
+    if (fxaa) {
+        mFxaaSourceExtentLocation = mFxaaProgram->uniformLocation("sourceExtent");
+        mFxaaTexelSizeLocation = mFxaaProgram->uniformLocation("texelSize");
+        mFxaaProgram->bind();
+        glUniform1i(mFxaaProgram->uniformLocation("sourceTexture"), 0);
+        mFxaaProgram->release();
+    } else {
+        DELETE_OPENGL_RESOURCE(mFxaaProgram);
+    }
+
+    static GLfloat const screenTriangle[] = { -1.0f, -1.0f, 3.0f, -1.0f, -1.0f, 3.0f };
+    glGenBuffers(1, &mScreenTriangleBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, mScreenTriangleBuffer);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(screenTriangle), screenTriangle, GL_STATIC_DRAW);
+    // not supported by all the contexts of the compatibility profile, the attribute is set on drawing then
+    if (mScreenTriangleArray.create()) {
+        mScreenTriangleArray.bind();
+        glEnableVertexAttribArray(VertexAttribute::POSITION);
+        glVertexAttribPointer(VertexAttribute::POSITION, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+        mScreenTriangleArray.release();
+    }
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
 
     mOpenGLInitialized = true;
     mNeedToAlignScene = true;
@@ -122,6 +306,7 @@ void SceneWidget::resizeGL(int w, int h)
 {
     glViewport(0, 0, w, h);
     glGetIntegerv(GL_VIEWPORT, mViewport);
+    mOcclusionCuller.setViewportSize(w, h);
 
     mNeedToAlignScene = true;
 }
@@ -129,20 +314,51 @@ void SceneWidget::resizeGL(int w, int h)
 void SceneWidget::paintGL()
 {
     if (!mOpenGLInitialized) return;
-    aiScene const *scene = mSceneImporter.GetScene();
+    aiScene const *scene = mScene.get();
     if (scene == nullptr) return;
 
+    bool streaming = this->isStreamingScene();
+    if (streaming) this->uploadPendingEntities();
+
     this->alignScene();
 
+    // rendered at a lower resolution while the camera moves, see dynamicResolutionEnabled(),
+    // and offscreen for the anti-aliasing, see antiAliasing()
+    bool timed = mInteracting && mDynamicResolutionEnabled;
+    mRenderScale = timed ? mFrameGovernor.scale() : 1.0f;
+    int width = std::max(1, qRound(mViewport[2] * mRenderScale));
+    int height = std::max(1, qRound(mViewport[3] * mRenderScale));
+    int samples = this->antiAliasingSamples();
+    bool fxaa = mAntiAliasing == ANTIALIASING_FXAA && mFxaaProgram;
+    if (samples == 0 && mMultisampleBuffer) {
+        delete mMultisampleBuffer;
+        mMultisampleBuffer = nullptr;
+    }
+    bool offscreen = (mRenderScale < 1.0f || samples > 0 || fxaa) && this->bindOffscreenBuffer(width, height, samples);
+    if (!offscreen) mRenderScale = 1.0f;
+    if (timed) mFrameTimer.begin();
+
     glEnable(GL_DEPTH_TEST);
     glDisable(GL_CULL_FACE);
     //glFrontFace(GL_CW);
-    glEnable(GL_BLEND);
+    // blending is only enabled for the transparent items, see drawRenderQueue()
 
     mModelViewMatrix = mCameraMatrix * mModelMatrix;
     mLight.getPosition(mLightPos);
     //mLightPos = mCameraMatrix * mLightPos;
-    this->drawSceneNode(mModelViewMatrix, scene->mRootNode);
+    this->drawRenderScene();
+
+    if (timed) mFrameTimer.end();
+    if (offscreen) this->presentOffscreenBuffer(width, height, samples, fxaa);
+    // the times of the frames before the interaction are dropped
+    float frameTime = 0.0f;
+    if (mFrameTimer.takeFrameTime(frameTime) && timed) {
+        mFrameGovernor.addFrameTime(frameTime);
+    }
+    emit frameRendered(mFrameGovernor.frameTime(), mRenderScale);
+
+    // keep on uploading in the next frame
+    if (streaming) this->update();
 }
 
 void SceneWidget::mousePressEvent(QMouseEvent *event)
@@ -151,6 +367,9 @@ void SceneWidget::mousePressEvent(QMouseEvent *event)
         int x = event->x()-mViewport[0];
         int y = mViewport[3]-1-event->y()-mViewport[1];
         mTrackBall.start(2.0*x/mViewport[2]-1.0, 2.0*y/mViewport[3]-1.0);
+        // picked on release if not dragged, see mouseReleaseEvent()
+        mPressMousePos = event->pos();
+        mMouseDragged = false;
         this->update();
         event->accept();
     } else if (event->buttons() & Qt::RightButton) {
@@ -162,9 +381,24 @@ void SceneWidget::mousePressEvent(QMouseEvent *event)
     mLastMousePos = event->pos();
 }
 
+void SceneWidget::mouseReleaseEvent(QMouseEvent *event)
+{
+    if (event->button() == Qt::LeftButton) {
+        PickResult picked;
+        if (!mMouseDragged && this->pick(event->pos(), picked)) {
+            emit entityPicked(picked.renderable->name(), picked.triangle, QVector3D(picked.position.x, picked.position.y, picked.position.z));
+        }
+        mMouseDragged = false;
+        event->accept();
+    } else {
+        event->ignore();
+    }
+}
+
 void SceneWidget::mouseMoveEvent(QMouseEvent *event)
 {
     if (event->buttons() & Qt::LeftButton) {
+        if ((event->pos() - mPressMousePos).manhattanLength() >= QApplication::startDragDistance()) mMouseDragged = true;
         int x = event->x()-mViewport[0];
         int y = mViewport[3]-1-event->y()-mViewport[1];
         mTrackBall.update(2.0*x/mViewport[2]-1.0, 2.0*y/mViewport[3]-1.0);
@@ -172,11 +406,13 @@ void SceneWidget::mouseMoveEvent(QMouseEvent *event)
         mModelMatrix = glm::translate(glm::mat4(1.0f), mSceneCenter);
         mModelMatrix = mModelMatrix * rotMat;
         mModelMatrix = glm::translate(mModelMatrix, -mSceneCenter);
+        this->beginInteraction();
         this->update();
         event->accept();
     } else if (event->buttons() & Qt::RightButton) {
         float dx = static_cast<float>(event->pos().x() - mLastMousePos.x()) * mCameraPanSpeed;
         float dy = static_cast<float>(mLastMousePos.y() - event->pos().y()) * mCameraPanSpeed;
+        this->beginInteraction();
         this->cameraPan(dx, dy);
         event->accept();
     } else {
@@ -198,61 +434,248 @@ void SceneWidget::wheelEvent(QWheelEvent *event)
         QPoint numSteps = numDegrees / 15;
         dz = numSteps.y() * mCameraZoomSpeed;
     }
+    this->beginInteraction();
     this->cameraZoom(dz);
     event->accept();
 }
 
+bool SceneWidget::pick(QPoint const &pos, PickResult &result)
+{
+    if (!mRenderScene || this->width() <= 0 || this->height() <= 0) return false;
+    mRenderScene->updateWorldTransforms();
+
+    // the ray through the point in the scene space, where the bounds of the instances are
+    float x = 2.0f*(pos.x()+0.5f)/this->width() - 1.0f;
+    float y = 1.0f - 2.0f*(pos.y()+0.5f)/this->height();
+    glm::mat4x4 invMat = glm::inverse(mProjectionMatrix * mCameraMatrix * mModelMatrix);
+    glm::vec4 nearPoint = invMat * glm::vec4(x, y, -1.0f, 1.0f);
+    glm::vec4 farPoint = invMat * glm::vec4(x, y, 1.0f, 1.0f);
+    glm::vec3 origin = glm::vec3(nearPoint) / nearPoint.w;
+    glm::vec3 direction = glm::vec3(farPoint) / farPoint.w - origin;
+
+    float distance = 1.0f; // at most to the far plane
+    unsigned int triangle = 0;
+    int instance = mRenderScene->instanceHierarchy().raycast(origin, direction, distance, [&](unsigned int i, float &d) -> bool {
+        OpenGLRenderableEntityPtr const &re = mRenderables[mRenderScene->instanceMesh(i)];
+        if (!re || !re->isDrawable()) return false;
+        // the node transform is affine, so the distances along the ray in the model space are the same
+        glm::mat4x4 invWorld = glm::inverse(mRenderScene->worldMatrix(mRenderScene->instanceNode(i)));
+        glm::vec3 o(invWorld * glm::vec4(origin, 1.0f));
+        glm::vec3 dir(invWorld * glm::vec4(direction, 0.0f));
+        unsigned int t;
+        if (!re->intersectRay(o, dir, d, t)) return false;
+        triangle = t;
+        return true;
+    });
+    if (instance < 0) return false;
+
+    result.meshIndex = mRenderScene->instanceMesh(instance);
+    result.node = mRenderScene->instanceNode(instance);
+    result.triangle = triangle;
+    // a static batch is reported as the mesh instance merged into it, the batches being merged
+    // from the assimp meshes the triangle is the face of the mesh, see PickResult
+    StaticBatchSource const *source = mStaticBatches ? mStaticBatches->findSource(result.meshIndex, triangle) : nullptr;
+    if (source) {
+        result.meshIndex = source->mesh;
+        result.node = source->node;
+        result.triangle = triangle - source->triangleBegin;
+    }
+    result.renderable = mRenderables[result.meshIndex];
+    result.position = origin + direction * distance;
+    return true;
+}
+
 void SceneWidget::loadSceneFromFile(const QString &pathName)
 {
     if (pathName.isEmpty()) return;
-    aiScene const *scene = mSceneImporter.ReadFile(pathName.toLocal8Bit().constData(),
-                                                   aiProcess_Triangulate |
-                                                   aiProcess_JoinIdenticalVertices |
-                                                   aiProcess_GenSmoothNormals);
-    if (scene == nullptr) {
-        LOG_ERROR_QSTRING(tr("Fail to read scene from file %1!").arg(pathName));
-        return;
+    mSceneLoader->loadAsync(pathName);
+}
+
+bool SceneWidget::isLoadingScene() const
+{
+    return mSceneLoader->isLoading();
+}
+
+void SceneWidget::setFrustumCullingEnabled(bool enabled)
+{
+    if (mFrustumCullingEnabled == enabled) return;
+    mFrustumCullingEnabled = enabled;
+    this->update();
+}
+
+void SceneWidget::setInstancingEnabled(bool enabled)
+{
+    if (mInstancingEnabled == enabled) return;
+    mInstancingEnabled = enabled;
+    this->update();
+}
+
+void SceneWidget::setIndirectDrawingEnabled(bool enabled)
+{
+    if (mIndirectDrawingEnabled == enabled) return;
+    mIndirectDrawingEnabled = enabled;
+    this->update();
+}
+
+void SceneWidget::setLevelOfDetailEnabled(bool enabled)
+{
+    if (mLevelOfDetailEnabled == enabled) return;
+    mLevelOfDetailEnabled = enabled;
+    this->update();
+}
+
+void SceneWidget::setLevelOfDetailPixelError(float pixels)
+{
+    if (mLevelOfDetailPixelError == pixels) return;
+    mLevelOfDetailPixelError = pixels;
+    this->update();
+}
+
+void SceneWidget::resetView(float yaw, float pitch)
+{
+    mViewRotation = glm::angleAxis(glm::radians(pitch), glm::vec3(1.0f, 0.0f, 0.0f)) *
+                    glm::angleAxis(glm::radians(yaw), glm::vec3(0.0f, 1.0f, 0.0f));
+    mNeedToAlignScene = true;
+    this->update();
+}
+
+void SceneWidget::setDynamicResolutionEnabled(bool enabled)
+{
+    if (mDynamicResolutionEnabled == enabled) return;
+    mDynamicResolutionEnabled = enabled;
+    this->update();
+}
+
+void SceneWidget::setAntiAliasing(AntiAliasing mode)
+{
+    if (mAntiAliasing == mode) return;
+    mAntiAliasing = mode;
+    // the buffers are reallocated on the next frame
+    this->update();
+}
+
+int SceneWidget::antiAliasingSamples() const
+{
+    static int const samples[] = { 0, 2, 4, 8, 16, 0 };
+    return std::min<int>(samples[mAntiAliasing], mMaxSamples);
+}
+
+bool SceneWidget::indirectDrawingSupported() const
+{
+    if (!mIndirectBuffer) return false;
+    GeometryArena *arena = GeometryArena::instance(this->context());
+    return arena && arena->supportsIndirectDraw();
+}
+
+void SceneWidget::setOcclusionCullingEnabled(bool enabled)
+{
+    if (mOcclusionCullingEnabled == enabled) return;
+    mOcclusionCullingEnabled = enabled;
+    this->update();
+}
+
+bool SceneWidget::isStreamingScene() const
+{
+    return !mPendingMaterials.empty() || mNextRenderableToUpload < mRenderables.size();
+}
+
+void SceneWidget::onSceneLoaded(SceneDataPtr sceneData)
+{
+    if (this->loadSceneData(sceneData)) {
+        emit sceneLoaded(sceneData->sourceFilePath);
+    } else {
+        emit sceneLoadFailed(sceneData->sourceFilePath);
     }
+}
 
-    this->loadSceneData(scene, QFileInfo(pathName).canonicalPath());
+void SceneWidget::onInteractionIdle()
+{
+    mInteracting = false;
+    // the last frame again at the full resolution
+    if (mRenderScale < 1.0f) this->update();
 }
 
-void SceneWidget::loadSceneData(aiScene const *scene, QString const &sourceFilePath)
+void SceneWidget::onTextureImageDecoded()
 {
-    if (scene == nullptr) return;
+    this->makeCurrent();
+    mTextureLoader->uploadDecoded();
+    this->doneCurrent();
+}
+
+bool SceneWidget::loadSceneData(SceneDataPtr sceneData)
+{
+    if (!sceneData || !sceneData->scene) return false;
+    aiScene const *scene = sceneData->scene.get();
 
     this->makeCurrent();
 
-    this->cleanupSceneGL();
+    if (!mStreamingEnabled) {
+        // the materials take their textures from the cache once all of them are uploaded
+        mTextureLoader->finish();
 
-    mMaterials.clear();
-    mRenderables.clear();
+        // upload the new scene first, the current one is kept until the new one is ready
+        for (OpenGLMaterialEntityPtr &me : sceneData->materials) {
+            if (me && !me->uploadData(this->context())) {
+                me->destroyGL(this->context());
+                // hold the place to keep consistent with the scene structure of assimp
+                me.reset();
+            }
+        }
 
-    for (unsigned int i=0; i<scene->mNumMaterials; ++i) {
-        aiMaterial *sceneMaterial = scene->mMaterials[i];
-        OpenGLMaterialEntityPtr newMaterialEntity = std::make_shared<OpenGLMaterialEntity>();
-        if (newMaterialEntity->loadData(this->context(), sceneMaterial, sourceFilePath)) {
-            newMaterialEntity->setName(sceneMaterial->GetName().C_Str());
-            mMaterials.emplace_back(newMaterialEntity);
-        } else {
-            // hold the place to keep consistent with the scene structure of assimp
-            // 占位，保持与assimp导入的场景图中的material索引一致
-            mMaterials.emplace_back(OpenGLMaterialEntityPtr());
+        for (size_t i=0; i<sceneData->renderables.size(); ++i) {
+            OpenGLRenderableEntityPtr &re = sceneData->renderables[i];
+            // the meshes merged into the static batches are not drawn any more
+            if (sceneData->staticBatches && sceneData->staticBatches->isMeshRetired(static_cast<unsigned int>(i))) continue;
+            if (re && !re->uploadData(this->context())) {
+                re->destroyGL(this->context());
+                // hold the place to keep consistent with the scene structure of assimp
+                re.reset();
+            }
         }
     }
 
-    for (unsigned int i=0; i<scene->mNumMeshes; ++i) {
-        aiMesh const *sceneMesh = scene->mMeshes[i];
-        OpenGLRenderableEntityPtr newRenderableEntity = std::make_shared<OpenGLRenderableEntity>();
-        if (newRenderableEntity->loadData(this->context(), sceneMesh)) {
-            newRenderableEntity->setName(sceneMesh->mName.C_Str());
-            newRenderableEntity->setMaterial(mMaterials[sceneMesh->mMaterialIndex]);
-            mRenderables.emplace_back(newRenderableEntity);
-        } else {
-            // hold the place to keep consistent with the scene structure of assimp
-            // 占位，保持与assimp导入的场景图中的mesh索引一致
-            mRenderables.emplace_back(OpenGLRenderableEntityPtr());
+    // the current scene is released once the new one (or its first batch in streaming
+    // mode) is uploaded, thus no frame goes without a scene
+    OpenGLMaterialEntityArray currentMaterials;
+    OpenGLRenderableEntityArray currentRenderables;
+    currentMaterials.swap(mMaterials);
+    currentRenderables.swap(mRenderables);
+    this->cleanupSceneGL();
+
+    mScene = sceneData->scene;
+    mRenderScene = sceneData->renderScene;
+    mStaticBatches = sceneData->staticBatches;
+    if (!mRenderScene) {
+        mRenderScene = std::make_shared<RenderScene>();
+        mRenderScene->build(scene->mRootNode, sceneData->renderables, mStaticBatches.get());
+    }
+    mMaterials = sceneData->materials;
+    mRenderables = sceneData->renderables;
+    this->uploadMaterialUniforms();
+
+    if (mStreamingEnabled) {
+        // uploaded by paintGL() frame by frame, the paths of the textures are looked
+        // up once here rather than in every frame
+        mPendingMaterials.resize(mMaterials.size());
+        for (size_t i=0; i<mMaterials.size(); ++i) {
+            mPendingMaterials[i].index = i;
+            mPendingMaterials[i].texturePath.clear();
+            if (mMaterials[i] && !mMaterials[i]->diffuseTextureFilePath().isEmpty()) {
+                mPendingMaterials[i].texturePath = QFileInfo(mMaterials[i]->diffuseTextureFilePath()).canonicalFilePath();
+            }
         }
+        mNextRenderableToUpload = 0;
+        this->uploadPendingEntities();
+    } else {
+        // the textures in use are held by the materials from now on
+        mTextureLoader->releaseUploaded();
+    }
+
+    for (OpenGLMaterialEntityPtr me : currentMaterials) {
+        if (me) me->destroyGL(this->context());
+    }
+    for (OpenGLRenderableEntityPtr re : currentRenderables) {
+        if (re) re->destroyGL(this->context());
     }
 
     this->doneCurrent();
@@ -272,6 +695,8 @@ void SceneWidget::loadSceneData(aiScene const *scene, QString const &sourceFileP
     this->recalculateBoundsCenter();
     mNeedToAlignScene = true;
     this->update();
+
+    return true;
 }
 
 void SceneWidget::cleanupSceneGL()
@@ -282,10 +707,63 @@ void SceneWidget::cleanupSceneGL()
     for (OpenGLRenderableEntityPtr re : mRenderables) {
         if (re) re->destroyGL(this->context());
     }
+    mPendingMaterials.clear();
+    mNextRenderableToUpload = mRenderables.size();
+    mMaterialUniformIndices.clear();
     mSceneCenter = glm::zero<glm::vec3>();
     mSceneBounds[0] = mSceneBounds[1] = mSceneBounds[2] = mSceneBounds[3] = mSceneBounds[4] = mSceneBounds[5] = 0.0f;
 }
 
+void SceneWidget::uploadPendingEntities()
+{
+    QElapsedTimer timer;
+    timer.start();
+    qint64 timeBudget = static_cast<qint64>(mUploadTimeBudget * 1.0e6f);
+
+    int uploadedNum = 0;
+
+    // the materials whose textures are still being decoded are put off, meanwhile
+    // the renderables using them are drawn without textures
+    size_t pendingNum = 0;
+    size_t i = 0;
+    for (; i<mPendingMaterials.size(); ++i) {
+        if (uploadedNum > 0 && timer.nsecsElapsed() >= timeBudget) break;
+        OpenGLMaterialEntityPtr &me = mMaterials[mPendingMaterials[i].index];
+        if (me && mTextureLoader->isPending(mPendingMaterials[i].texturePath)) {
+            mPendingMaterials[pendingNum++] = mPendingMaterials[i];
+            continue;
+        }
+        if (me && !me->uploadData(this->context())) {
+            me->destroyGL(this->context());
+            // hold the place to keep consistent with the scene structure of assimp
+            me.reset();
+        }
+        ++uploadedNum;
+    }
+    // the rest waits for the next frames
+    for (; i<mPendingMaterials.size(); ++i) {
+        mPendingMaterials[pendingNum++] = mPendingMaterials[i];
+    }
+    mPendingMaterials.resize(pendingNum);
+    if (mPendingMaterials.empty()) {
+        // the textures in use are held by the materials from now on
+        mTextureLoader->releaseUploaded();
+    }
+
+    while (mNextRenderableToUpload < mRenderables.size()) {
+        if (uploadedNum > 0 && timer.nsecsElapsed() >= timeBudget) break;
+        unsigned int meshIndex = static_cast<unsigned int>(mNextRenderableToUpload++);
+        OpenGLRenderableEntityPtr &re = mRenderables[meshIndex];
+        if (mStaticBatches && mStaticBatches->isMeshRetired(meshIndex)) continue;
+        if (re && !re->uploadData(this->context())) {
+            re->destroyGL(this->context());
+            // hold the place to keep consistent with the scene structure of assimp
+            re.reset();
+        }
+        ++uploadedNum;
+    }
+}
+
 void SceneWidget::clearSceneData()
 {
     for (OpenGLRenderableEntityPtr renderable : mRenderables) {
@@ -312,7 +790,9 @@ void SceneWidget::alignScene()
     mCameraPanSpeed = mSceneRadius * 0.01f;
 
     mTrackBall.reset();
-    mModelMatrix = glm::mat4x4(1.0f);
+    mTrackBall.update(mViewRotation);
+    mModelMatrix = glm::translate(glm::mat4(1.0f), mSceneCenter) * glm::mat4_cast(mViewRotation);
+    mModelMatrix = glm::translate(mModelMatrix, -mSceneCenter);
     mCameraMatrix = glm::lookAt(mCameraPos, mTargetPos, mCameraUp);
     mProjectionMatrix = glm::perspective(glm::radians(verticalAngle),
                                          (float)(mViewport[2])/(float)(mViewport[3]),
@@ -324,26 +804,12 @@ void SceneWidget::alignScene()
 
 void SceneWidget::recalculateBoundsCenter()
 {
-    bool initialized = false;
-    for (size_t i=0; i<mRenderables.size(); ++i) {
-        if (!mRenderables[i]) continue;
-        float const *rb = mRenderables[i]->bounds();
-        if (initialized) {
-            if (rb[0] < mSceneBounds[0]) mSceneBounds[0] = rb[0];
-            if (rb[1] > mSceneBounds[1]) mSceneBounds[1] = rb[1];
-            if (rb[2] < mSceneBounds[2]) mSceneBounds[2] = rb[2];
-            if (rb[3] > mSceneBounds[3]) mSceneBounds[3] = rb[3];
-            if (rb[4] < mSceneBounds[4]) mSceneBounds[4] = rb[4];
-            if (rb[5] > mSceneBounds[5]) mSceneBounds[5] = rb[5];
-        } else {
-            mSceneBounds[0] = rb[0];
-            mSceneBounds[1] = rb[1];
-            mSceneBounds[2] = rb[2];
-            mSceneBounds[3] = rb[3];
-            mSceneBounds[4] = rb[4];
-            mSceneBounds[5] = rb[5];
-            initialized = true;
-        }
+    // the root of the hierarchy over the instances bounds the whole scene (in the scene space)
+    float const *rb = mRenderScene ? mRenderScene->bounds() : nullptr;
+    if (rb && rb[0] <= rb[1]) {
+        std::copy(rb, rb+6, mSceneBounds);
+    } else {
+        std::fill(mSceneBounds, mSceneBounds+6, 0.0f);
     }
     float lx = mSceneBounds[1]-mSceneBounds[0];
     float ly = mSceneBounds[3]-mSceneBounds[2];
@@ -355,59 +821,470 @@ void SceneWidget::recalculateBoundsCenter()
     mSceneCenter.z = (mSceneBounds[4] + mSceneBounds[5]) * 0.5f;
 }
 
-void SceneWidget::drawRenderableEntity(glm::mat4x4 const &modelMat, OpenGLRenderableEntityPtr renderableEntity)
+void SceneWidget::drawRenderScene()
 {
-    if (!renderableEntity) return;
-    OpenGLMaterialEntityPtr material = renderableEntity->material();
-    if (!material) material = mDefaultMaterial;
+    mVisibleInstances.clear();
+    mCulledInstanceNumber = 0;
+    mOccludedInstanceNumber = 0;
+    if (!mRenderScene) return;
+    mRenderScene->updateWorldTransforms();
+
+    size_t instanceNum = mRenderScene->instanceNumber();
+    if (mFrustumCullingEnabled) {
+        // the planes are taken in the scene space, where the bounds of the instances are
+        mFrustum.setMatrix(mProjectionMatrix * mModelViewMatrix);
+        mRenderScene->cullInstances(mFrustum, mVisibleInstances);
+    } else {
+        mVisibleInstances.resize(instanceNum);
+        std::iota(mVisibleInstances.begin(), mVisibleInstances.end(), 0);
+    }
+    mCulledInstanceNumber = instanceNum - mVisibleInstances.size();
+
+    if (mOcclusionCullingEnabled) {
+        // the occluders are picked among the instances within the frustum
+        mOcclusionCuller.renderOccluders(*mRenderScene, mRenderables, mVisibleInstances, mProjectionMatrix * mModelViewMatrix);
+        mOcclusionCuller.cullInstances(*mRenderScene, mVisibleInstances);
+        mOccludedInstanceNumber = mOcclusionCuller.occludedInstanceNumber();
+    }
+
+    // the meshes referred to by more than one of the visible instances are drawn instanced
+    bool instancedPrograms = false;
+#ifdef USE_INSTANCED_DRAWING
+    instancedPrograms = mPhongSimpleInstancedProgram && mPhongTextureInstancedProgram;
+#endif
+    bool instancing = instancedPrograms && mInstancingEnabled;
+    // all the items take the instanced programs in the indirect draws
+    bool indirect = instancedPrograms && mIndirectDrawingEnabled && this->indirectDrawingSupported();
+    if (instancing) {
+        mMeshInstanceCounts.assign(mRenderables.size(), 0);
+        for (unsigned int instance : mVisibleInstances) {
+            ++mMeshInstanceCounts[mRenderScene->instanceMesh(instance)];
+        }
+    }
+
+    // the error of a level, at the unit distance from the camera, is projected onto
+    // this number of pixels (vertically, by the perspective projection)
+    float pixelsPerUnit = mProjectionMatrix[1][1] * 0.5f * mViewport[3] * mRenderScale;
+    float viewScale = glm::length(glm::vec3(mModelViewMatrix[0]));
+
+    mRenderQueue.clear();
+    for (unsigned int instance : mVisibleInstances) {
+        unsigned int meshIndex = mRenderScene->instanceMesh(instance);
+        assert(meshIndex < mRenderables.size());
+        OpenGLRenderableEntityPtr const &renderableEntity = mRenderables[meshIndex];
+        // not uploaded yet while streaming
+        if (!renderableEntity || !renderableEntity->isDrawable()) continue;
+
+        RenderItem item;
+        item.renderable = renderableEntity.get();
+        // the materials are held by the scene during the frame
+        OpenGLMaterialEntityPtr material = renderableEntity->material();
+        item.material = material ? material.get() : mDefaultMaterial.get();
+        item.program = mPhongSimpleProgram;
+        item.texture = nullptr;
+        if (renderableEntity->hasTexCoords() && item.material->diffuseTextureReady()) {
+            item.program = mPhongTextureProgram;
+            item.texture = item.material->diffuseTexture();
+        }
+        item.node = mRenderScene->instanceNode(instance);
+        float const *b = mRenderScene->instanceBounds(instance);
+        glm::vec4 center = mModelViewMatrix * glm::vec4((b[0]+b[1])*0.5f, (b[2]+b[3])*0.5f, (b[4]+b[5])*0.5f, 1.0f);
+        item.depth = -center.z;
+        item.level = 0;
+        if (mLevelOfDetailEnabled && renderableEntity->levelNumber() > 1) {
+            // the nearest depth of the bounding sphere of the instance, where the error looks the largest
+            glm::vec3 extent(b[1]-b[0], b[3]-b[2], b[5]-b[4]);
+            float distance = -center.z - 0.5f*glm::length(extent)*viewScale;
+            if (distance > 0.0f && pixelsPerUnit > 0.0f) {
+                glm::mat4x4 const &worldMat = mRenderScene->worldMatrix(item.node);
+                float worldScale = std::max(glm::length(glm::vec3(worldMat[0])),
+                                            std::max(glm::length(glm::vec3(worldMat[1])), glm::length(glm::vec3(worldMat[2]))));
+                // the largest error in the model space within the allowed pixels
+                float maxError = mLevelOfDetailPixelError * distance / (pixelsPerUnit * viewScale * worldScale);
+                item.level = renderableEntity->selectLevel(maxError);
+            }
+        }
+        // the textures with alpha (cut-outs, decals, glass) are blended as well
+        item.transparent = item.material->opacity() < 1.0f || (item.texture && item.material->diffuseTextureHasAlpha());
+        // the transparent ones are kept in the order of their depths
+        item.instanced = instancing && !item.transparent && mMeshInstanceCounts[meshIndex] > 1;
+        if (item.instanced || indirect) {
+            item.program = item.texture ? mPhongTextureInstancedProgram : mPhongSimpleInstancedProgram;
+        }
+        mRenderQueue.add(item);
+    }
+    mRenderQueue.sort();
+
+    if (indirect) {
+        this->drawRenderQueueIndirect();
+    } else {
+        this->drawRenderQueue();
+    }
+}
+
+void SceneWidget::drawRenderQueue()
+{
+    // the world transforms of the nodes are cached, only the view part changes per frame
+    glm::mat3x3 viewNormalMat = glm::transpose(glm::inverse(glm::mat3x3(mModelViewMatrix)));
+    glm::mat4x4 modelViewMat;
+    glm::mat3x3 normalMat;
+
+    this->uploadFrameUniforms();
+
+    // the current states, only the changed ones are set
+    QOpenGLShaderProgram *program = nullptr;
+    PhongUniformLocations const *uniforms = nullptr;
+    QOpenGLTexture *texture = nullptr;
+    OpenGLMaterialEntity const *material = nullptr;
+    unsigned int node = static_cast<unsigned int>(-1);
+    bool nodeMatrixSent = false;
+    int normalEncoded = -1;
+    bool blending = false;
+
+    // the transforms of the instanced items, uploaded in one go and taken by
+    // the batches in the order of the queue
+    std::vector<RenderItem> const &items = mRenderQueue.items();
+    mInstanceData.clear();
+    for (RenderItem const &item : items) {
+        if (!item.instanced) continue;
+        RenderableInstance instance;
+        glm::mat4x4 const &modelMat = mRenderScene->worldMatrix(item.node);
+        glm::mat3x3 const &instanceNormalMat = mRenderScene->normalMatrix(item.node);
+        std::copy(glm::value_ptr(modelMat), glm::value_ptr(modelMat)+16, instance.modelMatrix);
+        std::copy(glm::value_ptr(instanceNormalMat), glm::value_ptr(instanceNormalMat)+9, instance.normalMatrix);
+        mInstanceData.push_back(instance);
+    }
+    if (!mInstanceData.empty()) {
+        glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, mInstanceData.size()*sizeof(RenderableInstance), mInstanceData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    size_t nextInstance = 0;
+    mDrawCallNumber = 0;
+
+    glDisable(GL_BLEND);
+    for (size_t i = 0; i < items.size(); ) {
+        RenderItem const &item = items[i];
+        // the instances of a renderable sharing the states are drawn together
+        size_t batchEnd = i + 1;
+        if (item.instanced) {
+            while (batchEnd < items.size() && items[batchEnd].instanced && items[batchEnd].renderable == item.renderable &&
+                   items[batchEnd].level == item.level && items[batchEnd].program == item.program && items[batchEnd].material == item.material) {
+                ++batchEnd;
+            }
+        }
+
+        if (item.transparent && !blending) {
+            // the transparent items come after all the opaque ones, back to front
+            glEnable(GL_BLEND);
+            glDepthMask(GL_FALSE);
+            blending = true;
+        }
+
+        if (item.program != program) {
+            if (program) program->release();
+            program = item.program;
+            uniforms = this->bindProgram(program, viewNormalMat);
+#ifndef USE_UNIFORM_BUFFERS
+            // the uniforms of the other program are not those of this one
+            material = nullptr;
+#endif
+            node = static_cast<unsigned int>(-1);
+            normalEncoded = -1;
+        }
+
+        if (item.texture && item.texture != texture) {
+            item.texture->bind(OpenGLMaterialEntity::TEXUNIT_DIFFUSE);
+            texture = item.texture;
+        }
+
+        if (item.material != material) {
+            material = item.material;
+            this->applyMaterial(material, uniforms);
+        }
+
+        bool compact = item.renderable->vertexLayout() == VERTEX_LAYOUT_COMPACT;
+        if (static_cast<int>(compact) != normalEncoded) {
+            normalEncoded = compact;
+            glUniform1i(uniforms->normalEncoded, normalEncoded);
+        }
+
+        if (item.instanced) {
+            // the dequantization of the positions applies before the model transforms
+            glm::mat4x4 positionMat = compact ? item.renderable->positionTransform() : glm::mat4x4(1.0f);
+            glUniformMatrix4fv(uniforms->positionMatrix, 1, GL_FALSE, glm::value_ptr(positionMat));
+            GLsizei instanceNum = static_cast<GLsizei>(batchEnd - i);
+            item.renderable->drawSurfaceInstanced(this->context(), mInstanceBuffer, nextInstance*sizeof(RenderableInstance), instanceNum, item.level);
+            nextInstance += instanceNum;
+            ++mDrawCallNumber;
+            i = batchEnd;
+            continue;
+        }
+
+        if (item.node != node) {
+            node = item.node;
+            modelViewMat = mModelViewMatrix * mRenderScene->worldMatrix(node);
+            normalMat = viewNormalMat * mRenderScene->normalMatrix(node);
+            glUniformMatrix3fv(uniforms->normalMatrix, 1, GL_FALSE, glm::value_ptr(normalMat));
+            nodeMatrixSent = false;
+        }
+        if (compact) {
+            // the dequantization of the positions goes into the position transform
+            glm::mat4x4 positionMat = modelViewMat * item.renderable->positionTransform();
+            glUniformMatrix4fv(uniforms->modelViewMatrix, 1, GL_FALSE, glm::value_ptr(positionMat));
+            nodeMatrixSent = false;
+        } else if (!nodeMatrixSent) {
+            glUniformMatrix4fv(uniforms->modelViewMatrix, 1, GL_FALSE, glm::value_ptr(modelViewMat));
+            nodeMatrixSent = true;
+        }
+
+        item.renderable->drawSurface(this->context(), item.level);
+        ++mDrawCallNumber;
+        i = batchEnd;
+    }
+
+    if (texture) texture->release(OpenGLMaterialEntity::TEXUNIT_DIFFUSE);
+    if (program) program->release();
+    GeometryArena *arena = GeometryArena::instance(this->context());
+    if (arena) arena->releaseVertexArray();
+    if (blending) {
+        glDisable(GL_BLEND);
+        glDepthMask(GL_TRUE);
+    }
+}
+
+void SceneWidget::drawRenderQueueIndirect()
+{
+    glm::mat3x3 viewNormalMat = glm::transpose(glm::inverse(glm::mat3x3(mModelViewMatrix)));
+    GeometryArena *arena = GeometryArena::instance(this->context());
+    QOpenGLExtraFunctions *f = this->context()->extraFunctions();
+
+    this->uploadFrameUniforms();
 
-    QOpenGLShaderProgram *glslProgram = mPhongSimpleProgram;
-    bool useDiffuseTexture = false;
-    if (renderableEntity->hasTexCoords() && material->diffuseTextureReady()) {
-        glslProgram = mPhongTextureProgram;
-        useDiffuseTexture = true;
+    // the transforms of all the items go into the per-instance attributes, taken
+    // by the commands through their base instances, and the items sharing the
+    // states and the vertex array object make a batch drawn by one call
+    std::vector<RenderItem> const &items = mRenderQueue.items();
+    mInstanceData.clear();
+    mIndirectCommands.clear();
+    mIndirectBatches.clear();
+    for (size_t i = 0; i < items.size(); ) {
+        RenderItem const &item = items[i];
+        GeometryAllocation const &allocation = item.renderable->geometryAllocation();
+
+        // the run of the items of the same renderable is drawn as the instances of one command
+        size_t runEnd = i + 1;
+        while (runEnd < items.size() && items[runEnd].renderable == item.renderable && items[runEnd].level == item.level &&
+               items[runEnd].program == item.program && items[runEnd].material == item.material &&
+               items[runEnd].transparent == item.transparent) {
+            ++runEnd;
+        }
+        GLuint baseInstance = static_cast<GLuint>(mInstanceData.size());
+        // the dequantization of the positions goes into the model transforms
+        glm::mat4x4 positionMat = item.renderable->positionTransform();
+        for (size_t k = i; k < runEnd; ++k) {
+            RenderableInstance instance;
+            glm::mat4x4 modelMat = mRenderScene->worldMatrix(items[k].node) * positionMat;
+            glm::mat3x3 const &instanceNormalMat = mRenderScene->normalMatrix(items[k].node);
+            std::copy(glm::value_ptr(modelMat), glm::value_ptr(modelMat)+16, instance.modelMatrix);
+            std::copy(glm::value_ptr(instanceNormalMat), glm::value_ptr(instanceNormalMat)+9, instance.normalMatrix);
+            mInstanceData.push_back(instance);
+        }
+
+        IndirectBatch *batch = mIndirectBatches.empty() ? nullptr : &mIndirectBatches.back();
+        bool direct = !allocation.isValid();
+        if (!batch || direct || batch->direct || batch->program != item.program || batch->texture != item.texture ||
+            batch->material != item.material || batch->transparent != item.transparent ||
+            batch->page != allocation.page || batch->indexType != item.renderable->indexType()) {
+            // the renderables not in the arena are drawn on their own
+            IndirectBatch newBatch;
+            newBatch.renderable = item.renderable;
+            newBatch.program = item.program;
+            newBatch.texture = item.texture;
+            newBatch.material = item.material;
+            newBatch.transparent = item.transparent;
+            newBatch.direct = direct;
+            newBatch.level = item.level;
+            newBatch.page = allocation.page;
+            newBatch.indexType = item.renderable->indexType();
+            newBatch.commandBegin = mIndirectCommands.size();
+            newBatch.commandNumber = 0;
+            newBatch.baseInstance = baseInstance;
+            newBatch.instanceNumber = 0;
+            mIndirectBatches.push_back(newBatch);
+            batch = &mIndirectBatches.back();
+        }
+        GLuint instanceNum = static_cast<GLuint>(runEnd - i);
+        if (!direct) item.renderable->appendIndirectCommands(mIndirectCommands, instanceNum, baseInstance, item.level);
+        batch->commandNumber = mIndirectCommands.size() - batch->commandBegin;
+        batch->instanceNumber += instanceNum;
+        i = runEnd;
     }
 
-    glslProgram->bind();
-    glm::mat3x3 normMat = glm::transpose(glm::inverse(glm::mat3x3(modelMat)));
-    glUniformMatrix4fv(glslProgram->uniformLocation("projectionMatrix"), 1, GL_FALSE, glm::value_ptr(mProjectionMatrix));
-    glUniformMatrix4fv(glslProgram->uniformLocation("modelViewMatrix"), 1, GL_FALSE, glm::value_ptr(modelMat));
-    glUniformMatrix3fv(glslProgram->uniformLocation("normalMatrix"), 1, GL_FALSE, glm::value_ptr(normMat));
-    glUniform4fv(glslProgram->uniformLocation("lightPosition"), 1, glm::value_ptr(mLightPos));
-    glUniform4fv(glslProgram->uniformLocation("lightAmbient"), 1, mLight.ambient());
-    glUniform4fv(glslProgram->uniformLocation("lightDiffuse"), 1, mLight.diffuse());
-    glUniform4fv(glslProgram->uniformLocation("lightSpecular"), 1, mLight.specular());
-    glUniform4fv(glslProgram->uniformLocation("materialAmbient"), 1, material->ambient());
-    glUniform4fv(glslProgram->uniformLocation("materialDiffuse"), 1, material->diffuse());
-    glUniform4fv(glslProgram->uniformLocation("materialEmission"), 1, material->emission());
-    glUniform4fv(glslProgram->uniformLocation("materialSpecular"), 1, material->specular());
-    glUniform1f(glslProgram->uniformLocation("materialShininess"), material->shininess());
-    if (useDiffuseTexture) {
-        material->diffuseTexture()->bind(OpenGLMaterialEntity::TEXUNIT_DIFFUSE);
-        glUniform1i(glslProgram->uniformLocation("materialDiffuseMap"), OpenGLMaterialEntity::TEXUNIT_DIFFUSE);
+    if (!mInstanceData.empty()) {
+        glBindBuffer(GL_ARRAY_BUFFER, mInstanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, mInstanceData.size()*sizeof(RenderableInstance), mInstanceData.data(), GL_STREAM_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    if (!mIndirectCommands.empty()) {
+        glBindBuffer(GL_DRAW_INDIRECT_BUFFER, mIndirectBuffer);
+        glBufferData(GL_DRAW_INDIRECT_BUFFER, mIndirectCommands.size()*sizeof(DrawElementsIndirectCommand), mIndirectCommands.data(), GL_STREAM_DRAW);
+    }
+
+    // the current states, only the changed ones are set
+    QOpenGLShaderProgram *program = nullptr;
+    PhongUniformLocations const *uniforms = nullptr;
+    QOpenGLTexture *texture = nullptr;
+    OpenGLMaterialEntity const *material = nullptr;
+    int page = -1;
+    int normalEncoded = -1;
+    bool blending = false;
+    mDrawCallNumber = 0;
+
+    glDisable(GL_BLEND);
+    for (IndirectBatch const &batch : mIndirectBatches) {
+        if (batch.transparent && !blending) {
+            // the transparent items come after all the opaque ones, back to front
+            glEnable(GL_BLEND);
+            glDepthMask(GL_FALSE);
+            blending = true;
+        }
+        if (batch.program != program) {
+            if (program) program->release();
+            program = batch.program;
+            uniforms = this->bindProgram(program, viewNormalMat);
+            // the positions are dequantized by the model transforms of the instances
+            glUniformMatrix4fv(uniforms->positionMatrix, 1, GL_FALSE, glm::value_ptr(glm::mat4x4(1.0f)));
+            normalEncoded = -1;
+        }
+        if (batch.texture && batch.texture != texture) {
+            batch.texture->bind(OpenGLMaterialEntity::TEXUNIT_DIFFUSE);
+            texture = batch.texture;
+        }
+        if (batch.material != material) {
+            material = batch.material;
+            this->applyMaterial(material, uniforms);
+        }
+        // the vertex format is the same within a page
+        bool compact = batch.renderable->vertexLayout() == VERTEX_LAYOUT_COMPACT;
+        if (static_cast<int>(compact) != normalEncoded) {
+            normalEncoded = compact;
+            glUniform1i(uniforms->normalEncoded, normalEncoded);
+        }
+
+        if (batch.direct) {
+            page = -1;
+            batch.renderable->drawSurfaceInstanced(this->context(), mInstanceBuffer, batch.baseInstance*sizeof(RenderableInstance), batch.instanceNumber, batch.level);
+            ++mDrawCallNumber;
+            continue;
+        }
+        if (batch.page != page) {
+            // the instances are taken from the start of the buffer, offset by the base instances
+            page = batch.page;
+            arena->bindVertexArray(batch.renderable->geometryAllocation());
+            setup_instance_attributes(f, mInstanceBuffer, 0);
+        }
+        arena->multiDrawElementsIndirect(batch.indexType, batch.commandBegin*sizeof(DrawElementsIndirectCommand), static_cast<GLsizei>(batch.commandNumber));
+        ++mDrawCallNumber;
     }
-    renderableEntity->drawSurface(this->context());
-    if (useDiffuseTexture) {
-        material->diffuseTexture()->release();
+
+    if (!mIndirectCommands.empty()) glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    if (texture) texture->release(OpenGLMaterialEntity::TEXUNIT_DIFFUSE);
+    if (program) program->release();
+    arena->releaseVertexArray();
+    if (blending) {
+        glDisable(GL_BLEND);
+        glDepthMask(GL_TRUE);
     }
-    glslProgram->release();
 }
 
-void SceneWidget::drawSceneNode(glm::mat4x4 const &parentModelMat, const aiNode *node)
+void SceneWidget::uploadFrameUniforms()
+{
+#ifdef USE_UNIFORM_BUFFERS
+    // the uniforms shared by all the items of the frame, taken by all the programs
+    FrameUniformData frameData;
+    std::copy(glm::value_ptr(mProjectionMatrix), glm::value_ptr(mProjectionMatrix)+16, frameData.projectionMatrix);
+    std::copy(glm::value_ptr(mLightPos), glm::value_ptr(mLightPos)+4, frameData.lightPosition);
+    std::copy(mLight.ambient(), mLight.ambient()+4, frameData.lightAmbient);
+    std::copy(mLight.diffuse(), mLight.diffuse()+4, frameData.lightDiffuse);
+    std::copy(mLight.specular(), mLight.specular()+4, frameData.lightSpecular);
+    glBindBuffer(GL_UNIFORM_BUFFER, mFrameUniformBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniformData), &frameData);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    this->context()->extraFunctions()->glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, mFrameUniformBuffer);
+#endif
+}
+
+PhongUniformLocations const * SceneWidget::bindProgram(QOpenGLShaderProgram *program, glm::mat3x3 const &viewNormalMat)
 {
-    if (node == nullptr) return;
-    glm::mat4x4 nodeModelMat = get_glm_mat4x4(node->mTransformation);
-    glm::mat4x4 modelMat = parentModelMat * nodeModelMat;
-    for (unsigned int i=0; i<node->mNumMeshes; ++i) {
-        unsigned int curMeshIdx = node->mMeshes[i];
-        assert(curMeshIdx < mRenderables.size());
-        OpenGLRenderableEntityPtr renderableEntity = mRenderables[node->mMeshes[i]];
-        this->drawRenderableEntity(modelMat, renderableEntity);
+    program->bind();
+    PhongUniformLocations const *uniforms = this->programUniforms(program);
+#ifndef USE_UNIFORM_BUFFERS
+    // the uniforms shared by all the items of the frame
+    glUniformMatrix4fv(uniforms->projectionMatrix, 1, GL_FALSE, glm::value_ptr(mProjectionMatrix));
+    glUniform4fv(uniforms->lightPosition, 1, glm::value_ptr(mLightPos));
+    glUniform4fv(uniforms->lightAmbient, 1, mLight.ambient());
+    glUniform4fv(uniforms->lightDiffuse, 1, mLight.diffuse());
+    glUniform4fv(uniforms->lightSpecular, 1, mLight.specular());
+#endif
+    if (program == mPhongSimpleInstancedProgram || program == mPhongTextureInstancedProgram) {
+        // the view part only, the model transforms come with the instances
+        glUniformMatrix4fv(uniforms->modelViewMatrix, 1, GL_FALSE, glm::value_ptr(mModelViewMatrix));
+        glUniformMatrix3fv(uniforms->normalMatrix, 1, GL_FALSE, glm::value_ptr(viewNormalMat));
     }
+    return uniforms;
+}
 
-    for (unsigned int i=0; i<node->mNumChildren; ++i) {
-        this->drawSceneNode(modelMat, node->mChildren[i]);
+void SceneWidget::applyMaterial(OpenGLMaterialEntity const *material, PhongUniformLocations const *uniforms)
+{
+#ifdef USE_UNIFORM_BUFFERS
+    // the block is shared by the programs, only the range of the material is switched
+    Q_UNUSED(uniforms);
+    auto found = mMaterialUniformIndices.find(material);
+    GLintptr offset = found != mMaterialUniformIndices.end() ? static_cast<GLintptr>(found->second) * mMaterialUniformStride : 0;
+    this->context()->extraFunctions()->glBindBufferRange(GL_UNIFORM_BUFFER, MATERIAL_UNIFORM_BINDING, mMaterialUniformBuffer, offset, sizeof(MaterialUniformData));
+#else
+    glUniform4fv(uniforms->materialAmbient, 1, material->ambient());
+    glUniform4fv(uniforms->materialDiffuse, 1, material->diffuse());
+    glUniform4fv(uniforms->materialEmission, 1, material->emission());
+    glUniform4fv(uniforms->materialSpecular, 1, material->specular());
+    glUniform1f(uniforms->materialShininess, material->shininess());
+#endif
+}
+
+PhongUniformLocations const * SceneWidget::programUniforms(QOpenGLShaderProgram const *program) const
+{
+    if (program == mPhongTextureProgram) return &mPhongTextureUniforms;
+    if (program == mPhongSimpleInstancedProgram) return &mPhongSimpleInstancedUniforms;
+    if (program == mPhongTextureInstancedProgram) return &mPhongTextureInstancedUniforms;
+    return &mPhongSimpleUniforms;
+}
+
+void SceneWidget::uploadMaterialUniforms()
+{
+    // the default material goes first, followed by the ones referred to by the renderables
+    // (the failed uploads are dropped from the materials, but still referred to)
+    mMaterialUniformIndices.clear();
+    mMaterialUniformIndices.emplace(mDefaultMaterial.get(), 0);
+    std::vector<OpenGLMaterialEntity const *> materials(1, mDefaultMaterial.get());
+    for (OpenGLMaterialEntityPtr const &me : mMaterials) {
+        if (me && mMaterialUniformIndices.emplace(me.get(), materials.size()).second) materials.push_back(me.get());
+    }
+    for (OpenGLRenderableEntityPtr const &re : mRenderables) {
+        OpenGLMaterialEntityPtr me = re ? re->material() : OpenGLMaterialEntityPtr();
+        if (me && mMaterialUniformIndices.emplace(me.get(), materials.size()).second) materials.push_back(me.get());
     }
+
+#ifdef USE_UNIFORM_BUFFERS
+    if (!mMaterialUniformBuffer) return;
+    std::vector<char> data(materials.size() * mMaterialUniformStride, 0);
+    for (size_t i=0; i<materials.size(); ++i) {
+        get_material_uniform_data(materials[i], *reinterpret_cast<MaterialUniformData *>(&data[i*mMaterialUniformStride]));
+    }
+    glBindBuffer(GL_UNIFORM_BUFFER, mMaterialUniformBuffer);
+    glBufferData(GL_UNIFORM_BUFFER, data.size(), data.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+#endif
 }
 
 void SceneWidget::cameraZoom(float dz)
@@ -434,3 +1311,121 @@ void SceneWidget::cameraPan(float dx, float dy)
     mCameraMatrix = glm::lookAt(mCameraPos, mTargetPos, mCameraUp);
     this->update();
 }
+
+void SceneWidget::beginInteraction()
+{
+    if (!mInteracting) {
+        mInteracting = true;
+        // the scale reached in the last interaction is kept, not its frame times
+        mFrameGovernor.restart();
+    }
+    mIdleTimer.start();
+}
+
+bool SceneWidget::bindOffscreenBuffer(int width, int height, int &samples)
+{
+    // taken at the full size, so that they are not reallocated as the scale changes
+    if (!mOffscreenBuffer || mOffscreenBuffer->width() != mViewport[2] || mOffscreenBuffer->height() != mViewport[3]) {
+        delete mOffscreenBuffer;
+        mOffscreenBuffer = new QOpenGLFramebufferObject(mViewport[2], mViewport[3], QOpenGLFramebufferObject::Depth);
+        if (!mOffscreenBuffer->isValid()) {
+            LOG_WARNING_QSTRING(tr("Fail to create the offscreen buffer, dynamic resolution and anti-aliasing disabled"));
+            delete mOffscreenBuffer;
+            mOffscreenBuffer = nullptr;
+            mDynamicResolutionEnabled = false;
+            mAntiAliasing = ANTIALIASING_OFF;
+            return false;
+        }
+        // stretched onto the widget with linear filtering
+        glBindTexture(GL_TEXTURE_2D, mOffscreenBuffer->texture());
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glBindTexture(GL_TEXTURE_2D, 0);
+    }
+    if (samples > 0 && (!mMultisampleBuffer || mMultisampleBuffer->size() != mOffscreenBuffer->size() ||
+                        mMultisampleBufferSamples != samples)) {
+        delete mMultisampleBuffer;
+        QOpenGLFramebufferObjectFormat format;
+        format.setAttachment(QOpenGLFramebufferObject::Depth);
+        format.setSamples(samples);
+        mMultisampleBuffer = new QOpenGLFramebufferObject(mOffscreenBuffer->size(), format);
+        mMultisampleBufferSamples = samples;
+        if (!mMultisampleBuffer->isValid()) {
+            LOG_WARNING_QSTRING(tr("Fail to create the multisampled buffer of %1 samples, anti-aliasing disabled").arg(samples));
+            delete mMultisampleBuffer;
+            mMultisampleBuffer = nullptr;
+            mAntiAliasing = ANTIALIASING_OFF;
+            samples = 0;
+        }
+    }
+    if (!mTextureBlitter.isCreated() && !mTextureBlitter.create()) return false;
+
+    if (samples > 0) {
+        mMultisampleBuffer->bind();
+    } else {
+        mOffscreenBuffer->bind();
+    }
+    glViewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    return true;
+}
+
+void SceneWidget::presentOffscreenBuffer(int width, int height, int samples, bool fxaa)
+{
+    GLuint target = this->defaultFramebufferObject();
+    if (samples > 0) {
+        // resolved onto the widget at the full resolution, otherwise into the offscreen buffer to be stretched
+        bool direct = width == mViewport[2] && height == mViewport[3];
+        glBindFramebuffer(GL_READ_FRAMEBUFFER, mMultisampleBuffer->handle());
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, direct ? target : mOffscreenBuffer->handle());
+        GLint x = direct ? mViewport[0] : 0;
+        GLint y = direct ? mViewport[1] : 0;
+        this->context()->extraFunctions()->glBlitFramebuffer(0, 0, width, height, x, y, x+width, y+height,
+                                                             GL_COLOR_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, target);
+        if (direct) return;
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target);
+    glViewport(mViewport[0], mViewport[1], mViewport[2], mViewport[3]);
+    glDisable(GL_DEPTH_TEST);
+    if (fxaa) {
+        this->drawFxaaPass(width, height);
+        return;
+    }
+    // the lower left part of the buffer onto the whole viewport
+    QMatrix3x3 source = QOpenGLTextureBlitter::sourceTransform(QRectF(0, 0, width, height), mOffscreenBuffer->size(),
+                                                               QOpenGLTextureBlitter::OriginBottomLeft);
+    mTextureBlitter.bind();
+    mTextureBlitter.blit(mOffscreenBuffer->texture(), QMatrix4x4(), source);
+    mTextureBlitter.release();
+}
+
+void SceneWidget::drawFxaaPass(int width, int height)
+{
+    float bufferWidth = static_cast<float>(mOffscreenBuffer->width());
+    float bufferHeight = static_cast<float>(mOffscreenBuffer->height());
+    mFxaaProgram->bind();
+    glUniform2f(mFxaaSourceExtentLocation, width / bufferWidth, height / bufferHeight);
+    glUniform2f(mFxaaTexelSizeLocation, 1.0f / bufferWidth, 1.0f / bufferHeight);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, mOffscreenBuffer->texture());
+
+    if (mScreenTriangleArray.isCreated()) {
+        mScreenTriangleArray.bind();
+    } else {
+        glBindBuffer(GL_ARRAY_BUFFER, mScreenTriangleBuffer);
+        glEnableVertexAttribArray(VertexAttribute::POSITION);
+        glVertexAttribPointer(VertexAttribute::POSITION, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+    }
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    if (mScreenTriangleArray.isCreated()) {
+        mScreenTriangleArray.release();
+    } else {
+        glDisableVertexAttribArray(VertexAttribute::POSITION);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    glBindTexture(GL_TEXTURE_2D, 0);
+    mFxaaProgram->release();
+}
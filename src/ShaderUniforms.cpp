@@ -0,0 +1,74 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "ShaderUniforms.h"
+#include "OpenGLMaterialEntity.h"
+
+#include <QOpenGLShaderProgram>
+#include <QOpenGLContext>
+#include <QOpenGLExtraFunctions>
+
+#include <algorithm>
+
+void get_material_uniform_data(OpenGLMaterialEntity const *material, MaterialUniformData &data)
+{
+    std::copy(material->ambient(), material->ambient()+4, data.materialAmbient);
+    std::copy(material->diffuse(), material->diffuse()+4, data.materialDiffuse);
+    std::copy(material->emission(), material->emission()+4, data.materialEmission);
+    std::copy(material->specular(), material->specular()+4, data.materialSpecular);
+    data.materialShininess = material->shininess();
+    data.padding[0] = data.padding[1] = data.padding[2] = 0.0f;
+}
+
+PhongUniformLocations::PhongUniformLocations()
+{
+    modelViewMatrix = normalMatrix = normalEncoded = materialDiffuseMap = positionMatrix = -1;
+    projectionMatrix = lightPosition = lightAmbient = lightDiffuse = lightSpecular = -1;
+    materialAmbient = materialDiffuse = materialEmission = materialSpecular = materialShininess = -1;
+}
+
+void PhongUniformLocations::resolve(QOpenGLShaderProgram *program)
+{
+    modelViewMatrix = program->uniformLocation("modelViewMatrix");
+    normalMatrix = program->uniformLocation("normalMatrix");
+    normalEncoded = program->uniformLocation("normalEncoded");
+    materialDiffuseMap = program->uniformLocation("materialDiffuseMap");
+    positionMatrix = program->uniformLocation("positionMatrix");
+
+#ifdef USE_UNIFORM_BUFFERS
+    QOpenGLExtraFunctions *f = QOpenGLContext::currentContext()->extraFunctions();
+    GLuint frameBlock = f->glGetUniformBlockIndex(program->programId(), "FrameData");
+    if (frameBlock != GL_INVALID_INDEX) f->glUniformBlockBinding(program->programId(), frameBlock, FRAME_UNIFORM_BINDING);
+    GLuint materialBlock = f->glGetUniformBlockIndex(program->programId(), "MaterialData");
+    if (materialBlock != GL_INVALID_INDEX) f->glUniformBlockBinding(program->programId(), materialBlock, MATERIAL_UNIFORM_BINDING);
+#else
+    projectionMatrix = program->uniformLocation("projectionMatrix");
+    lightPosition = program->uniformLocation("lightPosition");
+    lightAmbient = program->uniformLocation("lightAmbient");
+    lightDiffuse = program->uniformLocation("lightDiffuse");
+    lightSpecular = program->uniformLocation("lightSpecular");
+    materialAmbient = program->uniformLocation("materialAmbient");
+    materialDiffuse = program->uniformLocation("materialDiffuse");
+    materialEmission = program->uniformLocation("materialEmission");
+    materialSpecular = program->uniformLocation("materialSpecular");
+    materialShininess = program->uniformLocation("materialShininess");
+#endif
+}
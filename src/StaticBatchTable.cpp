@@ -0,0 +1,305 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "StaticBatchTable.h"
+#include "OpenGLRenderableEntity.h"
+#include "RenderScene.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+
+#include <algorithm>
+#include <cmath>
+#include <map>
+
+#include "assimp/scene.h"
+
+// a batch is drawn with 16-bit indices
+static unsigned int const MAX_BATCH_VERTICES = 65536;
+// the meshes referred by more instances are left to the instanced drawing
+static unsigned int const MAX_MERGED_INSTANCES_PER_MESH = 8;
+// the largest extent of a batch, relative to the diagonal of the scene
+static float const MAX_BATCH_EXTENT_RATIO = 0.125f;
+
+/**
+ * @brief the vertex and index data of a batch, owned by its renderable
+ */
+struct StaticBatchData
+{
+    std::vector<unsigned char> vertices;
+    std::vector<unsigned short> indices;
+};
+
+/**
+ * @brief the instances merged into a batch, and the renderable made of them
+ */
+struct StaticBatchChunk
+{
+    std::vector<unsigned int> instances;
+    OpenGLRenderableEntityPtr renderable;
+};
+
+inline unsigned int triangle_number(aiMesh const *mesh)
+{
+    unsigned int triangleNumber = 0;
+    for (unsigned int i = 0; i < mesh->mNumFaces; ++i) {
+        if (mesh->mFaces[i].mNumIndices == 3) ++triangleNumber; // ignore non-triangle face
+    }
+    return triangleNumber;
+}
+
+/**
+ * @brief the material and the vertex format, which the meshes merged together agree on
+ */
+inline std::vector<unsigned int> batch_key(aiMesh const *mesh)
+{
+    std::vector<unsigned int> key(1, mesh->mMaterialIndex);
+    key.push_back(mesh->mNormals != nullptr ? 1u : 0u);
+    for (unsigned int c = 0; c < mesh->GetNumUVChannels(); ++c) {
+        key.push_back(mesh->mNumUVComponents[c]);
+    }
+    return key;
+}
+
+/**
+ * @brief merge the instances into a renderable in the scene space
+ */
+static OpenGLRenderableEntityPtr merge_instances(aiScene const *scene, RenderScene const &renderScene,
+                                                 std::vector<unsigned int> const &instances, VertexLayout vertexLayout)
+{
+    aiMesh const *first = scene->mMeshes[renderScene.instanceMesh(instances.front())];
+    unsigned int vertexNumber = 0, triangleNumber = 0;
+    for (unsigned int i : instances) {
+        aiMesh const *mesh = scene->mMeshes[renderScene.instanceMesh(i)];
+        vertexNumber += mesh->mNumVertices;
+        triangleNumber += triangle_number(mesh);
+    }
+
+    // the merged mesh is only kept for interleaving the vertices
+    aiMesh merged;
+    merged.mNumVertices = vertexNumber;
+    merged.mVertices = new aiVector3D[vertexNumber];
+    if (first->mNormals != nullptr) merged.mNormals = new aiVector3D[vertexNumber];
+    for (unsigned int c = 0; c < first->GetNumUVChannels(); ++c) {
+        merged.mTextureCoords[c] = new aiVector3D[vertexNumber];
+        merged.mNumUVComponents[c] = first->mNumUVComponents[c];
+    }
+
+    std::shared_ptr<StaticBatchData> data = std::make_shared<StaticBatchData>();
+    data->indices.reserve(static_cast<size_t>(triangleNumber)*3);
+    unsigned int base = 0;
+    for (unsigned int i : instances) {
+        aiMesh const *mesh = scene->mMeshes[renderScene.instanceMesh(i)];
+        glm::mat4x4 const &world = renderScene.worldMatrix(renderScene.instanceNode(i));
+        glm::mat3x3 const &normalMat = renderScene.normalMatrix(renderScene.instanceNode(i));
+        for (unsigned int v = 0; v < mesh->mNumVertices; ++v) {
+            aiVector3D const &p = mesh->mVertices[v];
+            glm::vec4 wp = world * glm::vec4(p.x, p.y, p.z, 1.0f);
+            merged.mVertices[base+v] = aiVector3D(wp.x, wp.y, wp.z);
+            if (merged.mNormals != nullptr) {
+                // normalized when interleaved
+                aiVector3D const &n = mesh->mNormals[v];
+                glm::vec3 wn = normalMat * glm::vec3(n.x, n.y, n.z);
+                merged.mNormals[base+v] = aiVector3D(wn.x, wn.y, wn.z);
+            }
+        }
+        for (unsigned int c = 0; c < first->GetNumUVChannels(); ++c) {
+            std::copy(mesh->mTextureCoords[c], mesh->mTextureCoords[c] + mesh->mNumVertices, merged.mTextureCoords[c] + base);
+        }
+        for (unsigned int f = 0; f < mesh->mNumFaces; ++f) {
+            if (mesh->mFaces[f].mNumIndices != 3) continue; // ignore non-triangle face
+            for (unsigned int k = 0; k < 3; ++k) {
+                data->indices.emplace_back(static_cast<unsigned short>(base + mesh->mFaces[f].mIndices[k]));
+            }
+        }
+        base += mesh->mNumVertices;
+    }
+
+    RenderableDataView view;
+    view.vertexNumber = vertexNumber;
+    view.vertexLayout = vertexLayout;
+    view.indexNumber = static_cast<unsigned int>(data->indices.size());
+    view.indexDataNumber = view.indexNumber;
+    view.indexSize = sizeof(unsigned short);
+    view.hasNormal = (merged.mNormals != nullptr);
+    for (unsigned int c = 0; c < merged.GetNumUVChannels(); ++c) {
+        view.textureComponents.emplace_back(merged.mNumUVComponents[c]);
+    }
+    for (unsigned int k = 0; k < 3; ++k) {
+        view.bounds[k*2] = view.bounds[k*2+1] = merged.mVertices[0][k];
+    }
+    for (unsigned int v = 1; v < vertexNumber; ++v) {
+        for (unsigned int k = 0; k < 3; ++k) {
+            view.bounds[k*2] = std::min(view.bounds[k*2], merged.mVertices[v][k]);
+            view.bounds[k*2+1] = std::max(view.bounds[k*2+1], merged.mVertices[v][k]);
+        }
+    }
+
+    if (vertexLayout == VERTEX_LAYOUT_COMPACT) {
+        view.vertexStride = compact_vertex_stride(&merged);
+        data->vertices.resize(static_cast<size_t>(vertexNumber)*view.vertexStride);
+        write_compact_mesh_vertices(&merged, view.bounds, data->vertices.data());
+    } else {
+        view.vertexStride = interleaved_components(&merged)*sizeof(float);
+        data->vertices.resize(static_cast<size_t>(vertexNumber)*view.vertexStride);
+        interleave_mesh_vertices(&merged, reinterpret_cast<float *>(data->vertices.data()));
+    }
+    view.vertexData = data->vertices.data();
+    view.indexData = data->indices.data();
+
+    OpenGLRenderableEntityPtr renderable = std::make_shared<OpenGLRenderableEntity>();
+    if (!renderable->loadData(view, data)) return OpenGLRenderableEntityPtr();
+    return renderable;
+}
+
+StaticBatchTable::StaticBatchTable()
+{
+    mSourceMeshNumber = 0;
+}
+
+bool StaticBatchTable::build(aiScene const *scene, RenderScene const &renderScene, OpenGLRenderableEntityArray &renderables,
+                             VertexLayout vertexLayout, unsigned int maxMeshVertices)
+{
+    this->clear();
+    mSourceMeshNumber = static_cast<unsigned int>(renderables.size());
+    if (scene == nullptr || scene->mMeshes == nullptr) return false;
+
+    float const *sceneBounds = renderScene.bounds();
+    if (renderScene.instanceNumber() == 0 || sceneBounds[0] > sceneBounds[1]) return false;
+    float sx = sceneBounds[1]-sceneBounds[0], sy = sceneBounds[3]-sceneBounds[2], sz = sceneBounds[5]-sceneBounds[4];
+    float maxExtent = std::sqrt(sx*sx + sy*sy + sz*sz) * MAX_BATCH_EXTENT_RATIO;
+
+    size_t meshNum = std::min<size_t>(renderables.size(), scene->mNumMeshes);
+    std::vector<unsigned int> instanceCounts(meshNum, 0);
+    for (size_t i = 0; i < renderScene.instanceNumber(); ++i) {
+        if (renderScene.instanceMesh(i) < meshNum) ++instanceCounts[renderScene.instanceMesh(i)];
+    }
+
+    // the instances of the small meshes grouped by the material and the vertex format
+    std::map<std::vector<unsigned int>, std::vector<unsigned int>> groups;
+    for (size_t i = 0; i < renderScene.instanceNumber(); ++i) {
+        unsigned int m = renderScene.instanceMesh(i);
+        if (m >= meshNum || !renderables[m]) continue;
+        aiMesh const *mesh = scene->mMeshes[m];
+        if (mesh->mNumVertices > maxMeshVertices || instanceCounts[m] > MAX_MERGED_INSTANCES_PER_MESH) continue;
+        if (triangle_number(mesh) == 0) continue;
+        groups[batch_key(mesh)].push_back(static_cast<unsigned int>(i));
+    }
+
+    // split each group at the median of the centers along the longest axis,
+    // until a chunk fits 16-bit indices and is small enough
+    std::vector<StaticBatchChunk> chunks;
+    for (auto &group : groups) {
+        std::vector<std::vector<unsigned int>> stack(1, std::move(group.second));
+        while (!stack.empty()) {
+            std::vector<unsigned int> instances = std::move(stack.back());
+            stack.pop_back();
+            if (instances.size() < 2) continue; // nothing to merge
+
+            float bounds[6];
+            std::copy(renderScene.instanceBounds(instances[0]), renderScene.instanceBounds(instances[0])+6, bounds);
+            unsigned int vertexNumber = 0;
+            for (unsigned int i : instances) {
+                float const *ib = renderScene.instanceBounds(i);
+                for (int k = 0; k < 3; ++k) {
+                    bounds[k*2] = std::min(bounds[k*2], ib[k*2]);
+                    bounds[k*2+1] = std::max(bounds[k*2+1], ib[k*2+1]);
+                }
+                vertexNumber += scene->mMeshes[renderScene.instanceMesh(i)]->mNumVertices;
+            }
+            int axis = 0;
+            for (int k = 1; k < 3; ++k) {
+                if (bounds[k*2+1]-bounds[k*2] > bounds[axis*2+1]-bounds[axis*2]) axis = k;
+            }
+            if (vertexNumber <= MAX_BATCH_VERTICES && bounds[axis*2+1]-bounds[axis*2] <= maxExtent) {
+                // the sources in the order of the nodes
+                std::sort(instances.begin(), instances.end());
+                chunks.emplace_back();
+                chunks.back().instances = std::move(instances);
+                continue;
+            }
+
+            size_t half = instances.size()/2;
+            std::nth_element(instances.begin(), instances.begin()+half, instances.end(), [&](unsigned int a, unsigned int b) {
+                float const *ba = renderScene.instanceBounds(a);
+                float const *bb = renderScene.instanceBounds(b);
+                return ba[axis*2]+ba[axis*2+1] < bb[axis*2]+bb[axis*2+1];
+            });
+            stack.emplace_back(instances.begin(), instances.begin()+half);
+            stack.emplace_back(instances.begin()+half, instances.end());
+        }
+    }
+    if (chunks.empty()) return false;
+
+    // the chunks are independent of each other
+    QtConcurrent::blockingMap(chunks, [&](StaticBatchChunk &chunk) {
+        chunk.renderable = merge_instances(scene, renderScene, chunk.instances, vertexLayout);
+    });
+
+    mBatchedInstances.assign(renderScene.instanceNumber(), 0);
+    mSourceOffsets.assign(1, 0);
+    for (StaticBatchChunk &chunk : chunks) {
+        if (!chunk.renderable) continue;
+        unsigned int firstMesh = renderScene.instanceMesh(chunk.instances.front());
+        chunk.renderable->setMaterial(renderables[firstMesh]->material());
+        chunk.renderable->setName(QString("static batch %1").arg(this->batchNumber()));
+        unsigned int triangleBegin = 0;
+        for (unsigned int i : chunk.instances) {
+            StaticBatchSource source;
+            source.mesh = renderScene.instanceMesh(i);
+            source.node = renderScene.instanceNode(i);
+            source.triangleBegin = triangleBegin;
+            source.triangleNumber = triangle_number(scene->mMeshes[source.mesh]);
+            triangleBegin += source.triangleNumber;
+            mSources.emplace_back(source);
+            mBatchedInstances[i] = 1;
+            --instanceCounts[source.mesh];
+        }
+        renderables.emplace_back(chunk.renderable);
+        mSourceOffsets.emplace_back(static_cast<unsigned int>(mSources.size()));
+    }
+
+    mRetiredMeshes.assign(meshNum, 0);
+    for (StaticBatchSource const &source : mSources) {
+        if (instanceCounts[source.mesh] == 0) mRetiredMeshes[source.mesh] = 1;
+    }
+    return this->batchNumber() > 0;
+}
+
+void StaticBatchTable::clear()
+{
+    mSourceMeshNumber = 0;
+    mSourceOffsets.clear();
+    mSources.clear();
+    mBatchedInstances.clear();
+    mRetiredMeshes.clear();
+}
+
+StaticBatchSource const * StaticBatchTable::findSource(unsigned int mesh, unsigned int triangle) const
+{
+    if (!this->isBatch(mesh)) return nullptr;
+    size_t batch = mesh - mSourceMeshNumber;
+    std::vector<StaticBatchSource>::const_iterator begin = mSources.begin() + mSourceOffsets[batch];
+    std::vector<StaticBatchSource>::const_iterator end = mSources.begin() + mSourceOffsets[batch+1];
+    std::vector<StaticBatchSource>::const_iterator it = std::upper_bound(begin, end, triangle,
+        [](unsigned int t, StaticBatchSource const &s) { return t < s.triangleBegin; });
+    if (it == begin) return nullptr;
+    return &*(it-1);
+}
@@ -0,0 +1,235 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "TextureCache.h"
+#include "LogUtils.h"
+
+#include <QOpenGLContext>
+#include <QOpenGLTexture>
+#include <QOffscreenSurface>
+#include <QThread>
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
+
+#include <algorithm>
+
+inline void flip_image_vertically(QImage &img)
+{
+    int h = img.height();
+    int bytesPerLine = img.bytesPerLine();
+    for (int y = 0; y < h/2; ++y) {
+        uchar *top = img.scanLine(y);
+        uchar *bottom = img.scanLine(h-1-y);
+        std::swap_ranges(top, top+bytesPerLine, bottom);
+    }
+}
+
+inline bool has_translucent_pixel(QImage const &img)
+{
+    int w = img.width(), h = img.height();
+    for (int y = 0; y < h; ++y) {
+        uchar const *line = img.constScanLine(y);
+        for (int x = 0; x < w; ++x) {
+            if (line[x*4+3] != 0xff) return true;
+        }
+    }
+    return false;
+}
+
+bool decode_texture_image(QString const &imageFilePath, TextureImage &textureImage)
+{
+    QFileInfo fileInfo(imageFilePath);
+    textureImage.canonicalPath = fileInfo.canonicalFilePath();
+    if (textureImage.canonicalPath.isEmpty()) {
+        LOG_ERROR_QSTRING(QString("Texture file %1 does not exist!").arg(imageFilePath));
+        return false;
+    }
+    textureImage.size = fileInfo.size();
+    textureImage.modifiedTime = fileInfo.lastModified().toMSecsSinceEpoch();
+
+    QFile imageFile(textureImage.canonicalPath);
+    if (!imageFile.open(QIODevice::ReadOnly)) {
+        LOG_ERROR_QSTRING(QString("Fail to open texture file %1!").arg(textureImage.canonicalPath));
+        return false;
+    }
+    QByteArray content = imageFile.readAll();
+    imageFile.close();
+    textureImage.contentHash = QCryptographicHash::hash(content, QCryptographicHash::Md5);
+
+    QImage img = QImage::fromData(content);
+    if (img.isNull()) {
+        LOG_ERROR_QSTRING(QString("Fail to decode texture file %1!").arg(textureImage.canonicalPath));
+        return false;
+    }
+
+    // the format taken by QOpenGLTexture, converted in place when possible
+    bool alphaChannel = img.hasAlphaChannel();
+    img = std::move(img).convertToFormat(QImage::Format_RGBA8888);
+    flip_image_vertically(img);
+    // an alpha channel is often there without being used, only a texel below opaque needs blending
+    textureImage.hasAlpha = alphaChannel && has_translucent_pixel(img);
+    textureImage.image = img;
+    return true;
+}
+
+TextureCache * TextureCache::instance(QOpenGLContext const *glCtx)
+{
+    if (glCtx == nullptr) return nullptr;
+    QOpenGLContextGroup *group = glCtx->shareGroup();
+    if (group == nullptr) return nullptr;
+
+    // owned by the share group, thus destroyed together with it
+    TextureCache *cache = group->findChild<TextureCache *>(QString(), Qt::FindDirectChildrenOnly);
+    if (cache == nullptr) cache = new TextureCache(group, glCtx);
+    return cache;
+}
+
+TextureCache::TextureCache(QOpenGLContextGroup *group, QOpenGLContext const *glCtx) : QObject(group)
+{
+    mGroup = group;
+    // created in the OpenGL context thread (the GUI thread), as required by the offscreen surfaces
+    mSurface = new QOffscreenSurface;
+    mSurface->setFormat(glCtx->format());
+    mSurface->create();
+}
+
+TextureCache::~TextureCache()
+{
+    delete mSurface;
+}
+
+void TextureCache::TextureReleaser::operator()(QOpenGLTexture *tex) const
+{
+    // the textures went with the share group otherwise
+    if (cache) cache->releaseTexture(tex);
+    else delete tex;
+}
+
+void TextureCache::releaseTexture(QOpenGLTexture *tex)
+{
+    if (QThread::currentThread() != this->thread()) {
+        // dropped with the cache (then with the share group) if not delivered
+        QMetaObject::invokeMethod(this, [this, tex]() { this->releaseTexture(tex); }, Qt::QueuedConnection);
+        return;
+    }
+
+    QOpenGLContext *currentCtx = QOpenGLContext::currentContext();
+    if (currentCtx && currentCtx->shareGroup() == mGroup) {
+        delete tex;
+        return;
+    }
+
+    QList<QOpenGLContext *> contexts = mGroup->shares();
+    if (contexts.isEmpty() || !mSurface->isValid() || !contexts.first()->makeCurrent(mSurface)) {
+        LOG_WARNING("No OpenGL context to release texture, the texture object is leaked!");
+        return;
+    }
+    QSurface *currentSurface = currentCtx ? currentCtx->surface() : nullptr;
+    delete tex;
+    if (currentCtx) currentCtx->makeCurrent(currentSurface);
+    else contexts.first()->doneCurrent();
+}
+
+// the caller should hold mMutex
+OpenGLTexturePtr TextureCache::findTexture(QString const &canonicalPath, qint64 size, qint64 modifiedTime, bool *hasAlpha) const
+{
+    QHash<QString, FileEntry>::const_iterator it = mFiles.constFind(canonicalPath);
+    if (it == mFiles.constEnd() || it.value().size != size || it.value().modifiedTime != modifiedTime) return OpenGLTexturePtr();
+    return this->findTexture(it.value().contentHash, hasAlpha);
+}
+
+// the caller should hold mMutex
+OpenGLTexturePtr TextureCache::findTexture(QByteArray const &contentHash, bool *hasAlpha) const
+{
+    QHash<QByteArray, TextureEntry>::const_iterator it = mTextures.constFind(contentHash);
+    if (it == mTextures.constEnd()) return OpenGLTexturePtr();
+    if (hasAlpha) *hasAlpha = it.value().hasAlpha;
+    return it.value().texture.lock();
+}
+
+OpenGLTexturePtr TextureCache::texture(QString const &imageFilePath, bool *hasAlpha)
+{
+    QFileInfo fileInfo(imageFilePath);
+    {
+        QMutexLocker locker(&mMutex);
+        OpenGLTexturePtr tex = this->findTexture(fileInfo.canonicalFilePath(), fileInfo.size(), fileInfo.lastModified().toMSecsSinceEpoch(), hasAlpha);
+        if (tex) return tex;
+    }
+
+    TextureImage textureImage;
+    if (!decode_texture_image(imageFilePath, textureImage)) return OpenGLTexturePtr();
+    return this->insert(textureImage, hasAlpha);
+}
+
+OpenGLTexturePtr TextureCache::insert(TextureImage const &textureImage, bool *hasAlpha)
+{
+    if (textureImage.image.isNull()) return OpenGLTexturePtr();
+
+    {
+        QMutexLocker locker(&mMutex);
+        FileEntry fileEntry;
+        fileEntry.size = textureImage.size;
+        fileEntry.modifiedTime = textureImage.modifiedTime;
+        fileEntry.contentHash = textureImage.contentHash;
+        mFiles.insert(textureImage.canonicalPath, fileEntry);
+
+        // the same image may be referred through a different path
+        OpenGLTexturePtr tex = this->findTexture(textureImage.contentHash, hasAlpha);
+        if (tex) return tex;
+    }
+
+    // textures are only created in the OpenGL context thread, so no one else can insert meanwhile
+    OpenGLTexturePtr tex(new QOpenGLTexture(textureImage.image), TextureReleaser{ QPointer<TextureCache>(this) });
+    if (!tex->isCreated() || !tex->isStorageAllocated()) return OpenGLTexturePtr();
+    tex->setMinificationFilter(QOpenGLTexture::LinearMipMapLinear);
+    tex->setMagnificationFilter(QOpenGLTexture::Linear);
+
+    QMutexLocker locker(&mMutex);
+    // drop the entries of the released textures before adding a new one
+    QHash<QByteArray, TextureEntry>::iterator it = mTextures.begin();
+    while (it != mTextures.end()) {
+        if (it.value().texture.expired()) it = mTextures.erase(it);
+        else ++it;
+    }
+    TextureEntry textureEntry = { tex, textureImage.hasAlpha };
+    mTextures.insert(textureImage.contentHash, textureEntry);
+    if (hasAlpha) *hasAlpha = textureImage.hasAlpha;
+    return tex;
+}
+
+bool TextureCache::contains(QString const &imageFilePath) const
+{
+    QFileInfo fileInfo(imageFilePath);
+    QMutexLocker locker(&mMutex);
+    return bool(this->findTexture(fileInfo.canonicalFilePath(), fileInfo.size(), fileInfo.lastModified().toMSecsSinceEpoch(), nullptr));
+}
+
+int TextureCache::textureNumber() const
+{
+    QMutexLocker locker(&mMutex);
+    int num = 0;
+    for (QHash<QByteArray, TextureEntry>::const_iterator it = mTextures.constBegin(); it != mTextures.constEnd(); ++it) {
+        if (!it.value().texture.expired()) ++num;
+    }
+    return num;
+}
@@ -0,0 +1,193 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "TextureLoader.h"
+
+#include <QFileInfo>
+#include <QImageReader>
+#include <QMutexLocker>
+#include <QThread>
+#include <QtConcurrent/QtConcurrentRun>
+
+TextureLoader::TextureLoader(QObject *parent) : QObject(parent)
+{
+    mThreadPool.setMaxThreadCount(QThread::idealThreadCount());
+    mTextureCache = nullptr;
+    mPendingJobs = 0;
+    mMemoryBudget = qint64(512) << 20;
+    mMemoryInFlight = 0;
+    mGeneration = 0;
+}
+
+TextureLoader::~TextureLoader()
+{
+    this->cancel();
+    mThreadPool.waitForDone();
+}
+
+void TextureLoader::setTextureCache(TextureCache *textureCache)
+{
+    QMutexLocker locker(&mMutex);
+    mTextureCache = textureCache;
+}
+
+qint64 TextureLoader::memoryBudget() const
+{
+    QMutexLocker locker(&mMutex);
+    return mMemoryBudget;
+}
+
+void TextureLoader::setMemoryBudget(qint64 bytes)
+{
+    QMutexLocker locker(&mMutex);
+    mMemoryBudget = bytes;
+    mCondition.wakeAll();
+}
+
+void TextureLoader::request(QStringList const &imageFilePaths)
+{
+    QMutexLocker locker(&mMutex);
+    for (QString const &imageFilePath : imageFilePaths) {
+        QString canonicalPath = QFileInfo(imageFilePath).canonicalFilePath();
+        if (canonicalPath.isEmpty() || mRequested.contains(canonicalPath)) continue;
+        if (mTextureCache && mTextureCache->contains(canonicalPath)) continue;
+
+        mRequested.insert(canonicalPath);
+        ++mPendingJobs;
+        unsigned int generation = mGeneration;
+        QtConcurrent::run(&mThreadPool, [this, canonicalPath, generation]() {
+            this->decodeImage(canonicalPath, generation);
+        });
+    }
+}
+
+bool TextureLoader::isPending(QString const &canonicalPath) const
+{
+    if (canonicalPath.isEmpty()) return false;
+    QMutexLocker locker(&mMutex);
+    return mRequested.contains(canonicalPath);
+}
+
+void TextureLoader::decodeImage(QString const &canonicalPath, unsigned int generation)
+{
+    // RGBA8888 after decoding, the size is known from the header of the file
+    QSize imageSize = QImageReader(canonicalPath).size();
+    qint64 reservedBytes = imageSize.isValid() ? qint64(imageSize.width()) * imageSize.height() * 4 : 0;
+
+    {
+        QMutexLocker locker(&mMutex);
+        // wait for the uploads unless nothing else is in flight
+        while (generation == mGeneration && mMemoryInFlight > 0 && mMemoryInFlight + reservedBytes > mMemoryBudget) {
+            mCondition.wait(&mMutex);
+        }
+        if (generation != mGeneration) {
+            --mPendingJobs;
+            mCondition.wakeAll();
+            return;
+        }
+        mMemoryInFlight += reservedBytes;
+    }
+
+    DecodedImage decoded;
+    bool succeeded = decode_texture_image(canonicalPath, decoded.textureImage);
+
+    bool firstInQueue = false;
+    {
+        QMutexLocker locker(&mMutex);
+        --mPendingJobs;
+        if (!succeeded || generation != mGeneration) {
+            mMemoryInFlight -= reservedBytes;
+            if (generation == mGeneration) mRequested.remove(canonicalPath);
+        } else {
+            // account the actual size, the estimation may be off for unusual formats
+            decoded.reservedBytes = decoded.textureImage.image.bytesPerLine() * qint64(decoded.textureImage.image.height());
+            mMemoryInFlight += decoded.reservedBytes - reservedBytes;
+            firstInQueue = mDecoded.empty();
+            mDecoded.push_back(std::move(decoded));
+        }
+        mCondition.wakeAll();
+    }
+
+    // one notification per batch, the receiver uploads the whole queue
+    if (firstInQueue) emit imageDecoded();
+}
+
+int TextureLoader::uploadDecoded()
+{
+    int num = 0;
+    for (;;) {
+        DecodedImage decoded;
+        TextureCache *textureCache = nullptr;
+        {
+            QMutexLocker locker(&mMutex);
+            if (mDecoded.empty()) break;
+            decoded = std::move(mDecoded.front());
+            mDecoded.pop_front();
+            textureCache = mTextureCache;
+        }
+
+        if (textureCache) {
+            OpenGLTexturePtr tex = textureCache->insert(decoded.textureImage);
+            if (tex) {
+                mUploaded.emplace_back(tex);
+                ++num;
+            }
+        }
+        // free the pixels before giving the memory back to the workers
+        decoded.textureImage.image = QImage();
+
+        QMutexLocker locker(&mMutex);
+        mMemoryInFlight -= decoded.reservedBytes;
+        mRequested.remove(decoded.textureImage.canonicalPath);
+        mCondition.wakeAll();
+    }
+    return num;
+}
+
+void TextureLoader::finish()
+{
+    for (;;) {
+        this->uploadDecoded();
+
+        QMutexLocker locker(&mMutex);
+        if (mDecoded.empty()) {
+            if (mPendingJobs == 0) break;
+            mCondition.wait(&mMutex);
+        }
+    }
+}
+
+void TextureLoader::releaseUploaded()
+{
+    mUploaded.clear();
+}
+
+void TextureLoader::cancel()
+{
+    QMutexLocker locker(&mMutex);
+    ++mGeneration;
+    for (DecodedImage const &decoded : mDecoded) {
+        mMemoryInFlight -= decoded.reservedBytes;
+    }
+    mDecoded.clear();
+    mRequested.clear();
+    mCondition.wakeAll();
+}
@@ -0,0 +1,301 @@
+/**
+ * -------------------------------------------------------------------------------
+ * This source file is part of CGQtAppBase, one of the examples for
+ * Computer Graphics Course of School of Engineering Science,
+ * University of Chinese Academy of Sciences (UCAS).
+ * Copyright (C) 2020 Xue Jian (xuejian@ucas.ac.cn)
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ * -------------------------------------------------------------------------------
+ */
+#include "VertexFormat.h"
+
+#include "assimp/mesh.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#   define VERTEXFORMAT_USE_SSE
+#   include <emmintrin.h>
+#endif
+
+unsigned int interleaved_components(aiMesh const *mesh)
+{
+    if (mesh == nullptr) return 0;
+
+    unsigned int comps = 3;
+    if (mesh->mNormals != nullptr) comps += 3;
+    unsigned int texNum = mesh->GetNumUVChannels();
+    for (unsigned int i=0; i<texNum; ++i) {
+        comps += mesh->mNumUVComponents[i];
+    }
+    return comps;
+}
+
+inline void copy_vector(float *dst, aiVector3D const &v, unsigned int compNum) {
+    if (compNum >= 1) dst[0] = v.x;
+    if (compNum >= 2) dst[1] = v.y;
+    if (compNum >= 3) dst[2] = v.z;
+}
+
+inline void copy_normal(float *dst, aiVector3D const &n) {
+    float len = std::sqrt(n.x*n.x + n.y*n.y + n.z*n.z);
+    if (len > 0.0f) {
+        dst[0] = n.x / len;
+        dst[1] = n.y / len;
+        dst[2] = n.z / len;
+    } else {
+        copy_vector(dst, n, 3);
+    }
+}
+
+inline void interleave_vertex(aiMesh const *mesh, unsigned int i, unsigned int texNum, float *d) {
+    copy_vector(d, mesh->mVertices[i], 3);
+    d += 3;
+    if (mesh->mNormals) {
+        copy_normal(d, mesh->mNormals[i]);
+        d += 3;
+    }
+    for (unsigned int ti=0; ti<texNum; ++ti) {
+        unsigned int compNum = mesh->mNumUVComponents[ti];
+        copy_vector(d, mesh->mTextureCoords[ti][i], compNum);
+        d += compNum;
+    }
+}
+
+#ifdef VERTEXFORMAT_USE_SSE
+// same as aiVector3D::NormalizeSafe(), the 4th lane is don't-care
+inline __m128 normalize_safe(__m128 n) {
+    __m128 sq = _mm_mul_ps(n, n);
+    __m128 len2 = _mm_add_ss(_mm_add_ss(sq, _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(1, 1, 1, 1))),
+                             _mm_shuffle_ps(sq, sq, _MM_SHUFFLE(2, 2, 2, 2)));
+    __m128 len = _mm_sqrt_ps(_mm_shuffle_ps(len2, len2, _MM_SHUFFLE(0, 0, 0, 0)));
+    __m128 nonZero = _mm_cmpgt_ps(len, _mm_setzero_ps());
+    return _mm_or_ps(_mm_and_ps(nonZero, _mm_div_ps(n, len)), _mm_andnot_ps(nonZero, n));
+}
+#endif
+
+void interleave_mesh_vertices(aiMesh const *mesh, float *dst)
+{
+    if (mesh == nullptr || dst == nullptr) return;
+
+    unsigned int vertNum = mesh->mNumVertices;
+    unsigned int texNum = mesh->GetNumUVChannels();
+    size_t stride = interleaved_components(mesh);
+    unsigned int i = 0;
+
+#ifdef VERTEXFORMAT_USE_SSE
+    static_assert(sizeof(aiVector3D) == 3*sizeof(float), "aiVector3D is expected to be 3 packed floats");
+    bool hasNormal = (mesh->mNormals != nullptr);
+    // Every attribute is moved by one unaligned 4-wide load and store. The load
+    // reads the first component of the next vertex, and the 4th lane of the store
+    // spills into the next attribute (or vertex), which is written afterwards in
+    // address order. Thus all vertices but the last one can take this path.
+    for (; i+1 < vertNum; ++i) {
+        float *d = dst + i*stride;
+        _mm_storeu_ps(d, _mm_loadu_ps(&mesh->mVertices[i].x));
+        d += 3;
+        if (hasNormal) {
+            _mm_storeu_ps(d, normalize_safe(_mm_loadu_ps(&mesh->mNormals[i].x)));
+            d += 3;
+        }
+        for (unsigned int ti=0; ti<texNum; ++ti) {
+            unsigned int compNum = mesh->mNumUVComponents[ti];
+            __m128 tc = _mm_loadu_ps(&mesh->mTextureCoords[ti][i].x);
+            if (compNum == 3) _mm_storeu_ps(d, tc);
+            else if (compNum == 2) _mm_storel_pi(reinterpret_cast<__m64 *>(d), tc);
+            else copy_vector(d, mesh->mTextureCoords[ti][i], compNum);
+            d += compNum;
+        }
+    }
+#endif
+
+    for (; i < vertNum; ++i) {
+        interleave_vertex(mesh, i, texNum, dst + i*stride);
+    }
+}
+
+void interleave_mesh_vertices(aiMesh const *mesh, unsigned int const *vertexRemap, unsigned int vertexNumber, float *dst)
+{
+    if (mesh == nullptr || vertexRemap == nullptr || dst == nullptr) return;
+
+    unsigned int texNum = mesh->GetNumUVChannels();
+    size_t stride = interleaved_components(mesh);
+    // the vertices are picked in any order, thus no 4-wide loads past the attributes
+    for (unsigned int i = 0; i < vertexNumber; ++i) {
+        interleave_vertex(mesh, vertexRemap[i], texNum, dst + i*stride);
+    }
+}
+
+unsigned int compact_vertex_stride(aiMesh const *mesh)
+{
+    if (mesh == nullptr) return 0;
+
+    unsigned int stride = compact_texcoord_offset(mesh->mNormals != nullptr);
+    unsigned int texNum = mesh->GetNumUVChannels();
+    for (unsigned int i=0; i<texNum; ++i) {
+        stride += (mesh->mNumUVComponents[i]*sizeof(unsigned short) + 3) / 4 * 4;
+    }
+    return stride;
+}
+
+unsigned int compact_texcoord_offset(bool hasNormal)
+{
+    return 4*sizeof(unsigned short) + (hasNormal ? 2*sizeof(short) : 0);
+}
+
+unsigned int vertex_stride(VertexLayout layout, bool hasNormal, unsigned int const *textureComponents, unsigned int textureChannels)
+{
+    if (layout == VERTEX_LAYOUT_COMPACT) {
+        unsigned int stride = compact_texcoord_offset(hasNormal);
+        for (unsigned int i=0; i<textureChannels; ++i) {
+            stride += (textureComponents[i]*sizeof(unsigned short) + 3) / 4 * 4;
+        }
+        return stride;
+    }
+
+    unsigned int comps = hasNormal ? 6 : 3;
+    for (unsigned int i=0; i<textureChannels; ++i) {
+        comps += textureComponents[i];
+    }
+    return comps*sizeof(float);
+}
+
+unsigned short float_to_half(float value)
+{
+    uint32_t f;
+    std::memcpy(&f, &value, sizeof(f));
+    uint32_t sign = (f >> 16) & 0x8000u;
+    uint32_t absf = f & 0x7fffffffu;
+
+    if (absf >= 0x7f800000u) {
+        // inf or nan
+        return static_cast<unsigned short>(sign | 0x7c00u | (absf > 0x7f800000u ? 0x0200u : 0u));
+    }
+    if (absf >= 0x477ff000u) {
+        // overflow (rounded to inf)
+        return static_cast<unsigned short>(sign | 0x7c00u);
+    }
+    if (absf < 0x38800000u) {
+        // subnormal half (or zero), shift the mantissa with the implicit bit into place
+        if (absf < 0x33000000u) return static_cast<unsigned short>(sign);
+        uint32_t e = absf >> 23;
+        uint32_t m = (absf & 0x007fffffu) | 0x00800000u;
+        uint32_t shift = 126u - e;
+        uint32_t h = m >> shift;
+        uint32_t rest = m & ((1u << shift) - 1u);
+        uint32_t halfway = 1u << (shift - 1u);
+        if (rest > halfway || (rest == halfway && (h & 1u))) ++h;
+        return static_cast<unsigned short>(sign | h);
+    }
+    // normal half, rebias the exponent and round the mantissa to nearest even
+    uint32_t h = (absf - 0x38000000u) >> 13;
+    uint32_t rest = absf & 0x1fffu;
+    if (rest > 0x1000u || (rest == 0x1000u && (h & 1u))) ++h;
+    return static_cast<unsigned short>(sign | h);
+}
+
+inline unsigned short quantize_unorm16(float v, float vmin, float extent) {
+    if (extent <= 0.0f) return 0;
+    float q = (v - vmin) / extent * 65535.0f + 0.5f;
+    return static_cast<unsigned short>(std::min(std::max(q, 0.0f), 65535.0f));
+}
+
+inline short quantize_snorm16(float v) {
+    float q = std::min(std::max(v, -1.0f), 1.0f) * 32767.0f;
+    return static_cast<short>(q >= 0.0f ? q + 0.5f : q - 0.5f);
+}
+
+inline float sign_not_zero(float v) {
+    return v >= 0.0f ? 1.0f : -1.0f;
+}
+
+// octahedral encoding of a normal, see "A Survey of Efficient Representations for Independent Unit Vectors" (Cigolle et al. 2014)
+inline void encode_octahedral_normal(aiVector3D const &n, short *dst) {
+    float l1 = std::fabs(n.x) + std::fabs(n.y) + std::fabs(n.z);
+    float px = 0.0f, py = 0.0f;
+    if (l1 > 0.0f) {
+        px = n.x / l1;
+        py = n.y / l1;
+        if (n.z < 0.0f) {
+            float ox = (1.0f - std::fabs(py)) * sign_not_zero(px);
+            float oy = (1.0f - std::fabs(px)) * sign_not_zero(py);
+            px = ox;
+            py = oy;
+        }
+    }
+    dst[0] = quantize_snorm16(px);
+    dst[1] = quantize_snorm16(py);
+}
+
+inline void write_compact_vertex(aiMesh const *mesh, unsigned int i, unsigned int texNum, float const bounds[6], float const extent[3], unsigned char *d) {
+    aiVector3D const &v = mesh->mVertices[i];
+    unsigned short position[4] = {
+        quantize_unorm16(v.x, bounds[0], extent[0]),
+        quantize_unorm16(v.y, bounds[2], extent[1]),
+        quantize_unorm16(v.z, bounds[4], extent[2]),
+        0
+    };
+    std::memcpy(d, position, sizeof(position));
+    d += sizeof(position);
+
+    if (mesh->mNormals) {
+        short normal[2];
+        encode_octahedral_normal(mesh->mNormals[i], normal);
+        std::memcpy(d, normal, sizeof(normal));
+        d += sizeof(normal);
+    }
+
+    for (unsigned int ti=0; ti<texNum; ++ti) {
+        unsigned int compNum = mesh->mNumUVComponents[ti];
+        aiVector3D const &tc = mesh->mTextureCoords[ti][i];
+        unsigned short texCoord[4] = { 0, 0, 0, 0 };
+        if (compNum >= 1) texCoord[0] = float_to_half(tc.x);
+        if (compNum >= 2) texCoord[1] = float_to_half(tc.y);
+        if (compNum >= 3) texCoord[2] = float_to_half(tc.z);
+        unsigned int bytes = (compNum*sizeof(unsigned short) + 3) / 4 * 4;
+        std::memcpy(d, texCoord, bytes);
+        d += bytes;
+    }
+}
+
+void write_compact_mesh_vertices(aiMesh const *mesh, float const bounds[6], void *dst)
+{
+    if (mesh == nullptr || dst == nullptr) return;
+
+    unsigned int vertNum = mesh->mNumVertices;
+    unsigned int texNum = mesh->GetNumUVChannels();
+    size_t stride = compact_vertex_stride(mesh);
+    float extent[3] = { bounds[1]-bounds[0], bounds[3]-bounds[2], bounds[5]-bounds[4] };
+
+    for (unsigned int i=0; i<vertNum; ++i) {
+        write_compact_vertex(mesh, i, texNum, bounds, extent, static_cast<unsigned char *>(dst) + i*stride);
+    }
+}
+
+void write_compact_mesh_vertices(aiMesh const *mesh, unsigned int const *vertexRemap, unsigned int vertexNumber, float const bounds[6], void *dst)
+{
+    if (mesh == nullptr || vertexRemap == nullptr || dst == nullptr) return;
+
+    unsigned int texNum = mesh->GetNumUVChannels();
+    size_t stride = compact_vertex_stride(mesh);
+    float extent[3] = { bounds[1]-bounds[0], bounds[3]-bounds[2], bounds[5]-bounds[4] };
+
+    for (unsigned int i=0; i<vertexNumber; ++i) {
+        write_compact_vertex(mesh, vertexRemap[i], texNum, bounds, extent, static_cast<unsigned char *>(dst) + i*stride);
+    }
+}
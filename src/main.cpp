@@ -20,6 +20,7 @@
  * -------------------------------------------------------------------------------
  */
 #include "MainWindow.h"
+#include "BatchRenderer.h"
 #include "LogUtils.h"
 #include "GLInc.h"
 #include "AppInfo.h"
@@ -27,6 +28,9 @@
 #include <QApplication>
 #include <QSurfaceFormat>
 #include <QDir>
+#include <QFile>
+#include <QCommandLineParser>
+#include <QTextStream>
 
 int main(int argc, char *argv[])
 {
@@ -39,6 +43,34 @@ int main(int argc, char *argv[])
 #endif
 
     QApplication a(argc, argv);
+    QCoreApplication::setApplicationVersion(QString("%1.%2.%3").arg(APP_VERSION_MAJOR).arg(APP_VERSION_MINOR).arg(APP_VERSION_PATCH));
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription(QCoreApplication::translate("main", "Scene viewer, or batch renderer of scene files into images with --batch"));
+    parser.addHelpOption();
+    parser.addVersionOption();
+    QCommandLineOption batchOption(QStringList() << "b" << "batch",
+                                   QCoreApplication::translate("main", "Render the scene files into images without showing any window."));
+    QCommandLineOption inputListOption("input-list",
+                                       QCoreApplication::translate("main", "Read the scene files from <file>, one per line."), "file");
+    QCommandLineOption outputOption(QStringList() << "o" << "output",
+                                    QCoreApplication::translate("main", "Write the images into <dir>."), "dir", QDir::currentPath());
+    QCommandLineOption sizeOption("size", QCoreApplication::translate("main", "Size of the images."), "WxH", "512x512");
+    QCommandLineOption formatOption("format", QCoreApplication::translate("main", "Format (file suffix) of the images."), "suffix", "png");
+    QCommandLineOption viewsOption("views",
+                                   QCoreApplication::translate("main", "Comma-separated camera presets: front, back, left, right, top, bottom, iso or yaw:pitch in degrees."),
+                                   "presets", "front,iso");
+    QCommandLineOption antiAliasingOption("antialiasing",
+                                          QCoreApplication::translate("main", "Anti-aliasing: off, msaa2, msaa4, msaa8, msaa16 or fxaa."), "mode", "msaa4");
+    parser.addOption(batchOption);
+    parser.addOption(inputListOption);
+    parser.addOption(outputOption);
+    parser.addOption(sizeOption);
+    parser.addOption(formatOption);
+    parser.addOption(viewsOption);
+    parser.addOption(antiAliasingOption);
+    parser.addPositionalArgument("files", QCoreApplication::translate("main", "Scene files to render in batch mode."), "[files...]");
+    parser.process(a);
 
     QSurfaceFormat format = QSurfaceFormat::defaultFormat();
 #if defined(USE_COMPATIBILITY_PROFILE) || defined(USE_OPENGLES)
@@ -56,7 +88,7 @@ int main(int argc, char *argv[])
     // 设置帧缓存相关的其他参数
     format.setDepthBufferSize(24); // 深度缓存位数
     format.setStencilBufferSize(8); // 模板缓存位数
-    format.setSamples(16); // 全屏反走样的采样数
+    format.setSamples(0); // 窗口缓存不做多重采样，反走样方式见 SceneWidget::setAntiAliasing()
     QSurfaceFormat::setDefaultFormat(format);
 
     QString logFilePath = QCoreApplication::applicationDirPath();
@@ -77,10 +109,55 @@ int main(int argc, char *argv[])
     log_info(appinfo);
     log_info(QString("Working dir: %1").arg(QCoreApplication::applicationDirPath()));
 
+    int retCode = 0;
+    if (parser.isSet(batchOption)) {
+        // 批处理模式：不显示窗口，将场景文件逐个绘制成图像
+        QStringList inputFiles = parser.positionalArguments();
+        if (parser.isSet(inputListOption)) {
+            QFile listFile(parser.value(inputListOption));
+            if (!listFile.open(QIODevice::ReadOnly | QIODevice::Text)) {
+                log_error(QString("Fail to open the input list %1").arg(listFile.fileName()));
+                return 1;
+            }
+            QTextStream stream(&listFile);
+            while (!stream.atEnd()) {
+                QString line = stream.readLine().trimmed();
+                if (!line.isEmpty()) inputFiles << line;
+            }
+        }
+
+        BatchRenderer renderer;
+        std::vector<CameraPreset> presets;
+        SceneWidget::AntiAliasing antiAliasing;
+        QStringList size = parser.value(sizeOption).split('x');
+        int width = size.size() == 2 ? size[0].toInt() : 0;
+        int height = size.size() == 2 ? size[1].toInt() : 0;
+        if (!BatchRenderer::parseCameraPresets(parser.value(viewsOption), presets) ||
+            !BatchRenderer::parseAntiAliasing(parser.value(antiAliasingOption), antiAliasing) ||
+            width <= 0 || height <= 0) {
+            log_error(QString("Invalid options of batch rendering"));
+            parser.showHelp(1);
+        }
+        renderer.setInputFiles(inputFiles);
+        renderer.setOutputDir(parser.value(outputOption));
+        renderer.setImageSize(QSize(width, height));
+        renderer.setImageFormat(parser.value(formatOption));
+        renderer.setCameraPresets(presets);
+        renderer.sceneWidget()->setAntiAliasing(antiAliasing);
+        QObject::connect(&renderer, &BatchRenderer::finished, &a, [](int failedNumber) {
+            QCoreApplication::exit(failedNumber > 0 ? 1 : 0);
+        });
+        // 在事件循环中开始，以便结束时退出事件循环
+        QMetaObject::invokeMethod(&renderer, "start", Qt::QueuedConnection);
+        retCode = a.exec();
+        log_info(QString(APP_NAME " exited with code %1.").arg(retCode));
+        return retCode;
+    }
+
     MainWindow w;
     w.show();
 
-    int retCode = a.exec();
+    retCode = a.exec();
     log_info(QString(APP_NAME " exited with code %1.").arg(retCode));
 
     return retCode;